@@ -28,12 +28,17 @@
 */
 
 #include "CCatCodec.h"
+#include "CCatWire.h"
+
+#include <stdlib.h> // posix_memalign
+#include <algorithm> // std::rotate
 
 #ifdef _WIN32
     #ifndef NOMINMAX
         #define NOMINMAX
     #endif
     #include <windows.h>
+    #include <malloc.h> // _aligned_malloc
 #elif __MACH__
     #include <mach/mach_time.h>
     #include <mach/mach.h>
@@ -150,13 +155,69 @@ uint64_t GetTimeMsec()
 //------------------------------------------------------------------------------
 // Codec : Create
 
+void* Codec::operator new(size_t bytes, const std::nothrow_t&) noexcept
+{
+#if defined(_WIN32)
+    return _aligned_malloc(bytes, kCacheLineBytes);
+#else
+    void* ptr = nullptr;
+    if (0 != posix_memalign(&ptr, kCacheLineBytes, bytes)) {
+        return nullptr;
+    }
+    return ptr;
+#endif
+}
+
+void Codec::operator delete(void* ptr, const std::nothrow_t&) noexcept
+{
+    Codec::operator delete(ptr);
+}
+
+void Codec::operator delete(void* ptr) noexcept
+{
+#if defined(_WIN32)
+    _aligned_free(ptr);
+#else
+    free(ptr);
+#endif
+}
+
+Codec::~Codec()
+{
+    // The worker reads window data owned by EncoderAlloc
+    Encoder::StopRecoveryWorker();
+
+    // Settings must still be valid to release borrowed data
+    Decoder::ReleaseBorrowed();
+    Decoder::FreeSolver();
+}
+
 CCatResult Codec::Create(const CCatSettings& settings)
 {
-    Settings = settings;
     Encoder::SettingsPtr = &Settings;
-    Encoder::AllocPtr = &Alloc;
+    Encoder::AllocPtr = &EncoderAlloc;
     Decoder::SettingsPtr = &Settings;
-    Decoder::AllocPtr = &Alloc;
+    Decoder::AllocPtr = &DecoderAlloc;
+
+    return Configure(settings);
+}
+
+CCatResult Codec::Reset(const CCatSettings& settings)
+{
+    Clear();
+    return Configure(settings);
+}
+
+void Codec::Clear()
+{
+    // Settings must still be valid to release borrowed data
+    Decoder::Reset();
+    Encoder::Reset();
+}
+
+CCatResult Codec::Configure(const CCatSettings& settings)
+{
+    Settings = settings;
 
     if (Settings.WindowPackets < kMinEncoderWindowSize) {
         Settings.WindowPackets = kMinEncoderWindowSize;
@@ -172,10 +233,87 @@ CCatResult Codec::Create(const CCatSettings& settings)
         Settings.WindowMsec = kMaxWindowMsec;
     }
 
+    // Recovered buffers are handed back the same way as retained originals
+    if (!Settings.OnReleaseOriginal) {
+        Settings.OnAllocateRecovered = nullptr;
+    }
+
+    // Also catches NaN
+    if (!(Settings.TargetLossRate > 0.f)) {
+        Settings.TargetLossRate = 0.f;
+    }
+    Encoder::InitializeRate();
+
+    // A private solver kept from before a reset is no longer needed
+    if (Settings.SharedSolver) {
+        Decoder::FreeSolver();
+    }
+
     return CCat_Success;
 }
 
 
+//------------------------------------------------------------------------------
+// CodecPool
+
+CodecPool::~CodecPool()
+{
+    for (Codec* codec : Idle) {
+        delete codec;
+    }
+}
+
+CCatResult CodecPool::Initialize(unsigned capacity)
+{
+    Capacity = capacity;
+    Idle.reserve(capacity);
+    return CCat_Success;
+}
+
+CCatResult CodecPool::Acquire(const CCatSettings& settings, Codec*& codecOut)
+{
+    Codec* codec = nullptr;
+    {
+        std::lock_guard<std::mutex> locker(Lock);
+        if (!Idle.empty())
+        {
+            codec = Idle.back();
+            Idle.pop_back();
+        }
+    }
+
+    if (codec) {
+        codecOut = codec;
+        return codec->Configure(settings);
+    }
+
+    codec = new (std::nothrow) Codec;
+    if (!codec) {
+        return CCat_OOM;
+    }
+
+    codecOut = codec;
+    return codec->Create(settings);
+}
+
+void CodecPool::Release(Codec* codec)
+{
+    // Clear outside the lock: This may call OnReleaseOriginal()
+    codec->Clear();
+
+    {
+        std::lock_guard<std::mutex> locker(Lock);
+        if (Idle.size() < Capacity)
+        {
+            Idle.push_back(codec);
+            return;
+        }
+    }
+
+    delete codec;
+}
+
+
 //------------------------------------------------------------------------------
 // Encoder
 
@@ -191,6 +329,12 @@ CCatResult Encoder::EncodeOriginal(const CCatOriginal& original)
         return CCat_InvalidInput;
     }
 
+    // If a full window wraps onto the oldest original, a recovery job
+    // submitted about a window ago may still be reading it
+    if (Jobs && Count >= kMaxEncoderWindowSize) {
+        waitForRecoveryJobs(NextSequence - kMaxEncoderWindowSize);
+    }
+
     // Pick window element
     EncoderWindowElement* element = &Window[NextIndex];
     if (++NextIndex >= kMaxEncoderWindowSize) {
@@ -200,14 +344,14 @@ CCatResult Encoder::EncodeOriginal(const CCatOriginal& original)
     // Resize the target window element 
     const bool resizeResult = element->Data.Resize(
         AllocPtr,
-        kEncodeOverhead + original.Bytes,
+        kRecoveryHeadroom + kEncodeOverhead + original.Bytes,
         pktalloc::Realloc::Uninitialized);
     if (!resizeResult) {
         return CCat_OOM;
     }
 
     // Write element data
-    uint8_t* data = element->Data.GetPtr();
+    uint8_t* data = element->GetData();
     memcpy(data + 2, original.Data, original.Bytes);
     WriteU16_LE(data, (uint16_t)(original.Bytes - 1));
     static_assert(kEncodeOverhead == 2, "Update this");
@@ -218,6 +362,7 @@ CCatResult Encoder::EncodeOriginal(const CCatOriginal& original)
 
     // Fill in element metadata
     element->SendUsec = nowUsec;
+    element->Priority = original.Priority;
 
     // Keep track of count of packets stored
     if (Count < kMaxEncoderWindowSize) {
@@ -232,6 +377,8 @@ CCatResult Encoder::EncodeOriginal(const CCatOriginal& original)
     // Update next sequence number
     ++NextSequence;
 
+    Rate.OnOriginal();
+
     return CCat_Success;
 }
 
@@ -251,6 +398,176 @@ CCatResult Encoder::EncodeRecovery(CCatRecovery& recoveryOut)
 {
     // Step (1): Find the set of packets to encode.
 
+    unsigned index, maxBytes;
+    uint8_t column;
+    const unsigned count = findRecoveryWindow(index, column, maxBytes);
+
+    // If window is empty:
+    if (count == 0)
+    {
+        recoveryOut.Data = nullptr;
+        recoveryOut.Count = 0;
+        recoveryOut.SequenceStart = 0;
+        recoveryOut.Bytes = 0;
+        recoveryOut.RecoveryRow = 0;
+        recoveryOut.ColumnMask = nullptr;
+
+        return CCat_NeedsMoreData;
+    }
+
+    // Step (2): Write recovery packet
+
+    PKTALLOC_DEBUG_ASSERT(NextSequence >= count);
+    const CCatResult result = writeRecovery(
+        NextSequence - count,
+        index,
+        column,
+        count,
+        maxBytes,
+        nullptr,
+        recoveryOut);
+
+    if (result == CCat_Success) {
+        Rate.OnRecovery(recoveryOut.Count);
+    }
+    return result;
+}
+
+CCatResult Encoder::EncodeRecoverySpan(
+    uint64_t sequenceStart,
+    unsigned count,
+    CCatRecovery& recoveryOut)
+{
+    const uint64_t nextSequence = NextSequence.ToUnsigned();
+
+    // Reject spans that reach past the last original
+    if (count <= 0 ||
+        count > kMaxEncoderWindowSize ||
+        sequenceStart > nextSequence ||
+        nextSequence - sequenceStart < count)
+    {
+        return CCat_InvalidInput;
+    }
+
+    // Trim originals from the front that the window no longer holds
+    unsigned windowSize = SettingsPtr->WindowPackets;
+    if (windowSize > Count) {
+        windowSize = Count;
+    }
+    unsigned offset = (unsigned)(nextSequence - sequenceStart);
+    if (offset > windowSize)
+    {
+        const unsigned trim = offset - windowSize;
+        if (trim >= count) {
+            return CCat_NeedsMoreData;
+        }
+        count -= trim;
+        offset = windowSize;
+    }
+
+    unsigned index = (NextIndex + kMaxEncoderWindowSize - offset) % kMaxEncoderWindowSize;
+    uint8_t column = (uint8_t)((NextColumn + kMatrixColumnCount - offset) % kMatrixColumnCount);
+
+    // Trim originals that are too old, as in EncodeRecovery()
+    const unsigned limitUsec = SettingsPtr->WindowMsec * 1000;
+    while ((uint64_t)(LastOriginalSendUsec - Window[index].SendUsec).ToUnsigned() > limitUsec)
+    {
+        if (--count <= 0) {
+            return CCat_NeedsMoreData;
+        }
+        if (++index >= kMaxEncoderWindowSize) {
+            index = 0;
+        }
+        if (++column >= kMatrixColumnCount) {
+            column = 0;
+        }
+        --offset;
+    }
+
+    // Find the largest packet in the span
+    unsigned maxBytes = 0;
+    for (unsigned i = 0, j = index; i < count; ++i)
+    {
+        const unsigned bytes = Window[j].GetBytes();
+        if (maxBytes < bytes) {
+            maxBytes = bytes;
+        }
+        if (++j >= kMaxEncoderWindowSize) {
+            j = 0;
+        }
+    }
+
+    return writeRecovery(
+        NextSequence - offset,
+        index,
+        column,
+        count,
+        maxBytes,
+        nullptr,
+        recoveryOut);
+}
+
+CCatResult Encoder::EncodeRecoveryPriority(
+    unsigned minPriority,
+    CCatRecovery& recoveryOut)
+{
+    unsigned index, maxBytes;
+    uint8_t column;
+    const unsigned count = findRecoveryWindow(index, column, maxBytes);
+
+    // Build the column mask over the same window as EncodeRecovery(), so the
+    // decoder can keep its recovery list sorted by both ends of each span
+    memset(RecoveryMask, 0, sizeof(RecoveryMask));
+    unsigned included = 0, lastIncluded = 0;
+    maxBytes = 0;
+
+    for (unsigned i = 0, j = index; i < count; ++i)
+    {
+        const EncoderWindowElement* element = &Window[j];
+
+        if (element->Priority >= minPriority)
+        {
+            RecoveryMask[i / 8] |= (uint8_t)(1 << (i % 8));
+            ++included;
+            lastIncluded = i;
+
+            if (maxBytes < element->GetBytes()) {
+                maxBytes = element->GetBytes();
+            }
+        }
+
+        if (++j >= kMaxEncoderWindowSize) {
+            j = 0;
+        }
+    }
+
+    if (included == 0) {
+        return CCat_NeedsMoreData;
+    }
+
+    const Counter64 sequenceStart = NextSequence - count;
+
+    // If every original qualifies, this is an ordinary recovery packet
+    if (included == count) {
+        return writeRecovery(sequenceStart, index, column, count, maxBytes, nullptr, recoveryOut);
+    }
+
+    // If only one qualifies, send it as a span of one, which is the original
+    if (included == 1)
+    {
+        index = (index + lastIncluded) % kMaxEncoderWindowSize;
+        column = (uint8_t)((column + lastIncluded) % kMatrixColumnCount);
+        return writeRecovery(sequenceStart + lastIncluded, index, column, 1, maxBytes, nullptr, recoveryOut);
+    }
+
+    return writeRecovery(sequenceStart, index, column, count, maxBytes, RecoveryMask, recoveryOut);
+}
+
+unsigned Encoder::findRecoveryWindow(
+    unsigned& indexOut,
+    uint8_t& columnOut,
+    unsigned& maxBytesOut) const
+{
     const unsigned limitUsec = SettingsPtr->WindowMsec * 1000;
     const unsigned windowSize = SettingsPtr->WindowPackets;
 
@@ -270,7 +587,7 @@ CCatResult Encoder::EncodeRecovery(CCatRecovery& recoveryOut)
         }
         prevIndex--;
 
-        EncoderWindowElement* element = &Window[prevIndex];
+        const EncoderWindowElement* element = &Window[prevIndex];
         const uint64_t deltaUsec = (uint64_t)(LastOriginalSendUsec - element->SendUsec).ToUnsigned();
         PKTALLOC_DEBUG_ASSERT(deltaUsec >= 0);
 
@@ -286,8 +603,8 @@ CCatResult Encoder::EncodeRecovery(CCatRecovery& recoveryOut)
         }
         column--;
         ++count;
-        if (maxBytes < element->Data.GetSize()) {
-            maxBytes = element->Data.GetSize();
+        if (maxBytes < element->GetBytes()) {
+            maxBytes = element->GetBytes();
         }
 
         // If window filled up:
@@ -296,86 +613,148 @@ CCatResult Encoder::EncodeRecovery(CCatRecovery& recoveryOut)
         }
     }
 
-    // If window is empty:
-    if (count == 0)
-    {
-        recoveryOut.Data = nullptr;
-        recoveryOut.Count = 0;
-        recoveryOut.SequenceStart = 0;
-        recoveryOut.Bytes = 0;
-        recoveryOut.RecoveryRow = 0;
-
-        return CCat_NeedsMoreData;
-    }
-
     PKTALLOC_DEBUG_ASSERT(count <= CCAT_MAX_WINDOW_PACKETS);
 
-    // Step (2): Write recovery packet
-
-    PKTALLOC_DEBUG_ASSERT(NextSequence >= count);
-    const Counter64 sequenceStart = NextSequence - count;
+    indexOut = index;
+    columnOut = column;
+    maxBytesOut = maxBytes;
+    return count;
+}
 
+CCatResult Encoder::writeRecovery(
+    Counter64 sequenceStart,
+    unsigned index,
+    uint8_t column,
+    unsigned count,
+    unsigned maxBytes,
+    const uint8_t* mask,
+    CCatRecovery& recoveryOut)
+{
     // Handle 1x1 case by referencing the original data
     if (count == 1)
     {
         EncoderWindowElement* element = &Window[index];
-        recoveryOut.Data = element->Data.GetPtr();
+        recoveryOut.Data = element->GetData();
         recoveryOut.Count = 1;
         recoveryOut.SequenceStart = sequenceStart.ToUnsigned();
-        recoveryOut.Bytes = element->Data.GetSize();
+        recoveryOut.Bytes = element->GetBytes();
         recoveryOut.RecoveryRow = 0;
-
+        recoveryOut.ColumnMask = nullptr;
         return CCat_Success;
     }
 
     // Make space for the largest packet
     PKTALLOC_DEBUG_ASSERT(maxBytes > 0);
-    RecoveryData.Resize(AllocPtr, maxBytes, pktalloc::Realloc::Uninitialized);
-    uint8_t* output = RecoveryData.GetPtr();
+    const bool resizeResult = RecoveryData.Resize(
+        AllocPtr,
+        kRecoveryHeadroom + maxBytes,
+        pktalloc::Realloc::Uninitialized);
+    if (!resizeResult) {
+        return CCat_OOM;
+    }
+    uint8_t* output = RecoveryData.GetPtr(kRecoveryHeadroom);
+
+    // Write metadata
+    const uint8_t row = nextRecoveryRow(sequenceStart, count);
+
+    recoveryOut.Data = output;
+    recoveryOut.Count = static_cast<uint8_t>(count);
+    recoveryOut.SequenceStart = sequenceStart.ToUnsigned();
+    recoveryOut.Bytes = maxBytes;
+    recoveryOut.RecoveryRow = row;
+    recoveryOut.ColumnMask = mask;
+
+    writeRecoveryData(output, index, column, count, maxBytes, row, mask);
+
+    return CCat_Success;
+}
 
+uint8_t Encoder::nextRecoveryRow(Counter64 sequenceStart, unsigned count)
+{
     // This will reduce recovery rates but improves speed
 #ifdef CCAT_MORE_PARITY_ROWS
 
     // Check if this is an xor parity row
-    const bool isParityRow = (sequenceStart >= NextParitySequence);
-
-    // Write metadata
-    uint8_t row = 0;
-    if (isParityRow) {
+    if (sequenceStart >= NextParitySequence)
+    {
         NextParitySequence = sequenceStart + count;
+        return 0;
     }
-    else
-    {
-        row = NextRow;
-        if (++NextRow >= kMatrixRowCount) {
-            NextRow = 1;
-        }
+
+    const uint8_t row = NextRow;
+    if (++NextRow >= kMatrixRowCount) {
+        NextRow = 1;
     }
+    return row;
 
 #else // CCAT_MORE_PARITY_ROWS
 
-    // Write metadata
-    uint8_t row = 0;
-    row = NextRow;
+    (void)sequenceStart;
+    (void)count;
+
+    const uint8_t row = NextRow;
     if (++NextRow >= kMatrixRowCount) {
         NextRow = 0;
     }
-    bool isParityRow = (row == 0);
+    return row;
 
 #endif // CCAT_MORE_PARITY_ROWS
+}
 
-    recoveryOut.Data = output;
-    recoveryOut.Count = static_cast<uint8_t>(count);
-    recoveryOut.SequenceStart = sequenceStart.ToUnsigned();
-    recoveryOut.Bytes = maxBytes;
-    recoveryOut.RecoveryRow = row;
+void Encoder::writeRecoveryData(
+    uint8_t* output,
+    unsigned index,
+    uint8_t column,
+    unsigned count,
+    unsigned maxBytes,
+    uint8_t row,
+    const uint8_t* mask) const
+{
+    const bool isParityRow = (row == 0);
+
+    // If only some columns are included:
+    if (mask)
+    {
+        memset(output, 0, maxBytes);
+
+        for (unsigned i = 0; i < count; ++i)
+        {
+            // If this column is included:
+            if (mask[i / 8] & (1 << (i % 8)))
+            {
+                const EncoderWindowElement* element = &Window[index];
+                PKTALLOC_DEBUG_ASSERT(element->GetBytes() > 2);
+                const uint8_t* data = element->GetData();
+                const unsigned dataBytes = element->GetBytes();
+
+                if (isParityRow) {
+                    gf256_add_mem(output, data, dataBytes);
+                }
+                else
+                {
+                    const uint8_t y = GetMatrixElement(row, column);
+
+                    gf256_muladd_mem(output, y, data, dataBytes);
+                }
+            }
+
+            if (++index >= kMaxEncoderWindowSize) {
+                index = 0;
+            }
+            if (++column >= kMatrixColumnCount) {
+                column = 0;
+            }
+        }
+
+        return;
+    }
 
     // Unroll first column:
     {
-        EncoderWindowElement* element = &Window[index];
-        PKTALLOC_DEBUG_ASSERT(element->Data.GetSize() > 2);
-        const uint8_t* data = element->Data.GetPtr();
-        const unsigned dataBytes = element->Data.GetSize();
+        const EncoderWindowElement* element = &Window[index];
+        PKTALLOC_DEBUG_ASSERT(element->GetBytes() > 2);
+        const uint8_t* data = element->GetData();
+        const unsigned dataBytes = element->GetBytes();
 
         // Write column
         if (isParityRow) {
@@ -400,10 +779,10 @@ CCatResult Encoder::EncodeRecovery(CCatRecovery& recoveryOut)
             index = 0;
         }
 
-        EncoderWindowElement* element = &Window[index];
-        PKTALLOC_DEBUG_ASSERT(element->Data.GetSize() > 2);
-        const uint8_t* data = element->Data.GetPtr();
-        const unsigned dataBytes = element->Data.GetSize();
+        const EncoderWindowElement* element = &Window[index];
+        PKTALLOC_DEBUG_ASSERT(element->GetBytes() > 2);
+        const uint8_t* data = element->GetData();
+        const unsigned dataBytes = element->GetBytes();
 
         // Write column
         if (isParityRow) {
@@ -420,22 +799,273 @@ CCatResult Encoder::EncodeRecovery(CCatRecovery& recoveryOut)
             gf256_muladd_mem(output, y, data, dataBytes);
         }
     }
+}
+
+CCatResult Encoder::EncodeLossReport(const CCatLossReport& report)
+{
+    return Rate.OnLossReport(report, GetTimeMsec());
+}
+
+CCatResult Encoder::ParseLossReport(
+    const uint8_t* data,
+    unsigned bytes,
+    CCatLossReport& reportOut)
+{
+    if (!ReadLossReport(data, bytes, NextSequence.ToUnsigned(), reportOut)) {
+        return CCat_InvalidInput;
+    }
+
+    return EncodeLossReport(reportOut);
+}
+
+CCatResult Encoder::GetRecoveryDue(unsigned& dueOut)
+{
+    if (!Rate.IsEnabled())
+    {
+        dueOut = 0;
+        return CCat_InvalidInput;
+    }
+
+    dueOut = Rate.GetRecoveryDue();
+    return CCat_Success;
+}
+
+/**
+    Async recovery:
+
+    SubmitRecovery() does everything EncodeRecovery() does except the math:
+    It picks the window and the row, so packets keep the same order and rows
+    as inline encoding, and sizes the job buffer, since the allocator is not
+    thread-safe.  The worker only reads the window elements in the span and
+    writes the job buffer.
+
+    Window elements are only overwritten by EncodeOriginal() once the window
+    is full, so that is the only place that needs to wait for the worker.
+*/
+CCatResult Encoder::SubmitRecovery()
+{
+    if (!Jobs)
+    {
+        Jobs = new (std::nothrow) RecoveryJobQueue;
+        if (!Jobs) {
+            return CCat_OOM;
+        }
+        Jobs->Thread = std::thread([this]() { runRecoveryWorker(); });
+    }
+    RecoveryJobQueue* jobs = Jobs;
+
+    if (jobs->SubmittedCount - jobs->CompletedCount >= CCAT_MAX_RECOVERY_JOBS) {
+        return CCat_Error;
+    }
+
+    unsigned index, maxBytes;
+    uint8_t column;
+    const unsigned count = findRecoveryWindow(index, column, maxBytes);
+    if (count == 0) {
+        return CCat_NeedsMoreData;
+    }
+
+    // Neither the worker nor the application is using this slot
+    RecoveryJob& job = jobs->Jobs[jobs->SubmittedCount % kRecoveryJobSlots];
+
+    PKTALLOC_DEBUG_ASSERT(maxBytes > 0);
+    const bool resizeResult = job.Data.Resize(
+        AllocPtr,
+        kRecoveryHeadroom + maxBytes,
+        pktalloc::Realloc::Uninitialized);
+    if (!resizeResult) {
+        return CCat_OOM;
+    }
+
+    PKTALLOC_DEBUG_ASSERT(NextSequence >= count);
+    job.SequenceStart = NextSequence - count;
+    job.Index = index;
+    job.Column = column;
+    job.Count = count;
+    job.Bytes = maxBytes;
+
+    // A single original is copied with row 0 instead of referenced,
+    // because the window element may be overwritten before it is sent
+    job.Row = (count == 1) ? 0 : nextRecoveryRow(job.SequenceStart, count);
+
+    {
+        std::lock_guard<std::mutex> locker(jobs->Lock);
+        ++jobs->SubmittedCount;
+    }
+    jobs->Submitted.notify_one();
+
+    Rate.OnRecovery(count);
 
     return CCat_Success;
 }
 
+CCatResult Encoder::CompleteRecovery(CCatRecovery& recoveryOut)
+{
+    RecoveryJobQueue* jobs = Jobs;
+
+    // If the oldest job is not finished:
+    if (!jobs || jobs->CompletedCount == jobs->DoneCount.load(std::memory_order_acquire))
+    {
+        recoveryOut.Data = nullptr;
+        recoveryOut.Count = 0;
+        recoveryOut.SequenceStart = 0;
+        recoveryOut.Bytes = 0;
+        recoveryOut.RecoveryRow = 0;
+        recoveryOut.ColumnMask = nullptr;
+
+        return CCat_NeedsMoreData;
+    }
+
+    // The slot stays valid until the next call
+    const RecoveryJob& job = jobs->Jobs[jobs->CompletedCount % kRecoveryJobSlots];
+    ++jobs->CompletedCount;
+
+    recoveryOut.Data = job.Data.GetPtr(kRecoveryHeadroom);
+    recoveryOut.Count = static_cast<uint8_t>(job.Count);
+    recoveryOut.SequenceStart = job.SequenceStart.ToUnsigned();
+    recoveryOut.Bytes = job.Bytes;
+    recoveryOut.RecoveryRow = job.Row;
+    recoveryOut.ColumnMask = nullptr;
+
+    return CCat_Success;
+}
+
+void Encoder::runRecoveryWorker()
+{
+    RecoveryJobQueue* jobs = Jobs;
+
+    std::unique_lock<std::mutex> locker(jobs->Lock);
+
+    while (!jobs->Terminate)
+    {
+        const unsigned done = jobs->DoneCount.load(std::memory_order_relaxed);
+        if (done == jobs->SubmittedCount)
+        {
+            jobs->Submitted.wait(locker);
+            continue;
+        }
+
+        // The application does not touch this job until DoneCount passes it
+        const RecoveryJob& job = jobs->Jobs[done % kRecoveryJobSlots];
+
+        locker.unlock();
+        writeRecoveryData(
+            job.Data.GetPtr(kRecoveryHeadroom),
+            job.Index,
+            job.Column,
+            job.Count,
+            job.Bytes,
+            job.Row,
+            nullptr);
+        locker.lock();
+
+        jobs->DoneCount.store(done + 1, std::memory_order_release);
+        jobs->Finished.notify_all();
+    }
+}
+
+void Encoder::waitForRecoveryJobs(Counter64 sequence)
+{
+    RecoveryJobQueue* jobs = Jobs;
+
+    // Find the last unfinished job whose span includes the sequence.
+    // Every job ends after it, so only the start needs checking
+    const unsigned done = jobs->DoneCount.load(std::memory_order_acquire);
+    unsigned waitCount = done;
+    for (unsigned i = done; i != jobs->SubmittedCount; ++i) {
+        if (jobs->Jobs[i % kRecoveryJobSlots].SequenceStart <= sequence) {
+            waitCount = i + 1;
+        }
+    }
+
+    // If no job reads it:
+    if (waitCount == done) {
+        return;
+    }
+
+    std::unique_lock<std::mutex> locker(jobs->Lock);
+    jobs->Finished.wait(locker, [jobs, waitCount]() {
+        return (int)(jobs->DoneCount.load(std::memory_order_relaxed) - waitCount) >= 0;
+    });
+}
+
+void Encoder::drainRecoveryJobs()
+{
+    RecoveryJobQueue* jobs = Jobs;
+    if (!jobs) {
+        return;
+    }
+
+    std::unique_lock<std::mutex> locker(jobs->Lock);
+    jobs->Finished.wait(locker, [jobs]() {
+        return jobs->DoneCount.load(std::memory_order_relaxed) == jobs->SubmittedCount;
+    });
+
+    jobs->SubmittedCount = 0;
+    jobs->DoneCount.store(0, std::memory_order_relaxed);
+    jobs->CompletedCount = 0;
+}
+
+void Encoder::StopRecoveryWorker()
+{
+    RecoveryJobQueue* jobs = Jobs;
+    if (!jobs) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> locker(jobs->Lock);
+        jobs->Terminate = true;
+    }
+    jobs->Submitted.notify_one();
+    jobs->Thread.join();
+
+    delete jobs;
+    Jobs = nullptr;
+}
+
+void Encoder::InitializeRate()
+{
+    Rate.Initialize(SettingsPtr->TargetLossRate, SettingsPtr->WindowPackets);
+}
+
+void Encoder::Reset()
+{
+    // Jobs read the window, so let them finish before it is reused
+    drainRecoveryJobs();
+
+    // Window element Data and RecoveryData keep their buffers, and are
+    // resized before use, so only the window position needs resetting
+    NextIndex = 0;
+    Count = 0;
+    NextSequence = 0;
+    NextColumn = 0;
+    NextRow = 1;
+    NextParitySequence = 0;
+    LastOriginalSendUsec = 0;
+}
+
 
 //------------------------------------------------------------------------------
 // Decoder
 
-CCatResult Decoder::DecodeRecovery(const CCatRecovery& recovery)
+CCatResult Decoder::DecodeRecovery(const CCatRecovery& recovery, const uint8_t* columnMask)
 {
+    // Count bounds the column masks and the window expansion below
+    if (!recovery.Data ||
+        recovery.Count <= 0 ||
+        recovery.Count > kMaxEncoderWindowSize)
+    {
+        return CCat_InvalidInput;
+    }
+
     // Expand window based on recovery span.  If the recovery packet includes some
     // data that was lost, this will expand the window to the right
     const Expand expandResult = ExpandWindow(recovery.SequenceStart, recovery.Count);
 
     // If the recovery packet is not useful:
     if (expandResult == Expand::OutOfWindow) {
+        ++StaleRecovery;
         return CCat_Success;
     }
 
@@ -446,11 +1076,25 @@ CCatResult Decoder::DecodeRecovery(const CCatRecovery& recovery)
         CleanupRecoveryList();
     }
 
+    // Unpack the column mask of a sparse recovery packet
+    uint64_t unpackedMask[kColumnMaskWords];
+    const uint64_t* mask = nullptr;
+    if (columnMask)
+    {
+        memset(unpackedMask, 0, sizeof(unpackedMask));
+        for (unsigned i = 0; i < recovery.Count; ++i) {
+            if (columnMask[i / 8] & (1 << (i % 8))) {
+                unpackedMask[i / 64] |= (uint64_t)1 << (i % 64);
+            }
+        }
+        mask = unpackedMask;
+    }
+
     // Check how many lost packets are covered by this recovery packet
     const Counter64 sequenceStart = recovery.SequenceStart;
     PKTALLOC_DEBUG_ASSERT(sequenceStart >= SequenceBase); // Should never happen
     const Counter64 sequenceEnd = recovery.SequenceStart + recovery.Count;
-    const unsigned lost = GetLostInRange(sequenceStart, sequenceEnd);
+    const unsigned lost = GetLostInRecovery(sequenceStart, sequenceEnd, mask);
 
     // If this packet covers no losses:
     if (0 == lost) {
@@ -459,30 +1103,80 @@ CCatResult Decoder::DecodeRecovery(const CCatRecovery& recovery)
     }
 
     // If one lost packet can be recovered:
-    if (1 == lost) {
+    if (1 == lost)
+    {
+        // The packet only helps with this loss, so drop it if it is too late
+        if (IsPastDeadline(sequenceStart, sequenceEnd)) {
+            ++LateRecovery;
+            return CCat_Success;
+        }
+
         // This is the most common recovery scenario, so it is handled specially
-        return SolveLostOne(recovery);
+        return SolveLostOne(recovery, mask);
+    }
+
+    // An ordinary packet nested inside a wider stored one, such as a span
+    // repair, does not fit the banded list.  Store it as a sparse packet
+    // that includes every original instead
+    if (!mask && !fitsBandedOrder(sequenceStart, sequenceEnd))
+    {
+        memset(unpackedMask, 0, sizeof(unpackedMask));
+        for (unsigned i = 0; i < recovery.Count; ++i) {
+            unpackedMask[i / 64] |= (uint64_t)1 << (i % 64);
+        }
+        mask = unpackedMask;
+    }
+
+    // A copy of a stored packet adds no rank, so drop it before storing
+    if (IsDuplicateRecovery(recovery, mask)) {
+        ++DuplicateRecovery;
+        return CCat_Success;
     }
 
     // Store recovery packet in the sorted list
-    CCatResult result = StoreRecovery(recovery);
+    CCatResult result = StoreRecovery(recovery, mask);
     if (result != CCat_Success) {
         return result;
     }
 
+    if (mask) {
+        return findSparseSolutions();
+    }
+
     // Check if we can recover any losses using multiple recovery packets
     return FindSolutions();
 }
 
 CCatResult Decoder::DecodeOriginal(const CCatOriginal& original)
 {
+    bool borrowed = false;
+    const CCatResult result = decodeOriginal(original, borrowed);
+
+    // In zero-copy retention mode every buffer is handed back exactly once
+    if (!borrowed && SettingsPtr->OnReleaseOriginal) {
+        SettingsPtr->OnReleaseOriginal(original, SettingsPtr->AppContextPtr);
+    }
+
+    return result;
+}
+
+CCatResult Decoder::decodeOriginal(const CCatOriginal& original, bool& borrowedOut)
+{
+    // Validate input
+    if (!original.Data ||
+        original.Bytes <= 0 ||
+        original.Bytes > kMaxPacketSize)
+    {
+        return CCat_InvalidInput;
+    }
+
     CCatResult result = CCat_Success;
 
     switch (ExpandWindow(original.SequenceNumber))
     {
     case Expand::Evacuated:
         // Store this original in the window
-        result = StoreOriginal(original);
+        result = StoreOriginal(original, borrowedOut);
 
         // Recovery packets not available so solutions cannot be attempted
         break;
@@ -492,14 +1186,14 @@ CCatResult Decoder::DecodeOriginal(const CCatOriginal& original)
         CleanupRecoveryList();
 
         // Store this original in the window
-        result = StoreOriginal(original);
+        result = StoreOriginal(original, borrowedOut);
 
         // Shifted window with this original so no recovery packets reference it
         break;
 
     case Expand::InWindow:
         // Original received out of order: Store this original in the window
-        result = StoreOriginal(original);
+        result = StoreOriginal(original, borrowedOut);
         if (result != CCat_Success) {
             return result;
         }
@@ -545,10 +1239,22 @@ Decoder::Expand Decoder::ExpandWindow(Counter64 sequenceStart, unsigned count)
         return Expand::InWindow;
     }
 
+    // Number of elements that must leave the window to make room
+    const uint64_t shift = span - kDecoderWindowSize;
+
     // If entire window has been evacuated:
-    // The - 63 is because we would round up to the nearest word below.
-    if (span >= kDecoderWindowSize * 2 - 63)
+    if (shift >= kDecoderWindowSize)
     {
+        // Hand borrowed data back before forgetting the window
+        if (SettingsPtr->OnReleaseOriginal) {
+            ReleaseBorrowedRange(0, kDecoderWindowSize);
+        }
+
+        // Everything still lost before the new window start is unrecovered
+        const uint64_t skipped = (sequenceStart - SequenceBase).ToUnsigned() - kDecoderWindowSize;
+        const uint64_t unrecovered = ReportUnrecovered + Lost.RangePopcount(0, kDecoderWindowSize) + skipped;
+        ReportUnrecovered = unrecovered < 0xffffffff ? (unsigned)unrecovered : 0xffffffff;
+
         // Invariant: End - Base <= kDecoderWindowSize
         // This means we have evacuated the whole window.
         Lost.SetAll();
@@ -562,8 +1268,8 @@ Decoder::Expand Decoder::ExpandWindow(Counter64 sequenceStart, unsigned count)
 #ifdef CCAT_FREE_UNUSED_PACKETS
         for (unsigned i = 0; i < kDecoderWindowSize; ++i)
         {
-            AllocPtr->Free(Packets[i].Data);
-            Packets[i].Data = nullptr;
+            AllocPtr->Free(PacketData[i]);
+            PacketData[i] = nullptr;
         }
 #endif // CCAT_FREE_UNUSED_PACKETS
 
@@ -574,43 +1280,37 @@ Decoder::Expand Decoder::ExpandWindow(Counter64 sequenceStart, unsigned count)
 
     // Handle span between (kDecoderWindowSize, kDecoderWindowSize * 2) uninclusive:
 
-    // Round up the minimum bit shift required to make room to the next word
-    const unsigned minBitShift = (unsigned)span - kDecoderWindowSize;
-    const unsigned roundWordShift = (minBitShift + 63) / 64;
-    PKTALLOC_DEBUG_ASSERT(roundWordShift >= 1 && roundWordShift < Lost.kWords);
+    // Shift the ring by exactly the number of new elements.  The packet
+    // arrays and Lost share the rotation, so the elements leaving the front
+    // become the new elements at the back
+    const unsigned shiftCount = (unsigned)shift;
 
-    // Shift words left to make room for all the new elements
-    for (unsigned i = roundWordShift; i < Lost.kWords; ++i) {
-        Lost.Words[i - roundWordShift] = Lost.Words[i];
-    }
+    // Losses shifted out of the window were not recovered
+    ReportUnrecovered += CountLost(0, shiftCount);
 
-    // Mark all new elements as lost
-    for (unsigned i = Lost.kWords - roundWordShift; i < Lost.kWords; ++i) {
-        Lost.Words[i] = (uint64_t)~((int64_t)0); // All lost
+    // Hand borrowed data that is leaving the window back to the application
+    if (SettingsPtr->OnReleaseOriginal) {
+        ReleaseBorrowedRange(0, shiftCount);
     }
 
-    const unsigned lostBits = roundWordShift * 64;
-    PKTALLOC_DEBUG_ASSERT(lostBits < kDecoderWindowSize);
-
 #ifdef CCAT_FREE_UNUSED_PACKETS
-    unsigned element = PacketsRotation;
-    for (unsigned i = 0; i < lostBits; ++i)
+    for (unsigned i = 0; i < shiftCount; ++i)
     {
-        AllocPtr->Free(Packets[element].Data);
-        Packets[element].Data = nullptr;
-        ++element;
-        if (element >= kDecoderWindowSize) {
-            element -= kDecoderWindowSize;
-        }
+        const unsigned slot = GetSlot(i);
+        AllocPtr->Free(PacketData[slot]);
+        PacketData[slot] = nullptr;
     }
 #endif // CCAT_FREE_UNUSED_PACKETS
 
-    SequenceBase += lostBits;
+    // Mark all new elements as lost
+    SetLostRange(0, shiftCount);
+
+    SequenceBase += shiftCount;
     PKTALLOC_DEBUG_ASSERT(SequenceEnd - SequenceBase <= kDecoderWindowSize);
     PKTALLOC_DEBUG_ASSERT(sequenceStart >= SequenceBase);
 
     // Increment packet rotation modulo the window size
-    PacketsRotation += lostBits;
+    PacketsRotation += shiftCount;
     if (PacketsRotation >= kDecoderWindowSize) {
         PacketsRotation -= kDecoderWindowSize;
     }
@@ -619,99 +1319,508 @@ Decoder::Expand Decoder::ExpandWindow(Counter64 sequenceStart, unsigned count)
 }
 
 void Decoder::ClearRecoveryList()
+{
+    clearRecoveryList(RecoveryFirst, RecoveryLast);
+    clearRecoveryList(SparseFirst, SparseLast);
+
+    RecoveryMaxBytes = 0;
+    RecoveryMaxCount = 0;
+}
+
+void Decoder::clearRecoveryList(RecoveryPacket*& first, RecoveryPacket*& last)
 {
     // For each recovery packet:
-    for (RecoveryPacket* recovery = RecoveryFirst, *next; recovery; recovery = next)
+    for (RecoveryPacket* recovery = first, *next; recovery; recovery = next)
     {
         next = recovery->Next;
 
         // Free memory for this packet
         AllocPtr->Free(recovery->Data);
-        AllocPtr->Destruct(recovery);
+        RecoveryPool.Destruct(recovery);
     }
 
     // Clear recovery list
-    RecoveryFirst = nullptr;
-    RecoveryLast = nullptr;
+    first = nullptr;
+    last = nullptr;
 }
 
 void Decoder::CleanupRecoveryList()
+{
+    cleanupRecoveryList(RecoveryFirst, RecoveryLast);
+    cleanupSparseList();
+}
+
+void Decoder::cleanupRecoveryList(RecoveryPacket*& first, RecoveryPacket*& last)
 {
     const Counter64 sequenceBase = SequenceBase;
 
     // For each recovery packet:
-    for (RecoveryPacket* recovery = RecoveryFirst, *next; recovery; recovery = next)
+    for (RecoveryPacket* recovery = first, *next; recovery; recovery = next)
     {
         // If we found a recovery packet that is entirely within the window:
         if (recovery->SequenceStart >= sequenceBase)
         {
             // Set this as the new recovery list head,
             // as all remaining sorted rows will also be within the window.
-            RecoveryFirst = recovery;
+            first = recovery;
             recovery->Prev = nullptr;
 
             PKTALLOC_DEBUG_ASSERT(recovery->SequenceEnd <= SequenceEnd);
-            PKTALLOC_DEBUG_ASSERT(RecoveryLast->SequenceEnd <= SequenceEnd);
+            PKTALLOC_DEBUG_ASSERT(last->SequenceEnd <= SequenceEnd);
 
             return;
         }
         next = recovery->Next;
 
         // Free memory for this packet
-        AllocPtr->Free(recovery->Data);
-        AllocPtr->Destruct(recovery);
+        FreeRecovery(recovery);
     }
 
     // Clear recovery list
-    RecoveryFirst = nullptr;
-    RecoveryLast = nullptr;
+    first = nullptr;
+    last = nullptr;
+}
+
+void Decoder::cleanupSparseList()
+{
+    const Counter64 sequenceBase = SequenceBase;
+
+    // For each recovery packet:
+    for (RecoveryPacket* recovery = SparseFirst, *next; recovery; recovery = next)
+    {
+        next = recovery->Next;
+
+        // If it references data that left the window:
+        if (recovery->SequenceStart < sequenceBase)
+        {
+            unlinkRecovery(recovery, SparseFirst, SparseLast);
+
+            // Free memory for this packet
+            FreeRecovery(recovery);
+        }
+    }
+
+    PKTALLOC_DEBUG_ASSERT(!SparseLast || SparseLast->SequenceEnd <= SequenceEnd);
+}
+
+void Decoder::unlinkRecovery(
+    RecoveryPacket* recovery,
+    RecoveryPacket*& first,
+    RecoveryPacket*& last)
+{
+    RecoveryPacket* prev = recovery->Prev;
+    RecoveryPacket* next = recovery->Next;
+
+    if (prev) {
+        prev->Next = next;
+    }
+    else {
+        first = next;
+    }
+
+    if (next) {
+        next->Prev = prev;
+    }
+    else {
+        last = prev;
+    }
+}
+
+void Decoder::FreeRecovery(RecoveryPacket* recovery)
+{
+    // If the last of the largest packets is leaving, recalculate on next store
+    if (recovery->Bytes == RecoveryMaxBytes) {
+        PKTALLOC_DEBUG_ASSERT(RecoveryMaxCount > 0);
+        --RecoveryMaxCount;
+    }
+
+    AllocPtr->Free(recovery->Data);
+    RecoveryPool.Destruct(recovery);
+}
+
+void Decoder::UpdateRecoveryMaxBytes()
+{
+    unsigned maxBytes = 0, maxCount = 0;
+
+    for (int list = 0; list < 2; ++list)
+    {
+        for (const RecoveryPacket* recovery = list ? SparseFirst : RecoveryFirst;
+            recovery; recovery = recovery->Next)
+        {
+            if (maxBytes < recovery->Bytes) {
+                maxBytes = recovery->Bytes;
+                maxCount = 1;
+            }
+            else if (maxBytes == recovery->Bytes) {
+                ++maxCount;
+            }
+        }
+    }
+
+    RecoveryMaxBytes = maxBytes;
+    RecoveryMaxCount = maxCount;
+}
+
+void Decoder::ReleaseBorrowed()
+{
+    if (SettingsPtr && SettingsPtr->OnReleaseOriginal) {
+        ReleaseBorrowedRange(0, kDecoderWindowSize);
+    }
+}
+
+void Decoder::Reset()
+{
+    ReleaseBorrowed();
+    ClearRecoveryList();
+    RecoveryPool.Clear(AllocPtr);
+
+    for (unsigned i = 0; i < kDecoderWindowSize; ++i)
+    {
+        AllocPtr->Free(PacketData[i]);
+        PacketData[i] = nullptr;
+        PacketBytes[i] = 0;
+    }
+
+    // All packets are lost initially
+    Lost.SetAll();
+    PacketsRotation = 0;
+    SequenceBase = 0;
+    SequenceEnd = 0;
+
+    // Solver state is kept for reuse: Solve() overwrites it
+
+    FailureSequence = 0;
+    LargeRecoverySuccesses = 0;
+    LargeRecoveryFailures = 0;
+    DuplicateRecovery = 0;
+    StaleRecovery = 0;
+    LateRecovery = 0;
+    DeadlineSequence = 0;
+
+    ReportSequenceEnd = 0;
+    NextOriginalSequence = 0;
+    ReportReceived = 0;
+    ReportRecovered = 0;
+    ReportUnrecovered = 0;
+    memset(ReportBursts, 0, sizeof(ReportBursts));
+}
+
+void Decoder::FreeSolver()
+{
+    if (Solver && !SolverShared)
+    {
+        AllocPtr->Free(Solver->Matrix.GetPtr());
+        AllocPtr->Destruct(Solver);
+        Solver = nullptr;
+    }
+}
+
+unsigned Decoder::FindReceived(unsigned elementStart, unsigned elementEnd) const
+{
+    PKTALLOC_DEBUG_ASSERT(elementEnd <= kDecoderWindowSize);
+    if (elementStart >= elementEnd) {
+        return elementEnd;
+    }
+
+    const unsigned slotStart = GetSlot(elementStart);
+    const unsigned found = Lost.FindFirstClear(slotStart);
+    unsigned element = elementStart + found - slotStart;
+
+    // If the search ran off the end of the ring, continue from the front
+    if (found >= kDecoderWindowSize) {
+        element += Lost.FindFirstClear(0);
+    }
+
+    return element < elementEnd ? element : elementEnd;
+}
+
+void Decoder::SetLostRange(unsigned elementStart, unsigned elementEnd)
+{
+    PKTALLOC_DEBUG_ASSERT(elementEnd <= kDecoderWindowSize);
+    if (elementStart >= elementEnd) {
+        return;
+    }
+
+    const unsigned slotStart = GetSlot(elementStart);
+    const unsigned slotEnd = slotStart + (elementEnd - elementStart);
+    if (slotEnd <= kDecoderWindowSize) {
+        Lost.SetRange(slotStart, slotEnd);
+    }
+    else
+    {
+        Lost.SetRange(slotStart, kDecoderWindowSize);
+        Lost.SetRange(0, slotEnd - kDecoderWindowSize);
+    }
+}
+
+void Decoder::ClearLostRange(unsigned elementStart, unsigned elementEnd)
+{
+    PKTALLOC_DEBUG_ASSERT(elementEnd <= kDecoderWindowSize);
+    if (elementStart >= elementEnd) {
+        return;
+    }
+
+    const unsigned slotStart = GetSlot(elementStart);
+    const unsigned slotEnd = slotStart + (elementEnd - elementStart);
+    if (slotEnd <= kDecoderWindowSize) {
+        Lost.ClearRange(slotStart, slotEnd);
+    }
+    else
+    {
+        Lost.ClearRange(slotStart, kDecoderWindowSize);
+        Lost.ClearRange(0, slotEnd - kDecoderWindowSize);
+    }
+}
+
+void Decoder::ReleaseBorrowedRange(unsigned elementStart, unsigned elementEnd)
+{
+    PKTALLOC_DEBUG_ASSERT(elementEnd <= kDecoderWindowSize);
+
+    for (unsigned element = elementStart; element < elementEnd; ++element)
+    {
+        const unsigned slot = GetSlot(element);
+        if (!PacketBorrowed.Check(slot)) {
+            continue;
+        }
+
+        CCatOriginal original;
+        original.Data = PacketData[slot] + kEncodeOverhead;
+        original.Bytes = PacketBytes[slot] - kEncodeOverhead;
+        original.SequenceNumber = (SequenceBase + element).ToUnsigned();
+
+        PacketData[slot] = nullptr;
+        PacketBytes[slot] = 0;
+        PacketBorrowed.Clear(slot);
+
+        SettingsPtr->OnReleaseOriginal(original, SettingsPtr->AppContextPtr);
+    }
+}
+
+void Decoder::ReleaseUnusedRecovered(uint8_t* data, Counter64 sequence)
+{
+    CCatOriginal original;
+    original.Data = data + kEncodeOverhead;
+    original.Bytes = 0;
+    original.SequenceNumber = sequence.ToUnsigned();
+
+    SettingsPtr->OnReleaseOriginal(original, SettingsPtr->AppContextPtr);
+}
+
+void Decoder::GetStats(CCatStats& statsOut) const
+{
+    statsOut.DuplicateRecovery = DuplicateRecovery;
+    statsOut.StaleRecovery = StaleRecovery;
+    statsOut.LateRecovery = LateRecovery;
+}
+
+void Decoder::GetLossReport(CCatLossReport& reportOut)
+{
+    uint64_t expected = (SequenceEnd - ReportSequenceEnd).ToUnsigned();
+    if (expected > 0xffffffff) {
+        expected = 0xffffffff;
+    }
+
+    // Originals received late may have been expected in an earlier report
+    const unsigned lost = expected > ReportReceived ? (unsigned)expected - ReportReceived : 0;
+    const unsigned recovered = ReportRecovered < lost ? ReportRecovered : lost;
+
+    reportOut.Expected = (unsigned)expected;
+    reportOut.Lost = lost;
+    reportOut.Recovered = recovered;
+    reportOut.Unrecovered = ReportUnrecovered;
+    reportOut.SequenceEnd = SequenceEnd.ToUnsigned();
+    for (unsigned i = 0; i < CCAT_LOSS_BURST_BINS; ++i) {
+        reportOut.Bursts[i] = ReportBursts[i];
+        ReportBursts[i] = 0;
+    }
+
+    // Walk the missing ranges, keeping the newest in a ring
+    const unsigned elementEnd = (unsigned)(SequenceEnd - SequenceBase).ToUnsigned();
+    unsigned found = 0;
+    unsigned element = 0;
+
+    while (element < elementEnd)
+    {
+        element = FindLost(element, elementEnd);
+        if (element >= elementEnd) {
+            break;
+        }
+
+        const unsigned clear = FindReceived(element, elementEnd);
+
+        CCatMissingRange& range = reportOut.Missing[found % CCAT_LOSS_REPORT_MAX_RANGES];
+        range.SequenceStart = (SequenceBase + element).ToUnsigned();
+        range.Count = clear - element;
+        ++found;
+
+        element = clear;
+    }
+
+    if (found > CCAT_LOSS_REPORT_MAX_RANGES)
+    {
+        // Rotate the oldest kept range to the front
+        CCatMissingRange* ranges = reportOut.Missing;
+        std::rotate(
+            ranges,
+            ranges + found % CCAT_LOSS_REPORT_MAX_RANGES,
+            ranges + CCAT_LOSS_REPORT_MAX_RANGES);
+        found = CCAT_LOSS_REPORT_MAX_RANGES;
+    }
+    reportOut.MissingCount = found;
+
+    // Start the next interval.  Recoveries beyond the lost count carry over
+    ReportSequenceEnd = SequenceEnd;
+    ReportReceived = 0;
+    ReportRecovered -= recovered;
+    if (ReportRecovered > kDecoderWindowSize) {
+        ReportRecovered = kDecoderWindowSize;
+    }
+    ReportUnrecovered = 0;
 }
 
-CCatResult Decoder::StoreOriginal(const CCatOriginal& original)
+CCatResult Decoder::StoreOriginal(const CCatOriginal& original, bool& borrowedOut)
 {
     const Counter64 sequence = original.SequenceNumber;
     const unsigned element = (unsigned)(sequence - SequenceBase).ToUnsigned();
     PKTALLOC_DEBUG_ASSERT(element < kDecoderWindowSize);
 
     // If this element was not lost:
-    if (!Lost.Check(element))
+    if (!IsLost(element))
     {
         // We have already received it.  This happens if recovery succeeds and
         // then the original arrives later.
         return CCat_Success;
     }
 
-    Lost.Clear(element);
+    ClearLost(element);
+    ++ReportReceived;
+
+    // A gap before this original is a loss burst
+    if (sequence >= NextOriginalSequence)
+    {
+        const uint64_t gap = (sequence - NextOriginalSequence).ToUnsigned();
+        if (gap > 0) {
+            ++ReportBursts[(gap < CCAT_LOSS_BURST_BINS ? (unsigned)gap : CCAT_LOSS_BURST_BINS) - 1];
+        }
+        NextOriginalSequence = sequence + 1;
+    }
+
+    // Lost elements never hold borrowed data: It is released on window shift
+    const unsigned slot = GetSlot(element);
+    PKTALLOC_DEBUG_ASSERT(!PacketBorrowed.Check(slot));
+
+    // Zero-copy retention: Keep the application buffer and write the length
+    // field into the CCAT_DECODE_HEADROOM bytes in front of it
+    if (SettingsPtr->OnReleaseOriginal)
+    {
+        AllocPtr->Free(PacketData[slot]);
+
+        uint8_t* data = const_cast<uint8_t*>(original.Data) - kEncodeOverhead;
+        WriteU16_LE(data, (uint16_t)(original.Bytes - 1));
+        PacketData[slot] = data;
+        PacketBytes[slot] = kEncodeOverhead + original.Bytes;
+        PacketBorrowed.Set(slot);
+
+        borrowedOut = true;
+        return CCat_Success;
+    }
 
     // Reallocate element memory
-    OriginalPacket* packet = GetPacket(element);
-    packet->Data = AllocPtr->Reallocate(
-        packet->Data,
+    uint8_t* data = AllocPtr->Reallocate(
+        PacketData[slot],
         2 + original.Bytes,
         pktalloc::Realloc::Uninitialized);
+    PacketData[slot] = data;
 
-    if (!packet->Data) {
+    if (!data) {
         return CCat_OOM;
     }
 
     // Copy original data here with length prepended
-    WriteU16_LE(packet->Data, (uint16_t)(original.Bytes - 1));
-    memcpy(packet->Data + 2, original.Data, original.Bytes);
-    packet->Bytes = 2 + original.Bytes;
+    WriteU16_LE(data, (uint16_t)(original.Bytes - 1));
+    memcpy(data + 2, original.Data, original.Bytes);
+    PacketBytes[slot] = 2 + original.Bytes;
 
     return CCat_Success;
 }
 
-CCatResult Decoder::StoreRecovery(const CCatRecovery& recovery)
+bool Decoder::IsDuplicateRecovery(const CCatRecovery& recovery, const uint64_t* mask) const
+{
+    const Counter64 sequenceStart = recovery.SequenceStart;
+    const Counter64 sequenceEnd = recovery.SequenceStart + recovery.Count;
+
+    // Scan right to left, as StoreRecovery() does to find the insertion point
+    for (const RecoveryPacket* packet = mask ? SparseLast : RecoveryLast; packet; packet = packet->Prev)
+    {
+        if (packet->SequenceEnd > sequenceEnd) {
+            continue;
+        }
+        if (packet->SequenceEnd < sequenceEnd) {
+            break; // Sorted by SequenceEnd so no match remains
+        }
+
+        if (packet->SequenceStart == sequenceStart &&
+            packet->MatrixRow == recovery.RecoveryRow &&
+            (!mask || 0 == memcmp(packet->ColumnMask, mask, sizeof(packet->ColumnMask))))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool Decoder::fitsBandedOrder(Counter64 sequenceStart, Counter64 sequenceEnd) const
+{
+    const RecoveryPacket* prev = RecoveryLast;
+    const RecoveryPacket* next = nullptr;
+
+    // Find insertion point, as StoreRecovery() does
+    while (prev)
+    {
+        if (prev->SequenceEnd < sequenceEnd) {
+            break;
+        }
+        else if (prev->SequenceEnd == sequenceEnd &&
+            prev->SequenceStart <= sequenceStart)
+        {
+            break;
+        }
+
+        next = prev;
+        prev = prev->Prev;
+    }
+
+    // Starts must also be sorted on both sides
+    if (next && sequenceStart > next->SequenceStart) {
+        return false;
+    }
+    if (prev && prev->SequenceStart > sequenceStart) {
+        return false;
+    }
+
+    return true;
+}
+
+CCatResult Decoder::StoreRecovery(const CCatRecovery& recovery, const uint64_t* mask)
 {
+    if (RecoveryMaxCount <= 0) {
+        UpdateRecoveryMaxBytes();
+    }
+
+    // Pad to the largest recovery packet in the window, so that a solve can
+    // usually extend it to SolutionBytes in place rather than copying it
+    const unsigned bytes = recovery.Bytes;
+    const unsigned capacity = (bytes < RecoveryMaxBytes) ? RecoveryMaxBytes : bytes;
+
     // Allocate packet
-    uint8_t* data = AllocPtr->Allocate(recovery.Bytes);
+    uint8_t* data = AllocPtr->Allocate(capacity);
 
     if (!data) {
         return CCat_OOM;
     }
 
-    RecoveryPacket* packet = AllocPtr->Construct<RecoveryPacket>();
+    RecoveryPacket* packet = RecoveryPool.Construct(AllocPtr);
 
     if (!packet) {
         AllocPtr->Free(data);
@@ -725,12 +1834,21 @@ CCatResult Decoder::StoreRecovery(const CCatRecovery& recovery)
     // Write recovery data
     memcpy(data, recovery.Data, recovery.Bytes);
     packet->Bytes = recovery.Bytes;
+    packet->Capacity = capacity;
     packet->Data = data;
     packet->SequenceStart = sequenceStart;
     packet->SequenceEnd = sequenceEnd;
     packet->MatrixRow = recovery.RecoveryRow;
+    packet->IsSparse = (mask != nullptr);
+    if (mask) {
+        memcpy(packet->ColumnMask, mask, sizeof(packet->ColumnMask));
+    }
 
-    RecoveryPacket* prev = RecoveryLast;
+    // Sparse packets go in their own list, sorted by SequenceEnd only
+    RecoveryPacket*& listFirst = mask ? SparseFirst : RecoveryFirst;
+    RecoveryPacket*& listLast = mask ? SparseLast : RecoveryLast;
+
+    RecoveryPacket* prev = listLast;
     RecoveryPacket* next = nullptr;
 
     // Find insertion point
@@ -753,11 +1871,11 @@ CCatResult Decoder::StoreRecovery(const CCatRecovery& recovery)
     // Insert between next and prev
     if (next)
     {
-        if (sequenceStart > next->SequenceStart || sequenceEnd > next->SequenceEnd)
+        if (!mask && sequenceStart > next->SequenceStart)
         {
             PKTALLOC_DEBUG_BREAK(); // Invalid input
             AllocPtr->Free(data);
-            AllocPtr->Destruct(packet);
+            RecoveryPool.Destruct(packet);
 
             return CCat_InvalidInput;
         }
@@ -765,28 +1883,36 @@ CCatResult Decoder::StoreRecovery(const CCatRecovery& recovery)
         next->Prev = packet;
     }
     else {
-        RecoveryLast = packet;
+        listLast = packet;
     }
 
     if (prev)
     {
-        if (prev->SequenceStart > sequenceStart || prev->SequenceEnd > sequenceEnd)
+        if (!mask && prev->SequenceStart > sequenceStart)
         {
             PKTALLOC_DEBUG_BREAK(); // Invalid input
             AllocPtr->Free(data);
-            AllocPtr->Destruct(packet);
+            RecoveryPool.Destruct(packet);
             return CCat_InvalidInput;
         }
 
         prev->Next = packet;
     }
     else {
-        RecoveryFirst = packet;
+        listFirst = packet;
     }
 
     packet->Next = next;
     packet->Prev = prev;
 
+    if (bytes > RecoveryMaxBytes) {
+        RecoveryMaxBytes = bytes;
+        RecoveryMaxCount = 1;
+    }
+    else if (bytes == RecoveryMaxBytes) {
+        ++RecoveryMaxCount;
+    }
+
     return CCat_Success;
 }
 
@@ -949,13 +2075,43 @@ CCatResult Decoder::StoreRecovery(const CCatRecovery& recovery)
     packet length to be recovered.  These original packets are then reported
     to the application.
 
-    The rows used for solution are erased from the recovery list and state is
-    returned back to normal.  If there are more solutions they will be found
-    on the right side of the matrix, so phase (1) is repeated until all
-    solutions are found.
-*/
+    The rows used for solution are erased from the recovery list and state is
+    returned back to normal.  If there are more solutions they will be found
+    on the right side of the matrix, so phase (1) is repeated until all
+    solutions are found.
+*/
+
+unsigned Decoder::GetLostInRecovery(
+    Counter64 sequenceStart,
+    Counter64 sequenceEnd,
+    const uint64_t* mask)
+{
+    if (!mask) {
+        return GetLostInRange(sequenceStart, sequenceEnd);
+    }
+
+    PKTALLOC_DEBUG_ASSERT(sequenceStart >= SequenceBase);
+    PKTALLOC_DEBUG_ASSERT(sequenceEnd <= SequenceEnd);
+    const unsigned start = (unsigned)(sequenceStart - SequenceBase).ToUnsigned();
+    const unsigned end = (unsigned)(sequenceEnd - SequenceBase).ToUnsigned();
+
+    // Losses are sparse, so visit each one and check the mask
+    unsigned lost = 0;
+    for (unsigned element = start; element < end; ++element)
+    {
+        element = FindLost(element, end);
+        if (element >= end) {
+            break;
+        }
+
+        const unsigned bit = element - start;
+        lost += (unsigned)(mask[bit / 64] >> (bit % 64)) & 1;
+    }
+
+    return lost;
+}
 
-CCatResult Decoder::SolveLostOne(const CCatRecovery& recovery)
+CCatResult Decoder::SolveLostOne(const CCatRecovery& recovery, const uint64_t* mask)
 {
     // Calculate element range
     const Counter64 sequenceStart = recovery.SequenceStart;
@@ -966,26 +2122,56 @@ CCatResult Decoder::SolveLostOne(const CCatRecovery& recovery)
     PKTALLOC_DEBUG_ASSERT(elementEnd <= kDecoderWindowSize);
 
     // Find lost element
-    const unsigned lostElement = Lost.FindFirstSet(elementStart, elementEnd);
+    unsigned lostElement = FindLost(elementStart, elementEnd);
+    if (mask)
+    {
+        // Skip losses that are not included
+        while (lostElement < elementEnd)
+        {
+            const unsigned bit = lostElement - elementStart;
+            if (0 != ((mask[bit / 64] >> (bit % 64)) & 1)) {
+                break;
+            }
+            if (++lostElement >= elementEnd) {
+                break;
+            }
+            lostElement = FindLost(lostElement, elementEnd);
+        }
+    }
     const Counter64 lostSequence = SequenceBase + lostElement;
     PKTALLOC_DEBUG_ASSERT(lostElement < kDecoderWindowSize);
-    OriginalPacket* lostPacket = GetPacket(lostElement);
+    const unsigned lostSlot = GetSlot(lostElement);
 
-    // Reallocate data
+    // Decode into an application buffer if one is provided
     const unsigned recoveryBytes = recovery.Bytes;
-    uint8_t* data = AllocPtr->Reallocate(
-        lostPacket->Data,
-        recoveryBytes,
-        pktalloc::Realloc::Uninitialized);
-    lostPacket->Data = data;
+    uint8_t* data = nullptr;
+    if (SettingsPtr->OnAllocateRecovered) {
+        data = SettingsPtr->OnAllocateRecovered(recoveryBytes, SettingsPtr->AppContextPtr);
+    }
 
-    if (!data) {
-        return CCat_OOM;
+    if (data)
+    {
+        AllocPtr->Free(PacketData[lostSlot]);
+        PacketData[lostSlot] = data;
+        PacketBorrowed.Set(lostSlot);
+    }
+    else
+    {
+        // Reallocate data
+        data = AllocPtr->Reallocate(
+            PacketData[lostSlot],
+            recoveryBytes,
+            pktalloc::Realloc::Uninitialized);
+        PacketData[lostSlot] = data;
+
+        if (!data) {
+            return CCat_OOM;
+        }
     }
 
     memcpy(data, recovery.Data, recoveryBytes);
 
-    // Calculate Packets[] element
+    // Calculate packet slot
     unsigned element = elementStart;
     element += PacketsRotation;
     if (element >= kDecoderWindowSize) {
@@ -996,26 +2182,30 @@ CCatResult Decoder::SolveLostOne(const CCatRecovery& recovery)
     unsigned column = (unsigned)(sequenceStart.ToUnsigned() % kMatrixColumnCount);
     const uint8_t row = recovery.RecoveryRow;
     uint8_t lostColumn = 0;
+    bool invalid = false;
 
     // For each protected packet:
     for (Counter64 sequence = sequenceStart; sequence < sequenceEnd; ++sequence)
     {
+        const unsigned bit = (unsigned)(sequence - sequenceStart).ToUnsigned();
+
         // If this is the lost sequence:
         if (sequence == lostSequence) {
             lostColumn = (uint8_t)column;
         }
-        else
+        else if (!mask || 0 != ((mask[bit / 64] >> (bit % 64)) & 1))
         {
             // Eliminate this original packet
             PKTALLOC_DEBUG_ASSERT(element < kDecoderWindowSize);
-            OriginalPacket* original = &Packets[element];
-            const uint8_t* originalData = original->Data;
-            const unsigned originalBytes = original->Bytes;
-            PKTALLOC_DEBUG_ASSERT(original->Bytes >= 2);
+            const uint8_t* originalData = PacketData[element];
+            const unsigned originalBytes = PacketBytes[element];
+            PKTALLOC_DEBUG_ASSERT(originalBytes >= 2);
 
-            if (!originalData || originalBytes > recoveryBytes) {
+            if (!originalData || originalBytes > recoveryBytes)
+            {
                 PKTALLOC_DEBUG_BREAK(); // Invalid input
-                return CCat_InvalidInput;
+                invalid = true;
+                break;
             }
 
             if (row == 0) {
@@ -1041,7 +2231,7 @@ CCatResult Decoder::SolveLostOne(const CCatRecovery& recovery)
     }
 
     // If this is not a parity row:
-    if (row != 0)
+    if (!invalid && row != 0)
     {
         const uint8_t y_inv = gf256_inv(GetMatrixElement(row, lostColumn));
 
@@ -1049,17 +2239,34 @@ CCatResult Decoder::SolveLostOne(const CCatRecovery& recovery)
     }
 
     // Check size
-    const unsigned originalBytes = (unsigned)ReadU16_LE(data) + 1;
-    if (originalBytes > recoveryBytes)
+    unsigned originalBytes = 0;
+    if (!invalid)
+    {
+        originalBytes = (unsigned)ReadU16_LE(data) + 1;
+        if (originalBytes > recoveryBytes)
+        {
+            PKTALLOC_DEBUG_BREAK(); // Invalid input.  Probably passed the wrong sequence numbers in?
+            invalid = true;
+        }
+    }
+
+    if (invalid)
     {
-        PKTALLOC_DEBUG_BREAK(); // Invalid input.  Probably passed the wrong sequence numbers in?
+        // Lost elements never hold borrowed data
+        if (PacketBorrowed.Check(lostSlot))
+        {
+            PacketData[lostSlot] = nullptr;
+            PacketBorrowed.Clear(lostSlot);
+            ReleaseUnusedRecovered(data, lostSequence);
+        }
         return CCat_InvalidInput;
     }
 
-    lostPacket->Bytes = 2 + originalBytes;
+    PacketBytes[lostSlot] = 2 + originalBytes;
 
     // Mark this element as received
-    Lost.Clear(lostElement);
+    ClearLost(lostElement);
+    ++ReportRecovered;
 
     // Report recovery
     CCatOriginal recoveredOriginal;
@@ -1075,11 +2282,11 @@ CCatResult Decoder::SolveLostOne(const CCatRecovery& recovery)
 CCatResult Decoder::FindSolutionsContaining(const Counter64 sequence)
 {
     // If there is no recovery list:
-    if (!RecoveryLast) {
+    if (!RecoveryLast && !SparseLast) {
         return CCat_Success;
     }
 
-    PKTALLOC_DEBUG_ASSERT(RecoveryFirst != nullptr);
+    PKTALLOC_DEBUG_ASSERT(!RecoveryLast || RecoveryFirst != nullptr);
     //PKTALLOC_DEBUG_ASSERT(RecoveryFirst->SequenceStart <= sequence);
     // This happens sometimes if an original is received that is not protected
 
@@ -1114,6 +2321,30 @@ CCatResult Decoder::FindSolutionsContaining(const Counter64 sequence)
         unreferenced = false;
     }
 
+    // Scan sparse packets that include it the same way.  These may nest, so
+    // a packet that starts after it does not end the scan:
+    for (RecoveryPacket* recovery = SparseLast; recovery; recovery = recovery->Prev)
+    {
+        if (sequence >= recovery->SequenceEnd) {
+            continue; // Try next
+        }
+        if (sequence < recovery->SequenceStart) {
+            continue; // Try next
+        }
+        if (!recovery->Includes(sequence)) {
+            continue; // Try next
+        }
+
+        const unsigned loss = GetLostInRecovery(recovery);
+
+        if (loss == 1) {
+            return Solve(recovery, recovery);
+        }
+        if (loss > 1) {
+            unreferenced = false;
+        }
+    }
+
     // If it is unreferenced:
     if (unreferenced) {
         return CCat_Success;
@@ -1124,14 +2355,46 @@ CCatResult Decoder::FindSolutionsContaining(const Counter64 sequence)
 }
 
 CCatResult Decoder::FindSolutions()
+{
+    // Lost does not change until a solution is found, so every range query
+    // in the scan can use the prefix counts
+    LostPrefix.Build(Lost);
+
+    CCatResult result = findBandedSolutions();
+
+    if (result == CCat_NeedsMoreData && SparseLast) {
+        result = findSparseSolutions();
+    }
+
+    return result;
+}
+
+CCatResult Decoder::findBandedSolutions()
 {
     RecoveryPacket* next = RecoveryLast;
+
+    // A sparse solution may have recovered every loss that the newest
+    // packets cover.  They cannot help any more, so release them
+    while (next && 0 == GetLostInRangeCached(next->SequenceStart, next->SequenceEnd))
+    {
+        RecoveryLast = next->Prev;
+        if (RecoveryLast) {
+            RecoveryLast->Next = nullptr;
+        }
+        else {
+            RecoveryFirst = nullptr;
+        }
+
+        FreeRecovery(next);
+        next = RecoveryLast;
+    }
+
     if (!next) {
         return CCat_NeedsMoreData;
     }
 
     Counter64 nextSequenceStart = next->SequenceStart;
-    unsigned nextLoss = GetLostInRange(nextSequenceStart, next->SequenceEnd);
+    unsigned nextLoss = GetLostInRangeCached(nextSequenceStart, next->SequenceEnd);
     unsigned fill = 1;
     unsigned loss = nextLoss;
     unsigned rightZeros = 0;
@@ -1159,7 +2422,7 @@ CCatResult Decoder::FindSolutions()
         unsigned overlapLoss;
         PKTALLOC_DEBUG_ASSERT(prev->SequenceEnd <= next->SequenceEnd);
         if (prev->SequenceEnd < next->SequenceEnd) {
-            overlapLoss = GetLostInRange(nextSequenceStart, prev->SequenceEnd);
+            overlapLoss = GetLostInRangeCached(nextSequenceStart, prev->SequenceEnd);
         }
         else {
             overlapLoss = nextLoss;
@@ -1189,7 +2452,7 @@ CCatResult Decoder::FindSolutions()
         PKTALLOC_DEBUG_ASSERT(prevSequenceStart <= nextSequenceStart);
         if (prevSequenceStart < nextSequenceStart)
         {
-            nextLoss = GetLostInRange(prevSequenceStart, prev->SequenceEnd);
+            nextLoss = GetLostInRangeCached(prevSequenceStart, prev->SequenceEnd);
             PKTALLOC_DEBUG_ASSERT(nextLoss >= overlapLoss);
             addedLoss = nextLoss - overlapLoss;
         }
@@ -1233,10 +2496,170 @@ CCatResult Decoder::FindSolutions()
     return CCat_NeedsMoreData;
 }
 
+CCatResult Decoder::findSparseSolutions()
+{
+    // Sparse rows are not banded, so the counting shortcuts above do not
+    // apply.  Instead accumulate the union of included losses from the right
+    // and stop once there are as many rows as losses
+    pktalloc::CustomBitSet<kDecoderWindowSize> included;
+    unsigned fill = 0;
+
+    for (RecoveryPacket* prev = SparseLast; prev; prev = prev->Prev)
+    {
+        if (++fill > kMaxRecoveryColumns) {
+            break;
+        }
+
+        const unsigned elementStart = (unsigned)(prev->SequenceStart - SequenceBase).ToUnsigned();
+        const unsigned elementEnd = (unsigned)(prev->SequenceEnd - SequenceBase).ToUnsigned();
+        PKTALLOC_DEBUG_ASSERT(elementEnd <= kDecoderWindowSize);
+
+        for (unsigned element = elementStart; element < elementEnd; ++element)
+        {
+            element = FindLost(element, elementEnd);
+            if (element >= elementEnd) {
+                break;
+            }
+
+            const unsigned bit = element - elementStart;
+            if (0 != ((prev->ColumnMask[bit / 64] >> (bit % 64)) & 1)) {
+                included.Set(element);
+            }
+        }
+
+        const unsigned loss = included.RangePopcount(0, kDecoderWindowSize);
+
+        if (loss > kMaxRecoveryColumns) {
+            break;
+        }
+
+        // If a solution is possible:
+        if (loss > 0 && loss <= fill) {
+            return Solve(prev, SparseLast);
+        }
+    }
+
+    return CCat_NeedsMoreData;
+}
+
+/// Solver state shared by the codecs on one thread that set SharedSolver
+struct SharedSolverContext
+{
+    /// Allocator for the solver and its matrix
+    pktalloc::Allocator Alloc;
+
+    DecoderSolver* Solver = nullptr;
+
+    /// Set while a decoder is solving, in case a callback re-enters
+    bool InUse = false;
+
+    ~SharedSolverContext()
+    {
+        if (Solver)
+        {
+            Alloc.Free(Solver->Matrix.GetPtr());
+            Alloc.Destruct(Solver);
+        }
+    }
+};
+
+static SharedSolverContext& GetSharedSolverContext()
+{
+    static thread_local SharedSolverContext context;
+    return context;
+}
+
+bool Decoder::acquireSolver()
+{
+    // A private solver is kept once allocated
+    if (Solver) {
+        return true;
+    }
+
+    if (SettingsPtr->SharedSolver)
+    {
+        SharedSolverContext& context = GetSharedSolverContext();
+
+        // If an OnRecoveredData() callback from another codec's solve led
+        // here, fall through and allocate a private solver instead
+        if (!context.InUse)
+        {
+            if (!context.Solver)
+            {
+                context.Solver = context.Alloc.Construct<DecoderSolver>();
+                if (!context.Solver) {
+                    return false;
+                }
+                context.Solver->MatrixAllocPtr = &context.Alloc;
+            }
+
+            context.InUse = true;
+            Solver = context.Solver;
+            SolverShared = true;
+            return true;
+        }
+    }
+
+    // Solver state is only needed once a multi-loss solve happens
+    Solver = AllocPtr->Construct<DecoderSolver>();
+    if (!Solver) {
+        return false;
+    }
+    Solver->MatrixAllocPtr = AllocPtr;
+    return true;
+}
+
+void Decoder::releaseSolver()
+{
+    if (SolverShared)
+    {
+        GetSharedSolverContext().InUse = false;
+        Solver = nullptr;
+        SolverShared = false;
+    }
+}
+
+bool Decoder::IsPastDeadline(Counter64 sequenceStart, Counter64 sequenceEnd) const
+{
+    Counter64 deadline = DeadlineSequence;
+
+    const unsigned deadlinePackets = SettingsPtr->DeadlinePackets;
+    if (deadlinePackets > 0 && SequenceEnd.ToUnsigned() > deadlinePackets)
+    {
+        const Counter64 packetDeadline = SequenceEnd - deadlinePackets;
+        if (deadline < packetDeadline) {
+            deadline = packetDeadline;
+        }
+    }
+
+    if (sequenceStart >= deadline) {
+        return false;
+    }
+    if (sequenceEnd <= deadline) {
+        return true;
+    }
+
+    // Check for losses between the deadline and the end of the range
+    const unsigned elementStart = (unsigned)(deadline - SequenceBase).ToUnsigned();
+    const unsigned elementEnd = (unsigned)(sequenceEnd - SequenceBase).ToUnsigned();
+    return FindLost(elementStart, elementEnd) >= elementEnd;
+}
+
 CCatResult Decoder::Solve(RecoveryPacket* spanStart, RecoveryPacket* spanEnd)
 {
     PKTALLOC_DEBUG_ASSERT(spanStart != nullptr && spanEnd != nullptr);
 
+    // Skip the solve if all of its output would be too late.  The rows are
+    // kept, as they may still help solve newer losses later
+    if (IsPastDeadline(spanStart->SequenceStart, spanEnd->SequenceEnd)) {
+        ++LateRecovery;
+        return CCat_NeedsMoreData;
+    }
+
+    if (!acquireSolver()) {
+        return CCat_OOM;
+    }
+
     CCatResult result;
 
     // Convert span to arrays of columns and rows
@@ -1272,6 +2695,9 @@ OnFail:
     // Release temporary space for this span and get resume point for search
     ReleaseSpan(spanStart, spanEnd, result);
 
+    // The solve is complete, so other codecs on this thread may use it
+    releaseSolver();
+
     // If any failures occurred:
     if (result != CCat_Success)
     {
@@ -1284,12 +2710,14 @@ OnFail:
 
 CCatResult Decoder::ArraysFromSpans(RecoveryPacket* spanStart, RecoveryPacket* spanEnd)
 {
-    SolutionBytes = 0;
-    RowCount = 0;
-    ColumnCount = 0;
+    Solver->SolutionBytes = 0;
+    Solver->RowCount = 0;
+    Solver->ColumnCount = 0;
 
     unsigned solutionBytes = 0;
     unsigned rowCount = 0;
+    bool sparseRows = false;
+    Counter64 sequenceStart = spanStart->SequenceStart;
     RecoveryPacket* recovery = spanStart;
 
     // Convert recovery row span into an array and calculate SolutionBytes
@@ -1297,10 +2725,16 @@ CCatResult Decoder::ArraysFromSpans(RecoveryPacket* spanStart, RecoveryPacket* s
     {
         // Incorporate this row into the array
         PKTALLOC_DEBUG_ASSERT(recovery->MatrixRow < kMatrixRowCount);
-        CauchyRows[rowCount] = recovery->MatrixRow;
-        RowInfo[rowCount].Recovery = recovery;
+        Solver->CauchyRows[rowCount] = recovery->MatrixRow;
+        Solver->RowInfo[rowCount].Recovery = recovery;
         ++rowCount;
         PKTALLOC_DEBUG_ASSERT(rowCount <= kMaxRecoveryRows);
+        sparseRows |= recovery->IsSparse;
+
+        // Sparse rows may nest, so the first row does not always start first
+        if (sequenceStart > recovery->SequenceStart) {
+            sequenceStart = recovery->SequenceStart;
+        }
 
         // Update solution bytes
         if (solutionBytes < recovery->Bytes) {
@@ -1315,12 +2749,12 @@ CCatResult Decoder::ArraysFromSpans(RecoveryPacket* spanStart, RecoveryPacket* s
         PKTALLOC_DEBUG_ASSERT(recovery);
     }
     PKTALLOC_DEBUG_ASSERT(solutionBytes > 2);
-    SolutionBytes = solutionBytes;
+    Solver->SolutionBytes = solutionBytes;
     PKTALLOC_DEBUG_ASSERT(rowCount > 0);
-    RowCount = rowCount;
+    Solver->RowCount = rowCount;
+    Solver->SparseRows = sparseRows;
 
     // Store original columns
-    const Counter64 sequenceStart = spanStart->SequenceStart;
     const Counter64 sequenceEnd = spanEnd->SequenceEnd;
     PKTALLOC_DEBUG_ASSERT(sequenceStart >= SequenceBase);
     const unsigned elementStart = (unsigned)(sequenceStart - SequenceBase).ToUnsigned();
@@ -1337,7 +2771,7 @@ CCatResult Decoder::ArraysFromSpans(RecoveryPacket* spanStart, RecoveryPacket* s
     unsigned lossSearchStart = elementStart;
     for (;;)
     {
-        unsigned nextLoss = Lost.FindFirstSet(lossSearchStart, elementEnd);
+        unsigned nextLoss = FindLost(lossSearchStart, elementEnd);
 
         // Constrain the loss index within the receive window.
         // It can fall out ahead if the window is partially empty.
@@ -1345,6 +2779,29 @@ CCatResult Decoder::ArraysFromSpans(RecoveryPacket* spanStart, RecoveryPacket* s
             break;
         }
 
+        // Start searching from next element
+        lossSearchStart = nextLoss + 1;
+
+        const Counter64 lossSequence = sequenceStart + nextLoss - elementStart;
+
+        // With sparse rows, only include losses that some row includes
+        if (sparseRows)
+        {
+            bool included = false;
+            for (unsigned i = 0; i < rowCount; ++i)
+            {
+                if (Solver->RowInfo[i].Recovery->Includes(lossSequence))
+                {
+                    included = true;
+                    break;
+                }
+            }
+
+            if (!included) {
+                continue;
+            }
+        }
+
         // Translate lost element into its rotated position in the decoder window ring buffer
         unsigned element = nextLoss;
         element += PacketsRotation;
@@ -1366,18 +2823,22 @@ CCatResult Decoder::ArraysFromSpans(RecoveryPacket* spanStart, RecoveryPacket* s
         }
 
         // Map column to original data
-        ColumnInfo[columnCount].OriginalPtr = &Packets[element];
-        ColumnInfo[columnCount].Sequence = sequenceStart + nextLoss - elementStart;
+        Solver->ColumnInfo[columnCount].Slot = element;
+        Solver->ColumnInfo[columnCount].Sequence = lossSequence;
         PKTALLOC_DEBUG_ASSERT(column < kMatrixColumnCount);
-        CauchyColumns[columnCount] = (uint8_t)column;
+        Solver->CauchyColumns[columnCount] = (uint8_t)column;
         ++columnCount;
         PKTALLOC_DEBUG_ASSERT(columnCount <= kMaxRecoveryColumns);
+    }
+    Solver->ColumnCount = columnCount;
 
-        // Start searching from next element
-        lossSearchStart = nextLoss + 1;
+    // If sparse rows include none of the losses:
+    if (columnCount <= 0)
+    {
+        PKTALLOC_DEBUG_ASSERT(sparseRows);
+        FailureSequence = sequenceStart;
+        return CCat_NeedsMoreData;
     }
-    PKTALLOC_DEBUG_ASSERT(columnCount > 0);
-    ColumnCount = columnCount;
 
     // Sanity check the system state
     if (rowCount < columnCount) {
@@ -1388,13 +2849,14 @@ CCatResult Decoder::ArraysFromSpans(RecoveryPacket* spanStart, RecoveryPacket* s
     // For each row:
     for (unsigned i = 0; i < rowCount; ++i) {
         // Initialize pivot rows assuming no row swaps
-        PivotRowIndex[i] = (uint8_t)i;
+        Solver->PivotRowIndex[i] = (uint8_t)i;
     }
 
     // For each column:
     for (unsigned i = 0; i < columnCount; ++i) {
         // Clear diagonal data in case we fail
-        DiagonalData[i] = nullptr;
+        Solver->DiagonalData[i] = nullptr;
+        Solver->DiagonalBorrowed[i] = false;
     }
 
     return CCat_Success;
@@ -1407,12 +2869,12 @@ CCatResult Decoder::PlanSolution()
     // as later recovery packets evacuated data on the left of the window,
     // so there is no advantage to padding; on ARM just do it byte-wise.
 
-    const unsigned rowCount = RowCount;
-    const unsigned columnCount = ColumnCount;
+    const unsigned rowCount = Solver->RowCount;
+    const unsigned columnCount = Solver->ColumnCount;
 
     // Allocate matrix
-    const bool resizeResult = Matrix.Resize(
-        AllocPtr,
+    const bool resizeResult = Solver->Matrix.Resize(
+        Solver->MatrixAllocPtr,
         rowCount * columnCount,
         pktalloc::Realloc::Uninitialized);
 
@@ -1420,50 +2882,55 @@ CCatResult Decoder::PlanSolution()
         return CCat_OOM;
     }
 
-    uint8_t* matrix = Matrix.GetPtr();
+    uint8_t* matrix = Solver->Matrix.GetPtr();
 
     // Uninitialized rows will contain zeros, which is used later in ExecuteSolutionPlan()
     memset(matrix, 0, rowCount * columnCount);
 
+    // Sparse rows break the banded structure that the code below relies on
+    if (Solver->SparseRows) {
+        return PlanSparseSolution();
+    }
+
     /*
         This loop accomplishes three things simultaneously in one sweep through the matrix:
         (1) Filling in the matrix.
         (2) Unrolling the first GE column elimination.
-        (3) Filling in ColumnStart and ColumnEnd for RowInfo[].
+        (3) Filling in ColumnStart and ColumnEnd for Solver->RowInfo[].
     */
 
     // Unroll first GE loop and build matrix:
     uint8_t* pivot_data = matrix;
     unsigned pivotColumnEnd = columnCount;
     {
-        RecoveryPacket* recovery = RowInfo[0].Recovery;
-        const uint8_t generatorRow = CauchyRows[0];
+        RecoveryPacket* recovery = Solver->RowInfo[0].Recovery;
+        const uint8_t generatorRow = Solver->CauchyRows[0];
 
-        PKTALLOC_DEBUG_ASSERT(recovery->SequenceStart <= ColumnInfo[0].Sequence);
-        PKTALLOC_DEBUG_ASSERT(recovery->SequenceEnd > ColumnInfo[0].Sequence);
-        RowInfo[0].ColumnStart = 0;
+        PKTALLOC_DEBUG_ASSERT(recovery->SequenceStart <= Solver->ColumnInfo[0].Sequence);
+        PKTALLOC_DEBUG_ASSERT(recovery->SequenceEnd > Solver->ColumnInfo[0].Sequence);
+        Solver->RowInfo[0].ColumnStart = 0;
 
         // Write element (0, 0)
-        const uint8_t x_first = GetMatrixElement(generatorRow, CauchyColumns[0]);
+        const uint8_t x_first = GetMatrixElement(generatorRow, Solver->CauchyColumns[0]);
         pivot_data[0] = x_first;
 
         // Divide remaining nonzero columns in this row by element (0, 0)
         for (unsigned column = 1; column < columnCount; ++column)
         {
-            const Counter64 columnSequence = ColumnInfo[column].Sequence;
-            PKTALLOC_DEBUG_ASSERT(columnSequence > ColumnInfo[column - 1].Sequence);
+            const Counter64 columnSequence = Solver->ColumnInfo[column].Sequence;
+            PKTALLOC_DEBUG_ASSERT(columnSequence > Solver->ColumnInfo[column - 1].Sequence);
             if (columnSequence >= recovery->SequenceEnd)
             {
                 pivotColumnEnd = column;
                 break;
             }
 
-            const uint8_t x = GetMatrixElement(generatorRow, CauchyColumns[column]);
+            const uint8_t x = GetMatrixElement(generatorRow, Solver->CauchyColumns[column]);
             pivot_data[column] = gf256_div(x, x_first);
         }
 
         // Determine column extent of each row in this first pass also
-        RowInfo[0].ColumnEnd = pivotColumnEnd;
+        Solver->RowInfo[0].ColumnEnd = pivotColumnEnd;
     }
 
     uint8_t* elim_data = pivot_data;
@@ -1474,16 +2941,16 @@ CCatResult Decoder::PlanSolution()
     {
         elim_data += columnCount;
 
-        RecoveryPacket* recovery = RowInfo[row].Recovery;
+        RecoveryPacket* recovery = Solver->RowInfo[row].Recovery;
         const Counter64 rowSequenceStart = recovery->SequenceStart;
-        const uint8_t generatorRow = CauchyRows[row];
+        const uint8_t generatorRow = Solver->CauchyRows[row];
 
 #ifdef PKTALLOC_DEBUG
         // Verify that this row does not start earlier than prior row
         for (unsigned column = 0; column < prevColumnStart; ++column)
         {
-            PKTALLOC_DEBUG_ASSERT(column == 0 || ColumnInfo[column].Sequence > ColumnInfo[column - 1].Sequence);
-            PKTALLOC_DEBUG_ASSERT(rowSequenceStart > ColumnInfo[column].Sequence);
+            PKTALLOC_DEBUG_ASSERT(column == 0 || Solver->ColumnInfo[column].Sequence > Solver->ColumnInfo[column - 1].Sequence);
+            PKTALLOC_DEBUG_ASSERT(rowSequenceStart > Solver->ColumnInfo[column].Sequence);
         }
 #endif
 
@@ -1491,8 +2958,8 @@ CCatResult Decoder::PlanSolution()
         unsigned columnStart = columnCount;
         for (unsigned column = prevColumnStart; column < columnCount; ++column)
         {
-            const Counter64 columnSequence = ColumnInfo[column].Sequence;
-            PKTALLOC_DEBUG_ASSERT(column == 0 || columnSequence > ColumnInfo[column - 1].Sequence);
+            const Counter64 columnSequence = Solver->ColumnInfo[column].Sequence;
+            PKTALLOC_DEBUG_ASSERT(column == 0 || columnSequence > Solver->ColumnInfo[column - 1].Sequence);
 
             if (rowSequenceStart <= columnSequence)
             {
@@ -1504,11 +2971,11 @@ CCatResult Decoder::PlanSolution()
         }
 
         PKTALLOC_DEBUG_ASSERT(columnStart < columnCount);
-        RowInfo[row].ColumnStart = columnStart;
+        Solver->RowInfo[row].ColumnStart = columnStart;
         prevColumnStart = columnStart;
 
         // Write first element
-        const uint8_t x_first = GetMatrixElement(generatorRow, CauchyColumns[columnStart]);
+        const uint8_t x_first = GetMatrixElement(generatorRow, Solver->CauchyColumns[columnStart]);
         elim_data[columnStart] = x_first;
 
         // Find column extent of this row
@@ -1521,11 +2988,11 @@ CCatResult Decoder::PlanSolution()
             // Unroll case where first row is added into this one:
             for (; column < pivotColumnEnd; ++column)
             {
-                PKTALLOC_DEBUG_ASSERT(ColumnInfo[column].Sequence > ColumnInfo[column - 1].Sequence);
-                PKTALLOC_DEBUG_ASSERT(recovery->SequenceEnd >= ColumnInfo[column].Sequence);
+                PKTALLOC_DEBUG_ASSERT(Solver->ColumnInfo[column].Sequence > Solver->ColumnInfo[column - 1].Sequence);
+                PKTALLOC_DEBUG_ASSERT(recovery->SequenceEnd >= Solver->ColumnInfo[column].Sequence);
 
                 // Muladd pivot row into this one
-                const uint8_t x = GetMatrixElement(generatorRow, CauchyColumns[column]);
+                const uint8_t x = GetMatrixElement(generatorRow, Solver->CauchyColumns[column]);
                 const uint8_t y = gf256_mul(pivot_data[column], x_first);
 
                 elim_data[column] = gf256_add(x, y);
@@ -1537,9 +3004,9 @@ CCatResult Decoder::PlanSolution()
         // Fill in remaining columns
         for (; column < columnCount; ++column)
         {
-            const Counter64 columnSequence = ColumnInfo[column].Sequence;
+            const Counter64 columnSequence = Solver->ColumnInfo[column].Sequence;
 
-            PKTALLOC_DEBUG_ASSERT(columnSequence > ColumnInfo[column - 1].Sequence);
+            PKTALLOC_DEBUG_ASSERT(columnSequence > Solver->ColumnInfo[column - 1].Sequence);
 
             if (recovery->SequenceEnd <= columnSequence)
             {
@@ -1547,30 +3014,72 @@ CCatResult Decoder::PlanSolution()
                 break;
             }
 
-            elim_data[column] = GetMatrixElement(generatorRow, CauchyColumns[column]);
+            elim_data[column] = GetMatrixElement(generatorRow, Solver->CauchyColumns[column]);
         }
 
-        RowInfo[row].ColumnEnd = columnEnd;
+        Solver->RowInfo[row].ColumnEnd = columnEnd;
     }
 
     // Resume Gaussian elimination from row 1
     return ResumeGaussianElimination(pivot_data, 1);
 }
 
+CCatResult Decoder::PlanSparseSolution()
+{
+    const unsigned rowCount = Solver->RowCount;
+    const unsigned columnCount = Solver->ColumnCount;
+    uint8_t* row_data = Solver->Matrix.GetPtr();
+
+    // Fill in each row, leaving zeros for columns it does not include
+    for (unsigned row = 0; row < rowCount; ++row, row_data += columnCount)
+    {
+        const RecoveryPacket* recovery = Solver->RowInfo[row].Recovery;
+        const uint8_t generatorRow = Solver->CauchyRows[row];
+
+        unsigned columnStart = 0, columnEnd = 0;
+        for (unsigned column = 0; column < columnCount; ++column)
+        {
+            const Counter64 columnSequence = Solver->ColumnInfo[column].Sequence;
+
+            if (columnSequence < recovery->SequenceStart) {
+                columnStart = column + 1;
+                continue;
+            }
+            if (columnSequence >= recovery->SequenceEnd) {
+                break;
+            }
+            columnEnd = column + 1;
+
+            if (recovery->Includes(columnSequence)) {
+                row_data[column] = GetMatrixElement(generatorRow, Solver->CauchyColumns[column]);
+            }
+        }
+
+        if (columnEnd < columnStart) {
+            columnEnd = columnStart;
+        }
+        Solver->RowInfo[row].ColumnStart = columnStart;
+        Solver->RowInfo[row].ColumnEnd = columnEnd;
+    }
+
+    // Rows may have zeros on the diagonal, so pivot from the start
+    return PivotedGaussianElimination(0);
+}
+
 CCatResult Decoder::ResumeGaussianElimination(
     uint8_t* pivot_data,
     unsigned row)
 {
-    const unsigned rowCount = RowCount;
-    const unsigned columnCount = ColumnCount;
+    const unsigned rowCount = Solver->RowCount;
+    const unsigned columnCount = Solver->ColumnCount;
 
     // Continue elimination for remaining pivots:
     for (; row < columnCount; ++row)
     {
         pivot_data += columnCount;
 
-        const unsigned pivotColumnStart = RowInfo[row].ColumnStart;
-        const unsigned pivotColumnEnd = RowInfo[row].ColumnEnd;
+        const unsigned pivotColumnStart = Solver->RowInfo[row].ColumnStart;
+        const unsigned pivotColumnEnd = Solver->RowInfo[row].ColumnEnd;
 
         // If the normal row order does not contain this:
         if (pivotColumnStart >= row) {
@@ -1611,7 +3120,7 @@ CCatResult Decoder::ResumeGaussianElimination(
         {
             elim_data += columnCount;
 
-            const unsigned columnStart = RowInfo[elim_row].ColumnStart;
+            const unsigned columnStart = Solver->RowInfo[elim_row].ColumnStart;
             PKTALLOC_DEBUG_ASSERT(columnStart >= pivotColumnStart);
 
             if (columnStart > row) {
@@ -1619,7 +3128,7 @@ CCatResult Decoder::ResumeGaussianElimination(
                 break;
             }
 
-            PKTALLOC_DEBUG_ASSERT(RowInfo[elim_row].ColumnEnd >= pivotColumnEnd);
+            PKTALLOC_DEBUG_ASSERT(Solver->RowInfo[elim_row].ColumnEnd >= pivotColumnEnd);
 
             // Muladd pivot row into this one
             const uint8_t elim_value = elim_data[row];
@@ -1657,8 +3166,8 @@ CCatResult Decoder::ResumeGaussianElimination(
 
 CCatResult Decoder::PivotedGaussianElimination(unsigned pivotColumn)
 {
-    const unsigned rowCount = RowCount;
-    const unsigned columnCount = ColumnCount;
+    const unsigned rowCount = Solver->RowCount;
+    const unsigned columnCount = Solver->ColumnCount;
 
     // Continue elimination for remaining pivots:
     for (;;)
@@ -1670,27 +3179,27 @@ CCatResult Decoder::PivotedGaussianElimination(unsigned pivotColumn)
         for (unsigned i = pivotColumn; i < rowCount; ++i)
         {
             // Grab next row index to check
-            const unsigned pivotRowIndex = PivotRowIndex[i];
+            const unsigned pivotRowIndex = Solver->PivotRowIndex[i];
 
             // Check if the diagonal is nonzero:
-            uint8_t* data = Matrix.GetPtr() + pivotRowIndex * columnCount;
+            uint8_t* data = Solver->Matrix.GetPtr() + pivotRowIndex * columnCount;
             const uint8_t diag = data[pivotColumn];
             if (diag == 0) {
                 continue; // Try next row
             }
 
             // Check if column range covers the loss column:
-            pivotColumnStart = RowInfo[pivotRowIndex].ColumnStart;
+            pivotColumnStart = Solver->RowInfo[pivotRowIndex].ColumnStart;
             PKTALLOC_DEBUG_ASSERT(pivotColumnStart <= pivotColumn);
-            pivotColumnEnd = RowInfo[pivotRowIndex].ColumnEnd;
+            pivotColumnEnd = Solver->RowInfo[pivotRowIndex].ColumnEnd;
             PKTALLOC_DEBUG_ASSERT(pivotColumnEnd > pivotColumn);
 
             // Swap this pivot row into place
             if (i != pivotColumn)
             {
-                const uint8_t temp = PivotRowIndex[pivotColumn];
-                PivotRowIndex[pivotColumn] = (uint8_t)pivotRowIndex;
-                PivotRowIndex[i] = temp;
+                const uint8_t temp = Solver->PivotRowIndex[pivotColumn];
+                Solver->PivotRowIndex[pivotColumn] = (uint8_t)pivotRowIndex;
+                Solver->PivotRowIndex[i] = temp;
             }
 
 #ifndef GF256_ALIGNED_ACCESSES
@@ -1719,8 +3228,8 @@ CCatResult Decoder::PivotedGaussianElimination(unsigned pivotColumn)
         if (!pivot_data)
         {
             // Record failure point
-            PKTALLOC_DEBUG_ASSERT(pivotColumn < ColumnCount);
-            FailureSequence = ColumnInfo[pivotColumn].Sequence;
+            PKTALLOC_DEBUG_ASSERT(pivotColumn < Solver->ColumnCount);
+            FailureSequence = Solver->ColumnInfo[pivotColumn].Sequence;
             return CCat_NeedsMoreData;
         }
 
@@ -1733,10 +3242,10 @@ CCatResult Decoder::PivotedGaussianElimination(unsigned pivotColumn)
         for (unsigned i = pivotColumn + 1; i < rowCount; ++i)
         {
             // Grab next row index to eliminate
-            const unsigned elimRowIndex = PivotRowIndex[i];
+            const unsigned elimRowIndex = Solver->PivotRowIndex[i];
 
             // Check if column is zero:
-            uint8_t* elim_data = Matrix.GetPtr() + elimRowIndex * columnCount;
+            uint8_t* elim_data = Solver->Matrix.GetPtr() + elimRowIndex * columnCount;
             const uint8_t elim_value = elim_data[pivotColumn];
 
             if (elim_value == 0) {
@@ -1746,11 +3255,11 @@ CCatResult Decoder::PivotedGaussianElimination(unsigned pivotColumn)
 
             // Since we are adding the pivot to this row, it may expand left
             // or right with additional nonzero columns
-            if (RowInfo[elimRowIndex].ColumnStart > pivotColumnStart) {
-                RowInfo[elimRowIndex].ColumnStart = pivotColumnStart;
+            if (Solver->RowInfo[elimRowIndex].ColumnStart > pivotColumnStart) {
+                Solver->RowInfo[elimRowIndex].ColumnStart = pivotColumnStart;
             }
-            if (RowInfo[elimRowIndex].ColumnEnd < pivotColumnEnd) {
-                RowInfo[elimRowIndex].ColumnEnd = pivotColumnEnd;
+            if (Solver->RowInfo[elimRowIndex].ColumnEnd < pivotColumnEnd) {
+                Solver->RowInfo[elimRowIndex].ColumnEnd = pivotColumnEnd;
             }
 
             // Add pivot row to this one
@@ -1783,19 +3292,19 @@ CCatResult Decoder::PivotedGaussianElimination(unsigned pivotColumn)
 
 CCatResult Decoder::EliminateOriginals()
 {
-    const unsigned solutionBytes = SolutionBytes;
-    const unsigned columnCount = ColumnCount;
+    const unsigned solutionBytes = Solver->SolutionBytes;
+    const unsigned columnCount = Solver->ColumnCount;
 
     // Find actual range of original data for the used recovery rows
-    Counter64 sequenceEnd = RowInfo[0].Recovery->SequenceEnd;
-    PKTALLOC_DEBUG_ASSERT(PivotRowIndex[0] == 0);
+    Counter64 sequenceEnd = Solver->RowInfo[0].Recovery->SequenceEnd;
+    PKTALLOC_DEBUG_ASSERT(Solver->SparseRows || Solver->PivotRowIndex[0] == 0);
 
     // Allocate space for solutions from recovery data
     for (unsigned column = 0; column < columnCount; ++column)
     {
-        const uint8_t rowIndex = PivotRowIndex[column];
-        PKTALLOC_DEBUG_ASSERT(rowIndex < RowCount);
-        RecoveryPacket* recovery = RowInfo[rowIndex].Recovery;
+        const uint8_t rowIndex = Solver->PivotRowIndex[column];
+        PKTALLOC_DEBUG_ASSERT(rowIndex < Solver->RowCount);
+        RecoveryPacket* recovery = Solver->RowInfo[rowIndex].Recovery;
 
         // Find the largest sequence extent including received originals
         if (sequenceEnd < recovery->SequenceEnd) {
@@ -1805,8 +3314,25 @@ CCatResult Decoder::EliminateOriginals()
         // Get recovery packet for this row
         uint8_t* data = recovery->Data;
 
-        // Reallocate to larger size, keeping any data currently there
-        data = AllocPtr->Reallocate(data, solutionBytes, pktalloc::Realloc::CopyExisting);
+        // Solve into an application buffer if one is provided
+        uint8_t* appData = nullptr;
+        if (SettingsPtr->OnAllocateRecovered) {
+            appData = SettingsPtr->OnAllocateRecovered(solutionBytes, SettingsPtr->AppContextPtr);
+        }
+
+        if (appData)
+        {
+            memcpy(appData, data, recovery->Bytes);
+            AllocPtr->Free(data);
+            data = appData;
+            Solver->DiagonalBorrowed[column] = true;
+        }
+        else if (recovery->Capacity < solutionBytes)
+        {
+            // It was not padded enough when stored, so reallocate to the
+            // larger size, keeping any data currently there
+            data = AllocPtr->Reallocate(data, solutionBytes, pktalloc::Realloc::CopyExisting);
+        }
 
         // Clear data reference from recovery packet
         recovery->Data = nullptr;
@@ -1822,11 +3348,17 @@ CCatResult Decoder::EliminateOriginals()
         memset(data + bytes, 0, solutionBytes - bytes);
 
         // Use this buffer for the solution
-        DiagonalData[column] = data;
+        Solver->DiagonalData[column] = data;
     }
 
-    // Store original columns
-    Counter64 sequence = RowInfo[0].Recovery->SequenceStart;
+    // Store original columns, from the earliest row start since sparse rows
+    // may nest
+    Counter64 sequence = Solver->RowInfo[0].Recovery->SequenceStart;
+    for (unsigned i = 1; i < Solver->RowCount; ++i) {
+        if (sequence > Solver->RowInfo[i].Recovery->SequenceStart) {
+            sequence = Solver->RowInfo[i].Recovery->SequenceStart;
+        }
+    }
 
     // Translate lost element into its rotated position in the decoder window ring buffer
     PKTALLOC_DEBUG_ASSERT(sequence >= SequenceBase);
@@ -1849,7 +3381,7 @@ CCatResult Decoder::EliminateOriginals()
         // Scan through the gaps before/between/after all losses
         Counter64 nextLostSequence;
         if (columnIndex < columnCount) {
-            nextLostSequence = ColumnInfo[columnIndex].Sequence;
+            nextLostSequence = Solver->ColumnInfo[columnIndex].Sequence;
         }
         else {
             nextLostSequence = sequenceEnd;
@@ -1859,34 +3391,41 @@ CCatResult Decoder::EliminateOriginals()
         while (sequence < nextLostSequence)
         {
             // Get original
-            OriginalPacket* original = &Packets[element];
-            const uint8_t* originalData = original->Data;
-            const unsigned originalBytes = original->Bytes;
-            PKTALLOC_DEBUG_ASSERT(originalBytes >= 2);
-
-            if (!originalData || originalBytes > solutionBytes) {
-                PKTALLOC_DEBUG_BREAK(); // Invalid input
-                return CCat_InvalidInput;
-            }
+            const uint8_t* originalData = PacketData[element];
+            const unsigned originalBytes = PacketBytes[element];
+            bool validated = false;
 
             // For each recovery packet:
             for (unsigned pivotColumn = 0; pivotColumn < columnCount; ++pivotColumn)
             {
-                const uint8_t rowIndex = PivotRowIndex[pivotColumn];
-                const RecoveryPacket* recovery = RowInfo[rowIndex].Recovery;
+                const uint8_t rowIndex = Solver->PivotRowIndex[pivotColumn];
+                const RecoveryPacket* recovery = Solver->RowInfo[rowIndex].Recovery;
 
                 // If this original packet is not referenced by this row:
-                if (sequence < recovery->SequenceStart ||
-                    sequence >= recovery->SequenceEnd)
+                if (!recovery->Includes(sequence))
                 {
                     // Note that sometimes the rows are switched around so
                     // we cannot abort early based on list sorting assumption.
                     continue;
                 }
 
+                // Validate once it is known to be needed.  A sparse row may
+                // span a loss that no row includes, which has no data
+                if (!validated)
+                {
+                    PKTALLOC_DEBUG_ASSERT(originalBytes >= 2);
+
+                    if (!originalData || originalBytes > solutionBytes) {
+                        PKTALLOC_DEBUG_BREAK(); // Invalid input
+                        return CCat_InvalidInput;
+                    }
+
+                    validated = true;
+                }
+
                 // Eliminate the original data from this row
-                uint8_t* resultData = DiagonalData[pivotColumn];
-                const uint8_t generatorRow = CauchyRows[rowIndex];
+                uint8_t* resultData = Solver->DiagonalData[pivotColumn];
+                const uint8_t generatorRow = Solver->CauchyRows[rowIndex];
                 if (generatorRow == 0) {
                     gf256_add_mem(resultData, originalData, originalBytes);
                 }
@@ -1927,15 +3466,15 @@ CCatResult Decoder::EliminateOriginals()
 
 void Decoder::ExecuteSolutionPlan()
 {
-    const unsigned columnCount = ColumnCount;
-    const unsigned solutionBytes = SolutionBytes;
-    const uint8_t* matrix = Matrix.GetPtr();
+    const unsigned columnCount = Solver->ColumnCount;
+    const unsigned solutionBytes = Solver->SolutionBytes;
+    const uint8_t* matrix = Solver->Matrix.GetPtr();
 
     // Eliminate lower left triangle.  For each column:
     for (unsigned j = 0; j < columnCount; ++j)
     {
-        void* block_j = DiagonalData[j];
-        const uint8_t* matrix_j = matrix + PivotRowIndex[j] * columnCount;
+        void* block_j = Solver->DiagonalData[j];
+        const uint8_t* matrix_j = matrix + Solver->PivotRowIndex[j] * columnCount;
 
         // Eliminate diagonal factor
         PKTALLOC_DEBUG_ASSERT(matrix_j[j] != 0);
@@ -1944,50 +3483,60 @@ void Decoder::ExecuteSolutionPlan()
         // For each row below diagonal:
         for (unsigned i = j + 1; i < columnCount; ++i)
         {
-            const uint8_t* matrix_i = matrix + PivotRowIndex[i] * columnCount;
+            const uint8_t* matrix_i = matrix + Solver->PivotRowIndex[i] * columnCount;
 
-            gf256_muladd_mem(DiagonalData[i], matrix_i[j], block_j, solutionBytes);
+            gf256_muladd_mem(Solver->DiagonalData[i], matrix_i[j], block_j, solutionBytes);
         }
     }
 
     // Eliminate upper right triangle.  For each column:
     for (unsigned j = columnCount - 1; j >= 1; --j)
     {
-        const void* block_j = DiagonalData[j];
+        const void* block_j = Solver->DiagonalData[j];
 
         // For each row above diagonal:
         for (int i = j - 1; i >= 0; --i)
         {
-            const uint8_t* matrix_i = Matrix.GetPtr() + PivotRowIndex[i] * columnCount;
+            const uint8_t* matrix_i = Solver->Matrix.GetPtr() + Solver->PivotRowIndex[i] * columnCount;
+
+            gf256_muladd_mem(Solver->DiagonalData[i], matrix_i[j], block_j, solutionBytes);
+        }
+    }
 
-            gf256_muladd_mem(DiagonalData[i], matrix_i[j], block_j, solutionBytes);
+    // With sparse rows there may be losses between the columns, so mark
+    // each column recovered individually
+    if (Solver->SparseRows)
+    {
+        for (unsigned i = 0; i < columnCount; ++i) {
+            ClearLost((unsigned)(Solver->ColumnInfo[i].Sequence - SequenceBase).ToUnsigned());
         }
+        return;
     }
 
     // Mark all packets in range recovered
-    const Counter64 sequenceStart = ColumnInfo[0].Sequence;
-    const Counter64 sequenceEnd = ColumnInfo[ColumnCount - 1].Sequence + 1;
+    const Counter64 sequenceStart = Solver->ColumnInfo[0].Sequence;
+    const Counter64 sequenceEnd = Solver->ColumnInfo[Solver->ColumnCount - 1].Sequence + 1;
     PKTALLOC_DEBUG_ASSERT(sequenceStart >= SequenceBase);
     const unsigned elementStart = (unsigned)(sequenceStart - SequenceBase).ToUnsigned();
     const unsigned elementEnd = (unsigned)(sequenceEnd - SequenceBase).ToUnsigned();
     PKTALLOC_DEBUG_ASSERT(elementEnd <= kDecoderWindowSize);
 
-    Lost.ClearRange(elementStart, elementEnd);
+    ClearLostRange(elementStart, elementEnd);
 }
 
 CCatResult Decoder::ReportSolution()
 {
-    const unsigned columnCount = ColumnCount;
-    const unsigned solutionBytes = SolutionBytes;
+    const unsigned columnCount = Solver->ColumnCount;
+    const unsigned solutionBytes = Solver->SolutionBytes;
     void* appContextPtr = SettingsPtr->AppContextPtr;
 
     // For each solution:
     for (unsigned column = 0; column < columnCount; ++column)
     {
         // Fill in losses in the original window
-        OriginalPacket* original = ColumnInfo[column].OriginalPtr;
-        uint8_t* data = DiagonalData[column];
-        PKTALLOC_DEBUG_ASSERT(original && data);
+        const unsigned slot = Solver->ColumnInfo[column].Slot;
+        uint8_t* data = Solver->DiagonalData[column];
+        PKTALLOC_DEBUG_ASSERT(slot < kDecoderWindowSize && data);
 
         // Decode length from the front overhead
         const unsigned originalBytes = ReadU16_LE(data) + 1;
@@ -2016,23 +3565,28 @@ CCatResult Decoder::ReportSolution()
         }
 
         // Free current original data pointer
-        AllocPtr->Free(original->Data);
+        AllocPtr->Free(PacketData[slot]);
 
         // Store original data
-        original->Data = data;
-        original->Bytes = 2 + originalBytes; // Include size overhead
+        PacketData[slot] = data;
+        PacketBytes[slot] = 2 + originalBytes; // Include size overhead
+        if (Solver->DiagonalBorrowed[column]) {
+            PacketBorrowed.Set(slot);
+        }
 
         // Clear diagonal data reference
-        DiagonalData[column] = nullptr;
+        Solver->DiagonalData[column] = nullptr;
 
         // Report recovery success
         CCatOriginal recoveredOriginal;
         recoveredOriginal.Data = data + 2;
         recoveredOriginal.Bytes = originalBytes;
-        recoveredOriginal.SequenceNumber = ColumnInfo[column].Sequence.ToUnsigned();
+        recoveredOriginal.SequenceNumber = Solver->ColumnInfo[column].Sequence.ToUnsigned();
         SettingsPtr->OnRecoveredData(recoveredOriginal, appContextPtr);
     }
 
+    ReportRecovered += columnCount;
+
     return CCat_Success;
 }
 
@@ -2041,22 +3595,40 @@ void Decoder::ReleaseSpan(
     RecoveryPacket* spanEnd,
     CCatResult solveResult)
 {
-    if (!spanStart) {
+    const unsigned columnCount = Solver->ColumnCount;
+
+    // Nothing to release if the span had no columns to solve
+    if (!spanStart || columnCount <= 0) {
         return;
     }
 
-    const unsigned columnCount = ColumnCount;
-
     // For each column:
     for (unsigned i = 0; i < columnCount; ++i)
     {
-        AllocPtr->Free(DiagonalData[i]);
+        uint8_t* data = Solver->DiagonalData[i];
 
-        DiagonalData[i] = nullptr;
+        // Hand back application buffers that were not reported
+        if (!Solver->DiagonalBorrowed[i]) {
+            AllocPtr->Free(data);
+        }
+        else if (data) {
+            ReleaseUnusedRecovered(data, Solver->ColumnInfo[i].Sequence);
+        }
+
+        Solver->DiagonalData[i] = nullptr;
     }
 
+    // Sparse rows may nest, so the span edge scans below do not apply
+    if (spanStart->IsSparse) {
+        releaseSparseSpan(spanStart, spanEnd, solveResult);
+        return;
+    }
+
+    RecoveryPacket*& listFirst = RecoveryFirst;
+    RecoveryPacket*& listLast = RecoveryLast;
+
     // The minimum sequence number that we can expect to fix in the future
-    const Counter64 futureMinSequence = RecoveryLast->SequenceStart;
+    const Counter64 futureMinSequence = listLast->SequenceStart;
 
     Counter64 poisonSequence = futureMinSequence;
 
@@ -2097,11 +3669,8 @@ void Decoder::ReleaseSpan(
 
         RecoveryPacket* next = recovery->Next;
 
-        // Free any unused recovery data
-        AllocPtr->Free(recovery->Data);
-
-        // Free all recovery objects in span
-        AllocPtr->Destruct(recovery);
+        // Free any unused recovery data and the recovery object
+        FreeRecovery(recovery);
 
         if (spanEnd == recovery) {
             break;
@@ -2112,8 +3681,8 @@ void Decoder::ReleaseSpan(
     }
 
     // Sequence number of left-most/right-most losses that were recovered
-    const Counter64 leftLossSequence = ColumnInfo[0].Sequence;
-    const Counter64 rightLossSequence = ColumnInfo[columnCount - 1].Sequence;
+    const Counter64 leftLossSequence = Solver->ColumnInfo[0].Sequence;
+    const Counter64 rightLossSequence = Solver->ColumnInfo[columnCount - 1].Sequence;
     RecoveryPacket* prev;
     RecoveryPacket* next;
 
@@ -2149,14 +3718,13 @@ void Decoder::ReleaseSpan(
                 prev->Next = next;
             }
             else {
-                RecoveryFirst = next;
+                listFirst = next;
             }
             next->Prev = prev;
         }
 
         // Release this packet
-        AllocPtr->Free(recovery->Data);
-        AllocPtr->Destruct(recovery);
+        FreeRecovery(recovery);
 
         recovery = prev;
     }
@@ -2193,14 +3761,13 @@ void Decoder::ReleaseSpan(
                 next->Prev = prev;
             }
             else {
-                RecoveryLast = prev;
+                listLast = prev;
             }
             prev->Next = next;
         }
 
         // Release this packet
-        AllocPtr->Free(recovery->Data);
-        AllocPtr->Destruct(recovery);
+        FreeRecovery(recovery);
 
         recovery = next;
     }
@@ -2210,13 +3777,47 @@ void Decoder::ReleaseSpan(
         spanNext->Prev = spanPrev;
     }
     else {
-        RecoveryLast = spanPrev;
+        listLast = spanPrev;
     }
     if (spanPrev) {
         spanPrev->Next = spanNext;
     }
     else {
-        RecoveryFirst = spanNext;
+        listFirst = spanNext;
+    }
+}
+
+void Decoder::releaseSparseSpan(
+    RecoveryPacket* spanStart,
+    RecoveryPacket* spanEnd,
+    CCatResult solveResult)
+{
+    // With further recovery packets we might still solve this,
+    // so keep what we have and wait for more to arrive.
+    if (solveResult == CCat_NeedsMoreData) {
+        return;
+    }
+
+    // Deallocate recovery packet span
+    for (RecoveryPacket* recovery = spanStart, *next; recovery; recovery = next)
+    {
+        next = (recovery == spanEnd) ? nullptr : recovery->Next;
+
+        unlinkRecovery(recovery, SparseFirst, SparseLast);
+        FreeRecovery(recovery);
+    }
+
+    // Packets outside the span may also have lost their last loss.
+    // The list is not sorted by SequenceStart, so check every packet
+    for (RecoveryPacket* recovery = SparseFirst, *next; recovery; recovery = next)
+    {
+        next = recovery->Next;
+
+        if (0 == GetLostInRecovery(recovery))
+        {
+            unlinkRecovery(recovery, SparseFirst, SparseLast);
+            FreeRecovery(recovery);
+        }
     }
 }
 
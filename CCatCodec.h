@@ -33,10 +33,16 @@
 #include "gf256.h"
 #include "Counter.h"
 #include "PacketAllocator.h"
+#include "CCatRate.h"
 
 #include <stdint.h> // uint32_t
 #include <string.h> // memcpy
 #include <new> // std::nothrow
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 
 namespace ccat {
@@ -74,6 +80,10 @@ static_assert(kMaxEncoderWindowSize == CCAT_MAX_WINDOW_PACKETS, "Header mismatch
 /// Max decoder window size
 static const unsigned kDecoderWindowSize = 2 * kMatrixColumnCount;
 
+/// Words in a sparse recovery column mask
+static const unsigned kColumnMaskWords = kMatrixColumnCount / 64;
+static_assert(kColumnMaskWords * 8 == CCAT_COLUMN_MASK_BYTES, "Header mismatch");
+
 /// Max packet size
 static const unsigned kMaxPacketSize = 65536;
 static_assert(kMaxPacketSize == CCAT_MAX_BYTES, "Header mismatch");
@@ -87,6 +97,20 @@ static const unsigned kMaxWindowMsec = 2000 * 1000; // Int32 limits
 
 /// Encode overhead
 static const unsigned kEncodeOverhead = 2;
+static_assert(kEncodeOverhead == CCAT_DECODE_HEADROOM, "Header mismatch");
+
+/// Bytes reserved in front of recovery data for the application packet header
+static const unsigned kRecoveryHeadroom = 32;
+static_assert(kRecoveryHeadroom == CCAT_RECOVERY_HEADROOM, "Header mismatch");
+static_assert(kRecoveryHeadroom % 16 == 0, "Must preserve SIMD alignment");
+
+/// Cache line size used to keep encoder and decoder state apart
+static const unsigned kCacheLineBytes = 64;
+
+/// Slots in the async recovery job ring.  One more than the job limit, so
+/// the packet returned by the last CompleteRecovery() stays valid
+static const unsigned kRecoveryJobSlots = CCAT_MAX_RECOVERY_JOBS + 1;
+static_assert((kRecoveryJobSlots & (kRecoveryJobSlots - 1)) == 0, "Must be a power of two");
 
 
 //------------------------------------------------------------------------------
@@ -269,14 +293,103 @@ struct EncoderWindowElement
     // Send time for this packet
     Counter64 SendUsec = 0;
 
-    // Data for packet that is prepended with data size
+    // CCatOriginal::Priority for this packet
+    uint8_t Priority = 0;
+
+    // Data for packet that is prepended with data size.
+    // The first kRecoveryHeadroom bytes are reserved for the packet header
     AlignedLightVector Data;
+
+    /// Pointer to packet data prepended with data size
+    PKTALLOC_FORCE_INLINE uint8_t* GetData() const
+    {
+        return Data.GetPtr(kRecoveryHeadroom);
+    }
+
+    /// Bytes of packet data including the prepended data size
+    PKTALLOC_FORCE_INLINE unsigned GetBytes() const
+    {
+        return Data.GetSize() - kRecoveryHeadroom;
+    }
+};
+
+
+//------------------------------------------------------------------------------
+// RecoveryJobQueue
+
+/// Recovery packet computed off the send thread for SubmitRecovery()
+struct RecoveryJob
+{
+    /// Start of recovery span
+    Counter64 SequenceStart = 0;
+
+    /// Window element and matrix column of the first original in the span
+    unsigned Index = 0;
+    uint8_t Column = 0;
+
+    /// Number of originals in the span
+    unsigned Count = 0;
+
+    /// Bytes of recovery data: The largest original in the span
+    unsigned Bytes = 0;
+
+    /// Matrix row number
+    uint8_t Row = 0;
+
+    /// Recovery data written by the worker.
+    /// The first kRecoveryHeadroom bytes are reserved for the packet header
+    AlignedLightVector Data;
+};
+
+/**
+    Ring of recovery jobs shared by the Encoder and its worker thread.
+
+    Jobs are submitted, finished and completed in order, so the jobs from
+    DoneCount up to SubmittedCount are the ones still reading the window.
+    The counters wrap around, and the slot for a counter is its value
+    modulo kRecoveryJobSlots.
+*/
+struct RecoveryJobQueue
+{
+    std::thread Thread;
+    std::mutex Lock;
+
+    /// Signalled when a job is submitted or Terminate is set
+    std::condition_variable Submitted;
+
+    /// Signalled when the worker finishes a job
+    std::condition_variable Finished;
+
+    /// Set to stop the worker.  Protected by Lock
+    bool Terminate = false;
+
+    /// Number of jobs submitted.  Changed with Lock held
+    unsigned SubmittedCount = 0;
+
+    /// Number of jobs finished by the worker.  Changed with Lock held,
+    /// and also read without it by the application thread
+    std::atomic<unsigned> DoneCount;
+
+    /// Number of jobs returned by CompleteRecovery().
+    /// Only used by the application thread
+    unsigned CompletedCount = 0;
+
+    RecoveryJob Jobs[kRecoveryJobSlots];
+
+    RecoveryJobQueue()
+        : DoneCount(0)
+    {
+    }
 };
 
 
 //------------------------------------------------------------------------------
 // Encoder
 
+// See CCatSerialize.h
+class SerialWriter;
+class SerialReader;
+
 class Encoder
 {
 public:
@@ -287,6 +400,33 @@ public:
     // API
     CCatResult EncodeOriginal(const CCatOriginal& original);
     CCatResult EncodeRecovery(CCatRecovery& recoveryOut);
+    CCatResult EncodeRecoverySpan(uint64_t sequenceStart, unsigned count, CCatRecovery& recoveryOut);
+    CCatResult EncodeRecoveryPriority(unsigned minPriority, CCatRecovery& recoveryOut);
+    CCatResult EncodeLossReport(const CCatLossReport& report);
+    CCatResult ParseLossReport(const uint8_t* data, unsigned bytes, CCatLossReport& reportOut);
+    CCatResult GetRecoveryDue(unsigned& dueOut);
+    CCatResult SubmitRecovery();
+    CCatResult CompleteRecovery(CCatRecovery& recoveryOut);
+
+    /// Stop the recovery worker started by SubmitRecovery() and drop its
+    /// jobs.  Must be called before the allocator is destroyed
+    void StopRecoveryWorker();
+
+    /// Start the rate controller from the settings
+    void InitializeRate();
+
+    /// Forget all originals.  Window and recovery buffers are kept for reuse,
+    /// and so is the recovery worker after its jobs finish
+    void Reset();
+
+    /// Bytes written by Serialize()
+    unsigned GetSerializedBytes() const;
+
+    /// Save the window and counters.  See CCatSerialize.h
+    void Serialize(SerialWriter& writer) const;
+
+    /// Restore state written by Serialize().  Only valid after Reset()
+    CCatResult Deserialize(SerialReader& reader);
 
 private:
     /// Preallocated window of packets
@@ -298,9 +438,13 @@ private:
     /// Count of window elements
     unsigned Count = 0;
 
-    /// Recovery packet generated by EncodeRecovery()
+    /// Recovery packet generated by EncodeRecovery().
+    /// The first kRecoveryHeadroom bytes are reserved for the packet header
     AlignedLightVector RecoveryData;
 
+    /// Column mask for the last sparse packet from EncodeRecoveryPriority()
+    uint8_t RecoveryMask[CCAT_COLUMN_MASK_BYTES];
+
     /// Next original packet sequence number
     Counter64 NextSequence = 0;
 
@@ -315,6 +459,56 @@ private:
 
     /// Last time an original packet was passed to EncodeOriginal()
     Counter64 LastOriginalSendUsec = 0;
+
+    /// Adaptive recovery rate, used if CCatSettings::TargetLossRate is set
+    RateController Rate;
+
+    /// Async recovery jobs and worker, created by the first SubmitRecovery()
+    RecoveryJobQueue* Jobs = nullptr;
+
+    /// Find the trailing window for a recovery packet, limited by the
+    /// settings.  Returns the count and sets the first window element index,
+    /// its matrix column, and the largest packet size
+    unsigned findRecoveryWindow(
+        unsigned& indexOut,
+        uint8_t& columnOut,
+        unsigned& maxBytesOut) const;
+
+    /// Write a recovery packet over count originals starting at window
+    /// element index, whose first matrix column is given.  If mask is not
+    /// null, only the originals with their bit set are included
+    CCatResult writeRecovery(
+        Counter64 sequenceStart,
+        unsigned index,
+        uint8_t column,
+        unsigned count,
+        unsigned maxBytes,
+        const uint8_t* mask,
+        CCatRecovery& recoveryOut);
+
+    /// Pick the matrix row for a recovery packet over count originals.
+    /// Row 0 is the xor parity row
+    uint8_t nextRecoveryRow(Counter64 sequenceStart, unsigned count);
+
+    /// Write maxBytes of recovery data for the given row to output.
+    /// Only reads the window, so the recovery worker can call it
+    void writeRecoveryData(
+        uint8_t* output,
+        unsigned index,
+        uint8_t column,
+        unsigned count,
+        unsigned maxBytes,
+        uint8_t row,
+        const uint8_t* mask) const;
+
+    /// Recovery worker thread loop
+    void runRecoveryWorker();
+
+    /// Wait until no unfinished job reads the original with this sequence
+    void waitForRecoveryJobs(Counter64 sequence);
+
+    /// Wait for all submitted jobs to finish and forget them
+    void drainRecoveryJobs();
 };
 
 
@@ -335,6 +529,9 @@ struct RecoveryPacket
     /// Bytes in packet data
     unsigned Bytes = 0;
 
+    /// Bytes allocated for packet data, which may be padded beyond Bytes
+    unsigned Capacity = 0;
+
     /// Start of recovery span
     Counter64 SequenceStart = 0;
 
@@ -343,19 +540,89 @@ struct RecoveryPacket
 
     /// Matrix row number
     uint8_t MatrixRow = 0;
+
+    /// Set if only the originals in ColumnMask are included
+    bool IsSparse = false;
+
+    /// Bit i is set if original SequenceStart + i is included
+    uint64_t ColumnMask[kColumnMaskWords];
+
+    /// Is the given sequence number in the span and included?
+    PKTALLOC_FORCE_INLINE bool Includes(Counter64 sequence) const
+    {
+        if (sequence < SequenceStart || sequence >= SequenceEnd) {
+            return false;
+        }
+        if (!IsSparse) {
+            return true;
+        }
+        const unsigned i = (unsigned)(sequence - SequenceStart).ToUnsigned();
+        return 0 != ((ColumnMask[i / 64] >> (i % 64)) & 1);
+    }
 };
 
 
 //------------------------------------------------------------------------------
-// OriginalPacket
+// DecoderSolver
 
-struct OriginalPacket
+/// Solver state for 2+ losses recovered at a time.  This is a few KB that is
+/// only touched by multi-loss solves, so the Decoder allocates it on first use
+struct DecoderSolver
 {
-    /// Pointer to packet data prepended with length field
-    uint8_t* Data = nullptr;
+    /// Number of bytes used for each recovery packet in the matrix.
+    /// This is also the maximum size of all recovery packets in the set
+    unsigned SolutionBytes = 0;
 
-    /// Bytes of data including the prepended length field
-    unsigned Bytes = 0;
+    /// Number of rows in matrix <= kMaxRecoveryRows
+    unsigned RowCount = 0;
+
+    /// Number of columns in matrix <= kMaxRecoveryColumns
+    unsigned ColumnCount = 0;
+
+    /// Set if any row in the matrix is a sparse recovery packet
+    bool SparseRows = false;
+
+    /// Information about recovery data for each row
+    struct {
+        /// Recovery packet for this row
+        RecoveryPacket* Recovery;
+
+        /// First lost column this one has
+        unsigned ColumnStart;
+
+        /// One beyond the last lost column this one covers
+        unsigned ColumnEnd;
+    } RowInfo[kMaxRecoveryColumns];
+
+    /// Information about original data for each column
+    struct {
+        /// Sequence number for this original packet
+        Counter64 Sequence;
+
+        /// Packet slot we will modify in-place
+        unsigned Slot;
+    } ColumnInfo[kMaxRecoveryRows];
+
+    /// Generator row values
+    uint8_t CauchyRows[kMaxRecoveryRows];
+
+    /// Generator column values
+    uint8_t CauchyColumns[kMaxRecoveryColumns];
+
+    /// Pivot row index for each matrix column
+    uint8_t PivotRowIndex[kMaxRecoveryColumns];
+
+    /// Solution matrix
+    AlignedLightVector Matrix;
+
+    /// Allocator for the solution matrix
+    pktalloc::Allocator* MatrixAllocPtr = nullptr;
+
+    /// Data that starts out as per-row data but becomes solved column data
+    uint8_t* DiagonalData[kMaxRecoveryColumns];
+
+    /// Set if DiagonalData came from OnAllocateRecovered()
+    bool DiagonalBorrowed[kMaxRecoveryColumns];
 };
 
 
@@ -371,16 +638,24 @@ struct OriginalPacket
     for possible solutions when a large number of recovery packets is received.
 
     Newer packets have higher sequence numbers.
-    In the bitfield, the first word contains the lowest window sequence number.
-    And the first bit of the first word indicates that the lowest sequence
-    number is lost if it is a '1'.
-
-    When the window is shifted to accomodate newer packets, it shifts the high
-    bits into the lower bits.  Instead of shifting with every new packet, it
-    will only shift in multiples of 64 bits to simplify this maintenance.
+    The bitfield is a ring that shares PacketsRotation with the packet arrays,
+    so the bit for the lowest window sequence number is at PacketsRotation.
+    A '1' bit indicates that the original packet is lost.
+
+    When the window is shifted to accomodate newer packets, ExpandWindow()
+    rotates the ring by exactly the number of new elements: The elements
+    leaving the front become the new elements at the back and are marked as
+    lost, so no bits are moved.
 */
 
-class Decoder
+#ifdef _MSC_VER
+    #pragma warning(push)
+    #pragma warning(disable: 4324) // structure was padded due to alignment specifier
+#endif
+
+// Starts on its own cache line so the decoder does not false-share with the
+// end of the encoder when the two halves run on different threads
+class alignas(kCacheLineBytes) Decoder
 {
 public:
     const CCatSettings* SettingsPtr = nullptr;
@@ -389,7 +664,40 @@ public:
     // so there is no need to explicitly free any memory on dtor.
 
     CCatResult DecodeOriginal(const CCatOriginal& original);
-    CCatResult DecodeRecovery(const CCatRecovery& recovery);
+
+    /// columnMask is null for ordinary packets, or the packed column mask
+    /// of a sparse packet.  recovery.ColumnMask is not read
+    CCatResult DecodeRecovery(const CCatRecovery& recovery, const uint8_t* columnMask);
+
+    /// Fill in a loss report and start the next report interval
+    void GetLossReport(CCatLossReport& reportOut);
+
+    /// Read the decoder counters
+    void GetStats(CCatStats& statsOut) const;
+
+    /// Set the oldest sequence number that is still worth recovering
+    void SetDeadline(uint64_t sequence)
+    {
+        DeadlineSequence = sequence;
+    }
+
+    /// Hand all borrowed original data back to the application
+    void ReleaseBorrowed();
+
+    /// Return to the initial state.  Packet data goes back to the allocator
+    void Reset();
+
+    /// Free the solver state if it was allocated
+    void FreeSolver();
+
+    /// Bytes written by Serialize()
+    unsigned GetSerializedBytes() const;
+
+    /// Save the window, loss bitmap and recovery packets.  See CCatSerialize.h
+    void Serialize(SerialWriter& writer) const;
+
+    /// Restore state written by Serialize().  Only valid after Reset()
+    CCatResult Deserialize(SerialReader& reader);
 
     PKTALLOC_FORCE_INLINE Decoder()
     {
@@ -398,24 +706,31 @@ public:
     }
 
 private:
+    /*
+        Fields are ordered by how often they are touched.  SettingsPtr and
+        AllocPtr above plus the receive path fields fill the first two cache
+        lines, which is all DecodeOriginal() reads for an in-order original
+        besides its own packet slot.  Packet pointers and lengths are kept in
+        separate arrays, and the solver scratch space is allocated on demand.
+    */
+
     //--------------------------------------------------------------------------
-    // Original/recovery data:
+    // Receive path, first cache line:
 
-    /// Bitfield - 1 bits mean a loss at that offset from SequenceBase.
-    /// Bits we have not received yet will also be marked with a 1.
-    pktalloc::CustomBitSet<kDecoderWindowSize> Lost;
+    /// First sequence number in the window
+    Counter64 SequenceBase = 0;
 
-    /// Ring buffer of packet data
-    OriginalPacket Packets[kDecoderWindowSize];
+    /// Largest sequence number in the window + 1
+    Counter64 SequenceEnd = 0;
 
     /// Rotation of packets ring buffer
     unsigned PacketsRotation = 0;
 
-    /// First sequence number in the window
-    Counter64 SequenceBase = 0;
+    /// Originals received since the last loss report
+    unsigned ReportReceived = 0;
 
-    /// Largest sequence number in the window + 1
-    Counter64 SequenceEnd = 0;
+    /// One beyond the largest original sequence number received
+    Counter64 NextOriginalSequence = 0;
 
     /// Recovery packet with the smallest sequence number.
     /// Stores up to kMaxDecoderRows recovery rows
@@ -424,59 +739,66 @@ private:
     /// Recovery packet with the largest sequence number
     RecoveryPacket* RecoveryLast = nullptr;
 
-
     //--------------------------------------------------------------------------
-    // Solver state for 2+ losses recovered at a time:
+    // Receive path, second cache line:
 
-    /// Number of bytes used for each recovery packet in the matrix.
-    /// This is also the maximum size of all recovery packets in the set
-    unsigned SolutionBytes = 0;
+    /// Recovery packets that do not fit the banded structure that
+    /// findBandedSolutions() relies on: Sparse packets, and ordinary packets
+    /// nested inside a wider one such as span repairs, which are stored with
+    /// every column included.  Sorted by SequenceEnd only, so rows may nest
+    RecoveryPacket* SparseFirst = nullptr;
+    RecoveryPacket* SparseLast = nullptr;
 
-    /// Number of rows in matrix <= kMaxRecoveryRows
-    unsigned RowCount = 0;
+    /// Bitfield - 1 bits mean a loss in that packet slot, so it rotates
+    /// with PacketsRotation.  Use IsLost() and friends with element offsets.
+    /// Bits we have not received yet will also be marked with a 1.
+    pktalloc::CustomBitSet<kDecoderWindowSize> Lost;
 
-    /// Solver state: Information about recovery data for each row
-    struct {
-        /// Recovery packet for this row
-        RecoveryPacket* Recovery;
 
-        /// First lost column this one has
-        unsigned ColumnStart;
+    //--------------------------------------------------------------------------
+    // Loss report state, updated as packets are decoded:
 
-        /// One beyond the last lost column this one covers
-        unsigned ColumnEnd;
-    } RowInfo[kMaxRecoveryColumns];
+    /// SequenceEnd when the last loss report was taken
+    Counter64 ReportSequenceEnd = 0;
 
-    /// Number of columns in matrix <= kMaxRecoveryColumns
-    unsigned ColumnCount = 0;
+    /// Originals recovered since the last loss report, including any
+    /// recovered ones not yet reported because they exceeded the lost count
+    unsigned ReportRecovered = 0;
 
-    /// Solver state: Information about original data for each column
-    struct {
-        /// Sequence number for this original packet
-        Counter64 Sequence;
+    /// Lost originals that left the window since the last loss report
+    unsigned ReportUnrecovered = 0;
 
-        /// Pointer to original packet we will modify in-place
-        OriginalPacket* OriginalPtr;
-    } ColumnInfo[kMaxRecoveryRows];
+    /// Gaps in received original sequence numbers by length
+    unsigned ReportBursts[CCAT_LOSS_BURST_BINS] = {};
 
-    /// Generator row values
-    uint8_t CauchyRows[kMaxRecoveryRows];
 
-    /// Generator column values
-    uint8_t CauchyColumns[kMaxRecoveryColumns];
+    //--------------------------------------------------------------------------
+    // Ring buffer of packet data, indexed by slot:
 
-    /// Solution matrix
-    AlignedLightVector Matrix;
+    /// Packet data prepended with length field
+    uint8_t* PacketData[kDecoderWindowSize] = {};
 
-    /// Pivot row index for each matrix column
-    uint8_t PivotRowIndex[kMaxRecoveryColumns];
+    /// Bytes of data including the prepended length field
+    unsigned PacketBytes[kDecoderWindowSize] = {};
 
-    /// Data that starts out as per-row data but becomes solved column data
-    uint8_t* DiagonalData[kMaxRecoveryColumns];
+    /// Set if the slot data is borrowed from the application in zero-copy
+    /// retention mode, and must be handed back with OnReleaseOriginal()
+    pktalloc::CustomBitSet<kDecoderWindowSize> PacketBorrowed;
 
 
     //--------------------------------------------------------------------------
-    // Statistics:
+    // Cold state:
+
+    /// Solver state for 2+ losses recovered at a time.  Allocated on first
+    /// use, or borrowed from the thread for each solve with SharedSolver
+    DecoderSolver* Solver = nullptr;
+
+    /// Set while Solver is borrowed from the thread
+    bool SolverShared = false;
+
+    /// Prefix popcounts of Lost, rebuilt before each scan of the recovery
+    /// rows and only valid until Lost changes
+    pktalloc::CustomBitSetPrefix<kDecoderWindowSize> LostPrefix;
 
     /// Sequence number we failed to recover
     Counter64 FailureSequence = 0;
@@ -487,6 +809,29 @@ private:
     /// Number of 2x2 or larger solves that failed
     uint64_t LargeRecoveryFailures = 0;
 
+    /// Recovery packets dropped by IsDuplicateRecovery()
+    uint64_t DuplicateRecovery = 0;
+
+    /// Recovery packets that arrived after their originals left the window
+    uint64_t StaleRecovery = 0;
+
+    /// Solves skipped by IsPastDeadline()
+    uint64_t LateRecovery = 0;
+
+    /// Oldest sequence number worth recovering, set by the application
+    Counter64 DeadlineSequence = 0;
+
+    /// Largest Bytes of the stored recovery packets, which new recovery
+    /// packets are padded to so solves can usually use them in place
+    unsigned RecoveryMaxBytes = 0;
+
+    /// Number of stored recovery packets with RecoveryMaxBytes.
+    /// When this drops to zero, RecoveryMaxBytes is recalculated
+    unsigned RecoveryMaxCount = 0;
+
+    /// RecoveryPacket nodes for both recovery lists
+    pktalloc::SlabPool<RecoveryPacket> RecoveryPool;
+
 
     //--------------------------------------------------------------------------
     // Original/recovery data:
@@ -501,15 +846,33 @@ private:
     };
     Expand ExpandWindow(Counter64 sequenceStart, unsigned count = 1);
 
-    /// Clear recovery list
+    /// Clear recovery lists
     void ClearRecoveryList();
+    void clearRecoveryList(RecoveryPacket*& first, RecoveryPacket*& last);
 
     /// Remove recovery packets from the front that reference unavailable data
     void CleanupRecoveryList();
+    void cleanupRecoveryList(RecoveryPacket*& first, RecoveryPacket*& last);
+
+    /// Remove sparse packets that reference unavailable data.  They are not
+    /// sorted by SequenceStart, so every packet is checked
+    void cleanupSparseList();
 
-    /// Look up packet at a given 0-based element.
+    /// Unlink a recovery packet from its list
+    static void unlinkRecovery(
+        RecoveryPacket* recovery,
+        RecoveryPacket*& first,
+        RecoveryPacket*& last);
+
+    /// Free a recovery packet that has been unlinked from its list
+    void FreeRecovery(RecoveryPacket* recovery);
+
+    /// Recalculate RecoveryMaxBytes from the stored recovery packets
+    void UpdateRecoveryMaxBytes();
+
+    /// Look up the packet slot at a given 0-based element.
     /// Applies Rotation to the ring buffer to arrive at the actual location.
-    PKTALLOC_FORCE_INLINE OriginalPacket* GetPacket(unsigned element)
+    PKTALLOC_FORCE_INLINE unsigned GetSlot(unsigned element) const
     {
         PKTALLOC_DEBUG_ASSERT(element < kDecoderWindowSize);
         PKTALLOC_DEBUG_ASSERT(PacketsRotation < kDecoderWindowSize);
@@ -519,14 +882,107 @@ private:
         if (element >= kDecoderWindowSize)
             element -= kDecoderWindowSize;
 
-        return &Packets[element];
+        return element;
+    }
+
+    /*
+        Lost is a ring that shares PacketsRotation with the packet arrays, so
+        the window shifts without moving any bits.  These helpers take element
+        offsets from SequenceBase and split ranges that wrap around the end.
+    */
+
+    PKTALLOC_FORCE_INLINE bool IsLost(unsigned element) const
+    {
+        return Lost.Check(GetSlot(element));
+    }
+
+    PKTALLOC_FORCE_INLINE void ClearLost(unsigned element)
+    {
+        Lost.Clear(GetSlot(element));
+    }
+
+    /// Count lost elements in [elementStart, elementEnd)
+    PKTALLOC_FORCE_INLINE unsigned CountLost(unsigned elementStart, unsigned elementEnd) const
+    {
+        PKTALLOC_DEBUG_ASSERT(elementEnd <= kDecoderWindowSize);
+        if (elementStart >= elementEnd) {
+            return 0;
+        }
+
+        const unsigned slotStart = GetSlot(elementStart);
+        const unsigned slotEnd = slotStart + (elementEnd - elementStart);
+        if (slotEnd <= kDecoderWindowSize) {
+            return Lost.RangePopcount(slotStart, slotEnd);
+        }
+        return Lost.RangePopcount(slotStart, kDecoderWindowSize) +
+            Lost.RangePopcount(0, slotEnd - kDecoderWindowSize);
     }
 
-    /// Store original data in window
-    CCatResult StoreOriginal(const CCatOriginal& original);
+    /// Returns the first lost element in [elementStart, elementEnd),
+    /// or elementEnd if there is none
+    PKTALLOC_FORCE_INLINE unsigned FindLost(unsigned elementStart, unsigned elementEnd) const
+    {
+        PKTALLOC_DEBUG_ASSERT(elementEnd <= kDecoderWindowSize);
+        if (elementStart >= elementEnd) {
+            return elementEnd;
+        }
+
+        const unsigned slotStart = GetSlot(elementStart);
+        const unsigned slotEnd = slotStart + (elementEnd - elementStart);
+        unsigned element;
+        if (slotEnd <= kDecoderWindowSize) {
+            element = elementStart + Lost.FindFirstSet(slotStart, slotEnd) - slotStart;
+        }
+        else
+        {
+            const unsigned found = Lost.FindFirstSet(slotStart, kDecoderWindowSize);
+            element = elementStart + found - slotStart;
+            if (found >= kDecoderWindowSize) {
+                element += Lost.FindFirstSet(0, slotEnd - kDecoderWindowSize);
+            }
+        }
+
+        // FindFirstSet() may return a set bit past the end of the range
+        return element < elementEnd ? element : elementEnd;
+    }
+
+    /// Returns the first element in [elementStart, elementEnd) that is not
+    /// lost, or elementEnd if there is none
+    unsigned FindReceived(unsigned elementStart, unsigned elementEnd) const;
+
+    /// Mark elements in [elementStart, elementEnd) as lost
+    void SetLostRange(unsigned elementStart, unsigned elementEnd);
+
+    /// Mark elements in [elementStart, elementEnd) as received
+    void ClearLostRange(unsigned elementStart, unsigned elementEnd);
+
+    /// Decode original data.  Sets borrowedOut if the data was retained
+    CCatResult decodeOriginal(const CCatOriginal& original, bool& borrowedOut);
+
+    /// Store original data in window.  Sets borrowedOut if it was retained
+    CCatResult StoreOriginal(const CCatOriginal& original, bool& borrowedOut);
+
+    /// Hand borrowed data in the given element range back to the application
+    void ReleaseBorrowedRange(unsigned elementStart, unsigned elementEnd);
 
-    /// Insert recovery packet into sorted list
-    CCatResult StoreRecovery(const CCatRecovery& recovery);
+    /// Hand an OnAllocateRecovered() buffer back with Bytes = 0,
+    /// when it was never reported because the recovery failed
+    void ReleaseUnusedRecovered(uint8_t* data, Counter64 sequence);
+
+    /// Check if the same recovery packet is already stored, so a copy that
+    /// arrives twice is dropped before StoreRecovery() allocates for it.
+    /// Stored packets are sorted by span and leave when the window slides
+    /// past them, so the list itself is the sliding window of seen packets
+    bool IsDuplicateRecovery(const CCatRecovery& recovery, const uint64_t* mask) const;
+
+    /// Check if an ordinary recovery packet can be inserted into the banded
+    /// list, which needs both SequenceStart and SequenceEnd to be sorted
+    bool fitsBandedOrder(Counter64 sequenceStart, Counter64 sequenceEnd) const;
+
+    /// Insert recovery packet into sorted list.
+    /// mask is null for ordinary packets that fitsBandedOrder(),
+    /// or the unpacked ColumnMask
+    CCatResult StoreRecovery(const CCatRecovery& recovery, const uint64_t* mask);
 
     PKTALLOC_FORCE_INLINE unsigned GetLostInRange(
         Counter64 sequenceStart,
@@ -536,11 +992,54 @@ private:
         PKTALLOC_DEBUG_ASSERT(sequenceEnd <= SequenceEnd);
         const unsigned start = (unsigned)(sequenceStart - SequenceBase).ToUnsigned();
         const unsigned end = (unsigned)(sequenceEnd - SequenceBase).ToUnsigned();
-        return Lost.RangePopcount(start, end);
+        return CountLost(start, end);
     }
 
-    /// Solve common case when recovery row is only missing one original
-    CCatResult SolveLostOne(const CCatRecovery& recovery);
+    /// GetLostInRange() using LostPrefix, which must be up to date
+    PKTALLOC_FORCE_INLINE unsigned GetLostInRangeCached(
+        Counter64 sequenceStart,
+        Counter64 sequenceEnd) const
+    {
+        PKTALLOC_DEBUG_ASSERT(sequenceStart >= SequenceBase);
+        PKTALLOC_DEBUG_ASSERT(sequenceEnd <= SequenceEnd);
+        const unsigned start = (unsigned)(sequenceStart - SequenceBase).ToUnsigned();
+        const unsigned end = (unsigned)(sequenceEnd - SequenceBase).ToUnsigned();
+        if (start >= end) {
+            return 0;
+        }
+
+        const unsigned slotStart = GetSlot(start);
+        const unsigned slotEnd = slotStart + (end - start);
+        if (slotEnd <= kDecoderWindowSize) {
+            return LostPrefix.RangePopcount(Lost, slotStart, slotEnd);
+        }
+        return LostPrefix.RangePopcount(Lost, slotStart, kDecoderWindowSize) +
+            LostPrefix.CountBelow(Lost, slotEnd - kDecoderWindowSize);
+    }
+
+    /// Count lost originals included in a recovery packet.
+    /// mask is null for ordinary packets, or the packet ColumnMask
+    unsigned GetLostInRecovery(
+        Counter64 sequenceStart,
+        Counter64 sequenceEnd,
+        const uint64_t* mask);
+
+    PKTALLOC_FORCE_INLINE unsigned GetLostInRecovery(const RecoveryPacket* recovery)
+    {
+        return GetLostInRecovery(
+            recovery->SequenceStart,
+            recovery->SequenceEnd,
+            recovery->IsSparse ? recovery->ColumnMask : nullptr);
+    }
+
+    /// Returns true if every loss in the range is past the deadline, which is
+    /// the later of DeadlineSequence and SettingsPtr->DeadlinePackets
+    /// behind SequenceEnd
+    bool IsPastDeadline(Counter64 sequenceStart, Counter64 sequenceEnd) const;
+
+    /// Solve common case when recovery row is only missing one original.
+    /// mask is null for ordinary packets
+    CCatResult SolveLostOne(const CCatRecovery& recovery, const uint64_t* mask);
 
     /// Check for a recovery packet in the list containing the given sequence
     /// number which now references just one loss.  Then call FindSolutions().
@@ -553,9 +1052,21 @@ private:
     /// Find solutions starting from the right (latest) side of the matrix
     CCatResult FindSolutions();
 
+    /// Search the main list, which is banded
+    CCatResult findBandedSolutions();
+
+    /// Search the list of sparse recovery packets
+    CCatResult findSparseSolutions();
+
     /// Solve the given span
     CCatResult Solve(RecoveryPacket* spanStart, RecoveryPacket* spanEnd);
 
+    /// Set Solver before a solve.  Returns false if out of memory
+    bool acquireSolver();
+
+    /// Hand a shared Solver back to the thread after a solve
+    void releaseSolver();
+
     /// Generate arrays from spans as a first step to planning a solution
     CCatResult ArraysFromSpans(RecoveryPacket* spanStart, RecoveryPacket* spanEnd);
 
@@ -564,6 +1075,9 @@ private:
     /// Return CCat_NeedsMoreData if given rows are insufficient to find a solution
     CCatResult PlanSolution();
 
+    /// PlanSolution() for matrices with sparse rows, which are not banded
+    CCatResult PlanSparseSolution();
+
     /// Gaussian elimination to put matrix in upper triangular form
     CCatResult ResumeGaussianElimination(
         uint8_t* pivot_data,
@@ -587,22 +1101,101 @@ private:
         RecoveryPacket* spanStart,
         RecoveryPacket* spanEnd,
         CCatResult solveResult);
+
+    /// Release exhausted span of sparse packets, and any other sparse
+    /// packets that no longer include a loss
+    void releaseSparseSpan(
+        RecoveryPacket* spanStart,
+        RecoveryPacket* spanEnd,
+        CCatResult solveResult);
 };
 
 
 //------------------------------------------------------------------------------
 // Codec
 
+/**
+    Encoder and Decoder share no mutable state: Each half has its own
+    allocator on its own cache line, and Settings is read-only after Create().
+    This is what allows ccat_encode_*() and ccat_decode_*() to be called from
+    different threads at the same time.
+*/
 class Codec
     : public Encoder
     , public Decoder
 {
 public:
+    ~Codec();
+
+    /// Allocated aligned to kCacheLineBytes so the alignment above holds
+    static void* operator new(size_t bytes, const std::nothrow_t&) noexcept;
+    static void operator delete(void* ptr, const std::nothrow_t&) noexcept;
+    static void operator delete(void* ptr) noexcept;
+
     CCatResult Create(const CCatSettings& settings);
 
+    /// Return to the state after Create(settings), keeping allocated memory
+    CCatResult Reset(const CCatSettings& settings);
+
+    /// Drop all encoder and decoder state, keeping allocated memory.
+    /// Borrowed data is released using the current settings
+    void Clear();
+
+    /// Apply new settings.  Only valid after Create() or Clear()
+    CCatResult Configure(const CCatSettings& settings);
+
+    /// Save encoder and decoder state.  A null buffer only sets bytesOut
+    CCatResult Serialize(uint8_t* buffer, unsigned bufferBytes, unsigned& bytesOut) const;
+
+    /// Replace all state with saved state.  On failure the codec is cleared
+    CCatResult Deserialize(const uint8_t* data, unsigned bytes);
+
 private:
     CCatSettings Settings;
-    pktalloc::Allocator Alloc;
+
+    /// Allocator used only by the Encoder
+    alignas(kCacheLineBytes) pktalloc::Allocator EncoderAlloc;
+
+    /// Allocator used only by the Decoder
+    alignas(kCacheLineBytes) pktalloc::Allocator DecoderAlloc;
+};
+
+#ifdef _MSC_VER
+    #pragma warning(pop)
+#endif
+
+
+//------------------------------------------------------------------------------
+// CodecPool
+
+/**
+    Thread-safe pool of idle codecs.
+
+    Released codecs are cleared right away, so borrowed data goes back to the
+    application that owned it, and are reconfigured when acquired again.
+    Up to Capacity idle codecs are kept, and extra ones are destroyed.
+*/
+class CodecPool
+{
+public:
+    ~CodecPool();
+
+    CCatResult Initialize(unsigned capacity);
+
+    /// Take an idle codec or create a new one
+    CCatResult Acquire(const CCatSettings& settings, Codec*& codecOut);
+
+    /// Return a codec to the pool
+    void Release(Codec* codec);
+
+private:
+    std::mutex Lock;
+
+    /// Idle codecs.  Reserved up front so Release() does not allocate
+    std::vector<Codec*> Idle;
+
+    /// Maximum number of idle codecs
+    unsigned Capacity = 0;
 };
 
 
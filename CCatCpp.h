@@ -36,11 +36,11 @@
 class CauchyCaterpillar
 {
 public:
-    // Initialize and pick window size in milliseconds
-    bool Initialize(unsigned windowMsec = 100)
+    // Initialize and pick window size in milliseconds.
+    // A non-zero target loss rate enables the adaptive recovery rate.
+    // Calling this again resets the codec and reuses its memory
+    bool Initialize(unsigned windowMsec = 100, float targetLossRate = 0.f)
     {
-        Destroy();
-
         CCatSettings settings;
         settings.AppContextPtr = this;
         settings.OnRecoveredData = [](CCatOriginal original, void* context)
@@ -50,8 +50,14 @@ public:
         };
         settings.WindowMsec = windowMsec;
         settings.WindowPackets = CCAT_MAX_WINDOW_PACKETS;
+        settings.TargetLossRate = targetLossRate;
 
-        CCatResult result = ccat_create(&settings, &Codec);
+        CCatResult result;
+        if (Codec) {
+            result = ccat_reset(Codec, &settings);
+        } else {
+            result = ccat_create(&settings, &Codec);
+        }
         if (result != CCat_Success)
         {
             Error = true;
@@ -90,11 +96,46 @@ public:
             Error = true;
     }
 
+    // Sparse packets from SendRecoveryPriority() keep their ColumnMask
     void OnRecovery(const CCatRecovery& recovery)
     {
-        CCatResult result = ccat_decode_recovery(Codec, &recovery);
+        CCatResult result = recovery.ColumnMask ?
+            ccat_decode_recovery_sparse(Codec, &recovery, recovery.ColumnMask) :
+            ccat_decode_recovery(Codec, &recovery);
+        if (result != CCat_Success)
+            Error = true;
+    }
+
+    void OnBatch(
+        const CCatOriginal* originals,
+        unsigned originalCount,
+        const CCatRecovery* recovery,
+        unsigned recoveryCount)
+    {
+        CCatResult result = ccat_decode_batch(
+            Codec,
+            originals,
+            originalCount,
+            recovery,
+            recoveryCount);
+        if (result != CCat_Success)
+            Error = true;
+    }
+
+    // Serialize a loss report for the peer into CCAT_LOSS_REPORT_MAX_BYTES.
+    // Returns the number of bytes written
+    unsigned GetLossReport(uint8_t* buffer)
+    {
+        unsigned bytes = 0;
+        CCatResult result = ccat_decode_get_loss_report(
+            Codec,
+            nullptr,
+            buffer,
+            CCAT_LOSS_REPORT_MAX_BYTES,
+            &bytes);
         if (result != CCat_Success)
             Error = true;
+        return bytes;
     }
 
     // Outgoing data:
@@ -114,6 +155,69 @@ public:
         return result == CCat_Success;
     }
 
+    // Recovery over only the originals with Priority >= minPriority
+    bool SendRecoveryPriority(unsigned minPriority, CCatRecovery& recovery)
+    {
+        CCatResult result = ccat_encode_recovery_priority(Codec, minPriority, &recovery);
+        if (result != CCat_Success && result != CCat_NeedsMoreData)
+            Error = true;
+        return result == CCat_Success;
+    }
+
+    // Targeted repair over part of the window.  Returns false if the span
+    // has already left the window
+    bool SendRecoverySpan(uint64_t sequenceStart, unsigned count, CCatRecovery& recovery)
+    {
+        CCatResult result = ccat_encode_recovery_span(Codec, sequenceStart, count, &recovery);
+        if (result != CCat_Success && result != CCat_NeedsMoreData)
+            Error = true;
+        return result == CCat_Success;
+    }
+
+    // Queue a recovery packet to be computed off this thread.  Returns false
+    // if the window is empty or CCAT_MAX_RECOVERY_JOBS are not completed yet
+    bool SubmitRecovery()
+    {
+        CCatResult result = ccat_encode_recovery_submit(Codec);
+        if (result == CCat_InvalidInput || result == CCat_OOM)
+            Error = true;
+        return result == CCat_Success;
+    }
+
+    // Next finished packet from SubmitRecovery().  Returns false if none is ready
+    bool CompleteRecovery(CCatRecovery& recovery)
+    {
+        CCatResult result = ccat_encode_recovery_complete(Codec, &recovery);
+        if (result != CCat_Success && result != CCat_NeedsMoreData)
+            Error = true;
+        return result == CCat_Success;
+    }
+
+    void OnLossReport(const CCatLossReport& report)
+    {
+        CCatResult result = ccat_encode_loss_report(Codec, &report);
+        if (result != CCat_Success)
+            Error = true;
+    }
+
+    // Serialized loss report from the peer's GetLossReport()
+    void OnLossReport(const uint8_t* data, unsigned bytes)
+    {
+        CCatResult result = ccat_encode_parse_loss_report(Codec, data, bytes, nullptr);
+        if (result != CCat_Success)
+            Error = true;
+    }
+
+    // Number of recovery packets to send now.  Requires a target loss rate
+    unsigned GetRecoveryDue()
+    {
+        unsigned due = 0;
+        CCatResult result = ccat_encode_recovery_due(Codec, &due);
+        if (result != CCat_Success)
+            Error = true;
+        return due;
+    }
+
 protected:
     virtual void OnRecoveredData(const CCatOriginal& original)
     {
@@ -0,0 +1,258 @@
+/** \file
+    \brief CCat Stream Multiplexer
+    \copyright Copyright (c) 2018 Christopher A. Taylor.  All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of CCat nor the names of its contributors may be
+      used to endorse or promote products derived from this software without
+      specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+    ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+    SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+    INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+    CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+    POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "CCatMux.h"
+
+namespace ccat {
+
+
+//------------------------------------------------------------------------------
+// Mux Header
+
+unsigned MuxHeaderBytes(uint64_t streamId)
+{
+    unsigned bytes = 1;
+    while (streamId >= 0x80)
+    {
+        streamId >>= 7;
+        ++bytes;
+    }
+    return bytes;
+}
+
+void WriteMuxHeader(uint8_t* data, uint64_t streamId)
+{
+    while (streamId >= 0x80)
+    {
+        *data++ = (uint8_t)streamId | 0x80;
+        streamId >>= 7;
+    }
+    *data = (uint8_t)streamId;
+}
+
+unsigned ReadMuxHeader(const uint8_t* data, unsigned bytes, uint64_t& streamIdOut)
+{
+    uint64_t streamId = 0;
+
+    for (unsigned i = 0; i < bytes && i < kMuxHeaderMax; ++i)
+    {
+        const uint8_t b = data[i];
+        streamId |= (uint64_t)(b & 0x7f) << (7 * i);
+
+        if ((b & 0x80) == 0)
+        {
+            streamIdOut = streamId;
+            return i + 1;
+        }
+    }
+
+    return 0;
+}
+
+
+//------------------------------------------------------------------------------
+// MuxEncoder
+
+MuxEncoder::~MuxEncoder()
+{
+    ccat_destroy(Codec);
+}
+
+CCatResult MuxEncoder::Initialize(const CCatSettings& codecSettings)
+{
+    if (Codec) {
+        return CCat_Error;
+    }
+
+    CCatSettings settings = codecSettings;
+    settings.AppContextPtr = nullptr;
+    settings.OnRecoveredData = nullptr;
+    settings.OnReleaseOriginal = nullptr;
+
+    return ccat_create(&settings, &Codec);
+}
+
+CCatResult MuxEncoder::EncodeOriginal(
+    uint64_t streamId,
+    uint8_t* data,
+    unsigned bytes,
+    const uint8_t*& datagramOut,
+    unsigned& datagramBytesOut)
+{
+    datagramOut = nullptr;
+    datagramBytesOut = 0;
+
+    if (!Codec) {
+        return CCat_Error;
+    }
+    if (!data || bytes <= 0) {
+        return CCat_InvalidInput;
+    }
+
+    // Mux header goes inside the protected data so it is recovered too
+    const unsigned headerBytes = MuxHeaderBytes(streamId);
+    uint8_t* payload = data - headerBytes;
+    WriteMuxHeader(payload, streamId);
+
+    CCatOriginal original;
+    original.Data = payload;
+    original.Bytes = headerBytes + bytes;
+    original.SequenceNumber = NextSequence;
+
+    const CCatResult result = ccat_encode_original(Codec, &original);
+    if (result != CCat_Success) {
+        return result;
+    }
+
+    // Wire header is written into the remaining headroom
+    unsigned datagramBytes = 0;
+    const uint8_t* datagram = Writer.WriteOriginal(
+        payload, original.Bytes, NextSequence, datagramBytes);
+    ++NextSequence;
+
+    if (!datagram) {
+        return CCat_Error;
+    }
+
+    datagramOut = datagram;
+    datagramBytesOut = datagramBytes;
+    return CCat_Success;
+}
+
+CCatResult MuxEncoder::EncodeRecovery(
+    const uint8_t*& datagramOut,
+    unsigned& datagramBytesOut)
+{
+    datagramOut = nullptr;
+    datagramBytesOut = 0;
+
+    if (!Codec) {
+        return CCat_Error;
+    }
+
+    CCatRecovery recovery;
+    const CCatResult result = ccat_encode_recovery(Codec, &recovery);
+    if (result != CCat_Success) {
+        return result;
+    }
+
+    unsigned datagramBytes = 0;
+    const uint8_t* datagram = Writer.WriteRecovery(recovery, datagramBytes);
+    if (!datagram) {
+        return CCat_Error;
+    }
+
+    datagramOut = datagram;
+    datagramBytesOut = datagramBytes;
+    return CCat_Success;
+}
+
+
+//------------------------------------------------------------------------------
+// MuxDecoder
+
+MuxDecoder::~MuxDecoder()
+{
+    ccat_destroy(Codec);
+}
+
+CCatResult MuxDecoder::Initialize(const MuxDecoderSettings& settings)
+{
+    if (Codec) {
+        return CCat_Error;
+    }
+
+    Settings = settings;
+
+    CCatSettings codecSettings = Settings.CodecSettings;
+    codecSettings.AppContextPtr = this;
+    codecSettings.OnReleaseOriginal = nullptr;
+    codecSettings.OnRecoveredData = [](CCatOriginal original, CCatAppContext context)
+    {
+        MuxDecoder* thiz = (MuxDecoder*)context;
+        thiz->deliver(original.Data, original.Bytes, true);
+    };
+
+    return ccat_create(&codecSettings, &Codec);
+}
+
+CCatResult MuxDecoder::Receive(const uint8_t* datagram, unsigned bytes)
+{
+    if (!Codec) {
+        return CCat_Error;
+    }
+
+    CCatOriginal original;
+    CCatRecovery recovery;
+
+    switch (Reader.Parse(datagram, bytes, original, recovery))
+    {
+    case WireType::Original:
+        {
+            uint64_t streamId;
+            if (0 == ReadMuxHeader(original.Data, original.Bytes, streamId)) {
+                return CCat_InvalidInput;
+            }
+
+            // Deliver before decoding, since decoding may recover later data
+            deliver(original.Data, original.Bytes, false);
+            return ccat_decode_original(Codec, &original);
+        }
+    case WireType::Recovery:
+        if (recovery.ColumnMask) {
+            return ccat_decode_recovery_sparse(Codec, &recovery, recovery.ColumnMask);
+        }
+        return ccat_decode_recovery(Codec, &recovery);
+    default:
+        break;
+    }
+
+    return CCat_InvalidInput;
+}
+
+void MuxDecoder::deliver(const uint8_t* data, unsigned bytes, bool recovered)
+{
+    uint64_t streamId;
+    const unsigned headerBytes = ReadMuxHeader(data, bytes, streamId);
+
+    // Recovered data from a misbehaving peer may have a bad header
+    if (headerBytes == 0 || !Settings.OnStreamData) {
+        return;
+    }
+
+    Settings.OnStreamData(
+        streamId,
+        data + headerBytes,
+        bytes - headerBytes,
+        recovered,
+        Settings.AppContextPtr);
+}
+
+
+} // namespace ccat
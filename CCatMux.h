@@ -0,0 +1,220 @@
+/** \file
+    \brief CCat Stream Multiplexer
+    \copyright Copyright (c) 2018 Christopher A. Taylor.  All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of CCat nor the names of its contributors may be
+      used to endorse or promote products derived from this software without
+      specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+    ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+    SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+    INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+    CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+    POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+/** \page Mux CCat Stream Multiplexer Module
+
+    Protects many low-rate streams with one shared CCat codec.
+
+    A stream sending 10 packets/second has only one packet in a 100 ms
+    window, so recovery for it alone is a copy of that packet, which is 100%
+    overhead.  The multiplexer instead gives the originals of a group of
+    streams one shared sequence number space, so each recovery packet covers
+    originals from every stream in the group.  The decoder hands received and
+    recovered data back to the application tagged with its stream id.
+
+    Each original is prefixed by a mux header inside the protected data, so
+    it is recovered along with the data:
+
+        Stream id: LEB128 varint, 1 to 10 bytes
+
+    Datagrams then use the CCatWire.h format, so the application should
+    reserve kMuxOriginalHeadroom bytes in front of its original data.
+
+    A group should carry no more originals per window than the codec window
+    holds (CCAT_MAX_WINDOW_PACKETS).  For more traffic than that, split the
+    streams across several groups, for example by hashing the stream id.
+
+    Like the codec itself, a MuxEncoder or MuxDecoder is not thread-safe.
+*/
+
+#include "ccat.h"
+#include "CCatWire.h"
+
+namespace ccat {
+
+
+//------------------------------------------------------------------------------
+// Constants
+
+/// Maximum bytes of mux header in front of original data
+static const unsigned kMuxHeaderMax = 10;
+
+/// Bytes the application should reserve in front of original data
+static const unsigned kMuxOriginalHeadroom = kWireOriginalHeaderMax + kMuxHeaderMax;
+
+
+//------------------------------------------------------------------------------
+// Mux Header
+
+/// Returns the number of bytes needed to write the mux header for a stream
+unsigned MuxHeaderBytes(uint64_t streamId);
+
+/// Writes the mux header, which must be exactly MuxHeaderBytes() long
+void WriteMuxHeader(uint8_t* data, uint64_t streamId);
+
+/// Parses the mux header from the front of the data.
+/// Returns the header length, or 0 if it is malformed
+unsigned ReadMuxHeader(const uint8_t* data, unsigned bytes, uint64_t& streamIdOut);
+
+
+//------------------------------------------------------------------------------
+// MuxEncoder
+
+/// Sending side of a multiplexed group of streams
+class MuxEncoder
+{
+public:
+    ~MuxEncoder();
+
+    /// Create the codec.  Callbacks in the settings are ignored.
+    /// Returns CCat_Success on success
+    CCatResult Initialize(const CCatSettings& codecSettings);
+
+    /**
+        EncodeOriginal()
+
+        Adds an original for the stream to the shared window and writes the
+        mux and wire headers in place in front of the data.
+        Precondition: kMuxOriginalHeadroom bytes are writable before data.
+
+        Sets datagramOut and datagramBytesOut to the datagram to send.
+        Returns CCat_Success on success.
+    */
+    CCatResult EncodeOriginal(
+        uint64_t streamId,
+        uint8_t* data,
+        unsigned bytes,
+        const uint8_t*& datagramOut,
+        unsigned& datagramBytesOut);
+
+    /**
+        EncodeRecovery()
+
+        Generates a recovery packet over the originals of all streams in the
+        window.  The datagram stays valid until the next call.
+
+        Returns CCat_NeedsMoreData if no originals have been sent yet.
+        Returns CCat_Success on success.
+    */
+    CCatResult EncodeRecovery(
+        const uint8_t*& datagramOut,
+        unsigned& datagramBytesOut);
+
+    /// Provide the next expected sequence number from MuxDecoder::GetNextExpected()
+    void OnPeerNextExpected(uint64_t nextExpected)
+    {
+        Writer.OnPeerNextExpected(nextExpected);
+    }
+
+    /// Codec for the group, for example for ccat_encode_recovery_due()
+    CCatCodec GetCodec() const
+    {
+        return Codec;
+    }
+
+private:
+    CCatCodec Codec = nullptr;
+    WireWriter Writer;
+
+    /// Next sequence number in the shared sequence space
+    uint64_t NextSequence = 0;
+};
+
+
+//------------------------------------------------------------------------------
+// MuxDecoder
+
+struct MuxDecoderSettings
+{
+    /// Settings used for the codec.  Callbacks are ignored
+    CCatSettings CodecSettings;
+
+    /// Application context pointer provided to callbacks
+    void* AppContextPtr = nullptr;
+
+    /**
+        OnStreamData()
+
+        Called for each original received or recovered, with the mux header
+        removed.  The data is only valid during the call.  An original that
+        arrives late after it was already recovered is delivered again.
+    */
+    void (*OnStreamData)(
+        uint64_t streamId,
+        const uint8_t* data,
+        unsigned bytes,
+        bool recovered,
+        void* context) = nullptr;
+};
+
+/// Receiving side of a multiplexed group of streams
+class MuxDecoder
+{
+public:
+    ~MuxDecoder();
+
+    /// Create the codec.  Returns CCat_Success on success
+    CCatResult Initialize(const MuxDecoderSettings& settings);
+
+    /**
+        Receive()
+
+        Parses a datagram from MuxEncoder and delivers any original data in
+        it, or recovered by it, through OnStreamData().
+
+        Returns CCat_InvalidInput if the datagram is malformed.
+        Returns CCat_Success on success.
+    */
+    CCatResult Receive(const uint8_t* datagram, unsigned bytes);
+
+    /// Next expected sequence number, to send to MuxEncoder::OnPeerNextExpected()
+    uint64_t GetNextExpected() const
+    {
+        return Reader.GetNextExpected();
+    }
+
+    /// Codec for the group, for example for ccat_decode_get_loss_report()
+    CCatCodec GetCodec() const
+    {
+        return Codec;
+    }
+
+private:
+    MuxDecoderSettings Settings;
+    CCatCodec Codec = nullptr;
+    WireReader Reader;
+
+    /// Strip the mux header and deliver the data to the application
+    void deliver(const uint8_t* data, unsigned bytes, bool recovered);
+};
+
+
+} // namespace ccat
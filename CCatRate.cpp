@@ -0,0 +1,207 @@
+/** \file
+    \brief CCat Adaptive Recovery Rate
+    \copyright Copyright (c) 2018 Christopher A. Taylor.  All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of CCat nor the names of its contributors may be
+      used to endorse or promote products derived from this software without
+      specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+    ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+    SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+    INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+    CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+    POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "CCatRate.h"
+
+#include <math.h>
+
+namespace ccat {
+
+
+//------------------------------------------------------------------------------
+// WindowedMax
+
+void WindowedMax::Update(float value, uint64_t timestamp, uint64_t windowLengthTime)
+{
+    const Sample sample(value, timestamp);
+
+    // On the first sample, new best sample, or if window length has expired:
+    if (!IsValid() ||
+        value >= Samples[0].Value ||
+        Samples[2].TimeoutExpired(sample.Timestamp, windowLengthTime))
+    {
+        Reset(sample);
+        return;
+    }
+
+    // Insert the new value into the sorted array
+    if (value >= Samples[1].Value)
+        Samples[2] = Samples[1] = sample;
+    else if (value >= Samples[2].Value)
+        Samples[2] = sample;
+
+    // Expire best if it has been the best for a long time
+    if (Samples[0].TimeoutExpired(sample.Timestamp, windowLengthTime))
+    {
+        // Also expire the next best if needed
+        if (Samples[1].TimeoutExpired(sample.Timestamp, windowLengthTime))
+        {
+            Samples[0] = Samples[2];
+            Samples[1] = sample;
+        }
+        else
+        {
+            Samples[0] = Samples[1];
+            Samples[1] = Samples[2];
+        }
+        Samples[2] = sample;
+        return;
+    }
+
+    // Quarter of window has gone by without a better value - Use the second-best
+    if (Samples[1].Value == Samples[0].Value &&
+        Samples[1].TimeoutExpired(sample.Timestamp, windowLengthTime / 4))
+    {
+        Samples[2] = Samples[1] = sample;
+        return;
+    }
+
+    // Half the window has gone by without a better value - Use the third-best one
+    if (Samples[2].Value == Samples[1].Value &&
+        Samples[2].TimeoutExpired(sample.Timestamp, windowLengthTime / 2))
+    {
+        Samples[2] = sample;
+    }
+}
+
+
+//------------------------------------------------------------------------------
+// RateController
+
+void RateController::Initialize(float targetLossRate, unsigned windowPackets)
+{
+    TargetLossRate = targetLossRate;
+    Rate = kRateInitial;
+    Credit = 0.f;
+    Z = kRateZInitial;
+    WindowPackets = (float)windowPackets;
+    LossSum = 0.f;
+    ExpectedSum = 0.f;
+    BurstMax.Reset();
+}
+
+void RateController::GetState(RateState& stateOut) const
+{
+    stateOut.Rate = Rate;
+    stateOut.Credit = Credit;
+    stateOut.Z = Z;
+    stateOut.WindowPackets = WindowPackets;
+    stateOut.LossSum = LossSum;
+    stateOut.ExpectedSum = ExpectedSum;
+    for (unsigned i = 0; i < WindowedMax::kSampleCount; ++i)
+    {
+        stateOut.BurstValues[i] = BurstMax.Samples[i].Value;
+        stateOut.BurstTimestamps[i] = BurstMax.Samples[i].Timestamp;
+    }
+    stateOut.Reserved = 0;
+}
+
+CCatResult RateController::SetState(const RateState& state)
+{
+    // Written so that NaN fails each check
+    if (!(state.Rate >= 0.f && state.Rate <= kRateMax) ||
+        !(state.Credit >= -kRateCreditMax && state.Credit <= kRateCreditMax) ||
+        !(state.Z >= kRateZMin && state.Z <= kRateZMax) ||
+        !(state.WindowPackets >= 0.f && state.WindowPackets <= (float)CCAT_MAX_WINDOW_PACKETS) ||
+        !(state.LossSum >= 0.f && state.ExpectedSum >= 0.f))
+    {
+        return CCat_InvalidInput;
+    }
+    for (unsigned i = 0; i < WindowedMax::kSampleCount; ++i) {
+        if (!(state.BurstValues[i] >= 0.f)) {
+            return CCat_InvalidInput;
+        }
+    }
+
+    Rate = state.Rate;
+    Credit = state.Credit;
+    Z = state.Z;
+    WindowPackets = state.WindowPackets;
+    LossSum = state.LossSum;
+    ExpectedSum = state.ExpectedSum;
+    for (unsigned i = 0; i < WindowedMax::kSampleCount; ++i)
+    {
+        BurstMax.Samples[i].Value = state.BurstValues[i];
+        BurstMax.Samples[i].Timestamp = state.BurstTimestamps[i];
+    }
+
+    return CCat_Success;
+}
+
+CCatResult RateController::OnLossReport(const CCatLossReport& report, uint64_t nowMsec)
+{
+    if (report.Lost > report.Expected ||
+        report.Recovered > report.Lost)
+    {
+        return CCat_InvalidInput;
+    }
+
+    if (!IsEnabled() || report.Expected == 0) {
+        return CCat_Success;
+    }
+
+    LossSum = LossSum * kRateCounterDecay + report.Lost;
+    ExpectedSum = ExpectedSum * kRateCounterDecay + report.Expected;
+
+    // Longest average burst length in recent reports.
+    // The last bin counts as its lower bound
+    unsigned bursts = 0, burstLoss = 0;
+    for (unsigned i = 0; i < CCAT_LOSS_BURST_BINS; ++i)
+    {
+        bursts += report.Bursts[i];
+        burstLoss += report.Bursts[i] * (i + 1);
+    }
+    if (bursts > 0) {
+        BurstMax.Update(burstLoss / (float)bursts, nowMsec, kRateBurstWindowMsec);
+    }
+
+    // Steer the margin so the residual loss settles on the target
+    const unsigned residual = report.Lost - report.Recovered;
+    Z += (residual - TargetLossRate * report.Expected) * kRateZStep;
+    if (Z < kRateZMin) {
+        Z = kRateZMin;
+    }
+    if (Z > kRateZMax) {
+        Z = kRateZMax;
+    }
+
+    // Half a loss is added so a few clean reports do not estimate zero loss
+    const float p = (LossSum + 0.5f) / (ExpectedSum + 1.f);
+    const float b = BurstMax.IsValid() ? BurstMax.GetBest() : 1.f;
+    const float n = WindowPackets > 1.f ? WindowPackets : 1.f;
+    Rate = p + Z * sqrtf(p * (1.f - p) * b / n);
+    if (Rate > kRateMax) {
+        Rate = kRateMax;
+    }
+
+    return CCat_Success;
+}
+
+
+} // namespace ccat
@@ -0,0 +1,244 @@
+/** \file
+    \brief CCat Adaptive Recovery Rate
+    \copyright Copyright (c) 2018 Christopher A. Taylor.  All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of CCat nor the names of its contributors may be
+      used to endorse or promote products derived from this software without
+      specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+    ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+    SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+    INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+    CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+    POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+/** \page Rate CCat Adaptive Recovery Rate
+
+    Decides how many recovery packets the encoder should send, from loss
+    reports fed back by the receiver (CCatLossReport):
+
+    + The loss rate p is a running average over the last several reports,
+      weighted by packet count.
+    + Recovery only fails when a window of N originals loses more than the
+      recovery packets sent over it, so the rate is set a margin above p:
+
+          Rate = p + Z * sqrt(p * (1 - p) * B / N)
+
+      B is the loss burst length, which widens the spread of the loss count
+      per window.  It is the windowed maximum of the average burst length in
+      each report over kRateBurstWindowMsec, so protection stays up for a
+      while after a burst.  N is measured from the encoder window.
+    + The static sweeps in docs/simulation_results.txt fit this with Z of
+      about 2 for 0.1% effective loss across 1% to 9% PLR.  Z starts a bit
+      lower and is then steered by the receiver.
+    + Z follows residual loss: originals the receiver lost and could not
+      recover.  Each one raises Z by a step, and each original that did not
+      need recovery lowers it by the target fraction of a step, so Z settles
+      where the residual loss meets the target.
+    + Each encoded original adds the rate to a credit, and each recovery
+      packet spends one, so the application can ask how many are due.
+*/
+
+#include "ccat.h"
+
+#include <stdint.h>
+
+namespace ccat {
+
+
+//------------------------------------------------------------------------------
+// Constants
+
+/// Window over which the longest burst length is remembered
+static const unsigned kRateBurstWindowMsec = 2000;
+
+/// Recovery packets per original before the first loss report
+static const float kRateInitial = 0.1f;
+
+/// Highest recovery rate: kMatrixRowCount / kMatrixColumnCount
+static const float kRateMax = 1.f / 3.f;
+
+/// Credit limit in recovery packets, so idle periods do not bank a burst
+static const float kRateCreditMax = 4.f;
+
+/// Range of the margin Z, in standard deviations of loss per window
+static const float kRateZInitial = 1.5f;
+static const float kRateZMin = 0.f;
+static const float kRateZMax = 6.f;
+
+/// Change in Z for each unrecovered original
+static const float kRateZStep = 0.1f;
+
+/// Decay of the loss counters per report
+static const float kRateCounterDecay = 0.95f;
+
+/// Weight of each new sample in the window size average
+static const float kRateAverageAlpha = 0.125f;
+
+
+//------------------------------------------------------------------------------
+// WindowedMax
+
+/// Running windowed maximum with a fixed time and resource cost.
+/// Ported from WindowedMinMax in tests/SiameseTools.h
+class WindowedMax
+{
+public:
+    struct Sample
+    {
+        /// Sample value
+        float Value;
+
+        /// Timestamp of data collection
+        uint64_t Timestamp;
+
+
+        explicit Sample(float value = 0.f, uint64_t timestamp = 0)
+            : Value(value)
+            , Timestamp(timestamp)
+        {
+        }
+
+        /// Check if a timeout expired
+        inline bool TimeoutExpired(uint64_t now, uint64_t timeout) const
+        {
+            return (uint64_t)(now - Timestamp) > timeout;
+        }
+    };
+
+    static const unsigned kSampleCount = 3;
+
+    Sample Samples[kSampleCount];
+
+
+    bool IsValid() const
+    {
+        return Samples[0].Value != 0.f; ///< ish
+    }
+
+    float GetBest() const
+    {
+        return Samples[0].Value;
+    }
+
+    void Reset(const Sample sample = Sample())
+    {
+        Samples[0] = Samples[1] = Samples[2] = sample;
+    }
+
+    void Update(float value, uint64_t timestamp, uint64_t windowLengthTime);
+};
+
+
+//------------------------------------------------------------------------------
+// RateController
+
+/// Controller state saved by ccat_serialize().  Fixed layout
+struct RateState
+{
+    float Rate;
+    float Credit;
+    float Z;
+    float WindowPackets;
+    float LossSum;
+    float ExpectedSum;
+    float BurstValues[WindowedMax::kSampleCount];
+    uint32_t Reserved;
+    uint64_t BurstTimestamps[WindowedMax::kSampleCount];
+};
+
+class RateController
+{
+public:
+    /// Enable the controller.  0 leaves it disabled
+    void Initialize(float targetLossRate, unsigned windowPackets);
+
+    bool IsEnabled() const
+    {
+        return TargetLossRate > 0.f;
+    }
+
+    /// Update the channel estimate from a receiver loss report
+    CCatResult OnLossReport(const CCatLossReport& report, uint64_t nowMsec);
+
+    /// An original was encoded
+    void OnOriginal()
+    {
+        Credit += Rate;
+        if (Credit > kRateCreditMax) {
+            Credit = kRateCreditMax;
+        }
+    }
+
+    /// A recovery packet was encoded over the given number of originals
+    void OnRecovery(unsigned count)
+    {
+        Credit -= 1.f;
+        if (Credit < -kRateCreditMax) {
+            Credit = -kRateCreditMax;
+        }
+
+        WindowPackets += (count - WindowPackets) * kRateAverageAlpha;
+    }
+
+    /// Number of recovery packets that should be sent now
+    unsigned GetRecoveryDue() const
+    {
+        return Credit >= 1.f ? (unsigned)Credit : 0;
+    }
+
+    /// Recovery packets per original
+    float GetRate() const
+    {
+        return Rate;
+    }
+
+    /// Save the state that changes after Initialize()
+    void GetState(RateState& stateOut) const;
+
+    /// Restore saved state.  Returns CCat_InvalidInput if it is out of range
+    CCatResult SetState(const RateState& state);
+
+private:
+    /// Target effective loss rate after recovery
+    float TargetLossRate = 0.f;
+
+    /// Recovery packets per original
+    float Rate = kRateInitial;
+
+    /// Recovery packets owed
+    float Credit = 0.f;
+
+    /// Margin over the loss rate in standard deviations
+    float Z = kRateZInitial;
+
+    /// Average originals covered by each recovery packet
+    float WindowPackets = 1.f;
+
+    /// Decayed sums of lost and expected originals
+    float LossSum = 0.f;
+    float ExpectedSum = 0.f;
+
+    /// Longest average loss burst length in recent reports
+    WindowedMax BurstMax;
+};
+
+
+} // namespace ccat
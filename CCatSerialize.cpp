@@ -0,0 +1,507 @@
+/** \file
+    \brief CCat Codec State Serialization
+    \copyright Copyright (c) 2018 Christopher A. Taylor.  All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of CCat nor the names of its contributors may be
+      used to endorse or promote products derived from this software without
+      specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+    ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+    SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+    INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+    CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+    POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "CCatSerialize.h"
+
+namespace ccat {
+
+
+//------------------------------------------------------------------------------
+// SerialWriter / SerialReader
+
+void SerialWriter::WriteData(const uint8_t* data, unsigned bytes)
+{
+    memcpy(Data, data, bytes);
+
+    const unsigned padded = SerializedDataBytes(bytes);
+    memset(Data + bytes, 0, padded - bytes);
+    Data += padded;
+}
+
+const uint8_t* SerialReader::ReadData(unsigned bytes)
+{
+    const unsigned padded = SerializedDataBytes(bytes);
+    if (Remaining < padded) {
+        return nullptr;
+    }
+
+    const uint8_t* data = Data;
+    Data += padded;
+    Remaining -= padded;
+    return data;
+}
+
+/// Packet data including the prepended data size must hold 1..kMaxPacketSize bytes
+static PKTALLOC_FORCE_INLINE bool IsValidDataBytes(uint32_t bytes)
+{
+    return bytes > kEncodeOverhead && bytes <= kEncodeOverhead + kMaxPacketSize;
+}
+
+/// Original data must also agree with its prepended data size
+static PKTALLOC_FORCE_INLINE bool IsValidOriginal(const uint8_t* data, uint32_t bytes)
+{
+    return kEncodeOverhead + ReadU16_LE(data) + 1u == bytes;
+}
+
+
+//------------------------------------------------------------------------------
+// Encoder
+
+unsigned Encoder::GetSerializedBytes() const
+{
+    unsigned bytes = sizeof(SerializedEncoder);
+
+    unsigned index = (NextIndex + kMaxEncoderWindowSize - Count) % kMaxEncoderWindowSize;
+    for (unsigned i = 0; i < Count; ++i)
+    {
+        bytes += sizeof(SerializedOriginal) + SerializedDataBytes(Window[index].GetBytes());
+        if (++index >= kMaxEncoderWindowSize) {
+            index = 0;
+        }
+    }
+
+    return bytes;
+}
+
+void Encoder::Serialize(SerialWriter& writer) const
+{
+    SerializedEncoder state;
+    memset(&state, 0, sizeof(state));
+    state.NextSequence = NextSequence.ToUnsigned();
+    state.NextParitySequence = NextParitySequence.ToUnsigned();
+    state.LastOriginalSendUsec = LastOriginalSendUsec.ToUnsigned();
+    state.NextIndex = NextIndex;
+    state.Count = Count;
+    state.NextColumn = NextColumn;
+    state.NextRow = NextRow;
+    Rate.GetState(state.Rate);
+    writer.Write(state);
+
+    // Oldest first, so the ring can be rebuilt at the same indices
+    unsigned index = (NextIndex + kMaxEncoderWindowSize - Count) % kMaxEncoderWindowSize;
+    for (unsigned i = 0; i < Count; ++i)
+    {
+        const EncoderWindowElement& element = Window[index];
+        if (++index >= kMaxEncoderWindowSize) {
+            index = 0;
+        }
+
+        SerializedOriginal original;
+        memset(&original, 0, sizeof(original));
+        original.SendUsec = element.SendUsec.ToUnsigned();
+        original.Bytes = element.GetBytes();
+        original.Priority = element.Priority;
+        writer.Write(original);
+        writer.WriteData(element.GetData(), original.Bytes);
+    }
+}
+
+CCatResult Encoder::Deserialize(SerialReader& reader)
+{
+    SerializedEncoder state;
+    if (!reader.Read(state)) {
+        return CCat_InvalidInput;
+    }
+
+    // The window position and matrix column both follow the sequence number
+    const unsigned expectedIndex = (unsigned)(state.NextSequence % kMaxEncoderWindowSize);
+    if (state.NextIndex != expectedIndex ||
+        state.NextColumn != (uint8_t)(state.NextSequence % kMatrixColumnCount) ||
+        state.Count > kMaxEncoderWindowSize ||
+        state.Count > state.NextSequence ||
+        state.NextRow >= kMatrixRowCount)
+    {
+        return CCat_InvalidInput;
+    }
+
+    if (Rate.IsEnabled())
+    {
+        const CCatResult rateResult = Rate.SetState(state.Rate);
+        if (rateResult != CCat_Success) {
+            return rateResult;
+        }
+    }
+
+    unsigned index = (state.NextIndex + kMaxEncoderWindowSize - state.Count) % kMaxEncoderWindowSize;
+    for (unsigned i = 0; i < state.Count; ++i)
+    {
+        SerializedOriginal original;
+        if (!reader.Read(original) || !IsValidDataBytes(original.Bytes)) {
+            return CCat_InvalidInput;
+        }
+        const uint8_t* data = reader.ReadData(original.Bytes);
+        if (!data || !IsValidOriginal(data, original.Bytes)) {
+            return CCat_InvalidInput;
+        }
+
+        EncoderWindowElement& element = Window[index];
+        if (++index >= kMaxEncoderWindowSize) {
+            index = 0;
+        }
+
+        const bool resizeResult = element.Data.Resize(
+            AllocPtr,
+            kRecoveryHeadroom + original.Bytes,
+            pktalloc::Realloc::Uninitialized);
+        if (!resizeResult) {
+            return CCat_OOM;
+        }
+
+        memcpy(element.GetData(), data, original.Bytes);
+        element.SendUsec = original.SendUsec;
+        element.Priority = original.Priority;
+    }
+
+    NextIndex = state.NextIndex;
+    Count = state.Count;
+    NextSequence = state.NextSequence;
+    NextColumn = state.NextColumn;
+    NextRow = state.NextRow;
+    NextParitySequence = state.NextParitySequence;
+    LastOriginalSendUsec = state.LastOriginalSendUsec;
+
+    return CCat_Success;
+}
+
+
+//------------------------------------------------------------------------------
+// Decoder
+
+unsigned Decoder::GetSerializedBytes() const
+{
+    unsigned bytes = sizeof(SerializedDecoder);
+
+    const unsigned span = (unsigned)(SequenceEnd - SequenceBase).ToUnsigned();
+    for (unsigned element = 0; element < span; ++element)
+    {
+        if (!IsLost(element)) {
+            bytes += sizeof(SerializedPacket) + SerializedDataBytes(PacketBytes[GetSlot(element)]);
+        }
+    }
+
+    for (const RecoveryPacket* packet = RecoveryFirst; packet; packet = packet->Next) {
+        bytes += sizeof(SerializedRecovery) + SerializedDataBytes(packet->Bytes);
+    }
+    for (const RecoveryPacket* packet = SparseFirst; packet; packet = packet->Next) {
+        bytes += sizeof(SerializedRecovery) + SerializedDataBytes(packet->Bytes);
+    }
+
+    return bytes;
+}
+
+static void serializeRecoveryList(SerialWriter& writer, const RecoveryPacket* packet)
+{
+    for (; packet; packet = packet->Next)
+    {
+        SerializedRecovery recovery;
+        memset(&recovery, 0, sizeof(recovery));
+        recovery.SequenceStart = packet->SequenceStart.ToUnsigned();
+        recovery.Count = (uint32_t)(packet->SequenceEnd - packet->SequenceStart).ToUnsigned();
+        recovery.Bytes = packet->Bytes;
+        recovery.MatrixRow = packet->MatrixRow;
+        recovery.IsSparse = packet->IsSparse ? 1 : 0;
+        if (packet->IsSparse) {
+            memcpy(recovery.ColumnMask, packet->ColumnMask, sizeof(recovery.ColumnMask));
+        }
+        writer.Write(recovery);
+        writer.WriteData(packet->Data, packet->Bytes);
+    }
+}
+
+void Decoder::Serialize(SerialWriter& writer) const
+{
+    const unsigned span = (unsigned)(SequenceEnd - SequenceBase).ToUnsigned();
+
+    SerializedDecoder state;
+    memset(&state, 0, sizeof(state));
+    state.SequenceBase = SequenceBase.ToUnsigned();
+    state.SequenceEnd = SequenceEnd.ToUnsigned();
+    state.NextOriginalSequence = NextOriginalSequence.ToUnsigned();
+    state.ReportSequenceEnd = ReportSequenceEnd.ToUnsigned();
+    state.FailureSequence = FailureSequence.ToUnsigned();
+    state.LargeRecoverySuccesses = LargeRecoverySuccesses;
+    state.LargeRecoveryFailures = LargeRecoveryFailures;
+    // Lost is a ring, so write it unrotated with bit 0 for SequenceBase
+    static_assert(sizeof(state.Lost) == sizeof(Lost.Words), "Update this");
+    for (unsigned element = 0; element < kDecoderWindowSize; ++element) {
+        if (IsLost(element)) {
+            state.Lost[element / 64] |= (uint64_t)1 << (element % 64);
+        }
+    }
+    state.ReportReceived = ReportReceived;
+    state.ReportRecovered = ReportRecovered;
+    state.ReportUnrecovered = ReportUnrecovered;
+    memcpy(state.ReportBursts, ReportBursts, sizeof(state.ReportBursts));
+    state.PacketCount = span - CountLost(0, span);
+    for (const RecoveryPacket* packet = RecoveryFirst; packet; packet = packet->Next) {
+        ++state.RecoveryCount;
+    }
+    for (const RecoveryPacket* packet = SparseFirst; packet; packet = packet->Next) {
+        ++state.SparseCount;
+    }
+    writer.Write(state);
+
+    // Borrowed packets are copied here, and come back owned by the decoder
+    for (unsigned element = 0; element < span; ++element)
+    {
+        if (IsLost(element)) {
+            continue;
+        }
+        const unsigned slot = GetSlot(element);
+
+        SerializedPacket packet;
+        packet.Element = element;
+        packet.Bytes = PacketBytes[slot];
+        writer.Write(packet);
+        writer.WriteData(PacketData[slot], packet.Bytes);
+    }
+
+    serializeRecoveryList(writer, RecoveryFirst);
+    serializeRecoveryList(writer, SparseFirst);
+}
+
+CCatResult Decoder::Deserialize(SerialReader& reader)
+{
+    SerializedDecoder state;
+    if (!reader.Read(state)) {
+        return CCat_InvalidInput;
+    }
+
+    const Counter64 sequenceBase = state.SequenceBase;
+    const uint64_t span = (Counter64(state.SequenceEnd) - sequenceBase).ToUnsigned();
+    if (span > kDecoderWindowSize) {
+        return CCat_InvalidInput;
+    }
+
+    SequenceBase = sequenceBase;
+    SequenceEnd = state.SequenceEnd;
+    // With no rotation the saved bitmap is also the ring
+    PacketsRotation = 0;
+    memcpy(Lost.Words, state.Lost, sizeof(state.Lost));
+
+    // Every element past the end of the window must be lost, and every
+    // element inside it that is not lost must have data
+    if (CountLost((unsigned)span, kDecoderWindowSize) != kDecoderWindowSize - span ||
+        state.PacketCount != span - CountLost(0, (unsigned)span))
+    {
+        return CCat_InvalidInput;
+    }
+
+    for (unsigned i = 0; i < state.PacketCount; ++i)
+    {
+        SerializedPacket packet;
+        if (!reader.Read(packet) ||
+            packet.Element >= span ||
+            IsLost(packet.Element) ||
+            PacketData[packet.Element] != nullptr ||
+            !IsValidDataBytes(packet.Bytes))
+        {
+            return CCat_InvalidInput;
+        }
+        const uint8_t* data = reader.ReadData(packet.Bytes);
+        if (!data || !IsValidOriginal(data, packet.Bytes)) {
+            return CCat_InvalidInput;
+        }
+
+        uint8_t* copy = AllocPtr->Allocate(packet.Bytes);
+        if (!copy) {
+            return CCat_OOM;
+        }
+        memcpy(copy, data, packet.Bytes);
+
+        // Slot equals element since PacketsRotation = 0
+        PacketData[packet.Element] = copy;
+        PacketBytes[packet.Element] = packet.Bytes;
+    }
+
+    const uint32_t recoveryTotal = state.RecoveryCount + state.SparseCount;
+    if (recoveryTotal < state.RecoveryCount) {
+        return CCat_InvalidInput;
+    }
+
+    for (uint32_t i = 0; i < recoveryTotal; ++i)
+    {
+        const bool isSparse = (i >= state.RecoveryCount);
+
+        SerializedRecovery recovery;
+        if (!reader.Read(recovery) ||
+            recovery.IsSparse != (isSparse ? 1 : 0) ||
+            recovery.Count <= 0 ||
+            recovery.Count > kMaxEncoderWindowSize ||
+            recovery.MatrixRow >= kMatrixRowCount ||
+            !IsValidDataBytes(recovery.Bytes))
+        {
+            return CCat_InvalidInput;
+        }
+
+        const Counter64 sequenceStart = recovery.SequenceStart;
+        const Counter64 sequenceEnd = sequenceStart + recovery.Count;
+        const uint64_t startElement = (sequenceStart - SequenceBase).ToUnsigned();
+        if (startElement >= span ||
+            startElement + recovery.Count > span)
+        {
+            return CCat_InvalidInput;
+        }
+
+        // Each list must stay sorted as StoreRecovery() keeps it.
+        // Sparse packets may nest, so only ties on SequenceEnd order starts
+        RecoveryPacket*& listFirst = isSparse ? SparseFirst : RecoveryFirst;
+        RecoveryPacket*& listLast = isSparse ? SparseLast : RecoveryLast;
+        if (listLast && (
+            listLast->SequenceEnd > sequenceEnd ||
+            (listLast->SequenceStart > sequenceStart &&
+                (!isSparse || listLast->SequenceEnd == sequenceEnd))))
+        {
+            return CCat_InvalidInput;
+        }
+
+        const uint8_t* data = reader.ReadData(recovery.Bytes);
+        if (!data) {
+            return CCat_InvalidInput;
+        }
+
+        uint8_t* copy = AllocPtr->Allocate(recovery.Bytes);
+        if (!copy) {
+            return CCat_OOM;
+        }
+        RecoveryPacket* packet = RecoveryPool.Construct(AllocPtr);
+        if (!packet) {
+            AllocPtr->Free(copy);
+            return CCat_OOM;
+        }
+
+        memcpy(copy, data, recovery.Bytes);
+        packet->Data = copy;
+        packet->Bytes = recovery.Bytes;
+        packet->Capacity = recovery.Bytes;
+        packet->SequenceStart = sequenceStart;
+        packet->SequenceEnd = sequenceEnd;
+        packet->MatrixRow = recovery.MatrixRow;
+        packet->IsSparse = isSparse;
+        if (isSparse) {
+            memcpy(packet->ColumnMask, recovery.ColumnMask, sizeof(packet->ColumnMask));
+        }
+
+        // Append to the end of the list
+        packet->Prev = listLast;
+        packet->Next = nullptr;
+        if (listLast) {
+            listLast->Next = packet;
+        }
+        else {
+            listFirst = packet;
+        }
+        listLast = packet;
+    }
+
+    NextOriginalSequence = state.NextOriginalSequence;
+    ReportSequenceEnd = state.ReportSequenceEnd;
+    FailureSequence = state.FailureSequence;
+    LargeRecoverySuccesses = state.LargeRecoverySuccesses;
+    LargeRecoveryFailures = state.LargeRecoveryFailures;
+    ReportReceived = state.ReportReceived;
+    ReportRecovered = state.ReportRecovered;
+    ReportUnrecovered = state.ReportUnrecovered;
+    memcpy(ReportBursts, state.ReportBursts, sizeof(ReportBursts));
+
+    UpdateRecoveryMaxBytes();
+
+    return CCat_Success;
+}
+
+
+//------------------------------------------------------------------------------
+// Codec
+
+CCatResult Codec::Serialize(uint8_t* buffer, unsigned bufferBytes, unsigned& bytesOut) const
+{
+    const unsigned bytes = sizeof(SerializedHeader) +
+        Encoder::GetSerializedBytes() +
+        Decoder::GetSerializedBytes();
+    bytesOut = bytes;
+
+    if (!buffer) {
+        return CCat_Success;
+    }
+    if (bufferBytes < bytes) {
+        return CCat_InvalidInput;
+    }
+
+    SerializedHeader header;
+    memset(&header, 0, sizeof(header));
+    header.Magic = kSerializeMagic;
+    header.Version = kSerializeVersion;
+    header.HeaderBytes = (uint16_t)sizeof(SerializedHeader);
+    header.TotalBytes = bytes;
+
+    SerialWriter writer(buffer);
+    writer.Write(header);
+    Encoder::Serialize(writer);
+    Decoder::Serialize(writer);
+    PKTALLOC_DEBUG_ASSERT(writer.GetPtr() == buffer + bytes);
+
+    return CCat_Success;
+}
+
+CCatResult Codec::Deserialize(const uint8_t* data, unsigned bytes)
+{
+    Clear();
+
+    SerialReader reader(data, bytes);
+
+    SerializedHeader header;
+    if (!reader.Read(header) ||
+        header.Magic != kSerializeMagic ||
+        header.Version != kSerializeVersion ||
+        header.HeaderBytes != sizeof(SerializedHeader) ||
+        header.TotalBytes != bytes)
+    {
+        return CCat_InvalidInput;
+    }
+
+    CCatResult result = Encoder::Deserialize(reader);
+    if (result == CCat_Success) {
+        result = Decoder::Deserialize(reader);
+    }
+    if (result == CCat_Success && reader.GetRemaining() != 0) {
+        result = CCat_InvalidInput;
+    }
+
+    if (result != CCat_Success)
+    {
+        // Drop partly restored state.  The rate controller is restarted too
+        Clear();
+        Encoder::InitializeRate();
+    }
+
+    return result;
+}
+
+
+} // namespace ccat
@@ -0,0 +1,240 @@
+/** \file
+    \brief CCat Codec State Serialization
+    \copyright Copyright (c) 2018 Christopher A. Taylor.  All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of CCat nor the names of its contributors may be
+      used to endorse or promote products derived from this software without
+      specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+    ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+    SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+    INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+    CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+    POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+/** \page Serialize CCat Codec State Serialization
+
+    ccat_serialize() saves the state of a codec so an idle stream can be
+    destroyed, and ccat_deserialize() restores it into another codec later.
+
+    The format is a SerializedHeader followed by the encoder and decoder
+    sections.  Every record is a fixed-size struct followed by its packet
+    data, and each is padded to kSerializeAlign bytes, so restoring is a
+    bounds check and a memcpy() per record:
+
+    + SerializedEncoder, then Count x { SerializedOriginal, data } for the
+      originals in the encoder window, oldest first.
+    + SerializedDecoder, then PacketCount x { SerializedPacket, data } for
+      each received or recovered original in the decoder window, then
+      RecoveryCount x { SerializedRecovery, data } for the stored recovery
+      packets.  Dense packets come before sparse ones, each list in order.
+
+    Fields are written in native byte order and the blob is only meant to be
+    read back by the same build of the library on the same machine type.
+    Any change to the layout must bump kSerializeVersion.
+
+    Settings and callbacks are not saved.  They come from the codec the
+    state is restored into.
+*/
+
+#include "CCatCodec.h"
+
+namespace ccat {
+
+
+//------------------------------------------------------------------------------
+// Constants
+
+/// "CCAT" read as a little-endian 32-bit word
+static const uint32_t kSerializeMagic = 0x54414343;
+
+/// Bump when the layout below changes
+static const uint16_t kSerializeVersion = 1;
+
+/// Alignment of each record within the blob
+static const unsigned kSerializeAlign = 8;
+
+
+//------------------------------------------------------------------------------
+// Records
+
+struct SerializedHeader
+{
+    uint32_t Magic;
+    uint16_t Version;
+
+    /// sizeof(SerializedHeader), to catch a mismatched layout
+    uint16_t HeaderBytes;
+
+    /// Bytes in the whole blob
+    uint32_t TotalBytes;
+    uint32_t Reserved;
+};
+
+struct SerializedEncoder
+{
+    uint64_t NextSequence;
+    uint64_t NextParitySequence;
+    uint64_t LastOriginalSendUsec;
+    uint32_t NextIndex;
+    uint32_t Count;
+    uint8_t NextColumn;
+    uint8_t NextRow;
+    uint8_t Reserved[6];
+    RateState Rate;
+};
+
+struct SerializedOriginal
+{
+    uint64_t SendUsec;
+
+    /// Bytes of data including the prepended data size
+    uint32_t Bytes;
+    uint8_t Priority;
+    uint8_t Reserved[3];
+};
+
+struct SerializedDecoder
+{
+    uint64_t SequenceBase;
+    uint64_t SequenceEnd;
+    uint64_t NextOriginalSequence;
+    uint64_t ReportSequenceEnd;
+    uint64_t FailureSequence;
+    uint64_t LargeRecoverySuccesses;
+    uint64_t LargeRecoveryFailures;
+
+    /// Loss bitmap, with bit 0 for SequenceBase
+    uint64_t Lost[pktalloc::CustomBitSet<kDecoderWindowSize>::kWords];
+
+    uint32_t ReportReceived;
+    uint32_t ReportRecovered;
+    uint32_t ReportUnrecovered;
+    uint32_t ReportBursts[CCAT_LOSS_BURST_BINS];
+
+    uint32_t PacketCount;
+    uint32_t RecoveryCount;
+    uint32_t SparseCount;
+};
+
+struct SerializedPacket
+{
+    /// Offset from SequenceBase
+    uint32_t Element;
+
+    /// Bytes of data including the prepended data size
+    uint32_t Bytes;
+};
+
+struct SerializedRecovery
+{
+    uint64_t SequenceStart;
+    uint32_t Count;
+    uint32_t Bytes;
+    uint8_t MatrixRow;
+    uint8_t IsSparse;
+    uint8_t Reserved[6];
+    uint64_t ColumnMask[kColumnMaskWords];
+};
+
+static_assert(sizeof(SerializedHeader) % kSerializeAlign == 0, "Unaligned record");
+static_assert(sizeof(SerializedEncoder) % kSerializeAlign == 0, "Unaligned record");
+static_assert(sizeof(SerializedOriginal) % kSerializeAlign == 0, "Unaligned record");
+static_assert(sizeof(SerializedDecoder) % kSerializeAlign == 0, "Unaligned record");
+static_assert(sizeof(SerializedPacket) % kSerializeAlign == 0, "Unaligned record");
+static_assert(sizeof(SerializedRecovery) % kSerializeAlign == 0, "Unaligned record");
+
+
+//------------------------------------------------------------------------------
+// SerialWriter
+
+/// Writes records into a buffer already checked to be large enough
+class SerialWriter
+{
+public:
+    explicit SerialWriter(uint8_t* data)
+        : Data(data)
+    {
+    }
+
+    template<class T> void Write(const T& record)
+    {
+        memcpy(Data, &record, sizeof(T));
+        Data += sizeof(T);
+    }
+
+    /// Write packet data padded to kSerializeAlign
+    void WriteData(const uint8_t* data, unsigned bytes);
+
+    uint8_t* GetPtr() const
+    {
+        return Data;
+    }
+
+private:
+    uint8_t* Data;
+};
+
+/// Bytes taken by packet data after padding
+PKTALLOC_FORCE_INLINE unsigned SerializedDataBytes(unsigned bytes)
+{
+    return (bytes + kSerializeAlign - 1) & ~(kSerializeAlign - 1);
+}
+
+
+//------------------------------------------------------------------------------
+// SerialReader
+
+/// Reads records with bounds checks.  Each read fails once the data runs out
+class SerialReader
+{
+public:
+    SerialReader(const uint8_t* data, unsigned bytes)
+        : Data(data)
+        , Remaining(bytes)
+    {
+    }
+
+    template<class T> bool Read(T& recordOut)
+    {
+        if (Remaining < sizeof(T)) {
+            return false;
+        }
+        memcpy(&recordOut, Data, sizeof(T));
+        Data += sizeof(T);
+        Remaining -= (unsigned)sizeof(T);
+        return true;
+    }
+
+    /// Returns packet data, or nullptr if it runs past the end
+    const uint8_t* ReadData(unsigned bytes);
+
+    unsigned GetRemaining() const
+    {
+        return Remaining;
+    }
+
+private:
+    const uint8_t* Data;
+    unsigned Remaining;
+};
+
+
+} // namespace ccat
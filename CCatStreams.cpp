@@ -0,0 +1,758 @@
+/** \file
+    \brief CCat Stream Manager
+    \copyright Copyright (c) 2018 Christopher A. Taylor.  All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of CCat nor the names of its contributors may be
+      used to endorse or promote products derived from this software without
+      specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+    ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+    SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+    INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+    CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+    POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "CCatStreams.h"
+#include "CCatCodec.h" // GetTimeUsec
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <new> // std::nothrow
+#include <string.h>
+
+#if defined(_WIN32)
+    #ifndef WIN32_LEAN_AND_MEAN
+        #define WIN32_LEAN_AND_MEAN
+    #endif
+    #include <windows.h>
+#elif defined(__linux__)
+    #include <pthread.h>
+    #include <sched.h>
+#endif
+
+namespace ccat {
+
+
+//------------------------------------------------------------------------------
+// Tools
+
+/// Mix the bits of a stream id (MurmurHash3 finalizer)
+static PKTALLOC_FORCE_INLINE uint64_t HashStreamId(uint64_t key)
+{
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    key *= 0xc4ceb9fe1a85ec53ULL;
+    key ^= key >> 33;
+    return key;
+}
+
+static void PinCurrentThread(unsigned core)
+{
+#if defined(_WIN32)
+    SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << (core % 64));
+#elif defined(__linux__)
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(core % CPU_SETSIZE, &cpus);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+#else
+    (void)core;
+#endif
+}
+
+
+//------------------------------------------------------------------------------
+// TimingWheel
+
+void TimingWheel::Reset(uint64_t tick)
+{
+    CurrentTick = tick;
+}
+
+void TimingWheel::link(WheelTimer** head, WheelTimer* timer)
+{
+    timer->Next = *head;
+    if (timer->Next) {
+        timer->Next->PrevNext = &timer->Next;
+    }
+    timer->PrevNext = head;
+    *head = timer;
+}
+
+void TimingWheel::Cancel(WheelTimer* timer)
+{
+    if (!timer->PrevNext) {
+        return;
+    }
+
+    *timer->PrevNext = timer->Next;
+    if (timer->Next) {
+        timer->Next->PrevNext = timer->PrevNext;
+    }
+    timer->Next = nullptr;
+    timer->PrevNext = nullptr;
+}
+
+void TimingWheel::Schedule(WheelTimer* timer, uint64_t expiryTick)
+{
+    Cancel(timer);
+
+    // Expire no sooner than the next tick and no later than the wheel allows
+    if (expiryTick <= CurrentTick) {
+        expiryTick = CurrentTick + 1;
+    }
+    if (expiryTick - CurrentTick > kWheelMaxTicks) {
+        expiryTick = CurrentTick + kWheelMaxTicks;
+    }
+    timer->ExpiryTick = expiryTick;
+
+    if (expiryTick - CurrentTick < kWheelSlots) {
+        link(&Level0[expiryTick % kWheelSlots], timer);
+    }
+    else {
+        link(&Level1[(expiryTick / kWheelSlots) % kWheelSlots], timer);
+    }
+}
+
+void TimingWheel::cascade()
+{
+    WheelTimer*& slot = Level1[(CurrentTick / kWheelSlots) % kWheelSlots];
+    WheelTimer* timer = slot;
+    slot = nullptr;
+
+    // Everything in this slot now expires within kWheelSlots ticks
+    while (timer)
+    {
+        WheelTimer* next = timer->Next;
+        timer->Next = nullptr;
+        timer->PrevNext = nullptr;
+
+        link(&Level0[timer->ExpiryTick % kWheelSlots], timer);
+
+        timer = next;
+    }
+}
+
+
+//------------------------------------------------------------------------------
+// StreamTable
+
+static const unsigned kStreamTableMinSize = 64;
+
+StreamTable::StreamTable()
+{
+    Slots.resize(kStreamTableMinSize);
+    for (Slot& slot : Slots) {
+        slot.Value = nullptr;
+    }
+    Mask = kStreamTableMinSize - 1;
+}
+
+Stream* StreamTable::Find(uint64_t streamId) const
+{
+    unsigned index = (unsigned)HashStreamId(streamId) & Mask;
+
+    for (;;)
+    {
+        const Slot& slot = Slots[index];
+        if (!slot.Value) {
+            return nullptr;
+        }
+        if (slot.Key == streamId) {
+            return slot.Value;
+        }
+        index = (index + 1) & Mask;
+    }
+}
+
+bool StreamTable::Insert(uint64_t streamId, Stream* stream)
+{
+    // Keep load factor under 1/2 so probe sequences stay short
+    if ((Count + 1) * 2 > Mask + 1) {
+        grow();
+    }
+
+    unsigned index = (unsigned)HashStreamId(streamId) & Mask;
+
+    for (;;)
+    {
+        Slot& slot = Slots[index];
+        if (!slot.Value)
+        {
+            slot.Key = streamId;
+            slot.Value = stream;
+            ++Count;
+            return true;
+        }
+        if (slot.Key == streamId) {
+            return false;
+        }
+        index = (index + 1) & Mask;
+    }
+}
+
+Stream* StreamTable::Remove(uint64_t streamId)
+{
+    unsigned index = (unsigned)HashStreamId(streamId) & Mask;
+
+    for (;;)
+    {
+        Slot& slot = Slots[index];
+        if (!slot.Value) {
+            return nullptr;
+        }
+        if (slot.Key == streamId) {
+            break;
+        }
+        index = (index + 1) & Mask;
+    }
+
+    Stream* removed = Slots[index].Value;
+    Slots[index].Value = nullptr;
+    --Count;
+
+    // Backward-shift deletion: Move later entries in the probe run into the
+    // hole if that brings them closer to their home slot
+    unsigned hole = index;
+    for (unsigned next = (hole + 1) & Mask; Slots[next].Value; next = (next + 1) & Mask)
+    {
+        const unsigned home = (unsigned)HashStreamId(Slots[next].Key) & Mask;
+
+        // If home is cyclically outside (hole, next] then it can move
+        if (((next - home) & Mask) >= ((next - hole) & Mask))
+        {
+            Slots[hole] = Slots[next];
+            Slots[next].Value = nullptr;
+            hole = next;
+        }
+    }
+
+    return removed;
+}
+
+void StreamTable::grow()
+{
+    std::vector<Slot> old;
+    old.swap(Slots);
+
+    const unsigned size = (Mask + 1) * 2;
+    Slots.resize(size);
+    for (Slot& slot : Slots) {
+        slot.Value = nullptr;
+    }
+    Mask = size - 1;
+    Count = 0;
+
+    for (const Slot& slot : old) {
+        if (slot.Value) {
+            Insert(slot.Key, slot.Value);
+        }
+    }
+}
+
+
+//------------------------------------------------------------------------------
+// Stream
+
+struct Stream : WheelTimer
+{
+    uint64_t Id = 0;
+    CCatCodec Codec = nullptr;
+    StreamShard* Shard = nullptr;
+
+    WireWriter Writer;
+    WireReader Reader;
+
+    /// Next original sequence number
+    uint64_t NextSequence = 0;
+
+    /// Originals sent since the last recovery packet
+    unsigned OriginalsSinceRecovery = 0;
+};
+
+
+//------------------------------------------------------------------------------
+// StreamShard
+
+class StreamShard
+{
+public:
+    std::atomic<uint64_t> StreamCount;
+    std::atomic<uint64_t> DatagramsSent;
+
+    StreamShard(const StreamManagerSettings& settings, unsigned index)
+        : StreamCount(0)
+        , DatagramsSent(0)
+        , Settings(settings)
+        , Index(index)
+        , Terminate(false)
+    {
+        RecoveryIntervalTicks = Settings.RecoveryIntervalUsec / Settings.TickUsec;
+        if (RecoveryIntervalTicks <= 0) {
+            RecoveryIntervalTicks = 1;
+        }
+    }
+
+    ~StreamShard()
+    {
+        Stop();
+        Table.ForEach([](Stream* stream) {
+            destroyStream(stream);
+        });
+    }
+
+    void Start()
+    {
+        Thread = std::thread([this]() { run(); });
+    }
+
+    void Stop()
+    {
+        Terminate = true;
+        if (Thread.joinable()) {
+            Thread.join();
+        }
+    }
+
+    CCatResult Enqueue(
+        uint8_t type,
+        uint64_t streamId,
+        const uint8_t* data = nullptr,
+        unsigned bytes = 0);
+
+    void Tick(uint64_t nowUsec);
+
+private:
+    const StreamManagerSettings& Settings;
+    const unsigned Index;
+    unsigned RecoveryIntervalTicks = 1;
+
+    std::thread Thread;
+    std::atomic<bool> Terminate;
+
+    /// Commands queued by the application
+    struct Command
+    {
+        uint8_t Type;
+        uint64_t StreamId;
+        unsigned Offset;
+        unsigned Bytes;
+    };
+
+    std::mutex QueueLock;
+    std::vector<Command> Queue;
+    std::vector<uint8_t> QueueData;
+
+    /// Owned by the shard: Swapped with the queue at the start of each tick
+    std::vector<Command> Commands;
+    std::vector<uint8_t> CommandData;
+
+    StreamTable Table;
+    TimingWheel Wheel;
+    bool WheelStarted = false;
+
+    /// Datagrams produced this tick
+    std::vector<StreamDatagram> Batch;
+
+    void run();
+
+    void createStream(uint64_t streamId);
+    static void destroyStream(Stream* stream);
+    void sendOriginal(Stream* stream, uint8_t* payload, unsigned bytes);
+    void receive(Stream* stream, const uint8_t* datagram, unsigned bytes);
+    void emitRecovery(Stream* stream);
+};
+
+enum CommandType
+{
+    Command_Create,
+    Command_Destroy,
+    Command_Send,
+    Command_Receive
+};
+
+CCatResult StreamShard::Enqueue(
+    uint8_t type,
+    uint64_t streamId,
+    const uint8_t* data,
+    unsigned bytes)
+{
+    std::lock_guard<std::mutex> locker(QueueLock);
+
+    Command command;
+    command.Type = type;
+    command.StreamId = streamId;
+    command.Offset = 0;
+    command.Bytes = bytes;
+
+    if (data)
+    {
+        // Leave room in front of the payload for the wire header
+        const size_t offset = QueueData.size() + kWireOriginalHeaderMax;
+        if (offset + bytes > 0xffffffff) {
+            return CCat_OOM;
+        }
+        QueueData.resize(offset + bytes);
+        memcpy(QueueData.data() + offset, data, bytes);
+        command.Offset = (unsigned)offset;
+    }
+
+    Queue.push_back(command);
+    return CCat_Success;
+}
+
+void StreamShard::run()
+{
+    if (Settings.PinWorkers) {
+        PinCurrentThread(Index);
+    }
+
+    const uint64_t tickUsec = Settings.TickUsec;
+
+    while (!Terminate)
+    {
+        const uint64_t nowUsec = GetTimeUsec();
+        Tick(nowUsec);
+
+        // Sleep until the next tick boundary
+        const uint64_t nextUsec = (nowUsec / tickUsec + 1) * tickUsec;
+        const uint64_t afterUsec = GetTimeUsec();
+        if (afterUsec < nextUsec) {
+            std::this_thread::sleep_for(std::chrono::microseconds(nextUsec - afterUsec));
+        }
+    }
+}
+
+void StreamShard::Tick(uint64_t nowUsec)
+{
+    const uint64_t tick = nowUsec / Settings.TickUsec;
+    if (!WheelStarted)
+    {
+        Wheel.Reset(tick);
+        WheelStarted = true;
+    }
+
+    // Take all queued commands
+    {
+        std::lock_guard<std::mutex> locker(QueueLock);
+        Commands.swap(Queue);
+        CommandData.swap(QueueData);
+    }
+
+    for (const Command& command : Commands)
+    {
+        if (command.Type == Command_Create) {
+            createStream(command.StreamId);
+            continue;
+        }
+
+        Stream* stream = Table.Find(command.StreamId);
+        if (!stream) {
+            continue;
+        }
+
+        switch (command.Type)
+        {
+        case Command_Destroy:
+            Table.Remove(command.StreamId);
+            destroyStream(stream);
+            StreamCount.store(Table.GetCount(), std::memory_order_relaxed);
+            break;
+        case Command_Send:
+            sendOriginal(stream, CommandData.data() + command.Offset, command.Bytes);
+            break;
+        case Command_Receive:
+            receive(stream, CommandData.data() + command.Offset, command.Bytes);
+            break;
+        default:
+            break;
+        }
+    }
+
+    // Emit recovery for streams whose timers expired
+    Wheel.Advance(tick, [this](WheelTimer* timer) {
+        emitRecovery(static_cast<Stream*>(timer));
+    });
+
+    if (!Batch.empty())
+    {
+        if (Settings.OnTickBatch) {
+            Settings.OnTickBatch(Index, Batch.data(), (unsigned)Batch.size(), Settings.AppContextPtr);
+        }
+        DatagramsSent.fetch_add(Batch.size(), std::memory_order_relaxed);
+        Batch.clear();
+    }
+
+    // Keep capacity for the next tick
+    Commands.clear();
+    CommandData.clear();
+}
+
+void StreamShard::createStream(uint64_t streamId)
+{
+    if (Table.Find(streamId)) {
+        return;
+    }
+
+    Stream* stream = new (std::nothrow) Stream;
+    if (!stream) {
+        return;
+    }
+    stream->Id = streamId;
+    stream->Shard = this;
+
+    CCatSettings settings = Settings.CodecSettings;
+    settings.AppContextPtr = stream;
+    settings.OnReleaseOriginal = nullptr;
+    settings.OnRecoveredData = [](CCatOriginal original, CCatAppContext context)
+    {
+        Stream* thiz = (Stream*)context;
+        const StreamManagerSettings& managerSettings = thiz->Shard->Settings;
+        if (managerSettings.OnRecoveredData) {
+            managerSettings.OnRecoveredData(thiz->Id, original, managerSettings.AppContextPtr);
+        }
+    };
+
+    if (ccat_create(&settings, &stream->Codec) != CCat_Success)
+    {
+        delete stream;
+        return;
+    }
+
+    Table.Insert(streamId, stream);
+    StreamCount.store(Table.GetCount(), std::memory_order_relaxed);
+}
+
+void StreamShard::destroyStream(Stream* stream)
+{
+    TimingWheel::Cancel(stream);
+    ccat_destroy(stream->Codec);
+    delete stream;
+}
+
+void StreamShard::sendOriginal(Stream* stream, uint8_t* payload, unsigned bytes)
+{
+    CCatOriginal original;
+    original.Data = payload;
+    original.Bytes = bytes;
+    original.SequenceNumber = stream->NextSequence;
+
+    if (ccat_encode_original(stream->Codec, &original) != CCat_Success) {
+        return;
+    }
+
+    // Header is written into the headroom left by Enqueue()
+    unsigned datagramBytes = 0;
+    const uint8_t* datagram = stream->Writer.WriteOriginal(
+        payload, bytes, stream->NextSequence, datagramBytes);
+    ++stream->NextSequence;
+
+    if (datagram)
+    {
+        StreamDatagram out;
+        out.StreamId = stream->Id;
+        out.Data = datagram;
+        out.Bytes = datagramBytes;
+        out.IsRecovery = false;
+        Batch.push_back(out);
+    }
+
+    // Start the recovery timer when a stream becomes active
+    ++stream->OriginalsSinceRecovery;
+    if (!stream->IsScheduled()) {
+        Wheel.Schedule(stream, Wheel.GetCurrentTick() + RecoveryIntervalTicks);
+    }
+}
+
+void StreamShard::receive(Stream* stream, const uint8_t* datagram, unsigned bytes)
+{
+    CCatOriginal original;
+    CCatRecovery recovery;
+
+    switch (stream->Reader.Parse(datagram, bytes, original, recovery))
+    {
+    case WireType::Original:
+        ccat_decode_original(stream->Codec, &original);
+        break;
+    case WireType::Recovery:
+        if (recovery.ColumnMask) {
+            ccat_decode_recovery_sparse(stream->Codec, &recovery, recovery.ColumnMask);
+        }
+        else {
+            ccat_decode_recovery(stream->Codec, &recovery);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+void StreamShard::emitRecovery(Stream* stream)
+{
+    // Idle streams leave the wheel until they send again
+    if (stream->OriginalsSinceRecovery <= 0) {
+        return;
+    }
+    stream->OriginalsSinceRecovery = 0;
+
+    CCatRecovery recovery;
+    if (ccat_encode_recovery(stream->Codec, &recovery) == CCat_Success)
+    {
+        // Recovery data stays valid until the next ccat_encode_recovery(),
+        // which cannot happen for this stream before the batch is delivered
+        unsigned datagramBytes = 0;
+        const uint8_t* datagram = stream->Writer.WriteRecovery(recovery, datagramBytes);
+        if (datagram)
+        {
+            StreamDatagram out;
+            out.StreamId = stream->Id;
+            out.Data = datagram;
+            out.Bytes = datagramBytes;
+            out.IsRecovery = true;
+            Batch.push_back(out);
+        }
+    }
+
+    Wheel.Schedule(stream, Wheel.GetCurrentTick() + RecoveryIntervalTicks);
+}
+
+
+//------------------------------------------------------------------------------
+// StreamManager
+
+StreamManager::~StreamManager()
+{
+    Shutdown();
+}
+
+CCatResult StreamManager::Initialize(const StreamManagerSettings& settings)
+{
+    Shutdown();
+
+    if (settings.TickUsec <= 0) {
+        return CCat_InvalidInput;
+    }
+
+    Settings = settings;
+
+    const unsigned shardCount = Settings.WorkerCount > 0 ? Settings.WorkerCount : 1;
+    for (unsigned i = 0; i < shardCount; ++i)
+    {
+        StreamShard* shard = new (std::nothrow) StreamShard(Settings, i);
+        if (!shard)
+        {
+            Shutdown();
+            return CCat_OOM;
+        }
+        Shards.push_back(shard);
+    }
+
+    if (Settings.WorkerCount > 0) {
+        for (StreamShard* shard : Shards) {
+            shard->Start();
+        }
+    }
+
+    return CCat_Success;
+}
+
+void StreamManager::Shutdown()
+{
+    for (StreamShard* shard : Shards) {
+        shard->Stop();
+    }
+    for (StreamShard* shard : Shards) {
+        delete shard;
+    }
+    Shards.clear();
+}
+
+unsigned StreamManager::GetShardForStream(uint64_t streamId) const
+{
+    // Use the high bits so the table index (low bits) is independent
+    return (unsigned)((HashStreamId(streamId) >> 32) % Shards.size());
+}
+
+CCatResult StreamManager::CreateStream(uint64_t streamId)
+{
+    if (Shards.empty()) {
+        return CCat_Error;
+    }
+    return Shards[GetShardForStream(streamId)]->Enqueue(Command_Create, streamId);
+}
+
+CCatResult StreamManager::DestroyStream(uint64_t streamId)
+{
+    if (Shards.empty()) {
+        return CCat_Error;
+    }
+    return Shards[GetShardForStream(streamId)]->Enqueue(Command_Destroy, streamId);
+}
+
+CCatResult StreamManager::Send(uint64_t streamId, const uint8_t* data, unsigned bytes)
+{
+    if (!data || bytes <= 0 || bytes > CCAT_MAX_BYTES) {
+        return CCat_InvalidInput;
+    }
+    if (Shards.empty()) {
+        return CCat_Error;
+    }
+    return Shards[GetShardForStream(streamId)]->Enqueue(Command_Send, streamId, data, bytes);
+}
+
+CCatResult StreamManager::Receive(uint64_t streamId, const uint8_t* datagram, unsigned bytes)
+{
+    if (!datagram || bytes <= 0 || bytes > CCAT_MAX_BYTES + kWireRecoveryHeaderMax) {
+        return CCat_InvalidInput;
+    }
+    if (Shards.empty()) {
+        return CCat_Error;
+    }
+    return Shards[GetShardForStream(streamId)]->Enqueue(Command_Receive, streamId, datagram, bytes);
+}
+
+void StreamManager::Tick(unsigned shard, uint64_t nowUsec)
+{
+    if (shard < Shards.size()) {
+        Shards[shard]->Tick(nowUsec);
+    }
+}
+
+uint64_t StreamManager::GetStreamCount() const
+{
+    uint64_t count = 0;
+    for (const StreamShard* shard : Shards) {
+        count += shard->StreamCount.load(std::memory_order_relaxed);
+    }
+    return count;
+}
+
+uint64_t StreamManager::GetDatagramsSent() const
+{
+    uint64_t count = 0;
+    for (const StreamShard* shard : Shards) {
+        count += shard->DatagramsSent.load(std::memory_order_relaxed);
+    }
+    return count;
+}
+
+
+} // namespace ccat
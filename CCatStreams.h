@@ -0,0 +1,323 @@
+/** \file
+    \brief CCat Stream Manager
+    \copyright Copyright (c) 2018 Christopher A. Taylor.  All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of CCat nor the names of its contributors may be
+      used to endorse or promote products derived from this software without
+      specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+    ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+    SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+    INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+    CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+    POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+/** \page Streams CCat Stream Manager Module
+
+    Runs many CCat codecs, one per stream, on a fixed set of worker shards.
+
+    + Streams are assigned to a shard by hashing the stream id, and a shard
+      only ever touches its own streams, so codecs need no locking.  Each
+      worker thread can be pinned to its own core.
+    + Each shard finds streams by id in an open-addressing table with linear
+      probing, which keeps lookups to one or two cache lines.
+    + Recovery emission is driven by a two-level hierarchical timing wheel, so
+      scheduling and expiring a timer is O(1) regardless of the stream count.
+      A stream only emits recovery if it sent originals since the last one.
+    + Application calls are queued to the owning shard and applied at the next
+      tick.  All datagrams produced during a tick are handed to the
+      application in one OnTickBatch() call, ready for sendmmsg().
+
+    Datagrams use the CCatWire.h format.
+
+    Without worker threads (WorkerCount = 0) there is one shard, and the
+    application drives it by calling Tick() from a single thread.
+*/
+
+#include "ccat.h"
+#include "CCatWire.h"
+
+#include <vector>
+
+namespace ccat {
+
+
+//------------------------------------------------------------------------------
+// Constants
+
+/// Slots per timing wheel level
+static const unsigned kWheelSlots = 256;
+
+/// Longest timer supported by the two wheel levels, in ticks
+static const unsigned kWheelMaxTicks = kWheelSlots * (kWheelSlots - 1);
+
+
+//------------------------------------------------------------------------------
+// Settings
+
+/// Outgoing datagram produced during a tick
+struct StreamDatagram
+{
+    /// Stream that produced it
+    uint64_t StreamId;
+
+    /// Datagram data, valid during the OnTickBatch() call
+    const uint8_t* Data;
+
+    /// Bytes in datagram
+    unsigned Bytes;
+
+    /// Is this a recovery packet?
+    bool IsRecovery;
+};
+
+struct StreamManagerSettings
+{
+    /// Number of worker threads.  0 = Application calls Tick() instead
+    unsigned WorkerCount = 0;
+
+    /// Pin each worker thread to the core with the same index
+    bool PinWorkers = false;
+
+    /// Tick interval in microseconds
+    unsigned TickUsec = 1000;
+
+    /// Default time between recovery packets for each stream
+    unsigned RecoveryIntervalUsec = 10000;
+
+    /// Settings used for each codec.  Callbacks are ignored
+    CCatSettings CodecSettings;
+
+    /// Application context pointer provided to callbacks
+    void* AppContextPtr = nullptr;
+
+    /**
+        OnTickBatch()
+
+        Called once per tick from the shard worker with every datagram the
+        shard produced during the tick.  Not called if there are none.
+    */
+    void (*OnTickBatch)(
+        unsigned shard,
+        const StreamDatagram* datagrams,
+        unsigned count,
+        void* context) = nullptr;
+
+    /**
+        OnRecoveredData()
+
+        Called from the shard worker when a stream recovers lost data.
+    */
+    void (*OnRecoveredData)(
+        uint64_t streamId,
+        CCatOriginal original,
+        void* context) = nullptr;
+};
+
+
+//------------------------------------------------------------------------------
+// TimingWheel
+
+/// Intrusive timer, embedded in the object being scheduled
+struct WheelTimer
+{
+    WheelTimer* Next = nullptr;
+    WheelTimer** PrevNext = nullptr;
+
+    /// Tick when the timer expires
+    uint64_t ExpiryTick = 0;
+
+    bool IsScheduled() const
+    {
+        return PrevNext != nullptr;
+    }
+};
+
+/**
+    Two-level hierarchical timing wheel.
+
+    Level 0 has one slot per tick.  Level 1 has one slot per kWheelSlots ticks,
+    and its slots are cascaded down into level 0 as time reaches them.
+    Timers further out than kWheelMaxTicks are clamped.
+*/
+class TimingWheel
+{
+public:
+    /// Set the current tick, before any timers are scheduled
+    void Reset(uint64_t tick);
+
+    /// Schedule or reschedule a timer to expire at the given tick
+    void Schedule(WheelTimer* timer, uint64_t expiryTick);
+
+    /// Unschedule a timer if it is scheduled
+    static void Cancel(WheelTimer* timer);
+
+    /// Advance to the given tick.  Expired timers are unlinked and passed to
+    /// onExpire(timer), which may reschedule that timer but no other
+    template<class T> void Advance(uint64_t tick, T&& onExpire)
+    {
+        while (CurrentTick < tick)
+        {
+            ++CurrentTick;
+
+            if ((CurrentTick % kWheelSlots) == 0) {
+                cascade();
+            }
+
+            // Detach the slot so rescheduled timers cannot land in it
+            WheelTimer*& slot = Level0[CurrentTick % kWheelSlots];
+            WheelTimer* timer = slot;
+            slot = nullptr;
+
+            while (timer)
+            {
+                WheelTimer* next = timer->Next;
+                timer->Next = nullptr;
+                timer->PrevNext = nullptr;
+
+                onExpire(timer);
+
+                timer = next;
+            }
+        }
+    }
+
+    uint64_t GetCurrentTick() const
+    {
+        return CurrentTick;
+    }
+
+private:
+    uint64_t CurrentTick = 0;
+    WheelTimer* Level0[kWheelSlots] = {};
+    WheelTimer* Level1[kWheelSlots] = {};
+
+    static void link(WheelTimer** head, WheelTimer* timer);
+
+    /// Move timers from the current level 1 slot into level 0
+    void cascade();
+};
+
+
+//------------------------------------------------------------------------------
+// StreamTable
+
+struct Stream;
+
+/**
+    Open-addressing hash table from stream id to stream, with linear probing
+    and backward-shift deletion, so there are no tombstones.  Each slot is 16
+    bytes, so four slots share a cache line.
+*/
+class StreamTable
+{
+public:
+    StreamTable();
+
+    /// Returns the stream, or nullptr if not found
+    Stream* Find(uint64_t streamId) const;
+
+    /// Returns false if the id is already present
+    bool Insert(uint64_t streamId, Stream* stream);
+
+    /// Returns the removed stream, or nullptr if not found
+    Stream* Remove(uint64_t streamId);
+
+    unsigned GetCount() const
+    {
+        return Count;
+    }
+
+    /// Call f(stream) for each stream
+    template<class T> void ForEach(T&& f) const
+    {
+        for (const Slot& slot : Slots) {
+            if (slot.Value) {
+                f(slot.Value);
+            }
+        }
+    }
+
+private:
+    struct Slot
+    {
+        uint64_t Key;
+        Stream* Value;
+    };
+
+    std::vector<Slot> Slots;
+    unsigned Mask = 0;
+    unsigned Count = 0;
+
+    void grow();
+};
+
+
+//------------------------------------------------------------------------------
+// StreamManager
+
+class StreamShard;
+
+class StreamManager
+{
+public:
+    ~StreamManager();
+
+    /// Start the shards.  Returns CCat_Success on success
+    CCatResult Initialize(const StreamManagerSettings& settings);
+
+    /// Stop worker threads and destroy all streams
+    void Shutdown();
+
+    unsigned GetShardCount() const
+    {
+        return (unsigned)Shards.size();
+    }
+
+    /// Shard that owns the given stream id
+    unsigned GetShardForStream(uint64_t streamId) const;
+
+    /// Queue stream creation.  Ignored by the shard if it already exists
+    CCatResult CreateStream(uint64_t streamId);
+
+    /// Queue stream destruction
+    CCatResult DestroyStream(uint64_t streamId);
+
+    /// Queue a copy of original data to send on the stream
+    CCatResult Send(uint64_t streamId, const uint8_t* data, unsigned bytes);
+
+    /// Queue a copy of a received CCatWire.h datagram for the stream
+    CCatResult Receive(uint64_t streamId, const uint8_t* datagram, unsigned bytes);
+
+    /// Run one tick on the shard.  Only for WorkerCount = 0,
+    /// or for the single-threaded benchmark
+    void Tick(unsigned shard, uint64_t nowUsec);
+
+    /// Statistics summed over all shards (approximate while running)
+    uint64_t GetStreamCount() const;
+    uint64_t GetDatagramsSent() const;
+
+private:
+    StreamManagerSettings Settings;
+    std::vector<StreamShard*> Shards;
+};
+
+
+} // namespace ccat
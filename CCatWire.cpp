@@ -0,0 +1,402 @@
+/** \file
+    \brief CCat Wire Format
+    \copyright Copyright (c) 2018 Christopher A. Taylor.  All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of CCat nor the names of its contributors may be
+      used to endorse or promote products derived from this software without
+      specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+    ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+    SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+    INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+    CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+    POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "CCatWire.h"
+#include "PacketAllocator.h" // PKTALLOC_DEBUG_ASSERT
+#include <string.h>
+
+namespace ccat {
+
+
+//------------------------------------------------------------------------------
+// Serialization
+
+static PKTALLOC_FORCE_INLINE void WriteSequence(
+    uint8_t* data,
+    uint64_t sequence,
+    bool is24)
+{
+    data[0] = (uint8_t)sequence;
+    data[1] = (uint8_t)(sequence >> 8);
+    if (is24) {
+        data[2] = (uint8_t)(sequence >> 16);
+    }
+}
+
+static PKTALLOC_FORCE_INLINE unsigned SequenceFieldBytes(uint8_t typeByte)
+{
+    return (typeByte & kWireSequence24Flag) ? 3 : 2;
+}
+
+static PKTALLOC_FORCE_INLINE void WriteU16(uint8_t* data, unsigned value)
+{
+    data[0] = (uint8_t)value;
+    data[1] = (uint8_t)(value >> 8);
+}
+
+static PKTALLOC_FORCE_INLINE unsigned ReadU16(const uint8_t* data)
+{
+    return data[0] | ((unsigned)data[1] << 8);
+}
+
+
+//------------------------------------------------------------------------------
+// WireWriter
+
+void WireWriter::OnPeerNextExpected(uint64_t nextExpected)
+{
+    const Counter64 next = nextExpected;
+
+    // Ignore stale feedback that arrives out of order
+    if (HasPeerFeedback && next < PeerNextExpected) {
+        return;
+    }
+
+    PeerNextExpected = next;
+    HasPeerFeedback = true;
+}
+
+uint8_t WireWriter::chooseSequenceFlags(Counter64 sequence) const
+{
+    // The peer expands the truncated field relative to the largest sequence
+    // number it has seen, which is somewhere between the last one it
+    // acknowledged and the last one we sent.  Cover the larger distance.
+    uint64_t mag = (sequence >= NextSequence) ?
+        (sequence - NextSequence).ToUnsigned() + 1 :
+        (NextSequence - sequence).ToUnsigned();
+
+    if (!HasPeerFeedback) {
+        // Without feedback assume the peer is within 24-bit range
+        return kWireSequence24Flag;
+    }
+
+    const uint64_t peerMag = (sequence >= PeerNextExpected) ?
+        (sequence - PeerNextExpected).ToUnsigned() + 1 :
+        (PeerNextExpected - sequence).ToUnsigned();
+    if (mag < peerMag) {
+        mag = peerMag;
+    }
+
+    if (mag < 0x8000) {
+        return 0;
+    }
+    if (mag < 0x800000) {
+        return kWireSequence24Flag;
+    }
+    return 0xff;
+}
+
+uint8_t* WireWriter::WriteOriginal(
+    uint8_t* payload,
+    unsigned payloadBytes,
+    uint64_t sequenceNumber,
+    unsigned& datagramBytesOut)
+{
+    datagramBytesOut = 0;
+
+    if (!payload || payloadBytes <= 0 || payloadBytes > CCAT_MAX_BYTES) {
+        return nullptr;
+    }
+
+    const Counter64 sequence = sequenceNumber;
+    const uint8_t flags = chooseSequenceFlags(sequence);
+    if (flags == 0xff) {
+        return nullptr;
+    }
+
+    if (sequence >= NextSequence) {
+        NextSequence = sequence + 1;
+    }
+
+    const unsigned headerBytes = 1 + SequenceFieldBytes(flags);
+    PKTALLOC_DEBUG_ASSERT(headerBytes <= kWireOriginalHeaderMax);
+    uint8_t* datagram = payload - headerBytes;
+
+    datagram[0] = flags;
+    WriteSequence(datagram + 1, sequenceNumber, flags != 0);
+
+    datagramBytesOut = headerBytes + payloadBytes;
+    return datagram;
+}
+
+uint8_t* WireWriter::WriteRecovery(
+    const CCatRecovery& recovery,
+    unsigned& datagramBytesOut)
+{
+    datagramBytesOut = 0;
+
+    if (!recovery.Data ||
+        recovery.Bytes <= 0 ||
+        recovery.Count <= 0 ||
+        recovery.Count > CCAT_MAX_WINDOW_PACKETS ||
+        recovery.RecoveryRow > CCAT_MAX_RECOVERY_ROW)
+    {
+        return nullptr;
+    }
+
+    const uint8_t sequenceFlags = chooseSequenceFlags(recovery.SequenceStart);
+    if (sequenceFlags == 0xff) {
+        return nullptr;
+    }
+
+    const unsigned sequenceBytes = SequenceFieldBytes(sequenceFlags);
+    const unsigned maskBytes = recovery.ColumnMask ? (recovery.Count + 7) / 8 : 0;
+    const unsigned headerBytes = 1 + sequenceBytes + 1 + (recovery.ColumnMask ? 1 + maskBytes : 0);
+    PKTALLOC_DEBUG_ASSERT(headerBytes <= kWireRecoveryHeaderMax);
+
+    // Write into the headroom reserved by the encoder
+    uint8_t* datagram = const_cast<uint8_t*>(recovery.Data) - headerBytes;
+
+    WriteSequence(datagram + 1, recovery.SequenceStart, sequenceFlags != 0);
+    datagram[1 + sequenceBytes] = recovery.Count;
+
+    if (recovery.ColumnMask)
+    {
+        datagram[0] = kWireSparseRecoveryType | sequenceFlags;
+        datagram[2 + sequenceBytes] = recovery.RecoveryRow;
+        memcpy(datagram + 3 + sequenceBytes, recovery.ColumnMask, maskBytes);
+    }
+    else {
+        datagram[0] = kWireRecoveryFlag | sequenceFlags | recovery.RecoveryRow;
+    }
+
+    datagramBytesOut = headerBytes + recovery.Bytes;
+    return datagram;
+}
+
+
+//------------------------------------------------------------------------------
+// WireReader
+
+WireType WireReader::Parse(
+    const uint8_t* datagram,
+    unsigned bytes,
+    CCatOriginal& originalOut,
+    CCatRecovery& recoveryOut)
+{
+    if (!datagram || bytes < 1) {
+        return WireType::Invalid;
+    }
+
+    const uint8_t typeByte = datagram[0];
+    if (typeByte == kWireLossReportType) {
+        return bytes >= kWireLossReportFixedBytes ? WireType::LossReport : WireType::Invalid;
+    }
+
+    const bool isSparse = (typeByte & kWireRowMask) == kWireSparseRecoveryType &&
+        (typeByte & kWireRecoveryFlag) == 0;
+    const bool isRecovery = isSparse || (typeByte & kWireRecoveryFlag) != 0;
+    const bool is24 = (typeByte & kWireSequence24Flag) != 0;
+    const unsigned sequenceBytes = is24 ? 3 : 2;
+    unsigned headerBytes = 1 + sequenceBytes + (isRecovery ? 1 : 0);
+
+    // Sparse recovery: Row byte and column mask follow the Count byte
+    if (isSparse)
+    {
+        if (bytes <= headerBytes) {
+            return WireType::Invalid;
+        }
+        const unsigned count = datagram[headerBytes - 1];
+        headerBytes += 1 + (count + 7) / 8;
+    }
+
+    // Payload must not be empty
+    if (bytes <= headerBytes || bytes - headerBytes > CCAT_MAX_BYTES) {
+        return WireType::Invalid;
+    }
+
+    // Re-expand the truncated sequence number
+    Counter64 sequence;
+    if (is24)
+    {
+        const uint32_t partial = (uint32_t)datagram[1] |
+            ((uint32_t)datagram[2] << 8) | ((uint32_t)datagram[3] << 16);
+        sequence = Counter64::ExpandFromTruncated(LargestSequence, Counter24(partial));
+    }
+    else
+    {
+        const uint16_t partial = (uint16_t)(datagram[1] | ((unsigned)datagram[2] << 8));
+        sequence = Counter64::ExpandFromTruncated(LargestSequence, Counter16(partial));
+    }
+
+    const uint8_t* payload = datagram + headerBytes;
+    const unsigned payloadBytes = bytes - headerBytes;
+
+    if (!isRecovery)
+    {
+        // Reserved bits must be zero
+        if ((typeByte & kWireRowMask) != 0) {
+            return WireType::Invalid;
+        }
+
+        if (sequence > LargestSequence) {
+            LargestSequence = sequence;
+        }
+
+        originalOut.Data = payload;
+        originalOut.Bytes = payloadBytes;
+        originalOut.SequenceNumber = sequence.ToUnsigned();
+        return WireType::Original;
+    }
+
+    const uint8_t count = datagram[1 + sequenceBytes];
+    if (count <= 0 || count > CCAT_MAX_WINDOW_PACKETS) {
+        return WireType::Invalid;
+    }
+
+    uint8_t row = typeByte & kWireRowMask;
+    const uint8_t* columnMask = nullptr;
+    if (isSparse)
+    {
+        row = datagram[2 + sequenceBytes];
+        if (row > CCAT_MAX_RECOVERY_ROW) {
+            return WireType::Invalid;
+        }
+        columnMask = datagram + 3 + sequenceBytes;
+    }
+
+    // Recovery span may reveal newer sequence numbers
+    const Counter64 last = sequence + (count - 1);
+    if (last > LargestSequence) {
+        LargestSequence = last;
+    }
+
+    recoveryOut.SequenceStart = sequence.ToUnsigned();
+    recoveryOut.Data = payload;
+    recoveryOut.Bytes = payloadBytes;
+    recoveryOut.Count = count;
+    recoveryOut.RecoveryRow = row;
+    recoveryOut.ColumnMask = columnMask;
+    return WireType::Recovery;
+}
+
+
+//------------------------------------------------------------------------------
+// Loss Reports
+
+unsigned WriteLossReport(const CCatLossReport& report, uint8_t* buffer)
+{
+    // Scale the counters down together until Expected fits
+    unsigned shift = 0;
+    while ((report.Expected >> shift) > 0xffff) {
+        ++shift;
+    }
+
+    buffer[0] = kWireLossReportType;
+    WriteSequence(buffer + 1, report.SequenceEnd, true);
+    WriteU16(buffer + 4, report.Expected >> shift);
+    WriteU16(buffer + 6, report.Lost >> shift);
+    WriteU16(buffer + 8, report.Recovered >> shift);
+
+    unsigned unrecovered = report.Unrecovered >> shift;
+    if (unrecovered > 0xffff) {
+        unrecovered = 0xffff;
+    }
+    WriteU16(buffer + 10, unrecovered);
+
+    uint8_t* data = buffer + 12;
+    for (unsigned i = 0; i < CCAT_LOSS_BURST_BINS; ++i) {
+        data[i] = (uint8_t)(report.Bursts[i] < 0xff ? report.Bursts[i] : 0xff);
+    }
+    data += CCAT_LOSS_BURST_BINS;
+
+    unsigned missingCount = report.MissingCount;
+    if (missingCount > CCAT_LOSS_REPORT_MAX_RANGES) {
+        missingCount = CCAT_LOSS_REPORT_MAX_RANGES;
+    }
+    *data++ = (uint8_t)missingCount;
+    PKTALLOC_DEBUG_ASSERT(data == buffer + kWireLossReportFixedBytes);
+
+    for (unsigned i = 0; i < missingCount; ++i)
+    {
+        const CCatMissingRange& range = report.Missing[i];
+        WriteU16(data, (unsigned)(report.SequenceEnd - range.SequenceStart));
+        WriteU16(data + 2, range.Count);
+        data += kWireLossReportRangeBytes;
+    }
+
+    return (unsigned)(data - buffer);
+}
+
+bool ReadLossReport(
+    const uint8_t* data,
+    unsigned bytes,
+    uint64_t nextSequence,
+    CCatLossReport& reportOut)
+{
+    if (!data ||
+        bytes < kWireLossReportFixedBytes ||
+        data[0] != kWireLossReportType)
+    {
+        return false;
+    }
+
+    const unsigned missingCount = data[kWireLossReportFixedBytes - 1];
+    if (missingCount > CCAT_LOSS_REPORT_MAX_RANGES ||
+        bytes != kWireLossReportFixedBytes + missingCount * kWireLossReportRangeBytes)
+    {
+        return false;
+    }
+
+    // The receiver cannot know of sequence numbers the sender has not used
+    const uint32_t partial = (uint32_t)data[1] |
+        ((uint32_t)data[2] << 8) | ((uint32_t)data[3] << 16);
+    const Counter64 sequenceEnd = Counter64::ExpandFromTruncated(Counter64(nextSequence), Counter24(partial));
+
+    reportOut.SequenceEnd = sequenceEnd.ToUnsigned();
+    reportOut.Expected = ReadU16(data + 4);
+    reportOut.Lost = ReadU16(data + 6);
+    reportOut.Recovered = ReadU16(data + 8);
+    reportOut.Unrecovered = ReadU16(data + 10);
+
+    const uint8_t* bursts = data + 12;
+    for (unsigned i = 0; i < CCAT_LOSS_BURST_BINS; ++i) {
+        reportOut.Bursts[i] = bursts[i];
+    }
+
+    reportOut.MissingCount = missingCount;
+    const uint8_t* ranges = data + kWireLossReportFixedBytes;
+    for (unsigned i = 0; i < missingCount; ++i)
+    {
+        const unsigned distance = ReadU16(ranges);
+        const unsigned count = ReadU16(ranges + 2);
+        if (count <= 0 || count > distance) {
+            return false;
+        }
+
+        reportOut.Missing[i].SequenceStart = (sequenceEnd - distance).ToUnsigned();
+        reportOut.Missing[i].Count = count;
+        ranges += kWireLossReportRangeBytes;
+    }
+
+    return true;
+}
+
+
+} // namespace ccat
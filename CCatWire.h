@@ -0,0 +1,251 @@
+/** \file
+    \brief CCat Wire Format
+    \copyright Copyright (c) 2018 Christopher A. Taylor.  All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of CCat nor the names of its contributors may be
+      used to endorse or promote products derived from this software without
+      specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+    ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+    SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+    INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+    CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+    POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+/** \page Wire CCat Wire Format Module
+
+    Compact zero-copy packet format for CCat originals and recovery packets.
+
+    Each datagram starts with a type byte:
+
+        bit 7    : 1 = Recovery packet, 0 = Original packet
+        bit 6    : 1 = 24-bit sequence field, 0 = 16-bit sequence field
+        bits 0-5 : Recovery: RecoveryRow.  Original: Reserved (zero)
+
+    Followed by the truncated sequence number (16 or 24 bits, little-endian).
+    Originals carry SequenceNumber and recovery packets carry SequenceStart.
+    Recovery packets then have one byte for Count (1..192).
+    The remainder of the datagram is the payload and its length is implied by
+    the datagram size.
+
+    Original header: 3 or 4 bytes.
+    Recovery header: 4 or 5 bytes.
+
+    Sparse recovery packets from ccat_encode_recovery_priority() use an
+    original type byte with the reserved bits set to kWireSparseRecoveryType,
+    since the recovery type byte has no room left.  It is followed by the
+    sequence field and Count as above, then one byte for RecoveryRow and
+    (Count + 7) / 8 bytes of ColumnMask.
+
+    Sparse recovery header: 6 to 30 bytes.
+
+    Loss reports from ccat_decode_get_loss_report() travel the other way and
+    use the type byte kWireLossReportType, which is an original type byte with
+    all reserved bits set, so the two can share a socket:
+
+        type byte (0x3f)
+        SequenceEnd, truncated to 24 bits
+        Expected, Lost, Recovered, Unrecovered: 16 bits each.  Scaled down
+            together by a power of two if Expected does not fit
+        Bursts: 8 bits each, saturating
+        MissingCount: 8 bits
+        For each missing range: 16-bit distance back from SequenceEnd to the
+            range start, then 16-bit Count
+
+    Loss report: 17 to 49 bytes.
+
+    The header is written in place into headroom in front of the payload, so
+    the payload is never copied.  ccat_encode_recovery() reserves
+    CCAT_RECOVERY_HEADROOM bytes for this purpose, and the application should
+    reserve kWireOriginalHeaderMax bytes in front of its own original data.
+
+    Parsing returns pointers into the datagram, so it also does not copy.
+
+    Sequence numbers are truncated using Counter<> and re-expanded at the
+    receiver based on the largest sequence number it has seen.  Without a
+    back-channel the writer always uses 24 bits, which tolerates gaps of up to
+    about 8 million packets.  When the application feeds the peer's next
+    expected sequence number back to the writer, it will drop to 16 bits.
+*/
+
+#include "ccat.h"
+#include "Counter.h"
+
+namespace ccat {
+
+
+//------------------------------------------------------------------------------
+// Constants
+
+/// Type byte flag: Set for recovery packets
+static const uint8_t kWireRecoveryFlag = 0x80;
+
+/// Type byte flag: Set when the sequence field is 24 bits
+static const uint8_t kWireSequence24Flag = 0x40;
+
+/// Type byte mask for the recovery row
+static const uint8_t kWireRowMask = 0x3f;
+static_assert(kWireRowMask == CCAT_MAX_RECOVERY_ROW, "Header mismatch");
+
+/// Maximum bytes of header in front of original data
+static const unsigned kWireOriginalHeaderMax = 1 + 3;
+
+/// Maximum bytes of header in front of recovery data
+static const unsigned kWireRecoveryHeaderMax = 1 + 3 + 1 + 1 + CCAT_COLUMN_MASK_BYTES;
+static_assert(kWireRecoveryHeaderMax <= CCAT_RECOVERY_HEADROOM, "Header mismatch");
+
+/// Type byte of a sparse recovery packet, combined with kWireSequence24Flag
+static const uint8_t kWireSparseRecoveryType = kWireRowMask - 1;
+
+/// Type byte of a loss report
+static const uint8_t kWireLossReportType = kWireRowMask;
+
+/// Bytes in a loss report before the missing ranges
+static const unsigned kWireLossReportFixedBytes = 1 + 3 + 4 * 2 + CCAT_LOSS_BURST_BINS + 1;
+
+/// Bytes per missing range in a loss report
+static const unsigned kWireLossReportRangeBytes = 2 + 2;
+
+/// Maximum bytes in a loss report
+static const unsigned kWireLossReportMax = kWireLossReportFixedBytes +
+    CCAT_LOSS_REPORT_MAX_RANGES * kWireLossReportRangeBytes;
+static_assert(kWireLossReportMax <= CCAT_LOSS_REPORT_MAX_BYTES, "Header mismatch");
+
+/// Type of datagram returned by WireReader::Parse()
+enum class WireType
+{
+    Invalid,
+    Original,
+    Recovery,
+    LossReport
+};
+
+
+//------------------------------------------------------------------------------
+// WireWriter
+
+/// Serializes packet headers for the sending side of a stream
+class WireWriter
+{
+public:
+    /// Provide the peer's next expected sequence number from its back-channel.
+    /// After this is called the writer may truncate to 16 bits
+    void OnPeerNextExpected(uint64_t nextExpected);
+
+    /**
+        WriteOriginal()
+
+        Writes the original header in place in front of the payload.
+        Precondition: kWireOriginalHeaderMax bytes are writable before payload.
+
+        Returns the start of the datagram and sets datagramBytesOut.
+        Returns nullptr if the sequence number cannot be represented.
+    */
+    uint8_t* WriteOriginal(
+        uint8_t* payload,
+        unsigned payloadBytes,
+        uint64_t sequenceNumber,
+        unsigned& datagramBytesOut);
+
+    /**
+        WriteRecovery()
+
+        Writes the recovery header in place in front of recovery.Data, using
+        the headroom reserved by ccat_encode_recovery().
+
+        Returns the start of the datagram and sets datagramBytesOut.
+        Returns nullptr if the sequence number cannot be represented.
+    */
+    uint8_t* WriteRecovery(
+        const CCatRecovery& recovery,
+        unsigned& datagramBytesOut);
+
+private:
+    /// Next sequence number expected by the peer
+    Counter64 PeerNextExpected = 0;
+
+    /// Largest sequence number written so far + 1
+    Counter64 NextSequence = 0;
+
+    /// Set once OnPeerNextExpected() has been called
+    bool HasPeerFeedback = false;
+
+    /// Returns the type byte flags for the sequence field, or 0xff on error
+    uint8_t chooseSequenceFlags(Counter64 sequence) const;
+};
+
+
+//------------------------------------------------------------------------------
+// WireReader
+
+/// Parses datagrams for the receiving side of a stream
+class WireReader
+{
+public:
+    /**
+        Parse()
+
+        Parses a datagram produced by WireWriter.  The output Data pointers
+        reference the provided datagram, which must stay valid while in use.
+
+        Returns WireType::Original if originalOut was filled in.
+        Returns WireType::Recovery if recoveryOut was filled in.  Its
+        ColumnMask is set for sparse packets, which should be passed to
+        ccat_decode_recovery_sparse().
+        Returns WireType::LossReport for a loss report, which should be passed
+        to ccat_encode_parse_loss_report() as-is.
+        Returns WireType::Invalid if the datagram is malformed.
+    */
+    WireType Parse(
+        const uint8_t* datagram,
+        unsigned bytes,
+        CCatOriginal& originalOut,
+        CCatRecovery& recoveryOut);
+
+    /// Next expected sequence number, to send to the peer's WireWriter
+    COUNTER_FORCE_INLINE uint64_t GetNextExpected() const
+    {
+        return (LargestSequence + 1).ToUnsigned();
+    }
+
+private:
+    /// Largest sequence number seen so far, used to re-expand truncated fields
+    Counter64 LargestSequence = 0;
+};
+
+
+//------------------------------------------------------------------------------
+// Loss Reports
+
+/// Serialize a loss report into at least kWireLossReportMax bytes.
+/// Returns the number of bytes written
+unsigned WriteLossReport(const CCatLossReport& report, uint8_t* buffer);
+
+/// Parse a loss report.  The truncated SequenceEnd is expanded relative to
+/// nextSequence, the next sequence number the sender will use.
+/// Returns false if the data is malformed
+bool ReadLossReport(
+    const uint8_t* data,
+    unsigned bytes,
+    uint64_t nextSequence,
+    CCatLossReport& reportOut);
+
+
+} // namespace ccat
@@ -124,6 +124,12 @@ Allocator::~Allocator()
         }
     }
     SIMDSafeFree(HugeChunkStart);
+
+    for (LargeBlockLink* link = LargeBlocks, *next; link; link = next)
+    {
+        next = link->AllNext;
+        SIMDSafeFree(link);
+    }
 }
 
 unsigned Allocator::GetMemoryUsedBytes() const
@@ -277,7 +283,11 @@ uint8_t* Allocator::Allocate(unsigned bytes)
     // Note: +1 for the AllocationHeader
     const unsigned units = (bytes + kUnitSize - 1) / kUnitSize + 1;
 
-    if (units > kFallbackThresholdUnits) {
+    if (units > kFallbackThresholdUnits)
+    {
+        if (units <= kLargeMaxUnits) {
+            return largeAllocate(units);
+        }
         return fallbackAllocate(bytes);
     }
 
@@ -292,73 +302,59 @@ uint8_t* Allocator::Allocate(unsigned bytes)
             continue;
         }
 
-        // Walk the holes in the bitmask:
+        // Find the first hole that fits after the last allocation
         UsedMaskT* usedPtr = &window->Used;
-        unsigned regionStart = window->ResumeScanOffset;
-        while (regionStart < UsedMaskT::kValidBits)
-        {
-            regionStart = usedPtr->FindFirstClear(regionStart);
-            unsigned regionEnd = regionStart + units;
-
-            // If we ran out of space:
-            if (regionEnd > UsedMaskT::kValidBits) {
-                break;
-            }
-
-            regionEnd = usedPtr->FindFirstSet(regionStart + 1, regionEnd);
-            PKTALLOC_DEBUG_ASSERT(regionEnd > regionStart);
-            PKTALLOC_DEBUG_ASSERT(regionEnd <= UsedMaskT::kValidBits);
-
-            if (regionEnd - regionStart < units)
-            {
-                regionStart = regionEnd + 1;
-                continue;
-            }
-            regionEnd = regionStart + units;
+        if (window->ResumeScanOffset >= UsedMaskT::kValidBits) {
+            continue;
+        }
+        const unsigned regionStart = usedPtr->FindFirstClearRun(window->ResumeScanOffset, units);
+        if (regionStart >= UsedMaskT::kValidBits) {
+            continue;
+        }
+        PKTALLOC_DEBUG_ASSERT(regionStart + units <= UsedMaskT::kValidBits);
 
-            // Carve out region
-            uint8_t* region = (uint8_t*)window + kWindowHeaderBytes + regionStart * kUnitSize;
-            AllocationHeader* regionHeader = (AllocationHeader*)region;
+        // Carve out region
+        uint8_t* region = (uint8_t*)window + kWindowHeaderBytes + regionStart * kUnitSize;
+        AllocationHeader* regionHeader = (AllocationHeader*)region;
 #ifdef PKTALLOC_DEBUG
-            regionHeader->Canary = AllocationHeader::kCanaryExpected;
+        regionHeader->Canary = AllocationHeader::kCanaryExpected;
 #endif // PKTALLOC_DEBUG
-            regionHeader->Header = window;
-            regionHeader->UsedUnits = units;
+        regionHeader->Header = window;
+        regionHeader->UsedUnits = units;
 
-            // Update window header
+        // Update window header
 #ifdef PKTALLOC_SHRINK
-            if (window->FreeUnitCount >= kWindowMaxUnits &&
-                !window->Preallocated)
-            {
-                PKTALLOC_DEBUG_ASSERT(EmptyWindowCount > 0);
-                --EmptyWindowCount;
-            }
+        if (window->FreeUnitCount >= kWindowMaxUnits &&
+            !window->Preallocated)
+        {
+            PKTALLOC_DEBUG_ASSERT(EmptyWindowCount > 0);
+            --EmptyWindowCount;
+        }
 #endif // PKTALLOC_SHRINK
-            window->FreeUnitCount -= units;
-            usedPtr->SetRange(regionStart, regionStart + units);
-            window->ResumeScanOffset = regionStart + units;
+        window->FreeUnitCount -= units;
+        usedPtr->SetRange(regionStart, regionStart + units);
+        window->ResumeScanOffset = regionStart + units;
 
-            // Any prior windows that failed to allocate are moved to full list
-            unsigned fullCount = preferredCount - 1 - i;
+        // Any prior windows that failed to allocate are moved to full list
+        unsigned fullCount = preferredCount - 1 - i;
 
-            // Move this window to the full list if we cannot make another allocation of the same size
-            if (regionStart + units * 2 > kWindowMaxUnits) {
-                // Include this one too
-                ++fullCount;
-            }
+        // Move this window to the full list if we cannot make another allocation of the same size
+        if (regionStart + units * 2 > kWindowMaxUnits) {
+            // Include this one too
+            ++fullCount;
+        }
 
-            moveLastFewWindowsToFull(fullCount);
+        moveLastFewWindowsToFull(fullCount);
 
-            uint8_t* data = region + kUnitSize;
+        uint8_t* data = region + kUnitSize;
 #ifdef PKTALLOC_SCRUB_MEMORY
-            memset(data, 0, (units - 1) * kUnitSize);
+        memset(data, 0, (units - 1) * kUnitSize);
 #endif // PKTALLOC_SCRUB_MEMORY
-            PKTALLOC_DEBUG_ASSERT((uintptr_t)data % kUnitSize == 0);
-            PKTALLOC_DEBUG_ASSERT((uint8_t*)regionHeader >= (uint8_t*)regionHeader->Header + kWindowHeaderBytes);
-            PKTALLOC_DEBUG_ASSERT(regionHeader->GetUnitStart() < kWindowMaxUnits);
-            PKTALLOC_DEBUG_ASSERT(regionHeader->GetUnitStart() + regionHeader->UsedUnits <= kWindowMaxUnits);
-            return data;
-        }
+        PKTALLOC_DEBUG_ASSERT((uintptr_t)data % kUnitSize == 0);
+        PKTALLOC_DEBUG_ASSERT((uint8_t*)regionHeader >= (uint8_t*)regionHeader->Header + kWindowHeaderBytes);
+        PKTALLOC_DEBUG_ASSERT(regionHeader->GetUnitStart() < kWindowMaxUnits);
+        PKTALLOC_DEBUG_ASSERT(regionHeader->GetUnitStart() + regionHeader->UsedUnits <= kWindowMaxUnits);
+        return data;
     }
 
     // Move all preferred windows to full since none of them worked out
@@ -464,8 +460,38 @@ uint8_t* Allocator::Reallocate(uint8_t* ptr, unsigned bytes, Realloc behavior)
 
     // If the existing allocation is big enough:
     const unsigned requestedUnits = (bytes + kUnitSize - 1) / kUnitSize + 1;
-    if (requestedUnits <= existingUnits) {
-        return ptr; // No change needed
+    if (requestedUnits <= existingUnits)
+    {
+        // Give back the tail if the data is not needed and most of it is unused
+        if (behavior == Realloc::Uninitialized && requestedUnits * 2 <= existingUnits) {
+            Shrink(ptr, bytes);
+        }
+        return ptr; // No move needed
+    }
+
+    ++ReallocateGrowCount;
+
+    // If the units right after the allocation are free, extend into them:
+    WindowHeader* window = regionHeader->Header;
+    if (window && requestedUnits <= kFallbackThresholdUnits)
+    {
+        const unsigned regionStart = regionHeader->GetUnitStart();
+        const unsigned regionEnd = regionStart + existingUnits;
+        const unsigned regionEndNew = regionStart + requestedUnits;
+
+        if (regionEndNew <= kWindowMaxUnits &&
+            window->Used.FindFirstSet(regionEnd, regionEndNew) >= regionEndNew)
+        {
+            window->Used.SetRange(regionEnd, regionEndNew);
+            window->FreeUnitCount -= requestedUnits - existingUnits;
+            regionHeader->UsedUnits = requestedUnits;
+
+            ++ReallocateInPlaceCount;
+
+            ALLOC_DEBUG_INTEGRITY_CHECK();
+
+            return ptr;
+        }
     }
 
     // Allocate new data
@@ -575,8 +601,13 @@ void Allocator::Free(uint8_t* ptr)
     WindowHeader* window = regionHeader->Header;
     if (!window)
     {
-        regionHeader->UsedUnits = 0; // Mark freed
-        fallbackFree(ptr);
+        if (regionHeader->UsedUnits <= kLargeMaxUnits) {
+            largeFree(regionHeader);
+        }
+        else {
+            regionHeader->UsedUnits = 0; // Mark freed
+            fallbackFree(ptr);
+        }
         return;
     }
 
@@ -683,6 +714,63 @@ void Allocator::freeEmptyWindows()
 
 #endif // PKTALLOC_SHRINK
 
+uint8_t* Allocator::largeAllocate(unsigned units)
+{
+    // Round up to the size class
+    unsigned classIndex = 0;
+    unsigned classUnits = kLargeMinUnits;
+    while (classUnits < units)
+    {
+        classUnits *= 2;
+        ++classIndex;
+    }
+    PKTALLOC_DEBUG_ASSERT(classIndex < kLargeClassCount);
+
+    LargeBlockLink* link = LargeFree[classIndex];
+    if (link) {
+        LargeFree[classIndex] = link->FreeNext;
+    }
+    else
+    {
+        // Note: +1 for the LargeBlockLink
+        link = (LargeBlockLink*)SIMDSafeAllocate(kUnitSize * (classUnits + 1));
+        if (!link) {
+            return nullptr;
+        }
+        link->AllNext = LargeBlocks;
+        LargeBlocks = link;
+    }
+
+    AllocationHeader* regionHeader = (AllocationHeader*)((uint8_t*)link + kUnitSize);
+#ifdef PKTALLOC_DEBUG
+    regionHeader->Canary = AllocationHeader::kCanaryExpected;
+#endif // PKTALLOC_DEBUG
+    regionHeader->Header = nullptr;
+    regionHeader->UsedUnits = classUnits;
+
+    uint8_t* data = (uint8_t*)regionHeader + kUnitSize;
+#ifdef PKTALLOC_SCRUB_MEMORY
+    memset(data, 0, (classUnits - 1) * kUnitSize);
+#endif // PKTALLOC_SCRUB_MEMORY
+    return data;
+}
+
+void Allocator::largeFree(AllocationHeader* regionHeader)
+{
+    unsigned classIndex = 0;
+    for (unsigned classUnits = kLargeMinUnits; classUnits < regionHeader->UsedUnits; classUnits *= 2) {
+        ++classIndex;
+    }
+    PKTALLOC_DEBUG_ASSERT(classIndex < kLargeClassCount);
+    PKTALLOC_DEBUG_ASSERT(regionHeader->UsedUnits == kLargeMinUnits << classIndex);
+
+    regionHeader->UsedUnits = 0; // Mark freed
+
+    LargeBlockLink* link = (LargeBlockLink*)((uint8_t*)regionHeader - kUnitSize);
+    link->FreeNext = LargeFree[classIndex];
+    LargeFree[classIndex] = link;
+}
+
 uint8_t* Allocator::fallbackAllocate(unsigned bytes)
 {
     // Calculate number of units required by this allocation
@@ -103,6 +103,11 @@ static const unsigned kWindowMaxUnits = 2048;
 /// Preallocated windows (about 128 KB on desktop)
 static const unsigned kPreallocatedWindows = 2;
 
+/// Power-of-two size classes for allocations too large for a window.
+/// Freed blocks are kept on a free list per class and reused without zeroing.
+/// Allocations beyond the largest class go straight to the heap
+static const unsigned kLargeClassCount = 4;
+
 /// PKTALLOC_SHRINK: Keep some windows around
 static const unsigned kEmptyWindowMinimum = 32;
 
@@ -181,6 +186,30 @@ PKTALLOC_FORCE_INLINE unsigned TrailingZeros64(uint64_t x)
 #endif
 }
 
+/// Returns number of zero bits above the highest non-zero bit
+/// Precondition: x != 0
+PKTALLOC_FORCE_INLINE unsigned LeadingZeros64(uint64_t x)
+{
+#ifdef _MSC_VER
+#ifdef _WIN64
+    unsigned long index;
+    // Note: Ignoring result because x != 0
+    _BitScanReverse64(&index, x);
+    return 63 - (unsigned)index;
+#else
+    unsigned long index;
+    if (0 != _BitScanReverse(&index, (uint32_t)(x >> 32)))
+        return 31 - (unsigned)index;
+    // Note: Ignoring result because x != 0
+    _BitScanReverse(&index, (uint32_t)x);
+    return 63 - (unsigned)index;
+#endif
+#else
+    // Note: Ignoring return value of 64 because x != 0
+    return (unsigned)__builtin_clzll(x);
+#endif
+}
+
 
 //------------------------------------------------------------------------------
 // CustomBitSet
@@ -240,7 +269,7 @@ struct CustomBitSet
         bitStart < kValidBits: First bit to test
         bitEnd <= kValidBits: Bit to stop at (non-inclusive)
     */
-    unsigned RangePopcount(unsigned bitStart, unsigned bitEnd)
+    unsigned RangePopcount(unsigned bitStart, unsigned bitEnd) const
     {
         static_assert(kWordBits == 64, "Update this");
 
@@ -282,7 +311,7 @@ struct CustomBitSet
 
         bitStart < kValidBits: Index to start looking
     */
-    unsigned FindFirstClear(const unsigned bitStart)
+    unsigned FindFirstClear(const unsigned bitStart) const
     {
         static_assert(kWordBits == 64, "Update this");
 
@@ -316,7 +345,7 @@ struct CustomBitSet
         bitStart < kValidBits: Index to start looking
         bitEnd <= kValidBits: Index to stop looking at
     */
-    unsigned FindFirstSet(unsigned bitStart, unsigned bitEnd = kValidBits)
+    unsigned FindFirstSet(unsigned bitStart, unsigned bitEnd = kValidBits) const
     {
         static_assert(kWordBits == 64, "Update this");
 
@@ -345,6 +374,103 @@ struct CustomBitSet
         return bitEnd;
     }
 
+    /// Number of holes FindFirstClearRun() walks before switching to the
+    /// word-at-a-time search
+    static const unsigned kClearRunHoleWalk = 4;
+
+    /**
+        Returns the bit index where the first run of 'count' clear bits starts.
+        Returns kValidBits if there is no such run.
+
+        The first few holes are walked one at a time, which nearly always finds
+        a fit.  After that each word is checked for a run in O(log count) steps
+        regardless of how many holes it has, so a fragmented bitfield costs at
+        most one pass over the words.
+
+        bitStart < kValidBits: Index to start looking
+        count > 0: Number of clear bits needed
+    */
+    unsigned FindFirstClearRun(unsigned bitStart, const unsigned count) const
+    {
+        static_assert(kWordBits == 64, "Update this");
+
+        for (unsigned i = 0; i < kClearRunHoleWalk; ++i)
+        {
+            bitStart = FindFirstClear(bitStart);
+            if (bitStart + count > kValidBits) {
+                return kValidBits;
+            }
+
+            const unsigned bitEnd = FindFirstSet(bitStart + 1, bitStart + count);
+            if (bitEnd - bitStart >= count) {
+                return bitStart;
+            }
+
+            bitStart = bitEnd + 1;
+            if (bitStart >= kValidBits) {
+                return kValidBits;
+            }
+        }
+
+        for (unsigned i = bitStart / kWordBits; i < kWords; ++i)
+        {
+            // Bits before bitStart count as set
+            WordT word = Words[i];
+            if (i == bitStart / kWordBits) {
+                word |= ((WordT)1 << (bitStart % kWordBits)) - 1;
+            }
+            if (word == kAllOnes) {
+                continue;
+            }
+
+            // Runs inside the word: Bit j of 'run' stays set while bits
+            // j..j+length-1 are all clear, doubling the length each step
+            if (count <= kWordBits)
+            {
+                WordT run = ~word;
+                for (unsigned length = 1; length < count && run != 0;)
+                {
+                    const unsigned shift = (length < count - length) ? length : count - length;
+                    run &= run >> shift;
+                    length += shift;
+                }
+
+                if (run != 0)
+                {
+                    const unsigned found = i * kWordBits + TrailingZeros64(run);
+                    return (found + count <= kValidBits) ? found : kValidBits;
+                }
+            }
+
+            // Run that starts in the clear bits at the top of the word and
+            // continues into the following words
+            const unsigned topBits = (word == 0) ? kWordBits : LeadingZeros64(word);
+            if (topBits == 0) {
+                continue;
+            }
+            const unsigned runStart = (i + 1) * kWordBits - topBits;
+
+            unsigned next = i + 1;
+            while (next < kWords && Words[next] == 0 && runStart + count > next * kWordBits) {
+                ++next;
+            }
+            unsigned runEnd = next * kWordBits;
+            if (next < kWords && Words[next] != 0) {
+                runEnd += TrailingZeros64(Words[next]);
+            }
+
+            if (runStart + count <= runEnd)
+            {
+                return (runStart + count <= kValidBits) ? runStart : kValidBits;
+            }
+
+            // Words that were clear are part of this run, so skip them
+            i = next - 1;
+        }
+
+        return kValidBits;
+    }
+
     /**
         Set a range of bits
 
@@ -437,6 +563,60 @@ struct CustomBitSet
 };
 
 
+/**
+    Prefix popcounts of a CustomBitSet, so RangePopcount() over the same set
+    costs two popcounts no matter how long the range is.
+
+    Only valid until the set is modified, and Build() must be called again.
+*/
+template<unsigned N>
+struct CustomBitSetPrefix
+{
+    typedef CustomBitSet<N> SetT;
+    static const unsigned kWordBits = SetT::kWordBits;
+
+    /// Bits set in all the words before each word
+    uint16_t Prefix[SetT::kWords + 1];
+
+
+    void Build(const SetT& set)
+    {
+        unsigned count = 0;
+        for (unsigned i = 0; i < SetT::kWords; ++i)
+        {
+            Prefix[i] = (uint16_t)count;
+            count += PopCount64(set.Words[i]);
+        }
+        Prefix[SetT::kWords] = (uint16_t)count;
+    }
+
+    /// Returns the number of bits set below the given bit.
+    /// bit <= kValidBits
+    unsigned CountBelow(const SetT& set, unsigned bit) const
+    {
+        const unsigned word = bit / kWordBits;
+        const unsigned shift = bit % kWordBits;
+
+        unsigned count = Prefix[word];
+        if (shift > 0) {
+            count += PopCount64(set.Words[word] << (kWordBits - shift));
+        }
+        return count;
+    }
+
+    /**
+        Returns the popcount of the bits within the given range.
+
+        bitStart <= bitEnd: First bit to test
+        bitEnd <= kValidBits: Bit to stop at (non-inclusive)
+    */
+    unsigned RangePopcount(const SetT& set, unsigned bitStart, unsigned bitEnd) const
+    {
+        return CountBelow(set, bitEnd) - CountBelow(set, bitStart);
+    }
+};
+
+
 //------------------------------------------------------------------------------
 // Enumerations
 
@@ -630,6 +810,17 @@ public:
     unsigned GetMemoryAllocatedBytes() const;
     bool IntegrityCheck() const;
 
+    /// Reallocate() calls that needed more space, and how many of those were
+    /// satisfied by extending into the free units after the allocation
+    uint64_t GetReallocateGrowCount() const
+    {
+        return ReallocateGrowCount;
+    }
+    uint64_t GetReallocateInPlaceCount() const
+    {
+        return ReallocateInPlaceCount;
+    }
+
 protected:
     typedef CustomBitSet<kWindowMaxUnits> UsedMaskT;
 
@@ -640,6 +831,16 @@ protected:
     static const unsigned kFallbackThresholdUnits = kWindowMaxUnits / 4;
 #endif // PKTALLOC_DISABLE
 
+    /// Units in the smallest and largest large block classes, including the
+    /// AllocationHeader.  The threshold is a power of two
+#ifdef PKTALLOC_DISABLE
+    static const unsigned kLargeMinUnits = 0;
+    static const unsigned kLargeMaxUnits = 0;
+#else // PKTALLOC_DISABLE
+    static const unsigned kLargeMinUnits = kFallbackThresholdUnits * 2;
+    static const unsigned kLargeMaxUnits = kLargeMinUnits << (kLargeClassCount - 1);
+#endif // PKTALLOC_DISABLE
+
     /// List index takes on this value if it is in the preferred list
     static const int kNotInFullList = -1;
 
@@ -691,6 +892,19 @@ protected:
 
     static_assert(kUnitSize >= (unsigned)sizeof(AllocationHeader), "too small");
 
+    /// This is in the unit in front of the AllocationHeader of each large
+    /// block.  Large blocks are only returned to the heap on dtor
+    struct LargeBlockLink
+    {
+        /// Next in the list of all large blocks
+        LargeBlockLink* AllNext;
+
+        /// Next in the free list for its class
+        LargeBlockLink* FreeNext;
+    };
+
+    static_assert(kUnitSize >= (unsigned)sizeof(LargeBlockLink), "too small");
+
     /// Round the window header size up to alignment size
     static const unsigned kWindowHeaderBytes = (unsigned)(sizeof(WindowHeader) + kAlignmentBytes - 1) & ~(kAlignmentBytes - 1);
 
@@ -711,6 +925,16 @@ protected:
     /// We switch Full to Preferred when it drops below 1/4 utilization
     static const unsigned kPreferredThresholdUnits = 3 * kWindowMaxUnits / 4;
 
+    /// All large blocks, in use or free
+    LargeBlockLink* LargeBlocks = nullptr;
+
+    /// Free large blocks for each size class
+    LargeBlockLink* LargeFree[kLargeClassCount] = {};
+
+    /// Statistics for Reallocate()
+    uint64_t ReallocateGrowCount = 0;
+    uint64_t ReallocateInPlaceCount = 0;
+
 
 #ifdef PKTALLOC_SHRINK
     /// Counter of the number of empty windows, which triggers us to clean house on Free()
@@ -726,10 +950,120 @@ protected:
     /// Allocate the units from a new window
     uint8_t* allocateFromNewWindow(unsigned units);
 
+    /// Large block functions used when the units do not fit in a window
+    uint8_t* largeAllocate(unsigned units);
+    void largeFree(AllocationHeader* regionHeader);
+
     /// Fallback functions used when the custom allocator will not work
     uint8_t* fallbackAllocate(unsigned bytes);
     void fallbackFree(uint8_t* ptr);
 };
 
 
+//------------------------------------------------------------------------------
+// SlabPool
+
+/**
+    Pool of small fixed-size objects of type T.
+
+    Objects are carved from slabs of kSlabCount objects that are allocated
+    from an Allocator, and free objects are kept on an intrusive list, so
+    Construct() and Destruct() are O(1) and there is no AllocationHeader in
+    front of each object.
+
+    Slabs are kept for reuse until Clear(), and since they belong to the
+    Allocator they are also freed when the Allocator is destroyed.
+*/
+template<class T, unsigned kSlabCount = 32>
+class SlabPool
+{
+public:
+    /// Returns nullptr if out of memory
+    T* Construct(Allocator* alloc)
+    {
+        if (!FreeList && !addSlab(alloc)) {
+            return nullptr;
+        }
+
+        Node* node = FreeList;
+        FreeList = node->NextFree;
+        ++LiveCount;
+        return new (node->Storage) T();
+    }
+
+    void Destruct(T* obj)
+    {
+        if (!obj) {
+            return;
+        }
+        obj->~T();
+
+        Node* node = reinterpret_cast<Node*>(obj);
+        node->NextFree = FreeList;
+        FreeList = node;
+        PKTALLOC_DEBUG_ASSERT(LiveCount > 0);
+        --LiveCount;
+    }
+
+    /// Give all slabs back to the allocator.
+    /// Precondition: All objects have been destructed
+    void Clear(Allocator* alloc)
+    {
+        PKTALLOC_DEBUG_ASSERT(LiveCount == 0);
+
+        for (Slab* slab = Slabs, *next; slab; slab = next)
+        {
+            next = slab->Next;
+            alloc->Free(reinterpret_cast<uint8_t*>(slab));
+        }
+
+        Slabs = nullptr;
+        FreeList = nullptr;
+    }
+
+protected:
+    union Node
+    {
+        Node* NextFree;
+        alignas(T) uint8_t Storage[sizeof(T)];
+    };
+
+    struct Slab
+    {
+        Slab* Next;
+        Node Nodes[kSlabCount];
+    };
+
+    static_assert(alignof(Slab) <= kUnitSize, "Allocator alignment too small");
+
+    /// List of all slabs
+    Slab* Slabs = nullptr;
+
+    /// List of free objects
+    Node* FreeList = nullptr;
+
+    /// Number of objects constructed and not yet destructed
+    unsigned LiveCount = 0;
+
+    bool addSlab(Allocator* alloc)
+    {
+        Slab* slab = reinterpret_cast<Slab*>(alloc->Allocate((unsigned)sizeof(Slab)));
+        if (!slab) {
+            return false;
+        }
+        slab->Next = Slabs;
+        Slabs = slab;
+
+        // Link in reverse so objects are handed out in address order
+        for (unsigned i = kSlabCount; i > 0; --i)
+        {
+            Node* node = &slab->Nodes[i - 1];
+            node->NextFree = FreeList;
+            FreeList = node;
+        }
+        return true;
+    }
+};
+
+
 } // namespace pktalloc
@@ -29,6 +29,7 @@
 
 #include "ccat.h"
 #include "CCatCodec.h"
+#include "CCatWire.h" // WriteLossReport
 #include <new> // std::nothrow
 
 namespace ccat {
@@ -97,6 +98,106 @@ CCAT_EXPORT CCatResult ccat_encode_recovery(
     return session->EncodeRecovery(*recoveryOut);
 }
 
+CCAT_EXPORT CCatResult ccat_encode_recovery_priority(
+    CCatCodec codec,
+    unsigned minPriority,
+    CCatRecovery* recoveryOut
+)
+{
+    Codec* session = reinterpret_cast<Codec*>(codec);
+    if (!session || !recoveryOut) {
+        return CCat_InvalidInput;
+    }
+
+    return session->EncodeRecoveryPriority(minPriority, *recoveryOut);
+}
+
+CCAT_EXPORT CCatResult ccat_encode_recovery_span(
+    CCatCodec codec,
+    uint64_t sequenceStart,
+    unsigned count,
+    CCatRecovery* recoveryOut
+)
+{
+    Codec* session = reinterpret_cast<Codec*>(codec);
+    if (!session || !recoveryOut) {
+        return CCat_InvalidInput;
+    }
+
+    return session->EncodeRecoverySpan(sequenceStart, count, *recoveryOut);
+}
+
+CCAT_EXPORT CCatResult ccat_encode_recovery_submit(
+    CCatCodec codec
+)
+{
+    Codec* session = reinterpret_cast<Codec*>(codec);
+    if (!session) {
+        return CCat_InvalidInput;
+    }
+
+    return session->SubmitRecovery();
+}
+
+CCAT_EXPORT CCatResult ccat_encode_recovery_complete(
+    CCatCodec codec,
+    CCatRecovery* recoveryOut
+)
+{
+    Codec* session = reinterpret_cast<Codec*>(codec);
+    if (!session || !recoveryOut) {
+        return CCat_InvalidInput;
+    }
+
+    return session->CompleteRecovery(*recoveryOut);
+}
+
+CCAT_EXPORT CCatResult ccat_encode_loss_report(
+    CCatCodec codec,
+    const CCatLossReport* report
+)
+{
+    Codec* session = reinterpret_cast<Codec*>(codec);
+    if (!session || !report) {
+        return CCat_InvalidInput;
+    }
+
+    return session->EncodeLossReport(*report);
+}
+
+CCAT_EXPORT CCatResult ccat_encode_parse_loss_report(
+    CCatCodec codec,
+    const uint8_t* data,
+    unsigned bytes,
+    CCatLossReport* reportOut
+)
+{
+    Codec* session = reinterpret_cast<Codec*>(codec);
+    if (!session || !data) {
+        return CCat_InvalidInput;
+    }
+
+    CCatLossReport report;
+    if (!reportOut) {
+        reportOut = &report;
+    }
+
+    return session->ParseLossReport(data, bytes, *reportOut);
+}
+
+CCAT_EXPORT CCatResult ccat_encode_recovery_due(
+    CCatCodec codec,
+    unsigned* dueOut
+)
+{
+    Codec* session = reinterpret_cast<Codec*>(codec);
+    if (!session || !dueOut) {
+        return CCat_InvalidInput;
+    }
+
+    return session->GetRecoveryDue(*dueOut);
+}
+
 CCAT_EXPORT CCatResult ccat_decode_original(
     CCatCodec codec,
     const CCatOriginal* original
@@ -116,11 +217,11 @@ CCAT_EXPORT CCatResult ccat_decode_recovery(
 )
 {
     Codec* session = reinterpret_cast<Codec*>(codec);
-    if (!session) {
+    if (!session || !recovery) {
         return CCat_InvalidInput;
     }
 
-    CCatResult result = session->DecodeRecovery(*recovery);
+    CCatResult result = session->DecodeRecovery(*recovery, nullptr);
 
     if (result == CCat_NeedsMoreData) {
         // If we need more data, just return a success code to simplify the API.
@@ -130,6 +231,124 @@ CCAT_EXPORT CCatResult ccat_decode_recovery(
     return result;
 }
 
+CCAT_EXPORT CCatResult ccat_decode_recovery_sparse(
+    CCatCodec codec,
+    const CCatRecovery* recovery,
+    const uint8_t* columnMask
+)
+{
+    Codec* session = reinterpret_cast<Codec*>(codec);
+    if (!session || !recovery || !columnMask) {
+        return CCat_InvalidInput;
+    }
+
+    CCatResult result = session->DecodeRecovery(*recovery, columnMask);
+
+    if (result == CCat_NeedsMoreData) {
+        return CCat_Success;
+    }
+
+    return result;
+}
+
+CCAT_EXPORT CCatResult ccat_decode_batch(
+    CCatCodec codec,
+    const CCatOriginal* originals,
+    unsigned originalCount,
+    const CCatRecovery* recovery,
+    unsigned recoveryCount
+)
+{
+    Codec* session = reinterpret_cast<Codec*>(codec);
+    if (!session ||
+        (originalCount > 0 && !originals) ||
+        (recoveryCount > 0 && !recovery))
+    {
+        return CCat_InvalidInput;
+    }
+
+    CCatResult batchResult = CCat_Success;
+
+    // Decode originals first so recovery packets see the latest losses
+    for (unsigned i = 0; i < originalCount; ++i)
+    {
+        const CCatResult result = session->DecodeOriginal(originals[i]);
+        if (result != CCat_Success && batchResult == CCat_Success) {
+            batchResult = result;
+        }
+    }
+
+    for (unsigned i = 0; i < recoveryCount; ++i)
+    {
+        const CCatResult result = session->DecodeRecovery(recovery[i], nullptr);
+        if (result != CCat_Success &&
+            result != CCat_NeedsMoreData &&
+            batchResult == CCat_Success)
+        {
+            batchResult = result;
+        }
+    }
+
+    return batchResult;
+}
+
+CCAT_EXPORT CCatResult ccat_decode_get_loss_report(
+    CCatCodec codec,
+    CCatLossReport* reportOut,
+    uint8_t* buffer,
+    unsigned bufferBytes,
+    unsigned* bytesOut
+)
+{
+    Codec* session = reinterpret_cast<Codec*>(codec);
+    if (!session ||
+        (buffer && (bufferBytes < CCAT_LOSS_REPORT_MAX_BYTES || !bytesOut)))
+    {
+        return CCat_InvalidInput;
+    }
+
+    CCatLossReport report;
+    if (!reportOut) {
+        reportOut = &report;
+    }
+
+    session->GetLossReport(*reportOut);
+
+    if (buffer) {
+        *bytesOut = WriteLossReport(*reportOut, buffer);
+    }
+
+    return CCat_Success;
+}
+
+CCAT_EXPORT CCatResult ccat_decode_get_stats(
+    CCatCodec codec,
+    CCatStats* statsOut
+)
+{
+    Codec* session = reinterpret_cast<Codec*>(codec);
+    if (!session || !statsOut) {
+        return CCat_InvalidInput;
+    }
+
+    session->GetStats(*statsOut);
+    return CCat_Success;
+}
+
+CCAT_EXPORT CCatResult ccat_decode_set_deadline(
+    CCatCodec codec,
+    uint64_t sequenceNumber
+)
+{
+    Codec* session = reinterpret_cast<Codec*>(codec);
+    if (!session) {
+        return CCat_InvalidInput;
+    }
+
+    session->SetDeadline(sequenceNumber);
+    return CCat_Success;
+}
+
 CCAT_EXPORT CCatResult ccat_destroy(
     CCatCodec codec
 )
@@ -144,6 +363,137 @@ CCAT_EXPORT CCatResult ccat_destroy(
     return CCat_Success;
 }
 
+CCAT_EXPORT CCatResult ccat_reset(
+    CCatCodec codec,
+    const CCatSettings* settings
+)
+{
+    Codec* session = reinterpret_cast<Codec*>(codec);
+    if (!session || !settings) {
+        return CCat_InvalidInput;
+    }
+
+    return session->Reset(*settings);
+}
+
+CCAT_EXPORT CCatResult ccat_serialize(
+    CCatCodec codec,
+    uint8_t* buffer,
+    unsigned bufferBytes,
+    unsigned* bytesOut
+)
+{
+    Codec* session = reinterpret_cast<Codec*>(codec);
+    if (!session || !bytesOut) {
+        return CCat_InvalidInput;
+    }
+
+    return session->Serialize(buffer, bufferBytes, *bytesOut);
+}
+
+CCAT_EXPORT CCatResult ccat_deserialize(
+    CCatCodec codec,
+    const uint8_t* data,
+    unsigned bytes
+)
+{
+    Codec* session = reinterpret_cast<Codec*>(codec);
+    if (!session || !data) {
+        return CCat_InvalidInput;
+    }
+
+    return session->Deserialize(data, bytes);
+}
+
+CCAT_EXPORT CCatResult ccat_pool_create(
+    unsigned capacity,
+    CCatPool* poolOut
+)
+{
+    if (!poolOut) {
+        return CCat_InvalidInput;
+    }
+
+    *poolOut = nullptr;
+
+    const int gf256Result = gf256_init();
+    if (gf256Result != 0) {
+        return CCat_Error;
+    }
+
+    CodecPool* pool = new (std::nothrow) CodecPool;
+    if (!pool) {
+        return CCat_OOM;
+    }
+
+    const CCatResult initResult = pool->Initialize(capacity);
+    if (initResult != CCat_Success)
+    {
+        delete pool;
+        return initResult;
+    }
+
+    *poolOut = reinterpret_cast<CCatPool>( pool );
+    return CCat_Success;
+}
+
+CCAT_EXPORT CCatResult ccat_pool_acquire(
+    CCatPool pool,
+    const CCatSettings* settings,
+    CCatCodec* codecOut
+)
+{
+    CodecPool* codecPool = reinterpret_cast<CodecPool*>(pool);
+    if (!codecPool || !settings || !codecOut) {
+        return CCat_InvalidInput;
+    }
+
+    *codecOut = nullptr;
+
+    Codec* codec = nullptr;
+    const CCatResult result = codecPool->Acquire(*settings, codec);
+    if (result != CCat_Success)
+    {
+        if (codec) {
+            codecPool->Release(codec);
+        }
+        return result;
+    }
+
+    *codecOut = reinterpret_cast<CCatCodec>( codec );
+    return CCat_Success;
+}
+
+CCAT_EXPORT CCatResult ccat_pool_release(
+    CCatPool pool,
+    CCatCodec codec
+)
+{
+    CodecPool* codecPool = reinterpret_cast<CodecPool*>(pool);
+    Codec* session = reinterpret_cast<Codec*>(codec);
+    if (!codecPool || !session) {
+        return CCat_InvalidInput;
+    }
+
+    codecPool->Release(session);
+
+    return CCat_Success;
+}
+
+CCAT_EXPORT CCatResult ccat_pool_destroy(
+    CCatPool pool
+)
+{
+    CodecPool* codecPool = reinterpret_cast<CodecPool*>(pool);
+    if (!codecPool) {
+        return CCat_InvalidInput;
+    }
+
+    delete codecPool;
+
+    return CCat_Success;
+}
+
 
 } // extern "C"
 
@@ -46,22 +46,39 @@
     Usage:
 
     (1) Call ccat_create() to create a CCatCodec object.
+    To reuse a codec for a new stream without heap traffic, call ccat_reset()
+    or take codecs from a CCatPool with ccat_pool_acquire().
 
     (2) When sending a packet, pass it to ccat_encode_original().
 
     (3) To encode recovery data, call ccat_encode_recovery(), which generates
     a packet that can be sent over the network to fill in for losses.
+    To let the library pick the rate instead, set TargetLossRate, send the
+    receiver's ccat_decode_get_loss_report() output back to
+    ccat_encode_parse_loss_report(), and call ccat_encode_recovery() as
+    often as ccat_encode_recovery_due() says.  To repair the missing ranges
+    in a loss report, call ccat_encode_recovery_span() instead.  To protect
+    some originals more than others, set CCatOriginal::Priority and mix in
+    packets from ccat_encode_recovery_priority().  To keep the recovery math
+    off the send thread, use ccat_encode_recovery_submit() and
+    ccat_encode_recovery_complete() instead of ccat_encode_recovery().
 
     (4) When receiving a packet, pass originals to ccat_decode_original().
-    Pass encoded data to the ccat_decode_recovery() function.  When recovery
-    occurs it will call the application's OnRecoveredData() callback.
+    Pass encoded data to the ccat_decode_recovery() function, or to
+    ccat_decode_recovery_sparse() for packets from
+    ccat_encode_recovery_priority().  When recovery occurs it will call the
+    application's OnRecoveredData() callback.
 
     Thread-safety:
 
     Applications using the library can use different locks to protect the
     ccat_encode_*() functions and the ccat_decode_*() functions, because no data
-    is shared between those.  Otherwise the library is not thread-safe and
-    does require locking on the application-side.
+    is shared between those.  The encoder and decoder each have their own
+    memory allocator and sit on separate cache lines, so one thread may encode
+    while another thread decodes on the same codec without any locking and
+    without false sharing.  The ccat_pool_*() functions are thread-safe.
+    Otherwise the library is not thread-safe and does require locking on
+    the application-side.
 
     Packet de-duplication:
 
@@ -128,6 +145,30 @@ extern "C" {
 /// Minimum size of encoder window in milliseconds
 #define CCAT_MIN_WINDOW_MSEC 10
 
+/// Number of writable bytes reserved in front of CCatRecovery::Data.
+/// The application may write its packet header there to avoid a copy
+#define CCAT_RECOVERY_HEADROOM 32
+
+/// Bytes in the largest CCatRecovery::ColumnMask
+#define CCAT_COLUMN_MASK_BYTES (CCAT_MAX_WINDOW_PACKETS / 8)
+
+/// Maximum number of jobs from ccat_encode_recovery_submit() that have not
+/// been returned by ccat_encode_recovery_complete()
+#define CCAT_MAX_RECOVERY_JOBS 15
+
+/// Number of writable bytes the decoder needs in front of CCatOriginal::Data
+/// when zero-copy retention is enabled (see CCatSettings::OnReleaseOriginal)
+#define CCAT_DECODE_HEADROOM 2
+
+/// Number of loss burst length bins in CCatLossReport
+#define CCAT_LOSS_BURST_BINS 4
+
+/// Maximum number of missing ranges in CCatLossReport
+#define CCAT_LOSS_REPORT_MAX_RANGES 8
+
+/// Buffer size that always fits a serialized loss report
+#define CCAT_LOSS_REPORT_MAX_BYTES 64
+
 /// These are the result codes that can be returned from the ccat_*() functions
 typedef enum CCatResult_t
 {
@@ -159,6 +200,9 @@ typedef enum CCatResult_t
 /// CCatCodec: Represents a UDP port socket running the CCat proxy
 typedef struct CCatCodec_t { int impl; }* CCatCodec;
 
+/// CCatPool: Pool of idle codecs that can be reused
+typedef struct CCatPool_t { int impl; }* CCatPool;
+
 /// CCatAppContextPtr: Points to application context data
 typedef void* CCatAppContext;
 
@@ -174,8 +218,14 @@ typedef struct CCatOriginal_t
     /// Packet sequence number.
     /// This must be an incrementing sequence number, starting from 0, which
     /// increments by 1 each time a packet is sent.
-    /// Suggestion: Truncate this and reconstruct it using Counter.h
+    /// Suggestion: Truncate this and reconstruct it using Counter.h,
+    /// or use the wire format provided by CCatWire.h
     uint64_t SequenceNumber;
+
+    /// Optional: Priority for unequal error protection, 0 = normal.
+    /// Read by ccat_encode_recovery_priority().  Not provided by the decoder.
+    /// C applications must set this when passing originals to the encoder
+    uint8_t Priority CCAT_CPP( = 0 );
 } CCatOriginal;
 
 /// CCat Recovery Packet generated by ccat_encode_recovery()
@@ -183,10 +233,13 @@ typedef struct CCatRecovery_t
 {
     /// Sequence start parameter.
     /// Provided by ccat_encode_recovery().
-    /// Suggestion: Truncate this and reconstruct it using Counter.h
+    /// Suggestion: Truncate this and reconstruct it using Counter.h,
+    /// or use the wire format provided by CCatWire.h
     uint64_t SequenceStart;
 
-    /// Pointer to buffer containing recovery data
+    /// Pointer to buffer containing recovery data.
+    /// When provided by ccat_encode_recovery(), CCAT_RECOVERY_HEADROOM bytes
+    /// in front of this pointer may be overwritten by the application
     const uint8_t* Data;
 
     /// Number of bytes in buffer
@@ -199,8 +252,72 @@ typedef struct CCatRecovery_t
 
     /// Recovery row parameter: Ranges from 0 ... CCAT_MAX_RECOVERY_ROW
     uint8_t RecoveryRow;
+
+    /// Column mask for sparse recovery packets from
+    /// ccat_encode_recovery_priority(), or null if every original in the span
+    /// is included.  Bit i (LSB first) of byte i/8 is set if original
+    /// SequenceStart + i is included, for (Count + 7) / 8 bytes.
+    /// Output only: The decoder never reads it, so pass it explicitly to
+    /// ccat_decode_recovery_sparse()
+    const uint8_t* ColumnMask CCAT_CPP( = nullptr );
 } CCatRecovery;
 
+/// Range of originals missing at the receiver
+typedef struct CCatMissingRange_t
+{
+    /// First missing sequence number
+    uint64_t SequenceStart;
+
+    /// Number of consecutive missing originals
+    unsigned Count;
+} CCatMissingRange;
+
+/// Loss report produced by the receiver for the sender's rate controller,
+/// covering the originals expected since the previous report
+typedef struct CCatLossReport_t
+{
+    /// Number of originals expected
+    unsigned Expected;
+
+    /// Number of those originals that did not arrive
+    unsigned Lost;
+
+    /// Number of lost originals that were recovered
+    unsigned Recovered;
+
+    /// Count of loss bursts by length: 1, 2, 3, and 4 or more packets.
+    /// May be all zero if the receiver does not track bursts
+    unsigned Bursts[CCAT_LOSS_BURST_BINS];
+
+    /// Optional fields filled in by ccat_decode_get_loss_report().
+    /// They may be left zero by applications that build their own reports:
+
+    /// Number of originals that left the receiver window without recovery
+    unsigned Unrecovered;
+
+    /// One beyond the largest sequence number known to the receiver
+    uint64_t SequenceEnd;
+
+    /// Ranges still missing in the receiver window, oldest first.
+    /// Only the newest CCAT_LOSS_REPORT_MAX_RANGES ranges are included
+    unsigned MissingCount;
+    CCatMissingRange Missing[CCAT_LOSS_REPORT_MAX_RANGES];
+} CCatLossReport;
+
+/// Decoder counters returned by ccat_decode_get_stats()
+typedef struct CCatStats_t
+{
+    /// Recovery packets dropped because an identical packet was stored
+    uint64_t DuplicateRecovery;
+
+    /// Recovery packets dropped because their originals left the window
+    uint64_t StaleRecovery;
+
+    /// Solves skipped because every loss was past the deadline
+    /// (see CCatSettings::DeadlinePackets and ccat_decode_set_deadline())
+    uint64_t LateRecovery;
+} CCatStats;
+
 /// CCat Settings
 typedef struct CCatSettings_t
 {
@@ -227,6 +344,97 @@ typedef struct CCatSettings_t
         CCatOriginal original, ///< Recovered original data
         CCatAppContext context ///< AppContextPtr
         ) CCAT_CPP( = nullptr );
+
+    /**
+        OnReleaseOriginal()
+
+        Optional: Provide a callback function to enable zero-copy retention.
+
+        By default ccat_decode_original() copies the original data.  When this
+        callback is set, the decoder instead keeps a pointer to the buffer the
+        application passed in and writes its length field into the
+        CCAT_DECODE_HEADROOM bytes in front of CCatOriginal::Data, so those
+        bytes must be writable.  The packet header parsed by CCatWire.h is
+        always large enough for this.
+
+        Every buffer passed to ccat_decode_original() or ccat_decode_batch()
+        is handed back through this callback exactly once: immediately if it
+        was not kept (duplicate, out of window, error), or later when it
+        leaves the decoder window or the codec is destroyed.  The same Data,
+        Bytes and SequenceNumber are provided.  Up to 2x CCAT_MAX_WINDOW_PACKETS
+        buffers may be held by one codec.
+
+        It is provided the AppContextPtr in the settings.
+    */
+    void (*OnReleaseOriginal)(
+        CCatOriginal original, ///< Original data being released
+        CCatAppContext context ///< AppContextPtr
+        ) CCAT_CPP( = nullptr );
+
+    /**
+        TargetLossRate
+
+        Optional: Set to enable the adaptive recovery rate controller.
+
+        This is the effective loss rate the application can tolerate after
+        recovery, for example 0.001 for 0.1%.  The controller picks the
+        lowest recovery rate that meets it from the reports passed to
+        ccat_encode_loss_report(), and ccat_encode_recovery_due() reports
+        when to send recovery packets.  0 disables the controller.
+    */
+    float TargetLossRate CCAT_CPP( = 0.f );
+
+    /**
+        SharedSolver
+
+        Optional: Set to non-zero to share the multi-loss solver state with
+        the other codecs decoding on the same thread that also set it.
+
+        Each decoder otherwise allocates about 6 KB of solver state plus a
+        solution matrix the first time it recovers two or more losses at once,
+        and keeps it.  A solve always finishes within one ccat_decode_*()
+        call, so codecs on one thread can take turns with a single copy.
+    */
+    unsigned SharedSolver CCAT_CPP( = 0 );
+
+    /**
+        OnAllocateRecovered()
+
+        Optional: Provide a callback function to decode recovered data
+        directly into application memory.  Ignored unless OnReleaseOriginal()
+        is also set.
+
+        Before recovering an original packet the decoder asks for a buffer of
+        at least the given number of bytes, which covers CCAT_DECODE_HEADROOM
+        plus the recovered data and any padding the decoder needs.  The data
+        is decoded in place and OnRecoveredData() is given a pointer to
+        buffer + CCAT_DECODE_HEADROOM, so the application does not need to
+        copy it.  The decoder keeps a borrowed reference for later recoveries
+        and hands the buffer back through OnReleaseOriginal() exactly once,
+        like a retained original.  If the recovery fails, the buffer is handed
+        back with Bytes = 0 without being reported.
+
+        Return null to have the decoder use its own memory instead.
+
+        It is provided the AppContextPtr in the settings.
+    */
+    uint8_t* (*OnAllocateRecovered)(
+        unsigned bytes, ///< Minimum buffer size in bytes
+        CCatAppContext context ///< AppContextPtr
+        ) CCAT_CPP( = nullptr );
+
+    /**
+        DeadlinePackets
+
+        Optional: Set to skip recovery of losses that would be too late.
+
+        Losses more than this many packets behind the newest sequence number
+        the decoder has seen are past the deadline.  A recovery whose losses
+        are all past the deadline is skipped, so no time is spent solving for
+        data the application would throw away.  0 disables the deadline.
+        See also ccat_decode_set_deadline().
+    */
+    unsigned DeadlinePackets CCAT_CPP( = 0 );
 } CCatSettings;
 
 
@@ -281,11 +489,163 @@ CCAT_EXPORT CCatResult ccat_encode_recovery(
     CCatRecovery* recoveryOut
 );
 
+/**
+    ccat_encode_recovery_priority()
+
+    Generate a recovery message over the same window as ccat_encode_recovery()
+    that only includes originals with Priority >= minPriority.  Interleave
+    these with ccat_encode_recovery() to spend more of the recovery budget on
+    the originals that matter most, such as keyframes and audio.
+
+    The packet is sparse: recoveryOut->ColumnMask lists the included
+    originals and must be sent along with it (CCatWire.h does this), and the
+    receiver passes it to ccat_decode_recovery_sparse().  If every original
+    qualifies, ColumnMask is null and the packet is an ordinary one.
+    If only one qualifies, the original data itself is provided.  These
+    packets are not counted by the adaptive recovery rate.
+
+    Returns CCat_Success on success.
+    Returns CCat_NeedsMoreData if no original in the window qualifies.
+    Returns other values on error.
+*/
+CCAT_EXPORT CCatResult ccat_encode_recovery_priority(
+    CCatCodec codec,
+    unsigned minPriority,
+    CCatRecovery* recoveryOut
+);
+
+/**
+    ccat_encode_recovery_span()
+
+    Generate a recovery message covering only the originals from sequenceStart
+    up to sequenceStart + count - 1, for targeted repair of the losses in a
+    loss report.  To repair a CCatMissingRange, call this Count times with
+    the range's SequenceStart and Count.  Each call uses a new recovery row,
+    so the receiver can solve any count losses in the span.  A span of one
+    packet yields the original data itself.
+
+    Originals that have left the encoder window are trimmed from the front
+    of the span, and recoveryOut describes the span actually encoded.  These
+    packets are not counted by the adaptive recovery rate.
+
+    Returns CCat_Success on success.
+    Returns CCat_NeedsMoreData if no part of the span is still in the window.
+    Returns CCat_InvalidInput if count is 0 or above CCAT_MAX_WINDOW_PACKETS,
+    or the span ends after the last original.
+    Returns other values on error.
+*/
+CCAT_EXPORT CCatResult ccat_encode_recovery_span(
+    CCatCodec codec,
+    uint64_t sequenceStart,
+    unsigned count,
+    CCatRecovery* recoveryOut
+);
+
+/**
+    ccat_encode_recovery_submit()
+
+    Asynchronous version of ccat_encode_recovery().  The recovery window and
+    row are chosen now, exactly as ccat_encode_recovery() would, and the
+    recovery data is computed by a worker thread that the codec starts on
+    first use.  Collect the packet later with ccat_encode_recovery_complete().
+    The adaptive recovery rate counts the packet when it is submitted.
+
+    The encoder keeps the originals a job reads until the job is done.  It
+    stores the last CCAT_MAX_WINDOW_PACKETS originals, so with WindowPackets
+    set to W, ccat_encode_original() waits for a job that is still running
+    after CCAT_MAX_WINDOW_PACKETS - W newer originals.  Keep W well below
+    CCAT_MAX_WINDOW_PACKETS to leave the worker that much time.
+
+    All other calls on the codec, including this one, must still be made
+    from one thread at a time.
+
+    Returns CCat_Success on success.
+    Returns CCat_NeedsMoreData if recovery packets cannot be produced.
+    Returns CCat_Error if CCAT_MAX_RECOVERY_JOBS jobs have not been returned
+    by ccat_encode_recovery_complete() yet.
+    Returns other values on error.
+*/
+CCAT_EXPORT CCatResult ccat_encode_recovery_submit(
+    CCatCodec codec
+);
+
+/**
+    ccat_encode_recovery_complete()
+
+    Returns the oldest finished job from ccat_encode_recovery_submit(), in
+    the order they were submitted.  This does not wait for the worker.
+
+    recoveryOut is filled in as by ccat_encode_recovery(), and its Data
+    remains valid until the next call to this function or ccat_reset().
+    A job over a single original provides a copy of the original data.
+
+    Returns CCat_Success on success.
+    Returns CCat_NeedsMoreData if the oldest job is not finished yet, or no
+    jobs were submitted.
+*/
+CCAT_EXPORT CCatResult ccat_encode_recovery_complete(
+    CCatCodec codec,
+    CCatRecovery* recoveryOut
+);
+
+/**
+    ccat_encode_loss_report()
+
+    When a loss report arrives from the receiver, pass it to this function to
+    update the adaptive recovery rate.  Ignored unless
+    CCatSettings::TargetLossRate is set.
+
+    Returns CCat_Success on success.
+    Returns CCat_InvalidInput if Lost > Expected or Recovered > Lost.
+*/
+CCAT_EXPORT CCatResult ccat_encode_loss_report(
+    CCatCodec codec,
+    const CCatLossReport* report
+);
+
+/**
+    ccat_encode_parse_loss_report()
+
+    When a serialized loss report from ccat_decode_get_loss_report() arrives
+    from the receiver, pass it to this function.  It is parsed and passed to
+    ccat_encode_loss_report().
+
+    Optional: If reportOut is not null it is filled in with the parsed report,
+    with sequence numbers fully expanded.
+
+    Returns CCat_Success on success.
+    Returns CCat_InvalidInput if the data is not a valid loss report.
+*/
+CCAT_EXPORT CCatResult ccat_encode_parse_loss_report(
+    CCatCodec codec,
+    const uint8_t* data,
+    unsigned bytes,
+    CCatLossReport* reportOut
+);
+
+/**
+    ccat_encode_recovery_due()
+
+    After calling ccat_encode_original(), call this function to find out how
+    many times ccat_encode_recovery() should be called now to hold the
+    adaptive recovery rate.  Requires CCatSettings::TargetLossRate.
+
+    Returns CCat_Success on success, and dueOut is set to the count.
+    Returns CCat_InvalidInput if the controller is not enabled.
+*/
+CCAT_EXPORT CCatResult ccat_encode_recovery_due(
+    CCatCodec codec,
+    unsigned* dueOut
+);
+
 /**
     ccat_decode_original()
 
     When the app receives an original packet, pass it to this function.
 
+    If CCatSettings::OnReleaseOriginal is set, the buffer is borrowed until it
+    is handed back through that callback.
+
     Returns CCat_Success on success.
     Returns other codes on failure.
 */
@@ -299,7 +659,13 @@ CCAT_EXPORT CCatResult ccat_decode_original(
 
     When the app receives a recovery packet, pass it to this function.
 
+    recovery->ColumnMask is not read, so the packet always covers every
+    original in its span.  Pass sparse packets to
+    ccat_decode_recovery_sparse() instead.
+
     Returns CCat_Success on success.
+    Returns CCat_InvalidInput if recovery or its Data is null, or its Count
+    is 0 or above CCAT_MAX_WINDOW_PACKETS.
     Returns other codes on failure.
 */
 CCAT_EXPORT CCatResult ccat_decode_recovery(
@@ -307,6 +673,108 @@ CCAT_EXPORT CCatResult ccat_decode_recovery(
     const CCatRecovery* recovery
 );
 
+/**
+    ccat_decode_recovery_sparse()
+
+    When the app receives a sparse recovery packet from
+    ccat_encode_recovery_priority(), pass it to this function along with its
+    column mask, which has (recovery->Count + 7) / 8 bytes in the same layout
+    as CCatRecovery::ColumnMask.  recovery->ColumnMask is not read.
+
+    Returns CCat_Success on success.
+    Returns CCat_InvalidInput if recovery or columnMask is null, or as for
+    ccat_decode_recovery().
+    Returns other codes on failure.
+*/
+CCAT_EXPORT CCatResult ccat_decode_recovery_sparse(
+    CCatCodec codec,
+    const CCatRecovery* recovery,
+    const uint8_t* columnMask
+);
+
+/**
+    ccat_decode_batch()
+
+    When the app receives several packets at once (for example from one
+    recvmmsg() call), pass them all to this function.
+
+    Originals are decoded before recovery packets, so that recovery packets
+    see the latest loss state and are less likely to be stored for later.
+    Either count may be zero.  Recovery packets are decoded as by
+    ccat_decode_recovery(), so sparse packets must not be included.
+
+    Returns CCat_Success on success.
+    Returns the first failure code otherwise, after processing the whole batch.
+*/
+CCAT_EXPORT CCatResult ccat_decode_batch(
+    CCatCodec codec,
+    const CCatOriginal* originals,
+    unsigned originalCount,
+    const CCatRecovery* recovery,
+    unsigned recoveryCount
+);
+
+/**
+    ccat_decode_get_loss_report()
+
+    Call this function about once per round trip to produce a loss report
+    to send back to the encoder.  The report covers the originals expected
+    since the previous call, and lists the ranges still missing in the
+    decoder window.  The counters are kept up to date as packets are decoded,
+    so this is cheap.
+
+    Optional: If reportOut is not null it is filled in with the report.
+
+    Optional: If buffer is not null, the report is also serialized into it
+    in a compact form of at most CCAT_LOSS_REPORT_MAX_BYTES bytes, which the
+    encoder side passes to ccat_encode_parse_loss_report().  bufferBytes must
+    be at least CCAT_LOSS_REPORT_MAX_BYTES and bytesOut is set to the size.
+
+    Returns CCat_Success on success.
+    Returns CCat_InvalidInput if the buffer is too small.
+*/
+CCAT_EXPORT CCatResult ccat_decode_get_loss_report(
+    CCatCodec codec,
+    CCatLossReport* reportOut,
+    uint8_t* buffer,
+    unsigned bufferBytes,
+    unsigned* bytesOut
+);
+
+/**
+    ccat_decode_get_stats()
+
+    Reads the decoder counters.  Like the other ccat_decode_*() functions it
+    must not run at the same time as them.  ccat_reset() zeroes the counters.
+
+    Returns CCat_Success on success.
+    Returns other codes on failure.
+*/
+CCAT_EXPORT CCatResult ccat_decode_get_stats(
+    CCatCodec codec,
+    CCatStats* statsOut
+);
+
+/**
+    ccat_decode_set_deadline()
+
+    Sets the oldest sequence number that is still worth recovering, for
+    example the next packet due for playout.  Losses before it are past the
+    deadline, and a recovery whose losses are all past the deadline is
+    skipped to save CPU time.  This lets the application apply a deadline in
+    time by tracking which packets can still be played.
+
+    When CCatSettings::DeadlinePackets is also set, the later of the two
+    deadlines is used.  ccat_reset() clears the deadline.
+
+    Returns CCat_Success on success.
+    Returns other codes on failure.
+*/
+CCAT_EXPORT CCatResult ccat_decode_set_deadline(
+    CCatCodec codec,
+    uint64_t sequenceNumber
+);
+
 /**
     ccat_destroy()
 
@@ -317,6 +785,128 @@ CCAT_EXPORT CCatResult ccat_destroy(
     CCatCodec codec
 );
 
+/**
+    ccat_reset()
+
+    Returns the codec to the state of a newly created codec with the given
+    settings, keeping the memory it has already allocated, so no heap
+    allocation is needed to reuse it for a new stream.
+
+    Borrowed original data is released first through the OnReleaseOriginal()
+    callback of the old settings.  Jobs from ccat_encode_recovery_submit()
+    are waited for and dropped, and the worker thread is kept for reuse.
+
+    Returns CCat_Success on success.
+    Returns other codes on failure.
+*/
+CCAT_EXPORT CCatResult ccat_reset(
+    CCatCodec codec,
+    const CCatSettings* settings
+);
+
+/**
+    ccat_serialize()
+
+    Saves the codec state so an idle stream can be destroyed and restored
+    later with ccat_deserialize(): the encoder window, the decoder window and
+    its stored recovery packets, and the sequence and row counters.
+    Settings, callbacks and recovery jobs are not saved.
+
+    Pass a null buffer to get the size in bytesOut.  Borrowed original data
+    is copied into the buffer and is still released by the codec as usual.
+    The format is only meant to be read back by the same library build.
+
+    Neither ccat_encode_*() nor ccat_decode_*() may run at the same time.
+
+    Returns CCat_Success on success, bytesOut is set to the size.
+    Returns CCat_InvalidInput if the buffer is too small.
+*/
+CCAT_EXPORT CCatResult ccat_serialize(
+    CCatCodec codec,
+    uint8_t* buffer,
+    unsigned bufferBytes,
+    unsigned* bytesOut
+);
+
+/**
+    ccat_deserialize()
+
+    Replaces the codec state with state saved by ccat_serialize().  The codec
+    may come from ccat_create(), ccat_reset() or ccat_pool_acquire(), and
+    should have the same settings as the codec that was saved.  Borrowed
+    original data held by the codec is released first.
+
+    Returns CCat_Success on success.
+    Returns CCat_InvalidInput if the data is malformed or from another
+    version, and the codec is left as if just reset.
+*/
+CCAT_EXPORT CCatResult ccat_deserialize(
+    CCatCodec codec,
+    const uint8_t* data,
+    unsigned bytes
+);
+
+
+//------------------------------------------------------------------------------
+// Codec Pool
+
+/**
+    ccat_pool_create()
+
+    Creates a thread-safe pool that keeps up to capacity idle codecs.
+    Codecs are created on demand, so the pool starts out empty.
+
+    Returns CCat_Success on success, poolOut is set to the created pool.
+    Returns other codes on failure, poolOut will be 0.
+*/
+CCAT_EXPORT CCatResult ccat_pool_create(
+    unsigned capacity,
+    CCatPool* poolOut
+);
+
+/**
+    ccat_pool_acquire()
+
+    Takes an idle codec from the pool and applies the settings, or creates
+    a new codec if the pool is empty.
+
+    Returns CCat_Success on success, codecOut is set to the codec.
+    Returns other codes on failure.
+*/
+CCAT_EXPORT CCatResult ccat_pool_acquire(
+    CCatPool pool,
+    const CCatSettings* settings,
+    CCatCodec* codecOut
+);
+
+/**
+    ccat_pool_release()
+
+    Resets the codec and returns it to the pool, or destroys it if the pool
+    is full.  Borrowed original data is released before this returns.
+    The codec may come from ccat_create() or from any pool.
+
+    Returns CCat_Success on success.
+    Returns other codes on failure.
+*/
+CCAT_EXPORT CCatResult ccat_pool_release(
+    CCatPool pool,
+    CCatCodec codec
+);
+
+/**
+    ccat_pool_destroy()
+
+    Destroys the pool and the idle codecs in it.  Codecs that have been
+    acquired are not affected and may still be passed to ccat_destroy().
+
+    Returns CCat_Success on success.
+    Returns other codes on failure.
+*/
+CCAT_EXPORT CCatResult ccat_pool_destroy(
+    CCatPool pool
+);
+
 
 #ifdef __cplusplus
 }
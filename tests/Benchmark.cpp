@@ -0,0 +1,1293 @@
+/** \file
+    \brief CCat Benchmarks
+    \copyright Copyright (c) 2018 Christopher A. Taylor.  All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of CCat nor the names of its contributors may be
+      used to endorse or promote products derived from this software without
+      specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+    ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+    SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+    INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+    CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+    POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "../CCatCpp.h"
+#include "../CCatCodec.h"
+#include "../CCatStreams.h"
+#include "../CCatWire.h"
+#include "../PacketAllocator.h"
+#include "Logger.h"
+#include "SiameseTools.h"
+
+#include <chrono>
+#include <thread>
+#include <vector>
+using namespace std;
+
+#if defined(_WIN32)
+    #ifndef NOMINMAX
+        #define NOMINMAX
+    #endif
+    #include <windows.h>
+#else
+    #include <time.h>
+#endif
+
+#if defined(__linux__)
+    #include <linux/perf_event.h>
+    #include <sys/ioctl.h>
+    #include <sys/syscall.h>
+    #include <unistd.h>
+#endif
+
+
+// Compiler-specific debug break
+#if defined(_DEBUG) || defined(DEBUG)
+    #define BENCH_DEBUG
+    #if defined(_WIN32)
+        #define BENCH_DEBUG_BREAK() __debugbreak()
+    #else
+        #define BENCH_DEBUG_BREAK() __builtin_trap()
+    #endif
+#else
+    #define BENCH_DEBUG_BREAK() do {} while (false);
+#endif
+
+static logger::Channel Logger("Benchmark", logger::Level::Trace);
+
+
+//------------------------------------------------------------------------------
+// Tools
+
+static void SetPacket(uint64_t sequence, uint8_t* data, unsigned bytes)
+{
+    siamese::PCGRandom prng;
+    prng.Seed(sequence, bytes);
+    for (unsigned i = 0; i < bytes; ++i) {
+        data[i] = (uint8_t)prng.Next();
+    }
+}
+
+static bool CheckPacket(uint64_t sequence, const uint8_t* data, unsigned bytes)
+{
+    siamese::PCGRandom prng;
+    prng.Seed(sequence, bytes);
+    for (unsigned i = 0; i < bytes; ++i) {
+        if (data[i] != (uint8_t)prng.Next()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/// Receiver that verifies the contents of recovered packets
+class VerifyingReceiver : public CauchyCaterpillar
+{
+public:
+    uint64_t RecoveredPackets = 0;
+    bool Corrupted = false;
+
+    void OnRecoveredData(const CCatOriginal& original) override
+    {
+        if (!CheckPacket(original.SequenceNumber, original.Data, original.Bytes)) {
+            Logger.Error("Corrupted packet ", original.SequenceNumber);
+            Corrupted = true;
+        }
+        ++RecoveredPackets;
+    }
+};
+
+
+//------------------------------------------------------------------------------
+// Wire Format
+
+/// Naive header with full 8-byte sequence numbers for comparison
+static const unsigned kNaiveOriginalHeaderBytes = 1 + 8;
+static const unsigned kNaiveRecoveryHeaderBytes = 1 + 8 + 1 + 1;
+
+static unsigned NaiveParse(
+    const uint8_t* datagram,
+    unsigned bytes,
+    CCatOriginal& originalOut,
+    CCatRecovery& recoveryOut)
+{
+    uint64_t sequence;
+    memcpy(&sequence, datagram + 1, 8);
+
+    if (datagram[0] == 0)
+    {
+        originalOut.Data = datagram + kNaiveOriginalHeaderBytes;
+        originalOut.Bytes = bytes - kNaiveOriginalHeaderBytes;
+        originalOut.SequenceNumber = sequence;
+        return 1;
+    }
+
+    recoveryOut.SequenceStart = sequence;
+    recoveryOut.Count = datagram[9];
+    recoveryOut.RecoveryRow = datagram[10];
+    recoveryOut.Data = datagram + kNaiveRecoveryHeaderBytes;
+    recoveryOut.Bytes = bytes - kNaiveRecoveryHeaderBytes;
+    return 2;
+}
+
+static bool BenchmarkWireFormat()
+{
+    Logger.Info("Wire format: Round-trip with 5% loss and 25% FEC");
+
+    static const unsigned kPackets = 100000;
+    static const unsigned kMaxPayload = 1200;
+
+    VerifyingReceiver receiver;
+    CauchyCaterpillar sender;
+    if (!sender.Initialize() || !receiver.Initialize()) {
+        Logger.Error("Initialize failed");
+        return false;
+    }
+
+    ccat::WireWriter writer;
+    ccat::WireReader reader;
+    siamese::PCGRandom prng;
+    prng.Seed(1);
+
+    vector<uint8_t> buffer(ccat::kWireOriginalHeaderMax + kMaxPayload);
+    uint8_t* payload = buffer.data() + ccat::kWireOriginalHeaderMax;
+
+    uint64_t headerBytes = 0, naiveHeaderBytes = 0, datagrams = 0, lost = 0;
+
+    for (uint64_t sequence = 0; sequence < kPackets; ++sequence)
+    {
+        const unsigned bytes = prng.Next() % kMaxPayload + 1;
+        SetPacket(sequence, payload, bytes);
+
+        CCatOriginal original;
+        original.Data = payload;
+        original.Bytes = bytes;
+        original.SequenceNumber = sequence;
+        sender.SendOriginal(original);
+
+        // Peer acknowledges now and then
+        if (sequence % 64 == 0) {
+            writer.OnPeerNextExpected(reader.GetNextExpected());
+        }
+
+        unsigned datagramBytes = 0;
+        const uint8_t* datagram = writer.WriteOriginal(payload, bytes, sequence, datagramBytes);
+        if (!datagram) {
+            Logger.Error("WriteOriginal failed");
+            return false;
+        }
+        headerBytes += datagramBytes - bytes;
+        naiveHeaderBytes += kNaiveOriginalHeaderBytes;
+        ++datagrams;
+
+        CCatOriginal parsedOriginal;
+        CCatRecovery parsedRecovery;
+
+        if (prng.Next() % 100 >= 5)
+        {
+            if (reader.Parse(datagram, datagramBytes, parsedOriginal, parsedRecovery) != ccat::WireType::Original ||
+                parsedOriginal.SequenceNumber != sequence ||
+                parsedOriginal.Bytes != bytes ||
+                parsedOriginal.Data != payload)
+            {
+                Logger.Error("Original parse mismatch at ", sequence);
+                return false;
+            }
+            receiver.OnOriginal(parsedOriginal);
+        }
+        else {
+            ++lost;
+        }
+
+        if (sequence % 4 != 3) {
+            continue;
+        }
+
+        CCatRecovery recovery;
+        if (!sender.SendRecovery(recovery)) {
+            Logger.Error("SendRecovery failed");
+            return false;
+        }
+        datagram = writer.WriteRecovery(recovery, datagramBytes);
+        if (!datagram) {
+            Logger.Error("WriteRecovery failed");
+            return false;
+        }
+        headerBytes += datagramBytes - recovery.Bytes;
+        naiveHeaderBytes += kNaiveRecoveryHeaderBytes;
+        ++datagrams;
+
+        if (reader.Parse(datagram, datagramBytes, parsedOriginal, parsedRecovery) != ccat::WireType::Recovery ||
+            parsedRecovery.SequenceStart != recovery.SequenceStart ||
+            parsedRecovery.Count != recovery.Count ||
+            parsedRecovery.RecoveryRow != recovery.RecoveryRow ||
+            parsedRecovery.Data != recovery.Data)
+        {
+            Logger.Error("Recovery parse mismatch at ", sequence);
+            return false;
+        }
+        receiver.OnRecovery(parsedRecovery);
+    }
+
+    if (receiver.Corrupted || receiver.IsError() || sender.IsError()) {
+        Logger.Error("Codec error during round-trip");
+        return false;
+    }
+
+    Logger.Info("  Lost ", lost, " originals, recovered ", receiver.RecoveredPackets);
+    Logger.Info("  Header bytes/packet: wire=", headerBytes / (float)datagrams,
+        " naive=", naiveHeaderBytes / (float)datagrams);
+
+    // Parse speed over a fixed set of datagrams
+    static const unsigned kParseSet = 256;
+    static const unsigned kParseIterations = 20000;
+    static const unsigned kParseBytes = 64;
+    vector<uint8_t> wireSet(kParseSet * kParseBytes), naiveSet(kParseSet * kParseBytes);
+    vector<const uint8_t*> wireDatagrams(kParseSet);
+    vector<unsigned> wireBytes(kParseSet);
+
+    // Without feedback the first datagram uses 24 bits, which primes the reader
+    ccat::WireWriter parseWriter;
+    uint8_t primer[ccat::kWireOriginalHeaderMax + 32] = {};
+    unsigned primerBytes = 0;
+    const uint8_t* primerDatagram = parseWriter.WriteOriginal(
+        primer + ccat::kWireOriginalHeaderMax, 32, 1000000, primerBytes);
+    parseWriter.OnPeerNextExpected(1000001);
+
+    for (unsigned i = 0; i < kParseSet; ++i)
+    {
+        uint8_t* slot = wireSet.data() + i * kParseBytes;
+        const uint64_t sequence = 1000001 + i;
+        wireDatagrams[i] = parseWriter.WriteOriginal(
+            slot + ccat::kWireOriginalHeaderMax, 32, sequence, wireBytes[i]);
+
+        uint8_t* naive = naiveSet.data() + i * kParseBytes;
+        naive[0] = 0;
+        memcpy(naive + 1, &sequence, 8);
+    }
+
+    CCatOriginal parsedOriginal;
+    CCatRecovery parsedRecovery;
+    uint64_t checksum = 0;
+
+    uint64_t t0 = siamese::GetTimeUsec();
+    for (unsigned j = 0; j < kParseIterations; ++j)
+    {
+        ccat::WireReader parseReader;
+        parseReader.Parse(primerDatagram, primerBytes, parsedOriginal, parsedRecovery);
+        for (unsigned i = 0; i < kParseSet; ++i)
+        {
+            parseReader.Parse(wireDatagrams[i], wireBytes[i], parsedOriginal, parsedRecovery);
+            checksum += parsedOriginal.SequenceNumber;
+        }
+    }
+    if (checksum != (uint64_t)kParseIterations * (kParseSet * 1000001ULL + kParseSet * (kParseSet - 1) / 2)) {
+        Logger.Error("Wire parse produced the wrong sequence numbers");
+        return false;
+    }
+    uint64_t t1 = siamese::GetTimeUsec();
+    for (unsigned j = 0; j < kParseIterations; ++j)
+    {
+        for (unsigned i = 0; i < kParseSet; ++i)
+        {
+            NaiveParse(naiveSet.data() + i * kParseBytes, 32 + kNaiveOriginalHeaderBytes, parsedOriginal, parsedRecovery);
+            checksum += parsedOriginal.SequenceNumber;
+        }
+    }
+    uint64_t t2 = siamese::GetTimeUsec();
+
+    const double ops = (double)kParseSet * kParseIterations;
+    Logger.Info("  Parse ns/op: wire=", (t1 - t0) * 1000. / ops,
+        " naive=", (t2 - t1) * 1000. / ops, " (checksum ", checksum % 1000, ")");
+
+    return true;
+}
+
+
+//------------------------------------------------------------------------------
+// Stream Manager
+
+struct StreamLoopback
+{
+    ccat::StreamManager* Receiver = nullptr;
+    siamese::PCGRandom Prng;
+    uint64_t Sent = 0;
+    uint64_t Lost = 0;
+    uint64_t Recovered = 0;
+    bool Corrupted = false;
+};
+
+static bool BenchmarkStreamManager()
+{
+    Logger.Info("Stream manager: 64 streams over loopback with 5% loss");
+
+    static const unsigned kStreams = 64;
+    static const unsigned kTicks = 2000;
+    static const unsigned kBytes = 200;
+
+    StreamLoopback loopback;
+    loopback.Prng.Seed(2);
+
+    ccat::StreamManager sender, receiver;
+    loopback.Receiver = &receiver;
+
+    ccat::StreamManagerSettings settings;
+    settings.TickUsec = 1000;
+    settings.RecoveryIntervalUsec = 40000;
+    settings.AppContextPtr = &loopback;
+    settings.OnTickBatch = [](unsigned shard, const ccat::StreamDatagram* datagrams, unsigned count, void* context)
+    {
+        (void)shard;
+        StreamLoopback* thiz = (StreamLoopback*)context;
+        for (unsigned i = 0; i < count; ++i)
+        {
+            if (!datagrams[i].IsRecovery) {
+                ++thiz->Sent;
+            }
+            if (thiz->Prng.Next() % 100 < 5)
+            {
+                if (!datagrams[i].IsRecovery) {
+                    ++thiz->Lost;
+                }
+                continue;
+            }
+            thiz->Receiver->Receive(datagrams[i].StreamId, datagrams[i].Data, datagrams[i].Bytes);
+        }
+    };
+    settings.OnRecoveredData = [](uint64_t streamId, CCatOriginal original, void* context)
+    {
+        (void)streamId;
+        StreamLoopback* thiz = (StreamLoopback*)context;
+        if (!CheckPacket(original.SequenceNumber, original.Data, original.Bytes)) {
+            thiz->Corrupted = true;
+        }
+        ++thiz->Recovered;
+    };
+
+    if (sender.Initialize(settings) != CCat_Success ||
+        receiver.Initialize(settings) != CCat_Success)
+    {
+        Logger.Error("StreamManager initialize failed");
+        return false;
+    }
+
+    for (unsigned i = 0; i < kStreams; ++i)
+    {
+        sender.CreateStream(i);
+        receiver.CreateStream(i);
+    }
+
+    vector<uint64_t> sequences(kStreams, 0);
+    uint8_t payload[kBytes];
+    uint64_t nowUsec = 1000000;
+
+    for (unsigned tick = 0; tick < kTicks; ++tick)
+    {
+        nowUsec += settings.TickUsec;
+
+        // Each stream sends every 10 ticks, staggered
+        for (unsigned i = tick % 10; i < kStreams; i += 10)
+        {
+            SetPacket(sequences[i], payload, kBytes);
+            ++sequences[i];
+            sender.Send(i, payload, kBytes);
+        }
+
+        sender.Tick(0, nowUsec);
+        receiver.Tick(0, nowUsec);
+    }
+
+    if (loopback.Corrupted) {
+        Logger.Error("Corrupted recovered data");
+        return false;
+    }
+    if (receiver.GetStreamCount() != kStreams || loopback.Lost <= 0 || loopback.Recovered <= 0) {
+        Logger.Error("Stream manager loopback did not recover data");
+        return false;
+    }
+
+    Logger.Info("  Sent ", loopback.Sent, " originals, lost ", loopback.Lost, ", recovered ", loopback.Recovered);
+
+    // Per-core capacity: One shard driven from this thread
+    Logger.Info("Stream manager: Per-core capacity at 100 packets/sec/stream, 200 byte packets, 1 recovery per 4 originals");
+
+    static const unsigned kStreamCounts[] = { 1000, 4000, 16000 };
+    memset(payload, 1, kBytes);
+
+    for (unsigned streams : kStreamCounts)
+    {
+        ccat::StreamManager manager;
+        ccat::StreamManagerSettings capacitySettings;
+        capacitySettings.TickUsec = 1000;
+        capacitySettings.RecoveryIntervalUsec = 40000;
+
+        if (manager.Initialize(capacitySettings) != CCat_Success) {
+            Logger.Error("StreamManager initialize failed");
+            return false;
+        }
+        for (unsigned i = 0; i < streams; ++i) {
+            manager.CreateStream(i);
+        }
+
+        nowUsec = 1000000;
+        manager.Tick(0, nowUsec);
+
+        const uint64_t t0 = siamese::GetTimeUsec();
+        for (unsigned tick = 0; tick < kTicks; ++tick)
+        {
+            nowUsec += capacitySettings.TickUsec;
+            for (unsigned i = tick % 10; i < streams; i += 10) {
+                manager.Send(i, payload, kBytes);
+            }
+            manager.Tick(0, nowUsec);
+        }
+        const uint64_t t1 = siamese::GetTimeUsec();
+
+        const double simulatedSeconds = kTicks * capacitySettings.TickUsec / 1000000.;
+        const double cpuSeconds = (t1 - t0) / 1000000.;
+        Logger.Info("  ", streams, " streams: ", (t1 - t0) / (double)kTicks, " usec/tick, ",
+            manager.GetDatagramsSent() * 1000. / (t1 - t0), " Kdatagrams/sec, capacity ~",
+            (uint64_t)(streams * simulatedSeconds / cpuSeconds), " streams/core");
+    }
+
+    return true;
+}
+
+
+//------------------------------------------------------------------------------
+// Concurrent Encode/Decode
+
+static uint64_t GetThreadCpuUsec()
+{
+#if defined(_WIN32)
+    FILETIME creation, exit, kernel, user;
+    GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user);
+    const uint64_t k = ((uint64_t)kernel.dwHighDateTime << 32) | kernel.dwLowDateTime;
+    const uint64_t u = ((uint64_t)user.dwHighDateTime << 32) | user.dwLowDateTime;
+    return (k + u) / 10;
+#else
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+}
+
+/// Pre-generated received packets so decoding can be replayed
+struct ReceivedStream
+{
+    struct Event
+    {
+        bool IsRecovery;
+        CCatRecovery Recovery;
+        uint64_t Sequence;
+        size_t Offset;
+    };
+
+    vector<Event> Events;
+    vector<uint8_t> Data;
+    uint64_t Lost = 0;
+};
+
+static const unsigned kConcurrentPackets = 50000;
+static const unsigned kConcurrentBytes = 400;
+
+static bool GenerateReceivedStream(ReceivedStream& stream)
+{
+    CauchyCaterpillar sender;
+    if (!sender.Initialize()) {
+        return false;
+    }
+
+    siamese::PCGRandom prng;
+    prng.Seed(3);
+
+    vector<uint8_t> payload(kConcurrentBytes);
+    stream.Data.reserve((size_t)kConcurrentPackets * kConcurrentBytes * 3 / 2);
+
+    for (uint64_t sequence = 0; sequence < kConcurrentPackets; ++sequence)
+    {
+        SetPacket(sequence, payload.data(), kConcurrentBytes);
+
+        CCatOriginal original;
+        original.Data = payload.data();
+        original.Bytes = kConcurrentBytes;
+        original.SequenceNumber = sequence;
+        sender.SendOriginal(original);
+
+        ReceivedStream::Event event;
+        if (prng.Next() % 100 >= 5)
+        {
+            event.IsRecovery = false;
+            event.Sequence = sequence;
+            event.Offset = stream.Data.size();
+            stream.Data.insert(stream.Data.end(), payload.begin(), payload.end());
+            stream.Events.push_back(event);
+        }
+        else {
+            ++stream.Lost;
+        }
+
+        if (sequence % 4 != 3) {
+            continue;
+        }
+
+        CCatRecovery recovery;
+        if (!sender.SendRecovery(recovery)) {
+            return false;
+        }
+        event.IsRecovery = true;
+        event.Recovery = recovery;
+        event.Offset = stream.Data.size();
+        stream.Data.insert(stream.Data.end(), recovery.Data, recovery.Data + recovery.Bytes);
+        stream.Events.push_back(event);
+    }
+
+    return !sender.IsError();
+}
+
+static void EncodeWork(CauchyCaterpillar& codec)
+{
+    vector<uint8_t> payload(kConcurrentBytes, 1);
+
+    for (uint64_t sequence = 0; sequence < kConcurrentPackets; ++sequence)
+    {
+        CCatOriginal original;
+        original.Data = payload.data();
+        original.Bytes = kConcurrentBytes;
+        original.SequenceNumber = sequence;
+        codec.SendOriginal(original);
+
+        if (sequence % 4 == 3)
+        {
+            CCatRecovery recovery;
+            codec.SendRecovery(recovery);
+        }
+    }
+}
+
+static void DecodeWork(CauchyCaterpillar& codec, const ReceivedStream& stream)
+{
+    for (const ReceivedStream::Event& event : stream.Events)
+    {
+        if (event.IsRecovery)
+        {
+            CCatRecovery recovery = event.Recovery;
+            recovery.Data = stream.Data.data() + event.Offset;
+            codec.OnRecovery(recovery);
+        }
+        else
+        {
+            CCatOriginal original;
+            original.Data = stream.Data.data() + event.Offset;
+            original.Bytes = kConcurrentBytes;
+            original.SequenceNumber = event.Sequence;
+            codec.OnOriginal(original);
+        }
+    }
+}
+
+static bool BenchmarkConcurrentCodec()
+{
+    Logger.Info("Concurrent codec: One thread encodes while another decodes on the same codec");
+
+    ReceivedStream stream;
+    if (!GenerateReceivedStream(stream)) {
+        Logger.Error("Failed to generate stream");
+        return false;
+    }
+
+    // Each half alone
+    uint64_t encodeSoloUsec, decodeSoloUsec;
+    {
+        VerifyingReceiver codec;
+        codec.Initialize();
+        const uint64_t t0 = GetThreadCpuUsec();
+        EncodeWork(codec);
+        const uint64_t t1 = GetThreadCpuUsec();
+        DecodeWork(codec, stream);
+        const uint64_t t2 = GetThreadCpuUsec();
+        encodeSoloUsec = t1 - t0;
+        decodeSoloUsec = t2 - t1;
+    }
+
+    // Both halves at once on the same codec without locks
+    VerifyingReceiver codec;
+    codec.Initialize();
+    uint64_t encodeUsec = 0, decodeUsec = 0;
+
+    std::thread encodeThread([&]() {
+        const uint64_t t0 = GetThreadCpuUsec();
+        EncodeWork(codec);
+        encodeUsec = GetThreadCpuUsec() - t0;
+    });
+    std::thread decodeThread([&]() {
+        const uint64_t t0 = GetThreadCpuUsec();
+        DecodeWork(codec, stream);
+        decodeUsec = GetThreadCpuUsec() - t0;
+    });
+    encodeThread.join();
+    decodeThread.join();
+
+    if (codec.IsError() || codec.Corrupted || codec.RecoveredPackets != stream.Lost)
+    {
+        Logger.Error("Concurrent decode failed: lost ", stream.Lost, " recovered ", codec.RecoveredPackets);
+        return false;
+    }
+
+    const double ops = kConcurrentPackets;
+    Logger.Info("  Encode ns/op: alone=", encodeSoloUsec * 1000. / ops, " concurrent=", encodeUsec * 1000. / ops);
+    Logger.Info("  Decode ns/op: alone=", decodeSoloUsec * 1000. / ops, " concurrent=", decodeUsec * 1000. / ops);
+    Logger.Info("  Lost ", stream.Lost, " originals, recovered ", codec.RecoveredPackets, " while encoding");
+
+    return true;
+}
+
+
+//------------------------------------------------------------------------------
+// Decoder Layout
+
+/// Counts hardware cache misses on this thread where the OS allows it
+class CacheMissCounter
+{
+public:
+    CacheMissCounter()
+    {
+#if defined(__linux__)
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_CACHE_MISSES;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        FD = (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+#endif
+    }
+
+    ~CacheMissCounter()
+    {
+#if defined(__linux__)
+        if (FD >= 0) {
+            close(FD);
+        }
+#endif
+    }
+
+    bool IsAvailable() const
+    {
+        return FD >= 0;
+    }
+
+    void Start()
+    {
+#if defined(__linux__)
+        if (FD >= 0)
+        {
+            ioctl(FD, PERF_EVENT_IOC_RESET, 0);
+            ioctl(FD, PERF_EVENT_IOC_ENABLE, 0);
+        }
+#endif
+    }
+
+    uint64_t Stop()
+    {
+        uint64_t count = 0;
+#if defined(__linux__)
+        if (FD >= 0)
+        {
+            ioctl(FD, PERF_EVENT_IOC_DISABLE, 0);
+            if (read(FD, &count, sizeof(count)) != (ssize_t)sizeof(count)) {
+                count = 0;
+            }
+        }
+#endif
+        return count;
+    }
+
+private:
+    int FD = -1;
+};
+
+static const unsigned kLayoutCodecs = 1024;
+static const unsigned kLayoutRounds = 256;
+static const unsigned kLayoutBytes = 100;
+
+/**
+    Many codecs each receive in-order originals round-robin, so each decode
+    starts with the codec state out of cache.  This is where the number of
+    cache lines the receive path touches shows up.
+*/
+static bool BenchmarkDecoderLayout()
+{
+    Logger.Info("Decoder layout: sizeof(Decoder)=", sizeof(ccat::Decoder),
+        " bytes, solver scratch allocated on first multi-loss solve=", sizeof(ccat::DecoderSolver), " bytes");
+    Logger.Info("  In-order originals round-robin over ", kLayoutCodecs, " codecs");
+
+    vector<CCatCodec> codecs(kLayoutCodecs, nullptr);
+    CCatSettings settings;
+    settings.WindowPackets = CCAT_MAX_WINDOW_PACKETS;
+    settings.OnRecoveredData = [](CCatOriginal, CCatAppContext) {};
+
+    for (CCatCodec& codec : codecs)
+    {
+        if (ccat_create(&settings, &codec) != CCat_Success) {
+            return false;
+        }
+    }
+
+    vector<uint8_t> payload(kLayoutBytes);
+    SetPacket(0, payload.data(), kLayoutBytes);
+
+    CacheMissCounter counter;
+    uint64_t decodeUsec = 0;
+    bool success = true;
+
+    // Warm-up rounds fill each window so the timed rounds reuse packet memory
+    for (unsigned round = 0; round < kLayoutRounds + CCAT_MAX_WINDOW_PACKETS * 2 && success; ++round)
+    {
+        const bool timed = round >= CCAT_MAX_WINDOW_PACKETS * 2;
+        if (round == CCAT_MAX_WINDOW_PACKETS * 2) {
+            counter.Start();
+        }
+
+        const uint64_t t0 = siamese::GetTimeUsec();
+
+        for (CCatCodec codec : codecs)
+        {
+            CCatOriginal original;
+            original.Data = payload.data();
+            original.Bytes = kLayoutBytes;
+            original.SequenceNumber = round;
+            if (ccat_decode_original(codec, &original) != CCat_Success)
+            {
+                success = false;
+                break;
+            }
+        }
+
+        if (timed) {
+            decodeUsec += siamese::GetTimeUsec() - t0;
+        }
+    }
+
+    const uint64_t misses = counter.Stop();
+    const double ops = (double)kLayoutCodecs * kLayoutRounds;
+
+    if (counter.IsAvailable()) {
+        Logger.Info("  Decode ns/op=", decodeUsec * 1000. / ops, " cache misses/op=", misses / ops);
+    }
+    else {
+        Logger.Info("  Decode ns/op=", decodeUsec * 1000. / ops, " cache misses/op unavailable");
+    }
+
+    for (CCatCodec codec : codecs) {
+        ccat_destroy(codec);
+    }
+
+    return success;
+}
+
+
+static const unsigned kScanOriginals = 200000;
+static const unsigned kScanBytes = 100;
+
+/**
+    Loss runs above the recovery rate, so recovery packets pile up in the
+    decoder without a solution, and each one that arrives rescans the stored
+    rows in FindSolutions().  This is where the cost of the loss range
+    queries shows up.
+*/
+static bool BenchmarkRecoveryScan(unsigned lossPercent, unsigned recoveryInterval)
+{
+    CCatSettings settings;
+    settings.WindowPackets = CCAT_MAX_WINDOW_PACKETS;
+    settings.WindowMsec = 1000000;
+    settings.OnRecoveredData = [](CCatOriginal, CCatAppContext) {};
+
+    CCatCodec encoder = nullptr, decoder = nullptr;
+    if (ccat_create(&settings, &encoder) != CCat_Success ||
+        ccat_create(&settings, &decoder) != CCat_Success)
+    {
+        return false;
+    }
+
+    siamese::PCGRandom prng;
+    prng.Seed(lossPercent, recoveryInterval);
+
+    vector<uint8_t> payload(kScanBytes);
+    uint64_t recoveryUsec = 0, recoveryCount = 0;
+    bool success = true;
+
+    for (unsigned sequence = 0; sequence < kScanOriginals && success; ++sequence)
+    {
+        SetPacket(sequence, payload.data(), kScanBytes);
+
+        CCatOriginal original;
+        original.Data = payload.data();
+        original.Bytes = kScanBytes;
+        original.SequenceNumber = sequence;
+        if (ccat_encode_original(encoder, &original) != CCat_Success) {
+            success = false;
+            break;
+        }
+
+        if (prng.Next() % 100 >= lossPercent &&
+            ccat_decode_original(decoder, &original) != CCat_Success)
+        {
+            success = false;
+            break;
+        }
+
+        if (sequence % recoveryInterval != 0) {
+            continue;
+        }
+
+        CCatRecovery recovery;
+        if (ccat_encode_recovery(encoder, &recovery) != CCat_Success) {
+            success = false;
+            break;
+        }
+
+        const uint64_t t0 = siamese::GetTimeUsec();
+        if (ccat_decode_recovery(decoder, &recovery) != CCat_Success) {
+            success = false;
+        }
+        recoveryUsec += siamese::GetTimeUsec() - t0;
+        ++recoveryCount;
+    }
+
+    Logger.Info("  ", lossPercent, "% loss, recovery every ", recoveryInterval,
+        " originals: Decode recovery ns/op=", recoveryUsec * 1000. / recoveryCount);
+
+    ccat_destroy(encoder);
+    ccat_destroy(decoder);
+
+    return success;
+}
+
+static bool BenchmarkRecoveryScans()
+{
+    Logger.Info("Recovery row scan: ", kScanOriginals, " originals of ", kScanBytes, " bytes");
+
+    return BenchmarkRecoveryScan(10, 20) &&
+        BenchmarkRecoveryScan(20, 10) &&
+        BenchmarkRecoveryScan(30, 4);
+}
+
+
+static const unsigned kLargeOriginals = 4000;
+static const unsigned kLargeLossPercent = 5;
+static const unsigned kLargeRecoveryInterval = 10;
+
+/**
+    Jumbo originals such as GSO batches and video keyframes do not fit in an
+    allocator window, so every packet stored by the encoder and decoder and
+    every recovery packet goes through the large block path.
+*/
+static bool BenchmarkLargePacket(unsigned bytes)
+{
+    CCatSettings settings;
+    settings.WindowPackets = CCAT_MAX_WINDOW_PACKETS;
+    settings.WindowMsec = 1000000;
+    settings.OnRecoveredData = [](CCatOriginal, CCatAppContext) {};
+
+    CCatCodec encoder = nullptr, decoder = nullptr;
+    if (ccat_create(&settings, &encoder) != CCat_Success ||
+        ccat_create(&settings, &decoder) != CCat_Success)
+    {
+        return false;
+    }
+
+    siamese::PCGRandom prng;
+    prng.Seed(bytes, 0);
+
+    vector<uint8_t> payload(bytes);
+    uint64_t encodeUsec = 0, decodeUsec = 0;
+    bool success = true;
+
+    for (unsigned sequence = 0; sequence < kLargeOriginals && success; ++sequence)
+    {
+        SetPacket(sequence, payload.data(), bytes);
+
+        CCatOriginal original;
+        original.Data = payload.data();
+        original.Bytes = bytes;
+        original.SequenceNumber = sequence;
+
+        uint64_t t0 = siamese::GetTimeUsec();
+        success = ccat_encode_original(encoder, &original) == CCat_Success;
+        encodeUsec += siamese::GetTimeUsec() - t0;
+
+        if (success && prng.Next() % 100 >= kLargeLossPercent)
+        {
+            t0 = siamese::GetTimeUsec();
+            success = ccat_decode_original(decoder, &original) == CCat_Success;
+            decodeUsec += siamese::GetTimeUsec() - t0;
+        }
+
+        if (!success || sequence % kLargeRecoveryInterval != 0) {
+            continue;
+        }
+
+        CCatRecovery recovery;
+        t0 = siamese::GetTimeUsec();
+        success = ccat_encode_recovery(encoder, &recovery) == CCat_Success;
+        encodeUsec += siamese::GetTimeUsec() - t0;
+
+        if (success && prng.Next() % 100 >= kLargeLossPercent)
+        {
+            t0 = siamese::GetTimeUsec();
+            const CCatResult result = ccat_decode_recovery(decoder, &recovery);
+            success = result == CCat_Success || result == CCat_NeedsMoreData;
+            decodeUsec += siamese::GetTimeUsec() - t0;
+        }
+    }
+
+    const double megabytes = (double)bytes * kLargeOriginals / 1000000.;
+    Logger.Info("  ", bytes / 1024, " KB: Encode MB/s=", megabytes * 1000000. / encodeUsec,
+        " Decode MB/s=", megabytes * 1000000. / decodeUsec);
+
+    ccat_destroy(encoder);
+    ccat_destroy(decoder);
+
+    return success;
+}
+
+static bool BenchmarkLargePackets()
+{
+    Logger.Info("Large packets: ", kLargeOriginals, " originals, ", kLargeLossPercent,
+        "% loss, recovery every ", kLargeRecoveryInterval, " originals");
+
+    return BenchmarkLargePacket(16 * 1024) &&
+        BenchmarkLargePacket(32 * 1024) &&
+        BenchmarkLargePacket(48 * 1024) &&
+        BenchmarkLargePacket(CCAT_MAX_BYTES);
+}
+
+
+//------------------------------------------------------------------------------
+// Allocator Fragmentation
+
+static const unsigned kFragmentOps = 2000000;
+static const unsigned kFragmentWindow = 384;
+static const unsigned kFragmentRecoveryInterval = 8;
+static const unsigned kFragmentMaxRecovery = 32;
+
+/**
+    Replays the allocation pattern of a decoder directly on the allocator:
+    Originals of mixed sizes arrive into a sliding window and are freed when
+    they fall out of it, while recovery packets are stored, grown when
+    originals are eliminated from them, and released out of order.
+*/
+static bool BenchmarkAllocatorFragmentation()
+{
+    Logger.Info("Allocator fragmentation: ", kFragmentOps, " originals, window of ",
+        kFragmentWindow, ", recovery every ", kFragmentRecoveryInterval);
+
+    pktalloc::Allocator allocator;
+    siamese::PCGRandom prng;
+    prng.Seed(kFragmentOps, 0);
+
+    vector<uint8_t*> originals(kFragmentWindow, nullptr);
+    vector<uint8_t*> recovery;
+    vector<unsigned> recoveryBytes;
+    uint64_t allocations = 0, usedBytes = 0, allocatedBytes = 0, samples = 0;
+
+    const uint64_t t0 = siamese::GetTimeUsec();
+
+    for (unsigned i = 0; i < kFragmentOps; ++i)
+    {
+        // Mostly small datagrams with the occasional large video frame
+        const uint32_t r = prng.Next();
+        const unsigned bytes = (r % 16 == 0) ? 4000 + r % 5000 : 20 + r % 1400;
+
+        uint8_t*& slot = originals[i % kFragmentWindow];
+        allocator.Free(slot);
+        slot = allocator.Allocate(bytes);
+        if (!slot) {
+            return false;
+        }
+        slot[0] = slot[bytes - 1] = (uint8_t)i;
+        ++allocations;
+
+        if (i % kFragmentRecoveryInterval != 0) {
+            continue;
+        }
+
+        // Release a recovery packet that was solved or fell out of the window
+        if (recovery.size() >= kFragmentMaxRecovery)
+        {
+            const unsigned index = prng.Next() % (unsigned)recovery.size();
+            allocator.Free(recovery[index]);
+            recovery[index] = recovery.back();
+            recoveryBytes[index] = recoveryBytes.back();
+            recovery.pop_back();
+            recoveryBytes.pop_back();
+        }
+
+        recoveryBytes.push_back(bytes + prng.Next() % 200);
+        recovery.push_back(allocator.Allocate(recoveryBytes.back()));
+        if (!recovery.back()) {
+            return false;
+        }
+        ++allocations;
+
+        // Grow a recovery packet to cover a larger original
+        const unsigned index = prng.Next() % (unsigned)recovery.size();
+        recoveryBytes[index] += prng.Next() % 512;
+        recovery[index] = allocator.Reallocate(recovery[index], recoveryBytes[index],
+            pktalloc::Realloc::CopyExisting);
+        if (!recovery[index]) {
+            return false;
+        }
+        ++allocations;
+
+        if (i % 1024 == 0)
+        {
+            usedBytes += allocator.GetMemoryUsedBytes();
+            allocatedBytes += allocator.GetMemoryAllocatedBytes();
+            ++samples;
+        }
+    }
+
+    const uint64_t t1 = siamese::GetTimeUsec();
+
+    for (uint8_t* data : originals) {
+        allocator.Free(data);
+    }
+    for (uint8_t* data : recovery) {
+        allocator.Free(data);
+    }
+
+    Logger.Info("  Allocations: ", allocations, " ns/op=", (t1 - t0) * 1000. / allocations,
+        " Used/allocated memory=", usedBytes * 100. / allocatedBytes, "% of ",
+        allocatedBytes / samples / 1024, " KB");
+    Logger.Info("  Reallocate grew in place: ", allocator.GetReallocateInPlaceCount() * 100. /
+        allocator.GetReallocateGrowCount(), "% of ", allocator.GetReallocateGrowCount());
+
+    return allocator.IntegrityCheck();
+}
+
+
+//------------------------------------------------------------------------------
+// Async Recovery
+
+static const unsigned kAsyncOriginals = 20000;
+static const unsigned kAsyncBytes = 1200;
+static const unsigned kAsyncWindow = 128;
+static const unsigned kAsyncRecoveryInterval = 4;
+
+/// Distinct payloads cycled through, so generating data is not timed
+static const unsigned kAsyncPayloads = 256;
+
+/**
+    Send thread time for a 128-packet window of 1200-byte originals, with
+    the recovery packets computed inline by ccat_encode_recovery() and then
+    by the worker through ccat_encode_recovery_submit().  The async packets
+    must match the inline ones exactly.
+
+    This counts CPU time on the send thread, so it holds up on a single
+    core where the worker preempts it.  Originals are not paced here, so the
+    worker falls behind and the send thread sleeps until the job queue has
+    room, which a paced sender would not need to do.
+*/
+static bool BenchmarkAsyncRecovery()
+{
+    Logger.Info("Async recovery: ", kAsyncOriginals, " originals of ", kAsyncBytes,
+        " bytes, window of ", kAsyncWindow, ", recovery every ", kAsyncRecoveryInterval);
+
+    CCatSettings settings;
+    settings.WindowPackets = kAsyncWindow;
+    settings.WindowMsec = 1000000;
+
+    CCatCodec inlineCodec = nullptr, asyncCodec = nullptr;
+    if (ccat_create(&settings, &inlineCodec) != CCat_Success ||
+        ccat_create(&settings, &asyncCodec) != CCat_Success)
+    {
+        return false;
+    }
+
+    vector<uint8_t> payloads(kAsyncPayloads * kAsyncBytes);
+    for (unsigned i = 0; i < kAsyncPayloads; ++i) {
+        SetPacket(i, payloads.data() + i * kAsyncBytes, kAsyncBytes);
+    }
+
+    CCatOriginal original;
+    original.Bytes = kAsyncBytes;
+
+    // Inline: Keep a copy of each packet to check the async ones against
+
+    vector<uint8_t> expected;
+    vector<size_t> expectedOffsets(1, 0);
+    expected.reserve(kAsyncOriginals / kAsyncRecoveryInterval * (kAsyncBytes + CCAT_DECODE_HEADROOM));
+    bool success = true;
+
+    uint64_t t0 = GetThreadCpuUsec();
+
+    for (unsigned sequence = 0; sequence < kAsyncOriginals && success; ++sequence)
+    {
+        original.Data = payloads.data() + (sequence % kAsyncPayloads) * kAsyncBytes;
+        original.SequenceNumber = sequence;
+        success = ccat_encode_original(inlineCodec, &original) == CCat_Success;
+
+        if (success && sequence % kAsyncRecoveryInterval == 0)
+        {
+            CCatRecovery recovery;
+            success = ccat_encode_recovery(inlineCodec, &recovery) == CCat_Success;
+            if (success)
+            {
+                expected.insert(expected.end(), recovery.Data, recovery.Data + recovery.Bytes);
+                expectedOffsets.push_back(expected.size());
+            }
+        }
+    }
+
+    const uint64_t inlineUsec = GetThreadCpuUsec() - t0;
+
+    // Async: Collect finished packets after each original
+
+    unsigned submitted = 0, completed = 0;
+    auto completeReady = [&]() {
+        CCatRecovery recovery;
+        while (ccat_encode_recovery_complete(asyncCodec, &recovery) == CCat_Success)
+        {
+            if (completed + 1 >= expectedOffsets.size() ||
+                recovery.Bytes != expectedOffsets[completed + 1] - expectedOffsets[completed] ||
+                0 != memcmp(recovery.Data, expected.data() + expectedOffsets[completed], recovery.Bytes))
+            {
+                success = false;
+            }
+            ++completed;
+        }
+    };
+
+    t0 = GetThreadCpuUsec();
+
+    for (unsigned sequence = 0; sequence < kAsyncOriginals && success; ++sequence)
+    {
+        original.Data = payloads.data() + (sequence % kAsyncPayloads) * kAsyncBytes;
+        original.SequenceNumber = sequence;
+
+        success = ccat_encode_original(asyncCodec, &original) == CCat_Success;
+
+        if (success && sequence % kAsyncRecoveryInterval == 0)
+        {
+            // Wait for room in the job queue
+            while (submitted - completed >= CCAT_MAX_RECOVERY_JOBS && success)
+            {
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+                completeReady();
+            }
+
+            success = success && ccat_encode_recovery_submit(asyncCodec) == CCat_Success;
+            ++submitted;
+        }
+
+        completeReady();
+    }
+
+    const uint64_t asyncUsec = GetThreadCpuUsec() - t0;
+
+    // Wait for the worker to finish the rest
+    while (completed < submitted && success)
+    {
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+        completeReady();
+    }
+
+    success = success && completed + 1 == expectedOffsets.size();
+
+    const unsigned recoveryCount = (unsigned)expectedOffsets.size() - 1;
+    Logger.Info("  Send thread CPU usec/recovery: Inline=", inlineUsec / (double)recoveryCount,
+        " Async=", asyncUsec / (double)recoveryCount);
+
+    ccat_destroy(inlineCodec);
+    ccat_destroy(asyncCodec);
+
+    return success;
+}
+
+
+//------------------------------------------------------------------------------
+// Entrypoint
+
+int main()
+{
+    Logger.Info("Cauchy Caterpillar Benchmarks");
+
+    if (!BenchmarkWireFormat())
+    {
+        BENCH_DEBUG_BREAK();
+        Logger.Error("Wire format benchmark failed");
+        return -1;
+    }
+
+    if (!BenchmarkDecoderLayout())
+    {
+        BENCH_DEBUG_BREAK();
+        Logger.Error("Decoder layout benchmark failed");
+        return -1;
+    }
+
+    if (!BenchmarkRecoveryScans())
+    {
+        BENCH_DEBUG_BREAK();
+        Logger.Error("Recovery scan benchmark failed");
+        return -1;
+    }
+
+    if (!BenchmarkAllocatorFragmentation())
+    {
+        BENCH_DEBUG_BREAK();
+        Logger.Error("Allocator fragmentation benchmark failed");
+        return -1;
+    }
+
+    if (!BenchmarkAsyncRecovery())
+    {
+        BENCH_DEBUG_BREAK();
+        Logger.Error("Async recovery benchmark failed");
+        return -1;
+    }
+
+    if (!BenchmarkLargePackets())
+    {
+        BENCH_DEBUG_BREAK();
+        Logger.Error("Large packet benchmark failed");
+        return -1;
+    }
+
+    if (!BenchmarkConcurrentCodec())
+    {
+        BENCH_DEBUG_BREAK();
+        Logger.Error("Concurrent codec benchmark failed");
+        return -1;
+    }
+
+    if (!BenchmarkStreamManager())
+    {
+        BENCH_DEBUG_BREAK();
+        Logger.Error("Stream manager benchmark failed");
+        return -1;
+    }
+
+    Logger.Info("Benchmarks complete");
+    return 0;
+}
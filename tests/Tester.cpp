@@ -28,6 +28,8 @@
 */
 
 #include "../CCatCpp.h"
+#include "../CCatMux.h"
+#include "../CCatSerialize.h"
 #include "Logger.h"
 #include "SiameseTools.h"
 #include "StrikeRegister.h"
@@ -35,6 +37,12 @@
 #include <omp.h> // Requires OpenMP for parallel for
 
 #include <fstream>
+#include <set>
+#include <sstream>
+#include <vector>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
 using namespace std;
 
 
@@ -53,6 +61,21 @@ static const unsigned kParallelRuns = 2000;
 // Simulate ~4 Mbps stream (1300 byte packets at 385 packets per second)
 static const int kPacketsPerSecond = 385;
 
+// Originals between loss reports in adaptive mode (~100 msec)
+static const unsigned kReportPackets = kPacketsPerSecond / 10;
+
+// Default target effective loss rate in adaptive mode
+static const float kDefaultTargetLossRate = 0.001f;
+
+// Streams in the group in mux mode
+static const unsigned kMuxStreams = 150;
+
+// Packets per window sent by each stream in mux mode (10 packets/second)
+static const unsigned kMuxStreamPacketsPerWindow = 1;
+
+// Simulations per FEC rate in mux mode
+static const unsigned kMuxRuns = 20;
+
 
 static std::atomic<bool> m_TestFailed;
 
@@ -158,11 +181,16 @@ struct RunState
     unsigned PacketsSent = 0;
     float FECRate = 0.f;
 
-    bool Initialize(unsigned runIndex, uint64_t seed, float fecRate)
+    // Adaptive mode: Sender picks the FEC rate from receiver loss reports
+    bool Adaptive = false;
+    unsigned ReportCounter = 0;
+
+    bool Initialize(unsigned runIndex, uint64_t seed, float fecRate, float targetLossRate = 0.f)
     {
         FECRate = fecRate;
+        Adaptive = targetLossRate > 0.f;
 
-        if (!Sender.Initialize(kWindowMsec))
+        if (!Sender.Initialize(kWindowMsec, targetLossRate))
         {
             Logger.Error("Failed to initialize sender");
             return false;
@@ -210,11 +238,21 @@ struct RunState
             Receiver.OnOriginal(original);
         }
 
+        unsigned recoveryCount = 0;
+        if (Adaptive) {
+            recoveryCount = Sender.GetRecoveryDue();
+        }
         // Maintain a fixed FEC rate >= fec / (original + fec)
-        if (FECSent < (uint64_t)(FECRate * (Sequence + FECSent)))
+        else if (FECSent < (uint64_t)(FECRate * (Sequence + FECSent))) {
+            recoveryCount = 1;
+        }
+
+        for (unsigned i = 0; i < recoveryCount; ++i)
         {
             CCatRecovery recovery;
-            Sender.SendRecovery(recovery);
+            if (!Sender.SendRecovery(recovery)) {
+                break;
+            }
             ++FECSent;
 
             if (Prng.Next() > kPlrPRNG32Thresh) {
@@ -222,9 +260,23 @@ struct RunState
             }
         }
 
+        // Feed back a loss report from the receiver
+        if (Adaptive && ++ReportCounter >= kReportPackets)
+        {
+            uint8_t report[CCAT_LOSS_REPORT_MAX_BYTES];
+            const unsigned reportBytes = Receiver.GetLossReport(report);
+            Sender.OnLossReport(report, reportBytes);
+            ReportCounter = 0;
+        }
+
         return (!Sender.IsError() && !Receiver.IsError());
     }
 
+    float GetFECOverhead() const
+    {
+        return FECSent / (float)(Sequence + FECSent);
+    }
+
     float GetEffLoss() const
     {
         return 1.f - Receiver.OriginalPackets / (float)Sequence;
@@ -274,6 +326,8 @@ struct TestResults
     float MinimumEffectiveLoss = 0.f;
     float AverageEffectiveLoss = 0.f;
     float MaximumEffectiveLoss = 0.f;
+    float AverageFECOverhead = 0.f;
+    float MaximumFECOverhead = 0.f;
 };
 
 void SimulateOneStream(RunState* state, float plr, int i)
@@ -315,7 +369,8 @@ void SimulateOneStream(RunState* state, float plr, int i)
 bool GetMinimumResult(
     float plr,
     float fec,
-    TestResults& results)
+    TestResults& results,
+    float targetLossRate = 0.f)
 {
     RunState* Runs = new RunState[kParallelRuns];
 
@@ -323,7 +378,7 @@ bool GetMinimumResult(
 
     for (unsigned i = 0; i < kParallelRuns; ++i)
     {
-        if (!Runs[i].Initialize(i, kExperimentSeed, fec))
+        if (!Runs[i].Initialize(i, kExperimentSeed, fec, targetLossRate))
         {
             Logger.Error("Initialization failed ", i);
             TESTER_DEBUG_BREAK();
@@ -348,16 +403,20 @@ bool GetMinimumResult(
     StatsCollector<float> eloss;
     StatsCollector<unsigned> count;
     StatsCollector<unsigned> fecsent;
+    StatsCollector<float> overhead;
     for (unsigned i = 0; i < kParallelRuns; ++i) {
         eloss.Update(Runs[i].GetEffLoss());
         count.Update(Runs[i].GetResetPacketCounter());
         fecsent.Update((unsigned)Runs[i].FECSent);
+        overhead.Update(Runs[i].GetFECOverhead());
     }
 
     results.PacketsPerSecond = (unsigned)(count.Average() / (float)kDurationSeconds);
     results.MinimumEffectiveLoss = eloss.minimum * 100.f;
     results.AverageEffectiveLoss = eloss.Average() * 100.f;
     results.MaximumEffectiveLoss = eloss.maximum * 100.f;
+    results.AverageFECOverhead = overhead.Average() * 100.f;
+    results.MaximumFECOverhead = overhead.maximum * 100.f;
 
     delete[] Runs;
     return true;
@@ -385,9 +444,1345 @@ void TestFECRate(float plr, float fec)
         results.MaximumEffectiveLoss);
 }
 
-int main()
+/// One row of a static sweep: docs/simulation_results.txt
+struct StaticResult
 {
-    Logger.Info("Cauchy Caterpillar Tester");
+    float PLR, FEC;
+    unsigned PPS;
+    float AverageEffectiveLoss;
+};
+
+/// Load a static sweep.  Loss columns are the fraction of packets delivered
+static bool LoadStaticResults(const char* path, std::vector<StaticResult>& rows)
+{
+    ifstream file(path);
+    if (!file) {
+        return false;
+    }
+
+    string line;
+    getline(file, line); // Skip header
+
+    while (getline(file, line))
+    {
+        istringstream fields(line);
+        StaticResult row;
+        float deliveredMin, deliveredAvg, deliveredMax;
+        if (fields >> row.PLR >> row.FEC >> row.PPS >> deliveredMin >> deliveredAvg >> deliveredMax)
+        {
+            row.AverageEffectiveLoss = 1.f - deliveredAvg;
+            rows.push_back(row);
+        }
+    }
+
+    return !rows.empty();
+}
+
+/// Find the least static FEC rate in the sweep that meets the target at the
+/// closest packet rate.  Returns a negative value if none does
+static float FindStaticFEC(
+    const std::vector<StaticResult>& rows,
+    float plr,
+    unsigned pps,
+    float targetLossRate)
+{
+    unsigned bestPPSDelta = ~0u;
+    for (const StaticResult& row : rows)
+    {
+        if (fabsf(row.PLR - plr) > 0.0001f) {
+            continue;
+        }
+        const unsigned delta = row.PPS > pps ? row.PPS - pps : pps - row.PPS;
+        if (bestPPSDelta > delta) {
+            bestPPSDelta = delta;
+        }
+    }
+
+    float bestFEC = -1.f;
+    for (const StaticResult& row : rows)
+    {
+        if (fabsf(row.PLR - plr) > 0.0001f) {
+            continue;
+        }
+        const unsigned delta = row.PPS > pps ? row.PPS - pps : pps - row.PPS;
+        if (delta != bestPPSDelta || row.AverageEffectiveLoss > targetLossRate) {
+            continue;
+        }
+        if (bestFEC < 0.f || bestFEC > row.FEC) {
+            bestFEC = row.FEC;
+        }
+    }
+
+    return bestFEC;
+}
+
+/**
+    Adaptive mode: For each PLR, let the rate controller pick the FEC rate
+    from loss reports and compare the overhead it used against the least
+    static FEC rate that met the same target in the static sweep.
+*/
+static int RunAdaptive(float targetLossRate, const char* staticPath)
+{
+    std::vector<StaticResult> staticRows;
+    if (!LoadStaticResults(staticPath, staticRows)) {
+        Logger.Warning("Unable to load static results from ", staticPath, " - Skipping comparison");
+    }
+
+    Logger.Info("Adaptive FEC with target effective loss ", targetLossRate * 100.f, "%");
+    Logger.Info("StaticFEC% is the least static rate meeting the target, or -1 if none did");
+    Logger.Info("PLR%\tPPS\tFEC%Avg\tFEC%Max\tEPLR%Avg\tEPLR%Max\tStaticFEC%");
+
+    for (float plr = 0.01f; plr < 0.1f; plr += 0.005f)
+    {
+        TestResults results;
+        if (!GetMinimumResult(plr, 0.f, results, targetLossRate))
+        {
+            Logger.Error("Quit on error in codec");
+            return -1;
+        }
+
+        const float staticFEC = FindStaticFEC(staticRows, plr, results.PacketsPerSecond, targetLossRate);
+
+        Logger.Info(plr * 100.f, "\t", results.PacketsPerSecond, "\t",
+            results.AverageFECOverhead, "\t", results.MaximumFECOverhead, "\t",
+            results.AverageEffectiveLoss, "\t", results.MaximumEffectiveLoss, "\t",
+            staticFEC < 0.f ? -1.f : staticFEC * 100.f);
+
+        if (m_TestFailed)
+        {
+            Logger.Error("Quit on error in codec");
+            return -1;
+        }
+    }
+
+    Logger.Info("Test successful!");
+    return 0;
+}
+
+/// Receiving side state for one mux mode simulation
+struct MuxRunState
+{
+    std::vector<uint8_t> Received;
+    uint64_t Delivered = 0;
+    bool Failed = false;
+};
+
+static void OnMuxStreamData(
+    uint64_t streamId,
+    const uint8_t* data,
+    unsigned bytes,
+    bool /*recovered*/,
+    void* context)
+{
+    MuxRunState* state = (MuxRunState*)context;
+
+    uint32_t seq = 0;
+    if (streamId >= kMuxStreams || bytes < 4)
+    {
+        state->Failed = true;
+        return;
+    }
+    memcpy(&seq, data, 4);
+
+    const uint64_t key = (streamId << 32) | seq;
+    const size_t index = (size_t)seq * kMuxStreams + (size_t)streamId;
+    if (index >= state->Received.size() || !CheckPacket(key, data + 4, bytes - 4))
+    {
+        state->Failed = true;
+        return;
+    }
+
+    if (!state->Received[index])
+    {
+        state->Received[index] = 1;
+        ++state->Delivered;
+    }
+}
+
+/**
+    Mux mode: kMuxStreams low-rate streams each send one packet per window.
+    On its own, the only recovery a stream can send is a copy of that packet,
+    which is 100% FEC for an effective loss of PLR^2.  Here all streams share
+    one CCatMux group, and we report the effective loss for lower FEC rates.
+*/
+static int RunMux(float plr)
+{
+    const unsigned windows = kDurationSeconds * 1000 / kWindowMsec;
+    const unsigned originals = windows * kMuxStreams * kMuxStreamPacketsPerWindow;
+
+    Logger.Info("Mux mode: ", kMuxStreams, " streams sending ", kMuxStreamPacketsPerWindow,
+        " packet(s) per ", kWindowMsec, " msec window at ", plr * 100.f, "% PLR");
+    Logger.Info("Each stream alone: FEC 100% for EPLR ", plr * plr * 100.f, "%");
+    Logger.Info("FEC%\tEPLR%Avg\tEPLR%Max");
+
+    const uint32_t lossThreshold = (uint32_t)(0xffffffff * (double)plr);
+
+    for (unsigned fecPercent = 10; fecPercent <= 50; fecPercent += 10)
+    {
+        const float fec = fecPercent / 100.f;
+        double lossSum = 0., lossMax = 0.;
+
+        for (unsigned run = 0; run < kMuxRuns; ++run)
+        {
+            ccat::MuxEncoder encoder;
+            ccat::MuxDecoder decoder;
+            MuxRunState state;
+            state.Received.resize((size_t)windows * kMuxStreamPacketsPerWindow * kMuxStreams);
+
+            CCatSettings codecSettings;
+            codecSettings.WindowMsec = kWindowMsec;
+            codecSettings.WindowPackets = kMuxStreams * kMuxStreamPacketsPerWindow;
+
+            ccat::MuxDecoderSettings decoderSettings;
+            decoderSettings.CodecSettings = codecSettings;
+            decoderSettings.AppContextPtr = &state;
+            decoderSettings.OnStreamData = OnMuxStreamData;
+
+            if (encoder.Initialize(codecSettings) != CCat_Success ||
+                decoder.Initialize(decoderSettings) != CCat_Success)
+            {
+                Logger.Error("Mux initialization failed");
+                return -1;
+            }
+
+            siamese::PCGRandom prng;
+            prng.Seed(run, fecPercent);
+
+            uint8_t buffer[ccat::kMuxOriginalHeadroom + kTestPacketMaxBytes];
+            unsigned order[kMuxStreams];
+            uint64_t recoverySent = 0, originalsSent = 0;
+
+            for (unsigned seq = 0; seq < windows * kMuxStreamPacketsPerWindow; ++seq)
+            {
+                // Streams send in a different order each window
+                for (unsigned i = 0; i < kMuxStreams; ++i) {
+                    order[i] = i;
+                }
+                for (unsigned i = kMuxStreams - 1; i > 0; --i) {
+                    std::swap(order[i], order[prng.Next() % (i + 1)]);
+                }
+
+                for (unsigned i = 0; i < kMuxStreams; ++i)
+                {
+                    const uint64_t streamId = order[i];
+                    uint8_t* data = buffer + ccat::kMuxOriginalHeadroom;
+                    const unsigned bytes = 4 + prng.Next() % (kTestPacketMaxBytes - 4 + 1);
+                    memcpy(data, &seq, 4);
+                    SetPacket((streamId << 32) | seq, data + 4, bytes - 4);
+
+                    const uint8_t* datagram = nullptr;
+                    unsigned datagramBytes = 0;
+                    if (encoder.EncodeOriginal(streamId, data, bytes, datagram, datagramBytes) != CCat_Success)
+                    {
+                        Logger.Error("Mux EncodeOriginal failed");
+                        return -1;
+                    }
+                    ++originalsSent;
+
+                    if (prng.Next() > lossThreshold) {
+                        decoder.Receive(datagram, datagramBytes);
+                    }
+
+                    // Send recovery to keep the FEC rate on target
+                    while (recoverySent < fec * (originalsSent + recoverySent))
+                    {
+                        if (encoder.EncodeRecovery(datagram, datagramBytes) != CCat_Success) {
+                            break;
+                        }
+                        ++recoverySent;
+
+                        if (prng.Next() > lossThreshold) {
+                            decoder.Receive(datagram, datagramBytes);
+                        }
+                    }
+                }
+            }
+
+            if (state.Failed)
+            {
+                Logger.Error("Mux delivered corrupted data");
+                return -1;
+            }
+
+            const double loss = 1. - state.Delivered / (double)originals;
+            lossSum += loss;
+            if (lossMax < loss) {
+                lossMax = loss;
+            }
+        }
+
+        Logger.Info(fecPercent, "\t", lossSum / kMuxRuns * 100., "\t", lossMax * 100.);
+    }
+
+    Logger.Info("Test successful!");
+    return 0;
+}
+
+
+//------------------------------------------------------------------------------
+// Regression: Borrowed recovery buffers
+
+// Originals per round in borrowed mode, one of which is lost
+static const unsigned kBorrowedRoundPackets = 10;
+
+// Rounds in borrowed mode
+static const unsigned kBorrowedRounds = 200;
+
+/// Application buffers lent to the decoder in borrowed mode
+struct BorrowedState
+{
+    std::set<uint8_t*> Outstanding;
+    uint64_t Recovered = 0;
+    bool Failed = false;
+};
+
+static uint8_t* LendBuffer(BorrowedState* state, unsigned bytes)
+{
+    uint8_t* buffer = (uint8_t*)malloc(bytes);
+    if (buffer) {
+        state->Outstanding.insert(buffer);
+    }
+    return buffer;
+}
+
+static void SetBorrowedCallbacks(CCatSettings& settings, BorrowedState* state)
+{
+    settings.AppContextPtr = state;
+    settings.OnRecoveredData = [](CCatOriginal original, CCatAppContext context) {
+        BorrowedState* borrowed = (BorrowedState*)context;
+        if (!CheckPacket(original.SequenceNumber, original.Data, original.Bytes)) {
+            borrowed->Failed = true;
+        }
+        ++borrowed->Recovered;
+    };
+    settings.OnReleaseOriginal = [](CCatOriginal original, CCatAppContext context) {
+        BorrowedState* borrowed = (BorrowedState*)context;
+        uint8_t* buffer = (uint8_t*)original.Data - CCAT_DECODE_HEADROOM;
+        if (borrowed->Outstanding.erase(buffer) != 1) {
+            borrowed->Failed = true;
+        }
+        free(buffer);
+    };
+    settings.OnAllocateRecovered = [](unsigned bytes, CCatAppContext context) {
+        return LendBuffer((BorrowedState*)context, bytes);
+    };
+}
+
+/**
+    Borrowed mode: The decoder decodes into buffers from OnAllocateRecovered().
+    Each round one original is lost, and a malformed recovery packet that is
+    shorter than the stored originals arrives before the real one.  The
+    malformed packet must be rejected and its buffer handed back, so the real
+    packet still recovers the loss and every buffer is released exactly once.
+*/
+static int RunBorrowed()
+{
+    Logger.Info("Borrowed mode: ", kBorrowedRounds, " rounds of ", kBorrowedRoundPackets,
+        " originals with one loss and one short recovery packet");
+
+    BorrowedState state;
+
+    CCatSettings settings;
+    settings.WindowMsec = kWindowMsec;
+    settings.WindowPackets = kBorrowedRoundPackets;
+
+    CCatSettings decoderSettings = settings;
+    SetBorrowedCallbacks(decoderSettings, &state);
+
+    CCatCodec encoder = nullptr, decoder = nullptr;
+    if (ccat_create(&settings, &encoder) != CCat_Success ||
+        ccat_create(&decoderSettings, &decoder) != CCat_Success)
+    {
+        Logger.Error("Borrowed mode create failed");
+        return -1;
+    }
+
+    siamese::PCGRandom prng;
+    prng.Seed(kBorrowedRounds, kBorrowedRoundPackets);
+
+    uint8_t shortData[8] = {};
+    uint64_t sequence = 0;
+
+    for (unsigned round = 0; round < kBorrowedRounds && !state.Failed; ++round)
+    {
+        const unsigned lostIndex = prng.Next() % kBorrowedRoundPackets;
+
+        for (unsigned i = 0; i < kBorrowedRoundPackets; ++i, ++sequence)
+        {
+            uint8_t* buffer = LendBuffer(&state, CCAT_DECODE_HEADROOM + kTestPacketMaxBytes);
+            if (!buffer) {
+                return -1;
+            }
+
+            CCatOriginal original;
+            original.Data = buffer + CCAT_DECODE_HEADROOM;
+            original.Bytes = (unsigned)kTestPacketMaxBytes;
+            original.SequenceNumber = sequence;
+            SetPacket(sequence, buffer + CCAT_DECODE_HEADROOM, kTestPacketMaxBytes);
+
+            if (ccat_encode_original(encoder, &original) != CCat_Success) {
+                state.Failed = true;
+            }
+
+            if (i == lostIndex)
+            {
+                state.Outstanding.erase(buffer);
+                free(buffer);
+            }
+            else if (ccat_decode_original(decoder, &original) != CCat_Success) {
+                state.Failed = true;
+            }
+        }
+
+        // Covers the whole round, so it includes originals longer than itself
+        CCatRecovery malformed;
+        malformed.SequenceStart = sequence - kBorrowedRoundPackets;
+        malformed.Count = (uint8_t)kBorrowedRoundPackets;
+        malformed.Data = shortData;
+        malformed.Bytes = sizeof(shortData);
+        malformed.RecoveryRow = 0;
+        if (ccat_decode_recovery(decoder, &malformed) != CCat_InvalidInput) {
+            state.Failed = true;
+        }
+
+        CCatRecovery recovery;
+        if (ccat_encode_recovery(encoder, &recovery) != CCat_Success ||
+            ccat_decode_recovery(decoder, &recovery) != CCat_Success)
+        {
+            state.Failed = true;
+        }
+    }
+
+    ccat_destroy(encoder);
+    ccat_destroy(decoder);
+
+    if (state.Failed || state.Recovered != kBorrowedRounds || !state.Outstanding.empty())
+    {
+        Logger.Error("Borrowed mode failed: Recovered=", state.Recovered,
+            " Outstanding buffers=", state.Outstanding.size());
+        return -1;
+    }
+
+    Logger.Info("Test successful!");
+    return 0;
+}
+
+
+//------------------------------------------------------------------------------
+// Regression: Span repair
+
+// Originals per round in span mode
+static const unsigned kSpanRoundPackets = 50;
+
+// Rounds in span mode
+static const unsigned kSpanRounds = 100;
+
+// Longest loss burst repaired in span mode
+static const unsigned kSpanMaxBurst = 8;
+
+/// Receiving side state for span mode
+struct SpanState
+{
+    uint64_t Recovered = 0;
+    bool Failed = false;
+};
+
+/**
+    A recovery packet with Count above CCAT_MAX_WINDOW_PACKETS that does not
+    fit the banded order would be stored as a nested span, with a column
+    mask wider than the decoder keeps.  Both decode calls must reject it
+*/
+static bool CheckOversizedSpan()
+{
+    CCatSettings settings;
+    settings.WindowMsec = 1000000;
+
+    CCatCodec decoder = nullptr;
+    if (ccat_create(&settings, &decoder) != CCat_Success) {
+        return false;
+    }
+
+    bool success = true;
+    uint8_t buffer[kTestPacketMaxBytes];
+
+    // Lose two originals in [50, 60) so a recovery packet over it is stored
+    for (uint64_t sequence = 0; sequence < 60; ++sequence)
+    {
+        if (sequence == 52 || sequence == 55) {
+            continue;
+        }
+
+        SetPacket(sequence, buffer, kTestPacketMaxBytes);
+
+        CCatOriginal original;
+        original.Data = buffer;
+        original.Bytes = (unsigned)kTestPacketMaxBytes;
+        original.SequenceNumber = sequence;
+        success &= ccat_decode_original(decoder, &original) == CCat_Success;
+    }
+
+    uint8_t data[kTestPacketMaxBytes + 2] = {};
+    CCatRecovery recovery;
+    recovery.SequenceStart = 50;
+    recovery.Count = 10;
+    recovery.Data = data;
+    recovery.Bytes = sizeof(data);
+    recovery.RecoveryRow = 1;
+    success &= ccat_decode_recovery(decoder, &recovery) == CCat_Success;
+
+    // Starts before the stored packet and ends far past the window limit
+    uint8_t mask[CCAT_COLUMN_MASK_BYTES];
+    memset(mask, 0xff, sizeof(mask));
+    recovery.SequenceStart = 40;
+    recovery.Count = 250;
+    success &= ccat_decode_recovery(decoder, &recovery) == CCat_InvalidInput;
+    success &= ccat_decode_recovery_sparse(decoder, &recovery, mask) == CCat_InvalidInput;
+
+    recovery.Count = 0;
+    success &= ccat_decode_recovery(decoder, &recovery) == CCat_InvalidInput;
+
+    success &= ccat_decode_recovery(decoder, nullptr) == CCat_InvalidInput;
+    success &= ccat_decode_recovery_sparse(decoder, nullptr, mask) == CCat_InvalidInput;
+
+    ccat_destroy(decoder);
+    return success;
+}
+
+/**
+    Span mode: Each round loses a burst of originals, and the receiver gets
+    one recovery packet over the whole round.  It cannot solve the burst, so
+    the sender repairs it with ccat_encode_recovery_span() packets that nest
+    inside the wide one.  Every other round the wide packet arrives after the
+    repairs instead.  Each burst must be recovered either way.
+*/
+static int RunSpan()
+{
+    Logger.Info("Span mode: ", kSpanRounds, " rounds of ", kSpanRoundPackets,
+        " originals with a burst loss repaired by span recovery");
+
+    SpanState state;
+
+    CCatSettings settings;
+    settings.WindowMsec = 1000000;
+    settings.WindowPackets = kSpanRoundPackets;
+    settings.AppContextPtr = &state;
+    settings.OnRecoveredData = [](CCatOriginal original, CCatAppContext context) {
+        SpanState* span = (SpanState*)context;
+        if (!CheckPacket(original.SequenceNumber, original.Data, original.Bytes)) {
+            span->Failed = true;
+        }
+        ++span->Recovered;
+    };
+
+    CCatCodec encoder = nullptr, decoder = nullptr;
+    if (ccat_create(&settings, &encoder) != CCat_Success ||
+        ccat_create(&settings, &decoder) != CCat_Success)
+    {
+        Logger.Error("Span mode create failed");
+        return -1;
+    }
+
+    siamese::PCGRandom prng;
+    prng.Seed(kSpanRounds, kSpanRoundPackets);
+
+    uint8_t buffer[kTestPacketMaxBytes];
+    uint64_t sequence = 0, lostCount = 0;
+
+    for (unsigned round = 0; round < kSpanRounds && !state.Failed; ++round)
+    {
+        const unsigned burst = 2 + prng.Next() % (kSpanMaxBurst - 1);
+        const unsigned burstStart = prng.Next() % (kSpanRoundPackets - burst + 1);
+        const uint64_t roundStart = sequence;
+
+        for (unsigned i = 0; i < kSpanRoundPackets; ++i, ++sequence)
+        {
+            const unsigned bytes = 1 + prng.Next() % kTestPacketMaxBytes;
+            SetPacket(sequence, buffer, bytes);
+
+            CCatOriginal original;
+            original.Data = buffer;
+            original.Bytes = bytes;
+            original.SequenceNumber = sequence;
+
+            if (ccat_encode_original(encoder, &original) != CCat_Success) {
+                state.Failed = true;
+            }
+
+            if (i >= burstStart && i < burstStart + burst) {
+                ++lostCount;
+            }
+            else if (ccat_decode_original(decoder, &original) != CCat_Success) {
+                state.Failed = true;
+            }
+        }
+
+        // Copy out the wide packet, as the span packets reuse its buffer
+        CCatRecovery wide;
+        if (ccat_encode_recovery(encoder, &wide) != CCat_Success || wide.Count != kSpanRoundPackets) {
+            state.Failed = true;
+            break;
+        }
+        std::vector<uint8_t> wideData(wide.Data, wide.Data + wide.Bytes);
+        wide.Data = wideData.data();
+
+        const bool wideFirst = (round % 2 == 0);
+        if (wideFirst && ccat_decode_recovery(decoder, &wide) != CCat_Success) {
+            state.Failed = true;
+        }
+
+        for (unsigned i = 0; i < burst; ++i)
+        {
+            CCatRecovery repair;
+            if (ccat_encode_recovery_span(encoder, roundStart + burstStart, burst, &repair) != CCat_Success ||
+                ccat_decode_recovery(decoder, &repair) != CCat_Success)
+            {
+                state.Failed = true;
+            }
+        }
+
+        if (!wideFirst && ccat_decode_recovery(decoder, &wide) != CCat_Success) {
+            state.Failed = true;
+        }
+
+        if (state.Recovered != lostCount)
+        {
+            Logger.Error("Span mode did not recover round ", round, ": burst of ", burst,
+                " at ", burstStart, (wideFirst ? " after" : " before"), " the wide packet");
+            state.Failed = true;
+        }
+    }
+
+    ccat_destroy(encoder);
+    ccat_destroy(decoder);
+
+    if (state.Failed)
+    {
+        Logger.Error("Span mode failed: Recovered=", state.Recovered, " of ", lostCount);
+        return -1;
+    }
+
+    if (!CheckOversizedSpan())
+    {
+        Logger.Error("Span mode accepted a recovery packet with an oversized Count");
+        return -1;
+    }
+
+    Logger.Info("Test successful!");
+    return 0;
+}
+
+
+//------------------------------------------------------------------------------
+// Regression: Serialize
+
+// Originals in serialize mode
+static const unsigned kSerializePackets = 20000;
+
+// Originals between hibernations in serialize mode
+static const unsigned kSerializeInterval = 997;
+
+// Loss rate for originals and recovery packets in serialize mode
+static const unsigned kSerializeLossPercent = 10;
+
+// Originals per recovery packet in serialize mode
+static const unsigned kSerializeRecoveryInterval = 4;
+
+// Borrowed originals held by the codec before each malformed blob
+static const unsigned kSerializeHeldPackets = 3;
+
+/// Stream state for serialize mode
+struct SerializeState
+{
+    /// FNV-1a hash of every recovery packet the encoder produced
+    uint64_t RecoveryHash = 14695981039346656037ULL;
+
+    std::vector<uint64_t> Recovered;
+    bool Failed = false;
+};
+
+/// Mix bytes into an FNV-1a hash
+static void HashBytes(uint64_t& hash, const void* data, size_t bytes)
+{
+    for (size_t i = 0; i < bytes; ++i)
+    {
+        hash ^= ((const uint8_t*)data)[i];
+        hash *= 1099511628211ULL;
+    }
+}
+
+/// Save the codec state into blob
+static bool SaveCodec(CCatCodec codec, std::vector<uint8_t>& blob)
+{
+    unsigned bytes = 0;
+    if (ccat_serialize(codec, nullptr, 0, &bytes) != CCat_Success) {
+        return false;
+    }
+    blob.resize(bytes);
+
+    unsigned written = 0;
+    return ccat_serialize(codec, blob.data(), bytes, &written) == CCat_Success &&
+        written == bytes;
+}
+
+/// Destroy the codec and restore it into a new one, as for an idle stream
+static bool HibernateCodec(CCatCodec& codec, const CCatSettings& settings)
+{
+    std::vector<uint8_t> blob;
+    if (!SaveCodec(codec, blob)) {
+        return false;
+    }
+
+    ccat_destroy(codec);
+    codec = nullptr;
+
+    return ccat_create(&settings, &codec) == CCat_Success &&
+        ccat_deserialize(codec, blob.data(), (unsigned)blob.size()) == CCat_Success;
+}
+
+/**
+    Run the serialize mode stream with the same seeded losses each time.
+    If hibernate is set, both codecs are hibernated every kSerializeInterval
+    originals.  The final states are saved into the blobs
+*/
+static bool RunSerializeStream(
+    bool hibernate,
+    SerializeState& state,
+    std::vector<uint8_t>& encoderBlob,
+    std::vector<uint8_t>& decoderBlob)
+{
+    CCatSettings settings;
+    settings.WindowMsec = 1000000; // Keep the window independent of timing
+    settings.AppContextPtr = &state;
+    settings.OnRecoveredData = [](CCatOriginal original, CCatAppContext context) {
+        SerializeState* serialize = (SerializeState*)context;
+        if (!CheckPacket(original.SequenceNumber, original.Data, original.Bytes)) {
+            serialize->Failed = true;
+        }
+        serialize->Recovered.push_back(original.SequenceNumber);
+    };
+
+    CCatCodec encoder = nullptr, decoder = nullptr;
+    if (ccat_create(&settings, &encoder) != CCat_Success ||
+        ccat_create(&settings, &decoder) != CCat_Success)
+    {
+        return false;
+    }
+
+    siamese::PCGRandom prng;
+    prng.Seed(kSerializePackets, kSerializeInterval);
+
+    uint8_t buffer[kTestPacketMaxBytes];
+
+    for (uint64_t sequence = 0; sequence < kSerializePackets && !state.Failed; ++sequence)
+    {
+        const unsigned bytes = 1 + prng.Next() % kTestPacketMaxBytes;
+        SetPacket(sequence, buffer, bytes);
+
+        CCatOriginal original;
+        original.Data = buffer;
+        original.Bytes = bytes;
+        original.SequenceNumber = sequence;
+
+        if (ccat_encode_original(encoder, &original) != CCat_Success) {
+            state.Failed = true;
+        }
+        if (prng.Next() % 100 >= kSerializeLossPercent &&
+            ccat_decode_original(decoder, &original) != CCat_Success)
+        {
+            state.Failed = true;
+        }
+
+        if (sequence % kSerializeRecoveryInterval == 0)
+        {
+            CCatRecovery recovery;
+            if (ccat_encode_recovery(encoder, &recovery) != CCat_Success) {
+                state.Failed = true;
+                break;
+            }
+
+            HashBytes(state.RecoveryHash, &recovery.SequenceStart, sizeof(recovery.SequenceStart));
+            HashBytes(state.RecoveryHash, &recovery.Count, sizeof(recovery.Count));
+            HashBytes(state.RecoveryHash, &recovery.RecoveryRow, sizeof(recovery.RecoveryRow));
+            HashBytes(state.RecoveryHash, recovery.Data, recovery.Bytes);
+
+            if (prng.Next() % 100 >= kSerializeLossPercent &&
+                ccat_decode_recovery(decoder, &recovery) != CCat_Success)
+            {
+                state.Failed = true;
+            }
+        }
+
+        if (hibernate && sequence % kSerializeInterval == kSerializeInterval - 1)
+        {
+            if (!HibernateCodec(encoder, settings) ||
+                !HibernateCodec(decoder, settings))
+            {
+                Logger.Error("Serialize mode hibernate failed at ", sequence);
+                state.Failed = true;
+            }
+        }
+    }
+
+    if (!SaveCodec(encoder, encoderBlob) || !SaveCodec(decoder, decoderBlob)) {
+        state.Failed = true;
+    }
+
+    ccat_destroy(encoder);
+    ccat_destroy(decoder);
+
+    return !state.Failed;
+}
+
+/// Write a field of a serialized record
+template<typename T>
+static void PatchBlob(std::vector<uint8_t>& blob, size_t offset, T value)
+{
+    memcpy(blob.data() + offset, &value, sizeof(value));
+}
+
+/**
+    Restore a malformed blob into a codec that holds borrowed originals.
+    It must be rejected, with every borrowed buffer handed back
+*/
+static bool CheckMalformedBlob(
+    CCatCodec codec,
+    BorrowedState& state,
+    const std::vector<uint8_t>& blob,
+    unsigned bytes)
+{
+    for (unsigned i = 0; i < kSerializeHeldPackets; ++i)
+    {
+        uint8_t* buffer = LendBuffer(&state, CCAT_DECODE_HEADROOM + kTestPacketMaxBytes);
+        if (!buffer) {
+            return false;
+        }
+
+        CCatOriginal original;
+        original.Data = buffer + CCAT_DECODE_HEADROOM;
+        original.Bytes = (unsigned)kTestPacketMaxBytes;
+        original.SequenceNumber = i;
+        SetPacket(i, buffer + CCAT_DECODE_HEADROOM, kTestPacketMaxBytes);
+
+        if (ccat_decode_original(codec, &original) != CCat_Success) {
+            return false;
+        }
+    }
+
+    return ccat_deserialize(codec, blob.data(), bytes) == CCat_InvalidInput &&
+        state.Outstanding.empty();
+}
+
+/**
+    Check that truncated and corrupted copies of a blob are rejected.
+    decoderOnly is set if the blob came from a codec that never encoded,
+    so the decoder record directly follows an empty encoder record
+*/
+static bool CheckMalformedBlobs(const std::vector<uint8_t>& good, bool decoderOnly)
+{
+    using namespace ccat;
+
+    BorrowedState state;
+
+    CCatSettings settings;
+    settings.WindowMsec = 1000000;
+    SetBorrowedCallbacks(settings, &state);
+
+    CCatCodec codec = nullptr;
+    if (ccat_create(&settings, &codec) != CCat_Success) {
+        return false;
+    }
+
+    bool success = true;
+    std::vector<uint8_t> blob;
+
+    // Truncated at every record boundary and between them, with TotalBytes
+    // matching so the records themselves run out
+    for (unsigned bytes = 0; bytes < good.size() && success; bytes += (bytes < 1024) ? 1 : 61)
+    {
+        blob = good;
+        if (bytes >= sizeof(SerializedHeader)) {
+            PatchBlob(blob, offsetof(SerializedHeader, TotalBytes), (uint32_t)bytes);
+        }
+        success = CheckMalformedBlob(codec, state, blob, bytes);
+    }
+
+    // Corrupted header and encoder fields
+    static const size_t kEncoderOffset = sizeof(SerializedHeader);
+    for (unsigned corruption = 0; corruption < 6 && success; ++corruption)
+    {
+        blob = good;
+        switch (corruption)
+        {
+        case 0: PatchBlob(blob, offsetof(SerializedHeader, Magic), (uint32_t)0); break;
+        case 1: PatchBlob(blob, offsetof(SerializedHeader, Version), (uint16_t)(kSerializeVersion + 1)); break;
+        case 2: PatchBlob(blob, offsetof(SerializedHeader, HeaderBytes), (uint16_t)0); break;
+        case 3: PatchBlob(blob, offsetof(SerializedHeader, TotalBytes), (uint32_t)(good.size() + 1)); break;
+        case 4:
+            // Trailing data after the last record
+            blob.push_back(0);
+            PatchBlob(blob, offsetof(SerializedHeader, TotalBytes), (uint32_t)blob.size());
+            break;
+        case 5: PatchBlob(blob, kEncoderOffset + offsetof(SerializedEncoder, Count), (uint32_t)0xffffffff); break;
+        }
+        success = CheckMalformedBlob(codec, state, blob, (unsigned)blob.size());
+    }
+
+    // Corrupted decoder fields
+    static const size_t kDecoderOffset = kEncoderOffset + sizeof(SerializedEncoder);
+    for (unsigned corruption = 0; decoderOnly && corruption < 4 && success; ++corruption)
+    {
+        blob = good;
+        switch (corruption)
+        {
+        case 0: PatchBlob(blob, kDecoderOffset + offsetof(SerializedDecoder, SequenceEnd), (uint64_t)0); break;
+        case 1: PatchBlob(blob, kDecoderOffset + offsetof(SerializedDecoder, PacketCount), (uint32_t)0xffffffff); break;
+        case 2: PatchBlob(blob, kDecoderOffset + offsetof(SerializedDecoder, RecoveryCount), (uint32_t)0xffffffff); break;
+        case 3: PatchBlob(blob, kDecoderOffset + offsetof(SerializedDecoder, SparseCount), (uint32_t)0xffffffff); break;
+        }
+        success = CheckMalformedBlob(codec, state, blob, (unsigned)blob.size());
+    }
+
+    // The original blob still restores after all that
+    if (success) {
+        success = ccat_deserialize(codec, good.data(), (unsigned)good.size()) == CCat_Success;
+    }
+
+    ccat_destroy(codec);
+
+    return success && !state.Failed && state.Outstanding.empty();
+}
+
+/**
+    Serialize mode: Runs a lossy stream once straight through, and once while
+    hibernating both codecs every kSerializeInterval originals.  Both runs
+    must produce the same recovery packets and recover the same originals in
+    the same order.  Then truncated and
+    corrupted copies of the final state must be rejected by
+    ccat_deserialize() without leaking borrowed buffers.
+*/
+static int RunSerialize()
+{
+    Logger.Info("Serialize mode: ", kSerializePackets, " originals at ", kSerializeLossPercent,
+        "% loss, hibernating every ", kSerializeInterval, " originals");
+
+    SerializeState straight, hibernated;
+    std::vector<uint8_t> encoderBlob, decoderBlob;
+
+    if (!RunSerializeStream(false, straight, encoderBlob, decoderBlob) ||
+        !RunSerializeStream(true, hibernated, encoderBlob, decoderBlob))
+    {
+        Logger.Error("Serialize mode stream failed");
+        return -1;
+    }
+
+    if (straight.RecoveryHash != hibernated.RecoveryHash) {
+        Logger.Error("Serialize mode mismatch: The encoder produced different recovery packets");
+        return -1;
+    }
+
+    if (straight.Recovered.empty() || straight.Recovered != hibernated.Recovered)
+    {
+        Logger.Error("Serialize mode mismatch: Recovered ", straight.Recovered.size(),
+            " straight and ", hibernated.Recovered.size(), " hibernated");
+        return -1;
+    }
+
+    if (!CheckMalformedBlobs(encoderBlob, false) ||
+        !CheckMalformedBlobs(decoderBlob, true))
+    {
+        Logger.Error("Serialize mode accepted a malformed blob or leaked a buffer");
+        return -1;
+    }
+
+    Logger.Info("Recovered ", straight.Recovered.size(), " originals either way");
+    Logger.Info("Test successful!");
+    return 0;
+}
+
+
+//------------------------------------------------------------------------------
+// Regression: Reset
+
+// Originals in each reset mode stream
+static const unsigned kResetPackets = 5000;
+
+// Loss rate for originals and recovery packets in reset mode
+static const unsigned kResetLossPercent = 10;
+
+// Originals per recovery packet in reset mode
+static const unsigned kResetRecoveryInterval = 4;
+
+// Deadline in packets in reset mode
+static const unsigned kResetDeadlinePackets = 24;
+
+// Originals between loss reports in reset mode
+static const unsigned kResetReportInterval = 500;
+
+// Reset mode repeats a burst loss every kResetBurstInterval originals.
+// No recovery arrives from the burst until kResetReplayLate, when a copy
+// of the packet from the end of the burst is replayed past the deadline.
+// It is replayed again at kResetReplayStale, once it has left the window
+static const unsigned kResetBurstInterval = 1000;
+static const unsigned kResetBurstStart = 100;
+static const unsigned kResetBurstEnd = 108;
+static const unsigned kResetReplayLate = 140;
+static const unsigned kResetReplayStale = 600;
+
+// Seed of the stream that dirties a codec before reuse
+static const uint64_t kResetDirtySeed = 1000000;
+
+/// Stream results compared between fresh and reused codecs in reset mode
+struct ResetState
+{
+    /// FNV-1a hash of every recovery packet the encoder produced
+    uint64_t RecoveryHash = 14695981039346656037ULL;
+
+    std::vector<uint64_t> Recovered;
+
+    /// Serialized loss reports, back to back
+    std::vector<uint8_t> Reports;
+
+    CCatStats Stats;
+
+    /// Buffers lent to the decoder in borrowed runs
+    BorrowedState Borrowed;
+
+    bool Failed = false;
+};
+
+static void SetResetCallbacks(CCatSettings& settings, ResetState* state, bool borrowed)
+{
+    settings.AppContextPtr = state;
+    settings.OnRecoveredData = [](CCatOriginal original, CCatAppContext context) {
+        ResetState* reset = (ResetState*)context;
+        if (!CheckPacket(original.SequenceNumber, original.Data, original.Bytes)) {
+            reset->Failed = true;
+        }
+        reset->Recovered.push_back(original.SequenceNumber);
+    };
+
+    if (!borrowed) {
+        return;
+    }
+
+    settings.OnReleaseOriginal = [](CCatOriginal original, CCatAppContext context) {
+        ResetState* reset = (ResetState*)context;
+        uint8_t* buffer = (uint8_t*)original.Data - CCAT_DECODE_HEADROOM;
+        if (reset->Borrowed.Outstanding.erase(buffer) != 1) {
+            reset->Failed = true;
+        }
+        free(buffer);
+    };
+    settings.OnAllocateRecovered = [](unsigned bytes, CCatAppContext context) {
+        return LendBuffer(&((ResetState*)context)->Borrowed, bytes);
+    };
+}
+
+/**
+    Run a seeded lossy stream through an encoder and decoder.  Besides
+    ordinary losses it repeats some recovery packets, and replays an old one
+    once it is past the deadline and again once it leaves the window, so
+    every decoder counter moves
+*/
+static void RunResetStream(
+    CCatCodec encoder,
+    CCatCodec decoder,
+    uint64_t seed,
+    bool borrowed,
+    ResetState& state)
+{
+    siamese::PCGRandom prng;
+    prng.Seed(seed, kResetPackets);
+
+    uint8_t buffer[kTestPacketMaxBytes];
+    std::vector<uint8_t> delayedData;
+    CCatRecovery delayed;
+
+    for (unsigned i = 0; i < kResetPackets && !state.Failed; ++i)
+    {
+        const uint64_t sequence = i;
+        const unsigned phase = i % kResetBurstInterval;
+        const unsigned bytes = 1 + prng.Next() % kTestPacketMaxBytes;
+        const bool lost = prng.Next() % 100 < kResetLossPercent ||
+            (phase >= kResetBurstStart && phase < kResetBurstEnd);
+
+        uint8_t* data = buffer;
+        if (borrowed && !lost)
+        {
+            data = LendBuffer(&state.Borrowed, CCAT_DECODE_HEADROOM + bytes);
+            if (!data) {
+                state.Failed = true;
+                break;
+            }
+            data += CCAT_DECODE_HEADROOM;
+        }
+
+        CCatOriginal original;
+        original.Data = data;
+        original.Bytes = bytes;
+        original.SequenceNumber = sequence;
+        SetPacket(sequence, data, bytes);
+
+        if (ccat_encode_original(encoder, &original) != CCat_Success) {
+            state.Failed = true;
+        }
+        if (!lost && ccat_decode_original(decoder, &original) != CCat_Success) {
+            state.Failed = true;
+        }
+
+        if (i % kResetRecoveryInterval == 0)
+        {
+            CCatRecovery recovery;
+            if (ccat_encode_recovery(encoder, &recovery) != CCat_Success) {
+                state.Failed = true;
+                break;
+            }
+
+            HashBytes(state.RecoveryHash, &recovery.SequenceStart, sizeof(recovery.SequenceStart));
+            HashBytes(state.RecoveryHash, &recovery.Count, sizeof(recovery.Count));
+            HashBytes(state.RecoveryHash, &recovery.RecoveryRow, sizeof(recovery.RecoveryRow));
+            HashBytes(state.RecoveryHash, recovery.Data, recovery.Bytes);
+
+            // Keep a copy to replay later
+            if (phase == kResetBurstEnd)
+            {
+                delayedData.assign(recovery.Data, recovery.Data + recovery.Bytes);
+                delayed = recovery;
+                delayed.Data = delayedData.data();
+            }
+
+            if (prng.Next() % 100 >= kResetLossPercent &&
+                (phase < kResetBurstStart || phase > kResetReplayLate))
+            {
+                const unsigned copies = (i % 7 == 0) ? 2 : 1;
+                for (unsigned j = 0; j < copies; ++j) {
+                    if (ccat_decode_recovery(decoder, &recovery) != CCat_Success) {
+                        state.Failed = true;
+                    }
+                }
+            }
+        }
+
+        // Replay the old packet past the deadline, then out of the window
+        if (!delayedData.empty() && (phase == kResetReplayLate || phase == kResetReplayStale) &&
+            ccat_decode_recovery(decoder, &delayed) != CCat_Success)
+        {
+            state.Failed = true;
+        }
+
+        if (i % kResetReportInterval == kResetReportInterval - 1)
+        {
+            uint8_t report[CCAT_LOSS_REPORT_MAX_BYTES];
+            unsigned reportBytes = 0;
+            if (ccat_decode_get_loss_report(decoder, nullptr, report, sizeof(report), &reportBytes) != CCat_Success) {
+                state.Failed = true;
+            }
+            state.Reports.insert(state.Reports.end(), report, report + reportBytes);
+        }
+    }
+
+    if (ccat_decode_get_stats(decoder, &state.Stats) != CCat_Success) {
+        state.Failed = true;
+    }
+}
+
+/// Compare the results of a reused codec with those of a fresh one
+static bool CompareResetState(const ResetState& fresh, const ResetState& reused, const char* how)
+{
+    if (reused.Failed ||
+        reused.RecoveryHash != fresh.RecoveryHash ||
+        reused.Recovered != fresh.Recovered ||
+        reused.Reports != fresh.Reports ||
+        reused.Stats.DuplicateRecovery != fresh.Stats.DuplicateRecovery ||
+        reused.Stats.StaleRecovery != fresh.Stats.StaleRecovery ||
+        reused.Stats.LateRecovery != fresh.Stats.LateRecovery)
+    {
+        Logger.Error("Reset mode: Codec reused by ", how, " differs from a fresh one: Recovered ",
+            reused.Recovered.size(), " vs ", fresh.Recovered.size(),
+            ", Duplicate ", reused.Stats.DuplicateRecovery, " vs ", fresh.Stats.DuplicateRecovery,
+            ", Stale ", reused.Stats.StaleRecovery, " vs ", fresh.Stats.StaleRecovery,
+            ", Late ", reused.Stats.LateRecovery, " vs ", fresh.Stats.LateRecovery);
+        return false;
+    }
+
+    return true;
+}
+
+/**
+    Dirty an encoder and decoder with different settings: a deadline set by
+    ccat_decode_set_deadline(), stored recovery packets, borrowed buffers
+    and recovery jobs that were never completed
+*/
+static void DirtyResetCodecs(CCatCodec encoder, CCatCodec decoder, bool borrowed, ResetState& dirty)
+{
+    if (ccat_decode_set_deadline(decoder, kResetPackets / 2) != CCat_Success) {
+        dirty.Failed = true;
+    }
+
+    RunResetStream(encoder, decoder, kResetDirtySeed, borrowed, dirty);
+
+    for (unsigned i = 0; i < 3; ++i) {
+        if (ccat_encode_recovery_submit(encoder) != CCat_Success) {
+            dirty.Failed = true;
+        }
+    }
+}
+
+/**
+    Reset mode: Runs a seeded stream through fresh codecs, then through
+    codecs that were dirtied by another stream with other settings and then
+    reused by ccat_reset(), and by ccat_pool_release() and
+    ccat_pool_acquire().  The recovery packets, recovered originals, loss
+    reports and decoder counters must all match the fresh run.  This is done
+    both with copied and with borrowed original data.
+*/
+static int RunReset()
+{
+    Logger.Info("Reset mode: ", kResetPackets, " originals at ", kResetLossPercent,
+        "% loss through fresh, reset and pooled codecs");
+
+    for (int borrowed = 0; borrowed < 2; ++borrowed)
+    {
+        ResetState fresh, reset, pooled, dirty;
+
+        CCatSettings settings;
+        settings.WindowMsec = 1000000; // Keep the window independent of timing
+        settings.DeadlinePackets = kResetDeadlinePackets;
+
+        CCatSettings dirtySettings;
+        dirtySettings.WindowMsec = 1000000;
+        dirtySettings.WindowPackets = 100;
+        dirtySettings.TargetLossRate = 0.001f;
+        SetResetCallbacks(dirtySettings, &dirty, borrowed != 0);
+
+        CCatSettings freshSettings = settings, resetSettings = settings, pooledSettings = settings;
+        SetResetCallbacks(freshSettings, &fresh, borrowed != 0);
+        SetResetCallbacks(resetSettings, &reset, borrowed != 0);
+        SetResetCallbacks(pooledSettings, &pooled, borrowed != 0);
+
+        // Fresh codecs
+        CCatCodec encoder = nullptr, decoder = nullptr;
+        if (ccat_create(&freshSettings, &encoder) != CCat_Success ||
+            ccat_create(&freshSettings, &decoder) != CCat_Success)
+        {
+            Logger.Error("Reset mode create failed");
+            return -1;
+        }
+        RunResetStream(encoder, decoder, kResetPackets, borrowed != 0, fresh);
+        ccat_destroy(encoder);
+        ccat_destroy(decoder);
+
+        if (fresh.Failed || fresh.Recovered.empty() || !fresh.Borrowed.Outstanding.empty() ||
+            fresh.Stats.DuplicateRecovery == 0 || fresh.Stats.StaleRecovery == 0 ||
+            fresh.Stats.LateRecovery == 0)
+        {
+            Logger.Error("Reset mode fresh stream failed or left a counter at zero");
+            return -1;
+        }
+
+        // Codecs reused by ccat_reset()
+        if (ccat_create(&dirtySettings, &encoder) != CCat_Success ||
+            ccat_create(&dirtySettings, &decoder) != CCat_Success)
+        {
+            Logger.Error("Reset mode create failed");
+            return -1;
+        }
+        DirtyResetCodecs(encoder, decoder, borrowed != 0, dirty);
+        if (dirty.Failed ||
+            ccat_reset(encoder, &resetSettings) != CCat_Success ||
+            ccat_reset(decoder, &resetSettings) != CCat_Success ||
+            !dirty.Borrowed.Outstanding.empty())
+        {
+            Logger.Error("Reset mode: ccat_reset() failed or kept borrowed buffers");
+            return -1;
+        }
+        RunResetStream(encoder, decoder, kResetPackets, borrowed != 0, reset);
+        ccat_destroy(encoder);
+        ccat_destroy(decoder);
+
+        // Codecs reused through a pool
+        dirty = ResetState();
+        CCatPool pool = nullptr;
+        if (ccat_pool_create(2, &pool) != CCat_Success ||
+            ccat_pool_acquire(pool, &dirtySettings, &encoder) != CCat_Success ||
+            ccat_pool_acquire(pool, &dirtySettings, &decoder) != CCat_Success)
+        {
+            Logger.Error("Reset mode pool failed");
+            return -1;
+        }
+        DirtyResetCodecs(encoder, decoder, borrowed != 0, dirty);
+        if (dirty.Failed ||
+            ccat_pool_release(pool, encoder) != CCat_Success ||
+            ccat_pool_release(pool, decoder) != CCat_Success ||
+            !dirty.Borrowed.Outstanding.empty() ||
+            ccat_pool_acquire(pool, &pooledSettings, &encoder) != CCat_Success ||
+            ccat_pool_acquire(pool, &pooledSettings, &decoder) != CCat_Success)
+        {
+            Logger.Error("Reset mode: Pool reuse failed or kept borrowed buffers");
+            return -1;
+        }
+        RunResetStream(encoder, decoder, kResetPackets, borrowed != 0, pooled);
+        ccat_pool_release(pool, encoder);
+        ccat_pool_release(pool, decoder);
+        ccat_pool_destroy(pool);
+
+        if (!CompareResetState(fresh, reset, "ccat_reset()") ||
+            !CompareResetState(fresh, pooled, "the pool") ||
+            !reset.Borrowed.Outstanding.empty() ||
+            !pooled.Borrowed.Outstanding.empty())
+        {
+            return -1;
+        }
+
+        Logger.Info(borrowed ? "Borrowed" : "Copied", " originals: Recovered ", fresh.Recovered.size(),
+            " with ", fresh.Stats.DuplicateRecovery, " duplicate, ", fresh.Stats.StaleRecovery,
+            " stale and ", fresh.Stats.LateRecovery, " late recovery packets either way");
+    }
+
+    Logger.Info("Test successful!");
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    Logger.Info("Cauchy Caterpillar Tester");
+
+    // Usage: unit_test adaptive [target loss rate] [static results file]
+    if (argc >= 2 && 0 == strcmp(argv[1], "adaptive"))
+    {
+        omp_set_num_threads(kParallelRuns);
+
+        const float target = argc >= 3 ? (float)atof(argv[2]) : kDefaultTargetLossRate;
+        const char* staticPath = argc >= 4 ? argv[3] : "docs/simulation_results.txt";
+        return RunAdaptive(target, staticPath);
+    }
+
+    // Usage: unit_test mux [PLR]
+    if (argc >= 2 && 0 == strcmp(argv[1], "mux"))
+    {
+        const float plr = argc >= 3 ? (float)atof(argv[2]) : 0.05f;
+        return RunMux(plr);
+    }
+
+    // Usage: unit_test borrowed
+    if (argc >= 2 && 0 == strcmp(argv[1], "borrowed")) {
+        return RunBorrowed();
+    }
+
+    // Usage: unit_test span
+    if (argc >= 2 && 0 == strcmp(argv[1], "span")) {
+        return RunSpan();
+    }
+
+    // Usage: unit_test serialize
+    if (argc >= 2 && 0 == strcmp(argv[1], "serialize")) {
+        return RunSerialize();
+    }
+
+    // Usage: unit_test reset
+    if (argc >= 2 && 0 == strcmp(argv[1], "reset")) {
+        return RunReset();
+    }
 
     omp_set_num_threads(kParallelRuns);
 
@@ -0,0 +1,342 @@
+/** \file
+    \brief Loopback Transport Benchmark
+    \copyright Copyright (c) 2018 Christopher A. Taylor.  All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of CCat nor the names of its contributors may be
+      used to endorse or promote products derived from this software without
+      specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+    ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+    SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+    INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+    CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+    POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "UDPTransport.h"
+#include "Logger.h"
+#include "SiameseTools.h"
+
+#include <atomic>
+#include <thread>
+#include <time.h>
+#include <stdlib.h>
+using namespace std;
+
+
+static logger::Channel Logger("TransportBenchmark", logger::Level::Trace);
+
+
+//------------------------------------------------------------------------------
+// Configuration
+
+struct BenchmarkConfig
+{
+    /// Duration of each run in seconds
+    unsigned Seconds = 2;
+
+    /// Percentage of datagrams dropped by the receiver's drop filter
+    float DropPercent = 2.f;
+
+    /// Recovery packets as a percentage of all packets sent
+    float FECPercent = 5.f;
+
+    /// Original payload size in bytes
+    unsigned PayloadBytes = 1200;
+
+    /// Use UDP GSO/GRO
+    bool UseGSO = true;
+
+    /// Run the CCat codec on top of the socket path
+    bool UseCCat = true;
+};
+
+struct BenchmarkResult
+{
+    uint64_t OriginalsSent = 0;
+    uint64_t DatagramsSent = 0;
+    uint64_t DatagramsReceived = 0;
+    uint64_t BytesReceived = 0;
+    uint64_t Dropped = 0;
+    uint64_t OriginalsDelivered = 0;
+    uint64_t Recovered = 0;
+    uint64_t GsoMessages = 0;
+    uint64_t GroMessages = 0;
+    uint64_t SenderCpuNsec = 0;
+    uint64_t ReceiverCpuNsec = 0;
+    uint64_t ElapsedUsec = 0;
+};
+
+static uint64_t GetThreadCpuNsec()
+{
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+//------------------------------------------------------------------------------
+// Loopback Run
+
+static void OnRecovered(CCatOriginal original, CCatAppContext context)
+{
+    (void)original;
+    ++*(uint64_t*)context;
+}
+
+static bool RunLoopback(const BenchmarkConfig& config, BenchmarkResult& result)
+{
+    transport::UDPReceiver receiver;
+    if (!receiver.Initialize(0, config.UseGSO, 100)) {
+        Logger.Error("Receiver initialization failed");
+        return false;
+    }
+
+    std::atomic<bool> senderDone(false);
+    std::atomic<uint64_t> peerNextExpected(0);
+    bool senderFailed = false;
+
+    const uint64_t t0 = siamese::GetTimeUsec();
+
+    std::thread senderThread([&]()
+    {
+        const uint64_t cpu0 = GetThreadCpuNsec();
+
+        transport::UDPSender sender;
+        CCatCodec encoder = nullptr;
+        CCatSettings settings;
+        settings.WindowPackets = CCAT_MAX_WINDOW_PACKETS;
+        if (!sender.Initialize(receiver.GetPort(), config.UseGSO) ||
+            (config.UseCCat && ccat_create(&settings, &encoder) != CCat_Success))
+        {
+            senderFailed = true;
+            senderDone = true;
+            return;
+        }
+
+        ccat::WireWriter writer;
+        const float fecRate = config.FECPercent / 100.f;
+        const uint64_t endUsec = t0 + config.Seconds * 1000000ULL;
+        uint64_t sequence = 0, fecSent = 0;
+
+        for (;;)
+        {
+            // Check the clock once per batch
+            if (sequence % transport::kMaxBatch == 0)
+            {
+                if (siamese::GetTimeUsec() >= endUsec) {
+                    break;
+                }
+                writer.OnPeerNextExpected(peerNextExpected.load(std::memory_order_relaxed));
+            }
+
+            uint8_t* payload = sender.NextPayload();
+            memcpy(payload, &sequence, sizeof(sequence));
+
+            if (encoder)
+            {
+                CCatOriginal original;
+                original.Data = payload;
+                original.Bytes = config.PayloadBytes;
+                original.SequenceNumber = sequence;
+                if (ccat_encode_original(encoder, &original) != CCat_Success) {
+                    senderFailed = true;
+                    break;
+                }
+            }
+
+            unsigned datagramBytes = 0;
+            const uint8_t* datagram = writer.WriteOriginal(payload, config.PayloadBytes, sequence, datagramBytes);
+            sender.Commit(datagram, datagramBytes);
+            ++sequence;
+
+            // Maintain a fixed FEC rate >= fec / (original + fec)
+            if (encoder && fecSent < (uint64_t)(fecRate * (sequence + fecSent)))
+            {
+                CCatRecovery recovery;
+                if (ccat_encode_recovery(encoder, &recovery) == CCat_Success)
+                {
+                    datagram = writer.WriteRecovery(recovery, datagramBytes);
+                    sender.QueueCopy(datagram, datagramBytes);
+                }
+                ++fecSent;
+            }
+        }
+
+        sender.Flush();
+
+        result.OriginalsSent = sequence;
+        result.DatagramsSent = sender.DatagramsSent;
+        result.GsoMessages = sender.GsoMessages;
+        result.SenderCpuNsec = GetThreadCpuNsec() - cpu0;
+
+        if (encoder) {
+            ccat_destroy(encoder);
+        }
+        senderDone = true;
+    });
+
+    // Receive on this thread
+    const uint64_t cpu0 = GetThreadCpuNsec();
+
+    CCatCodec decoder = nullptr;
+    CCatSettings settings;
+    settings.WindowPackets = CCAT_MAX_WINDOW_PACKETS;
+    settings.AppContextPtr = &result.Recovered;
+    settings.OnRecoveredData = OnRecovered;
+    if (config.UseCCat && ccat_create(&settings, &decoder) != CCat_Success) {
+        Logger.Error("Decoder initialization failed");
+        senderThread.join();
+        return false;
+    }
+
+    static const unsigned kMaxDatagrams = transport::kMaxBatch * transport::kMaxGsoSegments;
+    transport::Datagram* datagrams = new transport::Datagram[kMaxDatagrams];
+    transport::BatchDecoder* batchDecoder = new transport::BatchDecoder;
+    ccat::WireReader reader;
+
+    siamese::PCGRandom prng;
+    prng.Seed(siamese::GetTimeUsec());
+    const uint32_t dropThreshold = (uint32_t)(0xffffffff * (config.DropPercent / 100.f));
+
+    uint64_t originalsDelivered = 0;
+
+    for (;;)
+    {
+        const int count = receiver.ReceiveBatch(datagrams, kMaxDatagrams);
+        if (count < 0) {
+            Logger.Error("Receive failed");
+            break;
+        }
+        if (count == 0)
+        {
+            if (senderDone) {
+                break;
+            }
+            continue;
+        }
+
+        // Drop filter
+        unsigned kept = 0;
+        for (int i = 0; i < count; ++i)
+        {
+            result.BytesReceived += datagrams[i].Bytes;
+            if (prng.Next() < dropThreshold) {
+                ++result.Dropped;
+                continue;
+            }
+            datagrams[kept++] = datagrams[i];
+        }
+        result.DatagramsReceived += count;
+
+        if (decoder)
+        {
+            batchDecoder->Decode(decoder, datagrams, kept);
+            peerNextExpected.store(batchDecoder->GetNextExpected(), std::memory_order_relaxed);
+        }
+        else
+        {
+            CCatOriginal original;
+            CCatRecovery recovery;
+            for (unsigned i = 0; i < kept; ++i) {
+                if (reader.Parse(datagrams[i].Data, datagrams[i].Bytes, original, recovery) == ccat::WireType::Original) {
+                    ++originalsDelivered;
+                }
+            }
+            peerNextExpected.store(reader.GetNextExpected(), std::memory_order_relaxed);
+        }
+    }
+
+    if (decoder) {
+        originalsDelivered = batchDecoder->OriginalsReceived;
+    }
+    result.OriginalsDelivered = originalsDelivered;
+    result.GroMessages = receiver.GroMessages;
+    result.ReceiverCpuNsec = GetThreadCpuNsec() - cpu0;
+
+    senderThread.join();
+    result.ElapsedUsec = siamese::GetTimeUsec() - t0;
+
+    delete batchDecoder;
+    delete[] datagrams;
+    if (decoder) {
+        ccat_destroy(decoder);
+    }
+
+    return !senderFailed;
+}
+
+static void Report(const char* name, const BenchmarkResult& result)
+{
+    const double seconds = result.ElapsedUsec / 1000000.;
+    const double received = (double)(result.DatagramsReceived > 0 ? result.DatagramsReceived : 1);
+    const double sent = (double)(result.DatagramsSent > 0 ? result.DatagramsSent : 1);
+    const double originals = (double)(result.OriginalsSent > 0 ? result.OriginalsSent : 1);
+
+    Logger.Info(name, ": ", (uint64_t)(result.DatagramsReceived / seconds), " pps, ",
+        result.BytesReceived * 8 / seconds / 1e9, " Gb/s, sender ",
+        result.SenderCpuNsec / sent, " ns/pkt, receiver ",
+        result.ReceiverCpuNsec / received, " ns/pkt");
+    Logger.Info("  sent=", result.DatagramsSent, " received=", result.DatagramsReceived,
+        " dropped=", result.Dropped, " recovered=", result.Recovered,
+        " gso=", result.GsoMessages, " gro=", result.GroMessages,
+        " effective loss=", 100. * (1. - (result.OriginalsDelivered + result.Recovered) / originals), "%");
+}
+
+
+//------------------------------------------------------------------------------
+// Entrypoint
+
+int main(int argc, char** argv)
+{
+    BenchmarkConfig config;
+
+    // Usage: transport_benchmark [seconds] [drop%] [fec%] [payload bytes] [nogso]
+    if (argc > 1) config.Seconds = (unsigned)atoi(argv[1]);
+    if (argc > 2) config.DropPercent = (float)atof(argv[2]);
+    if (argc > 3) config.FECPercent = (float)atof(argv[3]);
+    if (argc > 4) config.PayloadBytes = (unsigned)atoi(argv[4]);
+    if (argc > 5) config.UseGSO = (0 != strcmp(argv[5], "nogso"));
+
+    if (config.PayloadBytes <= 8 ||
+        config.PayloadBytes + ccat::kWireRecoveryHeaderMax + 2 > transport::kMaxDatagramBytes - transport::kPayloadHeadroom)
+    {
+        Logger.Error("Invalid payload size");
+        return -1;
+    }
+
+    Logger.Info("Loopback transport: ", config.Seconds, " seconds per run, drop=", config.DropPercent,
+        "%, fec=", config.FECPercent, "%, payload=", config.PayloadBytes, " bytes, gso=", config.UseGSO);
+
+    BenchmarkResult baseline, withCCat;
+
+    config.UseCCat = false;
+    if (!RunLoopback(config, baseline)) {
+        Logger.Error("Socket-only run failed");
+        return -1;
+    }
+    Report("Socket only", baseline);
+
+    config.UseCCat = true;
+    if (!RunLoopback(config, withCCat)) {
+        Logger.Error("CCat run failed");
+        return -1;
+    }
+    Report("Socket + CCat", withCCat);
+
+    return 0;
+}
@@ -0,0 +1,463 @@
+/** \file
+    \brief Batched UDP Transport Reference
+    \copyright Copyright (c) 2018 Christopher A. Taylor.  All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of CCat nor the names of its contributors may be
+      used to endorse or promote products derived from this software without
+      specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+    ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+    SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+    INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+    CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+    POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "UDPTransport.h"
+
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+
+#ifndef UDP_SEGMENT
+    #define UDP_SEGMENT 103
+#endif
+#ifndef UDP_GRO
+    #define UDP_GRO 104
+#endif
+
+namespace transport {
+
+
+//------------------------------------------------------------------------------
+// Tools
+
+static const int kSocketBufferBytes = 8 * 1024 * 1024;
+
+static int CreateSocket()
+{
+    const int s = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (s < 0) {
+        return -1;
+    }
+
+    int bufferBytes = kSocketBufferBytes;
+    setsockopt(s, SOL_SOCKET, SO_SNDBUF, &bufferBytes, sizeof(bufferBytes));
+    setsockopt(s, SOL_SOCKET, SO_RCVBUF, &bufferBytes, sizeof(bufferBytes));
+    return s;
+}
+
+static sockaddr_in LoopbackAddress(uint16_t port)
+{
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    return addr;
+}
+
+
+//------------------------------------------------------------------------------
+// UDPSender
+
+UDPSender::~UDPSender()
+{
+    if (Socket >= 0) {
+        close(Socket);
+    }
+    free(Buffers);
+}
+
+bool UDPSender::Initialize(uint16_t port, bool enableGSO)
+{
+    Socket = CreateSocket();
+    if (Socket < 0) {
+        return false;
+    }
+
+    const sockaddr_in addr = LoopbackAddress(port);
+    if (0 != connect(Socket, (const sockaddr*)&addr, sizeof(addr))) {
+        return false;
+    }
+
+    Buffers = (uint8_t*)malloc(kMaxBatch * kMaxDatagramBytes);
+    if (!Buffers) {
+        return false;
+    }
+
+    EnableGSO = enableGSO;
+    return true;
+}
+
+uint8_t* UDPSender::NextPayload()
+{
+    if (QueuedCount >= kMaxBatch) {
+        Flush();
+    }
+
+    SlotReserved = true;
+    return Buffers + QueuedCount * kMaxDatagramBytes + kPayloadHeadroom;
+}
+
+void UDPSender::Commit(const uint8_t* datagram, unsigned bytes)
+{
+    if (!SlotReserved || QueuedCount >= kMaxBatch) {
+        return;
+    }
+    SlotReserved = false;
+
+    Queued[QueuedCount].Data = datagram;
+    Queued[QueuedCount].Bytes = bytes;
+    ++QueuedCount;
+}
+
+bool UDPSender::QueueCopy(const uint8_t* datagram, unsigned bytes)
+{
+    if (bytes > kMaxDatagramBytes) {
+        return false;
+    }
+
+    if (QueuedCount >= kMaxBatch && !Flush()) {
+        return false;
+    }
+
+    uint8_t* slot = Buffers + QueuedCount * kMaxDatagramBytes;
+    memcpy(slot, datagram, bytes);
+
+    Queued[QueuedCount].Data = slot;
+    Queued[QueuedCount].Bytes = bytes;
+    ++QueuedCount;
+    return true;
+}
+
+bool UDPSender::Flush()
+{
+    if (QueuedCount <= 0) {
+        return true;
+    }
+
+    bool success = sendQueued(EnableGSO);
+
+    // If the kernel or device does not support GSO, stop using it
+    if (!success && EnableGSO)
+    {
+        EnableGSO = false;
+        success = sendQueued(false);
+    }
+
+    QueuedCount = 0;
+    return success;
+}
+
+bool UDPSender::sendQueued(bool useGSO)
+{
+    mmsghdr messages[kMaxBatch];
+    iovec iovecs[kMaxBatch];
+    union {
+        char Buffer[CMSG_SPACE(sizeof(uint16_t))];
+        cmsghdr Align;
+    } controls[kMaxBatch];
+
+    memset(messages, 0, sizeof(messages));
+
+    unsigned messageCount = 0;
+    unsigned gsoMessages = 0;
+
+    // Group runs of equal-sized datagrams into GSO messages:
+    for (unsigned i = 0; i < QueuedCount;)
+    {
+        const unsigned segmentBytes = Queued[i].Bytes;
+        unsigned end = i + 1;
+        unsigned totalBytes = segmentBytes;
+
+        if (useGSO)
+        {
+            while (end < QueuedCount &&
+                end - i < kMaxGsoSegments &&
+                totalBytes + Queued[end].Bytes <= 65000)
+            {
+                const unsigned bytes = Queued[end].Bytes;
+
+                // Only the last segment may be shorter
+                if (bytes > segmentBytes) {
+                    break;
+                }
+                totalBytes += bytes;
+                ++end;
+                if (bytes < segmentBytes) {
+                    break;
+                }
+            }
+        }
+
+        msghdr& msg = messages[messageCount].msg_hdr;
+        msg.msg_iov = &iovecs[i];
+        msg.msg_iovlen = end - i;
+
+        // Point the iovecs at each datagram so no copy is needed
+        for (unsigned j = i; j < end; ++j)
+        {
+            iovecs[j].iov_base = const_cast<uint8_t*>(Queued[j].Data);
+            iovecs[j].iov_len = Queued[j].Bytes;
+        }
+
+        if (end - i > 1)
+        {
+            msg.msg_control = controls[messageCount].Buffer;
+            msg.msg_controllen = sizeof(controls[messageCount].Buffer);
+
+            cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+            cmsg->cmsg_level = SOL_UDP;
+            cmsg->cmsg_type = UDP_SEGMENT;
+            cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+            const uint16_t gsoSize = (uint16_t)segmentBytes;
+            memcpy(CMSG_DATA(cmsg), &gsoSize, sizeof(gsoSize));
+
+            ++gsoMessages;
+        }
+
+        ++messageCount;
+        i = end;
+    }
+
+    // Send all messages
+    unsigned sent = 0;
+    while (sent < messageCount)
+    {
+        const int result = sendmmsg(Socket, messages + sent, messageCount - sent, 0);
+        ++SendCalls;
+        if (result < 0)
+        {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == ENOBUFS) {
+                // Dropped on the floor like any other congestion
+                break;
+            }
+            // Nothing was sent if the first message failed
+            return sent > 0;
+        }
+        sent += (unsigned)result;
+    }
+
+    DatagramsSent += QueuedCount;
+    for (unsigned i = 0; i < QueuedCount; ++i) {
+        BytesSent += Queued[i].Bytes;
+    }
+    GsoMessages += gsoMessages;
+    return true;
+}
+
+
+//------------------------------------------------------------------------------
+// UDPReceiver
+
+UDPReceiver::~UDPReceiver()
+{
+    if (Socket >= 0) {
+        close(Socket);
+    }
+    free(Buffers);
+}
+
+bool UDPReceiver::Initialize(uint16_t port, bool enableGRO, unsigned timeoutMsec)
+{
+    Socket = CreateSocket();
+    if (Socket < 0) {
+        return false;
+    }
+
+    sockaddr_in addr = LoopbackAddress(port);
+    if (0 != bind(Socket, (const sockaddr*)&addr, sizeof(addr))) {
+        return false;
+    }
+
+    socklen_t addrLen = sizeof(addr);
+    if (0 != getsockname(Socket, (sockaddr*)&addr, &addrLen)) {
+        return false;
+    }
+    Port = ntohs(addr.sin_port);
+
+    timeval tv;
+    tv.tv_sec = timeoutMsec / 1000;
+    tv.tv_usec = (timeoutMsec % 1000) * 1000;
+    setsockopt(Socket, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    if (enableGRO)
+    {
+        int one = 1;
+        EnableGRO = (0 == setsockopt(Socket, SOL_UDP, UDP_GRO, &one, sizeof(one)));
+    }
+
+    BufferBytes = EnableGRO ? kGroBufferBytes : kMaxDatagramBytes;
+    Buffers = (uint8_t*)malloc((size_t)kMaxBatch * BufferBytes);
+    return Buffers != nullptr;
+}
+
+int UDPReceiver::ReceiveBatch(Datagram* datagramsOut, unsigned maxDatagrams)
+{
+    mmsghdr messages[kMaxBatch];
+    iovec iovecs[kMaxBatch];
+    union {
+        char Buffer[CMSG_SPACE(sizeof(int))];
+        cmsghdr Align;
+    } controls[kMaxBatch];
+
+    memset(messages, 0, sizeof(messages));
+
+    // Without GRO each message is one datagram
+    unsigned messageCount = kMaxBatch;
+    if (!EnableGRO && messageCount > maxDatagrams) {
+        messageCount = maxDatagrams;
+    }
+
+    for (unsigned i = 0; i < messageCount; ++i)
+    {
+        iovecs[i].iov_base = Buffers + (size_t)i * BufferBytes;
+        iovecs[i].iov_len = BufferBytes;
+
+        msghdr& msg = messages[i].msg_hdr;
+        msg.msg_iov = &iovecs[i];
+        msg.msg_iovlen = 1;
+        if (EnableGRO)
+        {
+            msg.msg_control = controls[i].Buffer;
+            msg.msg_controllen = sizeof(controls[i].Buffer);
+        }
+    }
+
+    int result;
+    do {
+        result = recvmmsg(Socket, messages, messageCount, MSG_WAITFORONE, nullptr);
+    } while (result < 0 && errno == EINTR);
+    ++RecvCalls;
+
+    if (result < 0) {
+        return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+    }
+
+    unsigned count = 0;
+    for (int i = 0; i < result; ++i)
+    {
+        const uint8_t* data = (const uint8_t*)iovecs[i].iov_base;
+        unsigned bytes = messages[i].msg_len;
+
+        // Find GRO segment size if the kernel coalesced datagrams
+        unsigned segmentBytes = bytes;
+        if (EnableGRO)
+        {
+            msghdr& msg = messages[i].msg_hdr;
+            for (cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+            {
+                if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO)
+                {
+                    int gsoSize = 0;
+                    memcpy(&gsoSize, CMSG_DATA(cmsg), sizeof(gsoSize));
+                    if (gsoSize > 0) {
+                        segmentBytes = (unsigned)gsoSize;
+                        ++GroMessages;
+                    }
+                }
+            }
+        }
+
+        // Split into datagrams
+        while (bytes > 0 && count < maxDatagrams)
+        {
+            const unsigned segment = bytes < segmentBytes ? bytes : segmentBytes;
+            datagramsOut[count].Data = data;
+            datagramsOut[count].Bytes = segment;
+            ++count;
+            data += segment;
+            bytes -= segment;
+        }
+    }
+
+    return (int)count;
+}
+
+
+//------------------------------------------------------------------------------
+// BatchDecoder
+
+CCatResult BatchDecoder::Decode(
+    CCatCodec codec,
+    const Datagram* datagrams,
+    unsigned count)
+{
+    static const unsigned kMaxDatagrams = kMaxBatch * kMaxGsoSegments;
+    if (count > kMaxDatagrams) {
+        count = kMaxDatagrams;
+    }
+
+    unsigned originalCount = 0, recoveryCount = 0;
+    CCatResult sparseResult = CCat_Success;
+
+    for (unsigned i = 0; i < count; ++i)
+    {
+        const ccat::WireType type = Reader.Parse(
+            datagrams[i].Data,
+            datagrams[i].Bytes,
+            Originals[originalCount],
+            Recovery[recoveryCount]);
+
+        if (type == ccat::WireType::Original) {
+            ++originalCount;
+        }
+        else if (type == ccat::WireType::Recovery)
+        {
+            const CCatRecovery& recovery = Recovery[recoveryCount];
+
+            // The batch call takes no column masks, so sparse packets go alone
+            if (recovery.ColumnMask)
+            {
+                ++RecoveryReceived;
+                const CCatResult result = ccat_decode_recovery_sparse(codec, &recovery, recovery.ColumnMask);
+                if (result != CCat_Success && sparseResult == CCat_Success) {
+                    sparseResult = result;
+                }
+            }
+            else {
+                ++recoveryCount;
+            }
+        }
+        else {
+            ++Invalid;
+        }
+    }
+
+    OriginalsReceived += originalCount;
+    RecoveryReceived += recoveryCount;
+
+    const CCatResult result = ccat_decode_batch(
+        codec,
+        Originals,
+        originalCount,
+        Recovery,
+        recoveryCount);
+
+    return (sparseResult != CCat_Success) ? sparseResult : result;
+}
+
+
+} // namespace transport
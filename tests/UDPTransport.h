@@ -0,0 +1,215 @@
+/** \file
+    \brief Batched UDP Transport Reference
+    \copyright Copyright (c) 2018 Christopher A. Taylor.  All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of CCat nor the names of its contributors may be
+      used to endorse or promote products derived from this software without
+      specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+    ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+    SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+    INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+    CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+    POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+/** \page Transport Batched UDP Transport Reference
+
+    Reference Linux UDP transport showing the fastest way to drive CCat:
+
+    + Sends are queued and flushed with one sendmmsg() call per batch.
+    + Runs of equal-sized datagrams are coalesced into one UDP GSO message
+      (UDP_SEGMENT) without copying, by pointing the iovecs at each datagram.
+    + Receives use recvmmsg() with UDP GRO enabled, and coalesced buffers are
+      split back into datagrams using the reported segment size.
+    + Received datagrams are parsed with CCatWire.h and fed to the decoder
+      through ccat_decode_batch().
+
+    GSO requires every segment to be the same size except the last one, so
+    originals of varying size fall back to one datagram per message.
+*/
+
+#include "../ccat.h"
+#include "../CCatWire.h"
+
+#include <stdint.h>
+#include <sys/socket.h>
+
+namespace transport {
+
+
+//------------------------------------------------------------------------------
+// Constants
+
+/// Maximum number of datagrams per batch
+static const unsigned kMaxBatch = 64;
+
+/// Maximum size of a datagram handled by the transport
+static const unsigned kMaxDatagramBytes = 2048;
+
+/// Bytes reserved in front of each payload for the packet header
+static const unsigned kPayloadHeadroom = CCAT_RECOVERY_HEADROOM;
+static_assert(kPayloadHeadroom >= ccat::kWireOriginalHeaderMax, "Too small");
+
+/// Size of a receive buffer when GRO is enabled
+static const unsigned kGroBufferBytes = 65536;
+
+/// Limit on segments in one GSO message (kernel limit is 64)
+static const unsigned kMaxGsoSegments = 64;
+
+
+//------------------------------------------------------------------------------
+// Datagram
+
+struct Datagram
+{
+    const uint8_t* Data;
+    unsigned Bytes;
+};
+
+
+//------------------------------------------------------------------------------
+// UDPSender
+
+class UDPSender
+{
+public:
+    ~UDPSender();
+
+    /// Connect to 127.0.0.1:port.  Returns false on failure
+    bool Initialize(uint16_t port, bool enableGSO);
+
+    /// Returns a payload buffer with kPayloadHeadroom bytes of headroom, that
+    /// can hold kMaxDatagramBytes - kPayloadHeadroom bytes.  Flushes if full.
+    uint8_t* NextPayload();
+
+    /// Queue the datagram written into the last NextPayload() buffer
+    void Commit(const uint8_t* datagram, unsigned bytes);
+
+    /// Copy a datagram into the next buffer and queue it
+    bool QueueCopy(const uint8_t* datagram, unsigned bytes);
+
+    /// Send all queued datagrams
+    bool Flush();
+
+    /// Statistics
+    uint64_t DatagramsSent = 0;
+    uint64_t BytesSent = 0;
+    uint64_t SendCalls = 0;
+    uint64_t GsoMessages = 0;
+
+private:
+    int Socket = -1;
+    bool EnableGSO = false;
+
+    /// Buffers for queued datagrams
+    uint8_t* Buffers = nullptr;
+
+    /// Queued datagrams
+    Datagram Queued[kMaxBatch];
+    unsigned QueuedCount = 0;
+
+    /// Set by NextPayload() until Commit()
+    bool SlotReserved = false;
+
+    /// Send one round of sendmmsg(), returns false on failure
+    bool sendQueued(bool useGSO);
+};
+
+
+//------------------------------------------------------------------------------
+// UDPReceiver
+
+class UDPReceiver
+{
+public:
+    ~UDPReceiver();
+
+    /// Bind to 127.0.0.1:port (0 = pick one).  Returns false on failure
+    bool Initialize(uint16_t port, bool enableGRO, unsigned timeoutMsec);
+
+    /// Port bound by Initialize()
+    uint16_t GetPort() const
+    {
+        return Port;
+    }
+
+    /// Socket for use with epoll or io_uring
+    int GetSocket() const
+    {
+        return Socket;
+    }
+
+    /**
+        ReceiveBatch()
+
+        Receives up to kMaxBatch messages with one recvmmsg() call and splits
+        GRO buffers back into datagrams.  Datagrams are valid until the next
+        call.
+
+        Returns the number of datagrams, 0 on timeout, or -1 on error.
+    */
+    int ReceiveBatch(Datagram* datagramsOut, unsigned maxDatagrams);
+
+    /// Statistics
+    uint64_t RecvCalls = 0;
+    uint64_t GroMessages = 0;
+
+private:
+    int Socket = -1;
+    uint16_t Port = 0;
+    bool EnableGRO = false;
+    unsigned BufferBytes = 0;
+    uint8_t* Buffers = nullptr;
+};
+
+
+//------------------------------------------------------------------------------
+// BatchDecoder
+
+/// Parses a batch of received datagrams and feeds them to ccat_decode_batch().
+/// Sparse recovery packets are passed to ccat_decode_recovery_sparse()
+class BatchDecoder
+{
+public:
+    /// Parse and decode the batch.  Returns the first failure code
+    CCatResult Decode(
+        CCatCodec codec,
+        const Datagram* datagrams,
+        unsigned count);
+
+    /// Next expected sequence number for the sender's back-channel
+    uint64_t GetNextExpected() const
+    {
+        return Reader.GetNextExpected();
+    }
+
+    /// Statistics
+    uint64_t OriginalsReceived = 0;
+    uint64_t RecoveryReceived = 0;
+    uint64_t Invalid = 0;
+
+private:
+    ccat::WireReader Reader;
+    CCatOriginal Originals[kMaxBatch * kMaxGsoSegments];
+    CCatRecovery Recovery[kMaxBatch * kMaxGsoSegments];
+};
+
+
+} // namespace transport
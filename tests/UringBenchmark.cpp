@@ -0,0 +1,594 @@
+/** \file
+    \brief io_uring vs epoll Receive Benchmark
+    \copyright Copyright (c) 2018 Christopher A. Taylor.  All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of CCat nor the names of its contributors may be
+      used to endorse or promote products derived from this software without
+      specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+    ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+    SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+    INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+    CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+    POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "UDPTransport.h"
+#include "UringTransport.h"
+#include "Logger.h"
+#include "SiameseTools.h"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+#include <time.h>
+#include <stdlib.h>
+using namespace std;
+
+
+static logger::Channel Logger("UringBenchmark", logger::Level::Trace);
+
+
+//------------------------------------------------------------------------------
+// Configuration
+
+struct BenchmarkConfig
+{
+    /// Duration of each run in seconds
+    unsigned Seconds = 2;
+
+    /// Number of concurrent streams, each with its own socket and codec
+    unsigned Streams = 16;
+
+    /// Percentage of datagrams dropped by the receiver's drop filter
+    float DropPercent = 2.f;
+
+    /// Recovery packets as a percentage of all packets sent
+    float FECPercent = 5.f;
+
+    /// Original payload size in bytes
+    unsigned PayloadBytes = 1200;
+};
+
+struct BenchmarkResult
+{
+    uint64_t OriginalsSent = 0;
+    uint64_t DatagramsReceived = 0;
+    uint64_t OriginalsDelivered = 0;
+    uint64_t Recovered = 0;
+    uint64_t Dropped = 0;
+    uint64_t Syscalls = 0;
+    uint64_t ReceiverCpuNsec = 0;
+    uint64_t ElapsedUsec = 0;
+};
+
+static uint64_t GetThreadCpuNsec()
+{
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/// Originals sent per stream before moving to the next one
+static const unsigned kSendBurst = 16;
+
+
+//------------------------------------------------------------------------------
+// Sender
+
+/// Sends FEC-protected streams round-robin from its own thread
+class StreamSender
+{
+public:
+    std::atomic<bool> Done;
+    bool Failed = false;
+    uint64_t OriginalsSent = 0;
+
+    /// Next expected sequence number reported back by each receive stream
+    std::vector<std::atomic<uint64_t>> PeerNextExpected;
+
+    StreamSender(const BenchmarkConfig& config)
+        : Done(false)
+        , PeerNextExpected(config.Streams)
+        , Config(config)
+    {
+        for (auto& next : PeerNextExpected) {
+            next = 0;
+        }
+    }
+
+    void Start(const std::vector<uint16_t>& ports)
+    {
+        Thread = std::thread([this, ports]() { run(ports); });
+    }
+
+    void Join()
+    {
+        Thread.join();
+    }
+
+private:
+    const BenchmarkConfig& Config;
+    std::thread Thread;
+
+    void run(const std::vector<uint16_t>& ports);
+};
+
+void StreamSender::run(const std::vector<uint16_t>& ports)
+{
+    const unsigned streams = Config.Streams;
+    std::vector<transport::UDPSender> senders(streams);
+    std::vector<CCatCodec> encoders(streams, nullptr);
+    std::vector<ccat::WireWriter> writers(streams);
+    std::vector<uint64_t> sequences(streams, 0), fecSent(streams, 0);
+
+    CCatSettings settings;
+    settings.WindowPackets = CCAT_MAX_WINDOW_PACKETS;
+
+    for (unsigned i = 0; i < streams; ++i)
+    {
+        if (!senders[i].Initialize(ports[i], false) ||
+            ccat_create(&settings, &encoders[i]) != CCat_Success)
+        {
+            Failed = true;
+            break;
+        }
+    }
+
+    const float fecRate = Config.FECPercent / 100.f;
+    const uint64_t endUsec = siamese::GetTimeUsec() + Config.Seconds * 1000000ULL;
+
+    while (!Failed && siamese::GetTimeUsec() < endUsec)
+    {
+        for (unsigned i = 0; i < streams && !Failed; ++i)
+        {
+            ccat::WireWriter& writer = writers[i];
+            writer.OnPeerNextExpected(PeerNextExpected[i].load(std::memory_order_relaxed));
+
+            for (unsigned j = 0; j < kSendBurst; ++j)
+            {
+                uint64_t& sequence = sequences[i];
+                uint8_t* payload = senders[i].NextPayload();
+                memcpy(payload, &sequence, sizeof(sequence));
+
+                CCatOriginal original;
+                original.Data = payload;
+                original.Bytes = Config.PayloadBytes;
+                original.SequenceNumber = sequence;
+                if (ccat_encode_original(encoders[i], &original) != CCat_Success) {
+                    Failed = true;
+                    break;
+                }
+
+                unsigned datagramBytes = 0;
+                const uint8_t* datagram = writer.WriteOriginal(payload, Config.PayloadBytes, sequence, datagramBytes);
+                senders[i].Commit(datagram, datagramBytes);
+                ++sequence;
+                ++OriginalsSent;
+
+                if (fecSent[i] < (uint64_t)(fecRate * (sequence + fecSent[i])))
+                {
+                    CCatRecovery recovery;
+                    if (ccat_encode_recovery(encoders[i], &recovery) == CCat_Success)
+                    {
+                        datagram = writer.WriteRecovery(recovery, datagramBytes);
+                        senders[i].QueueCopy(datagram, datagramBytes);
+                    }
+                    ++fecSent[i];
+                }
+            }
+
+            senders[i].Flush();
+        }
+    }
+
+    for (CCatCodec encoder : encoders) {
+        if (encoder) {
+            ccat_destroy(encoder);
+        }
+    }
+
+    Done = true;
+}
+
+
+//------------------------------------------------------------------------------
+// Receive Streams
+
+/// Per-stream decoder state shared by both receive loops
+struct ReceiveStream
+{
+    CCatCodec Decoder = nullptr;
+    ccat::WireReader Reader;
+    uint64_t Recovered = 0;
+    uint64_t Originals = 0;
+
+    /// io_uring loop only: Ring that owns the borrowed buffers
+    transport::UringReceiver* Ring = nullptr;
+    uint64_t Released = 0;
+};
+
+static void OnRecovered(CCatOriginal original, CCatAppContext context)
+{
+    (void)original;
+    ++((ReceiveStream*)context)->Recovered;
+}
+
+static void OnReleaseOriginal(CCatOriginal original, CCatAppContext context)
+{
+    ReceiveStream* stream = (ReceiveStream*)context;
+    stream->Ring->ReturnBuffer(stream->Ring->BufferIdFromPointer(original.Data));
+    ++stream->Released;
+}
+
+static bool CreateStreams(std::vector<ReceiveStream>& streams, bool zeroCopy)
+{
+    for (ReceiveStream& stream : streams)
+    {
+        CCatSettings settings;
+        settings.WindowPackets = CCAT_MAX_WINDOW_PACKETS;
+        settings.AppContextPtr = &stream;
+        settings.OnRecoveredData = OnRecovered;
+        if (zeroCopy) {
+            settings.OnReleaseOriginal = OnReleaseOriginal;
+        }
+        if (ccat_create(&settings, &stream.Decoder) != CCat_Success) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void DestroyStreams(std::vector<ReceiveStream>& streams, BenchmarkResult& result)
+{
+    for (ReceiveStream& stream : streams)
+    {
+        if (stream.Decoder) {
+            ccat_destroy(stream.Decoder);
+            stream.Decoder = nullptr;
+        }
+        result.Recovered += stream.Recovered;
+        result.OriginalsDelivered += stream.Originals;
+    }
+}
+
+
+//------------------------------------------------------------------------------
+// epoll + recvmmsg
+
+static bool RunEpoll(const BenchmarkConfig& config, BenchmarkResult& result)
+{
+    std::vector<transport::UDPReceiver> receivers(config.Streams);
+    std::vector<uint16_t> ports;
+
+    const int epollFd = epoll_create1(0);
+    if (epollFd < 0) {
+        return false;
+    }
+
+    for (unsigned i = 0; i < config.Streams; ++i)
+    {
+        if (!receivers[i].Initialize(0, false, 0)) {
+            close(epollFd);
+            return false;
+        }
+        const int s = receivers[i].GetSocket();
+        fcntl(s, F_SETFL, fcntl(s, F_GETFL) | O_NONBLOCK);
+
+        epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.u32 = i;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, s, &ev);
+        ports.push_back(receivers[i].GetPort());
+    }
+
+    std::vector<ReceiveStream> streams(config.Streams);
+    if (!CreateStreams(streams, false)) {
+        close(epollFd);
+        return false;
+    }
+
+    transport::Datagram datagrams[transport::kMaxBatch];
+    CCatOriginal originals[transport::kMaxBatch];
+    CCatRecovery recovery[transport::kMaxBatch];
+    epoll_event events[64];
+
+    siamese::PCGRandom prng;
+    prng.Seed(siamese::GetTimeUsec());
+    const uint32_t dropThreshold = (uint32_t)(0xffffffff * (config.DropPercent / 100.f));
+
+    StreamSender sender(config);
+    const uint64_t t0 = siamese::GetTimeUsec();
+    const uint64_t cpu0 = GetThreadCpuNsec();
+    sender.Start(ports);
+
+    for (;;)
+    {
+        const int ready = epoll_wait(epollFd, events, 64, 100);
+        ++result.Syscalls;
+        if (ready <= 0)
+        {
+            if (ready < 0 && errno != EINTR) {
+                break;
+            }
+            if (sender.Done) {
+                break;
+            }
+            continue;
+        }
+
+        for (int e = 0; e < ready; ++e)
+        {
+            const unsigned index = events[e].data.u32;
+            ReceiveStream& stream = streams[index];
+
+            // Drain the socket
+            for (;;)
+            {
+                const int count = receivers[index].ReceiveBatch(datagrams, transport::kMaxBatch);
+                ++result.Syscalls;
+                if (count <= 0) {
+                    break;
+                }
+                result.DatagramsReceived += count;
+
+                unsigned originalCount = 0, recoveryCount = 0;
+                for (int i = 0; i < count; ++i)
+                {
+                    if (prng.Next() < dropThreshold) {
+                        ++result.Dropped;
+                        continue;
+                    }
+                    const ccat::WireType type = stream.Reader.Parse(
+                        datagrams[i].Data, datagrams[i].Bytes,
+                        originals[originalCount], recovery[recoveryCount]);
+                    if (type == ccat::WireType::Original) {
+                        ++originalCount;
+                    }
+                    else if (type == ccat::WireType::Recovery) {
+                        ++recoveryCount;
+                    }
+                }
+
+                stream.Originals += originalCount;
+                ccat_decode_batch(stream.Decoder, originals, originalCount, recovery, recoveryCount);
+                sender.PeerNextExpected[index].store(stream.Reader.GetNextExpected(), std::memory_order_relaxed);
+            }
+        }
+    }
+
+    result.ReceiverCpuNsec = GetThreadCpuNsec() - cpu0;
+    sender.Join();
+    result.ElapsedUsec = siamese::GetTimeUsec() - t0;
+    result.OriginalsSent = sender.OriginalsSent;
+
+    DestroyStreams(streams, result);
+    close(epollFd);
+    return !sender.Failed;
+}
+
+
+//------------------------------------------------------------------------------
+// io_uring
+
+class UringStreams : public transport::UringHandler
+{
+public:
+    transport::UringReceiver* Ring = nullptr;
+    std::vector<ReceiveStream>* Streams = nullptr;
+    StreamSender* Sender = nullptr;
+    siamese::PCGRandom Prng;
+    uint32_t DropThreshold = 0;
+    uint64_t Dropped = 0;
+
+    void OnDatagram(
+        uint32_t socketId,
+        uint8_t* payload,
+        unsigned bytes,
+        uint16_t bufferId) override
+    {
+        if (Prng.Next() < DropThreshold) {
+            ++Dropped;
+            Ring->ReturnBuffer(bufferId);
+            return;
+        }
+
+        ReceiveStream& stream = (*Streams)[socketId];
+        CCatOriginal original;
+        CCatRecovery recovery;
+
+        switch (stream.Reader.Parse(payload, bytes, original, recovery))
+        {
+        case ccat::WireType::Original:
+            // Decoder borrows the buffer and hands it back via OnReleaseOriginal
+            ++stream.Originals;
+            ccat_decode_original(stream.Decoder, &original);
+            break;
+        case ccat::WireType::Recovery:
+            // Recovery data is copied if it is kept
+            ccat_decode_recovery(stream.Decoder, &recovery);
+            Ring->ReturnBuffer(bufferId);
+            break;
+        default:
+            Ring->ReturnBuffer(bufferId);
+            break;
+        }
+
+        Sender->PeerNextExpected[socketId].store(stream.Reader.GetNextExpected(), std::memory_order_relaxed);
+    }
+};
+
+static bool RunUring(const BenchmarkConfig& config, BenchmarkResult& result, bool& unavailableOut)
+{
+    unavailableOut = false;
+
+    // Enough buffers for every decoder to fill its window plus a backlog
+    unsigned bufferCount = 1024;
+    while (bufferCount < config.Streams * transport::kUringRetainedPerStream + 4096 && bufferCount < 32768) {
+        bufferCount *= 2;
+    }
+
+    transport::UringReceiver ring;
+    if (!ring.Initialize(bufferCount)) {
+        Logger.Warning("io_uring with multishot recvmsg and provided buffer rings is unavailable: ", strerror(errno));
+        unavailableOut = true;
+        return false;
+    }
+
+    std::vector<transport::UDPReceiver> receivers(config.Streams);
+    std::vector<uint16_t> ports;
+    for (unsigned i = 0; i < config.Streams; ++i)
+    {
+        if (!receivers[i].Initialize(0, false, 0) ||
+            ring.AddSocket(receivers[i].GetSocket()) < 0)
+        {
+            return false;
+        }
+        ports.push_back(receivers[i].GetPort());
+    }
+
+    std::vector<ReceiveStream> streams(config.Streams);
+    for (ReceiveStream& stream : streams) {
+        stream.Ring = &ring;
+    }
+    if (!CreateStreams(streams, true)) {
+        return false;
+    }
+
+    StreamSender sender(config);
+
+    UringStreams handler;
+    handler.Ring = &ring;
+    handler.Streams = &streams;
+    handler.Sender = &sender;
+    handler.Prng.Seed(siamese::GetTimeUsec());
+    handler.DropThreshold = (uint32_t)(0xffffffff * (config.DropPercent / 100.f));
+
+    const uint64_t t0 = siamese::GetTimeUsec();
+    const uint64_t cpu0 = GetThreadCpuNsec();
+    sender.Start(ports);
+
+    bool success = true;
+    for (;;)
+    {
+        const int count = ring.Poll(&handler, 100);
+        if (count < 0) {
+            Logger.Error("io_uring poll failed");
+            success = false;
+            break;
+        }
+        if (count == 0 && sender.Done) {
+            break;
+        }
+    }
+
+    result.ReceiverCpuNsec = GetThreadCpuNsec() - cpu0;
+    sender.Join();
+    result.ElapsedUsec = siamese::GetTimeUsec() - t0;
+    result.OriginalsSent = sender.OriginalsSent;
+    result.DatagramsReceived = ring.Datagrams;
+    result.Dropped = handler.Dropped;
+    result.Syscalls = ring.EnterCalls;
+
+    // Destroying the decoders hands back every borrowed buffer
+    uint64_t released = 0;
+    DestroyStreams(streams, result);
+    for (const ReceiveStream& stream : streams) {
+        released += stream.Released;
+    }
+    if (released != result.OriginalsDelivered) {
+        Logger.Error("Decoders released ", released, " of ", result.OriginalsDelivered, " borrowed buffers");
+        success = false;
+    }
+
+    Logger.Info("  io_uring: rearms=", ring.Rearms, " starved=", ring.Starved, " buffers=", bufferCount);
+    return success && !sender.Failed;
+}
+
+
+//------------------------------------------------------------------------------
+// Report
+
+static void Report(const char* name, const BenchmarkResult& result)
+{
+    const double seconds = result.ElapsedUsec / 1000000.;
+    const double cpuSeconds = result.ReceiverCpuNsec / 1e9;
+    const double received = (double)(result.DatagramsReceived > 0 ? result.DatagramsReceived : 1);
+    const double originals = (double)(result.OriginalsSent > 0 ? result.OriginalsSent : 1);
+
+    Logger.Info(name, ": ", (uint64_t)(result.DatagramsReceived / (cpuSeconds > 0. ? cpuSeconds : 1.)),
+        " packets per core-second, ", (uint64_t)(result.DatagramsReceived / seconds), " pps wall, ",
+        result.ReceiverCpuNsec / received, " ns/pkt, ",
+        result.Syscalls / received, " syscalls/pkt");
+    Logger.Info("  received=", result.DatagramsReceived, " dropped=", result.Dropped,
+        " recovered=", result.Recovered,
+        " delivered=", 100. * (result.OriginalsDelivered + result.Recovered) / originals, "% of sent");
+}
+
+
+//------------------------------------------------------------------------------
+// Entrypoint
+
+int main(int argc, char** argv)
+{
+    BenchmarkConfig config;
+
+    // Usage: uring_benchmark [seconds] [streams] [drop%] [fec%] [payload bytes]
+    if (argc > 1) config.Seconds = (unsigned)atoi(argv[1]);
+    if (argc > 2) config.Streams = (unsigned)atoi(argv[2]);
+    if (argc > 3) config.DropPercent = (float)atof(argv[3]);
+    if (argc > 4) config.FECPercent = (float)atof(argv[4]);
+    if (argc > 5) config.PayloadBytes = (unsigned)atoi(argv[5]);
+
+    if (config.Streams <= 0 || config.Streams > 64 ||
+        config.PayloadBytes <= 8 ||
+        config.PayloadBytes + ccat::kWireRecoveryHeaderMax + 2 > transport::kMaxDatagramBytes - transport::kPayloadHeadroom ||
+        config.PayloadBytes + 64 > transport::kUringBufferBytes)
+    {
+        Logger.Error("Invalid arguments");
+        return -1;
+    }
+
+    Logger.Info("Receive loops: ", config.Seconds, " seconds per run, streams=", config.Streams,
+        ", drop=", config.DropPercent, "%, fec=", config.FECPercent, "%, payload=", config.PayloadBytes, " bytes");
+
+    BenchmarkResult epollResult;
+    if (!RunEpoll(config, epollResult)) {
+        Logger.Error("epoll run failed");
+        return -1;
+    }
+    Report("epoll + recvmmsg (copying decoder)", epollResult);
+
+    BenchmarkResult uringResult;
+    bool unavailable = false;
+    if (!RunUring(config, uringResult, unavailable))
+    {
+        // Fall back gracefully when io_uring is blocked or too old
+        if (unavailable) {
+            Logger.Warning("Skipping io_uring run");
+            return 0;
+        }
+        Logger.Error("io_uring run failed");
+        return -1;
+    }
+    Report("io_uring multishot (zero-copy decoder)", uringResult);
+
+    return 0;
+}
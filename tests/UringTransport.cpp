@@ -0,0 +1,388 @@
+/** \file
+    \brief io_uring Receive Loop Reference
+    \copyright Copyright (c) 2018 Christopher A. Taylor.  All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of CCat nor the names of its contributors may be
+      used to endorse or promote products derived from this software without
+      specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+    ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+    SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+    INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+    CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+    POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "UringTransport.h"
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+
+namespace transport {
+
+
+//------------------------------------------------------------------------------
+// System Calls
+
+static int SysSetup(unsigned entries, io_uring_params* params)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int SysEnter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags, void* arg, size_t argBytes)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, arg, argBytes);
+}
+
+static int SysRegister(int fd, unsigned opcode, void* arg, unsigned argCount)
+{
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, argCount);
+}
+
+template<typename T>
+static inline T LoadAcquire(const T* p)
+{
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+template<typename T>
+static inline void StoreRelease(T* p, T value)
+{
+    __atomic_store_n(p, value, __ATOMIC_RELEASE);
+}
+
+static const unsigned kQueueDepth = 256;
+
+
+//------------------------------------------------------------------------------
+// UringReceiver
+
+UringReceiver::~UringReceiver()
+{
+    if (BufRegistered)
+    {
+        io_uring_buf_reg reg;
+        memset(&reg, 0, sizeof(reg));
+        reg.bgid = kUringBufferGroup;
+        SysRegister(RingFd, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+    }
+
+    // Closing the ring cancels all outstanding requests
+    if (RingFd >= 0) {
+        close(RingFd);
+    }
+
+    if (Sqes) {
+        munmap(Sqes, SqesBytes);
+    }
+    if (CqRing && CqRing != SqRing) {
+        munmap(CqRing, CqRingBytes);
+    }
+    if (SqRing) {
+        munmap(SqRing, SqRingBytes);
+    }
+    if (BufRing) {
+        munmap(BufRing, BufRingBytes);
+    }
+    free(Buffers);
+}
+
+bool UringReceiver::Initialize(unsigned bufferCount)
+{
+    if (bufferCount <= 0 || bufferCount > 32768 || (bufferCount & (bufferCount - 1)) != 0) {
+        return false;
+    }
+
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    RingFd = SysSetup(kQueueDepth, &params);
+    if (RingFd < 0) {
+        return false;
+    }
+
+    // Waiting with a timeout needs IORING_ENTER_EXT_ARG
+    if (0 == (params.features & IORING_FEAT_EXT_ARG)) {
+        return false;
+    }
+
+    // Map the rings
+    SqRingBytes = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    CqRingBytes = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    const bool singleMap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (singleMap && CqRingBytes > SqRingBytes) {
+        SqRingBytes = CqRingBytes;
+    }
+
+    SqRing = mmap(nullptr, SqRingBytes, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, RingFd, IORING_OFF_SQ_RING);
+    if (SqRing == MAP_FAILED) {
+        SqRing = nullptr;
+        return false;
+    }
+
+    if (singleMap) {
+        CqRing = SqRing;
+    }
+    else
+    {
+        CqRing = mmap(nullptr, CqRingBytes, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, RingFd, IORING_OFF_CQ_RING);
+        if (CqRing == MAP_FAILED) {
+            CqRing = nullptr;
+            return false;
+        }
+    }
+
+    SqesBytes = params.sq_entries * sizeof(io_uring_sqe);
+    void* sqes = mmap(nullptr, SqesBytes, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, RingFd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        return false;
+    }
+    Sqes = (io_uring_sqe*)sqes;
+
+    uint8_t* sq = (uint8_t*)SqRing;
+    SqHead = (unsigned*)(sq + params.sq_off.head);
+    SqTail = (unsigned*)(sq + params.sq_off.tail);
+    SqArray = (unsigned*)(sq + params.sq_off.array);
+    SqMask = *(unsigned*)(sq + params.sq_off.ring_mask);
+    SqEntries = params.sq_entries;
+    SqLocalTail = *SqTail;
+
+    uint8_t* cq = (uint8_t*)CqRing;
+    CqHead = (unsigned*)(cq + params.cq_off.head);
+    CqTail = (unsigned*)(cq + params.cq_off.tail);
+    CqMask = *(unsigned*)(cq + params.cq_off.ring_mask);
+    Cqes = (io_uring_cqe*)(cq + params.cq_off.cqes);
+
+    // Allocate buffers and the provided buffer ring
+    Buffers = (uint8_t*)aligned_alloc(4096, (size_t)bufferCount * kUringBufferBytes);
+    if (!Buffers) {
+        return false;
+    }
+
+    BufRingBytes = bufferCount * sizeof(io_uring_buf);
+    void* bufRing = mmap(nullptr, BufRingBytes, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (bufRing == MAP_FAILED) {
+        return false;
+    }
+    BufRing = (io_uring_buf_ring*)bufRing;
+    BufCount = bufferCount;
+
+    io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)BufRing;
+    reg.ring_entries = bufferCount;
+    reg.bgid = kUringBufferGroup;
+    if (0 != SysRegister(RingFd, IORING_REGISTER_PBUF_RING, &reg, 1)) {
+        return false;
+    }
+    BufRegistered = true;
+
+    // Hand every buffer to the kernel
+    BufLocalTail = 0;
+    for (unsigned i = 0; i < bufferCount; ++i) {
+        ReturnBuffer((uint16_t)i);
+    }
+    StoreRelease(&BufRing->tail, BufLocalTail);
+
+    memset(&RecvHeader, 0, sizeof(RecvHeader));
+    return true;
+}
+
+int UringReceiver::AddSocket(int socket)
+{
+    if (RingFd < 0 || socket < 0) {
+        return -1;
+    }
+
+    const uint32_t socketId = (uint32_t)Sockets.size();
+    Sockets.push_back(socket);
+    NeedsRearm.push_back(0);
+
+    if (!armSocket(socketId)) {
+        return -1;
+    }
+    return (int)socketId;
+}
+
+void UringReceiver::ReturnBuffer(uint16_t bufferId)
+{
+    // Index the entries directly: In C++ the flexible array member in
+    // io_uring_buf_ring is offset by the size of an empty struct
+    io_uring_buf* buf = (io_uring_buf*)BufRing + (BufLocalTail & (BufCount - 1));
+    buf->addr = (uint64_t)(uintptr_t)(Buffers + (size_t)bufferId * kUringBufferBytes);
+    buf->len = kUringBufferBytes;
+    buf->bid = bufferId;
+    ++BufLocalTail;
+}
+
+io_uring_sqe* UringReceiver::getSqe()
+{
+    // If the queue is full, submit what is there first
+    if (SqLocalTail - LoadAcquire(SqHead) >= SqEntries)
+    {
+        StoreRelease(SqTail, SqLocalTail);
+        if (SysEnter(RingFd, SqEntries, 0, 0, nullptr, 0) < 0) {
+            return nullptr;
+        }
+        if (SqLocalTail - LoadAcquire(SqHead) >= SqEntries) {
+            return nullptr;
+        }
+    }
+
+    const unsigned index = SqLocalTail & SqMask;
+    io_uring_sqe* sqe = &Sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    SqArray[index] = index;
+    ++SqLocalTail;
+    return sqe;
+}
+
+bool UringReceiver::armSocket(uint32_t socketId)
+{
+    io_uring_sqe* sqe = getSqe();
+    if (!sqe) {
+        return false;
+    }
+
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = Sockets[socketId];
+    sqe->addr = (uint64_t)(uintptr_t)&RecvHeader;
+    sqe->len = 1;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = kUringBufferGroup;
+    sqe->user_data = socketId;
+    return true;
+}
+
+int UringReceiver::submitAndWait(unsigned timeoutMsec)
+{
+    const unsigned toSubmit = SqLocalTail - *SqTail;
+    StoreRelease(SqTail, SqLocalTail);
+
+    __kernel_timespec ts;
+    ts.tv_sec = timeoutMsec / 1000;
+    ts.tv_nsec = (long long)(timeoutMsec % 1000) * 1000000;
+
+    io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    arg.ts = (uint64_t)(uintptr_t)&ts;
+
+    ++EnterCalls;
+    const int result = SysEnter(RingFd, toSubmit, 1,
+        IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+    if (result < 0 && errno != ETIME && errno != EINTR) {
+        return -1;
+    }
+    return 0;
+}
+
+int UringReceiver::Poll(UringHandler* handler, unsigned timeoutMsec)
+{
+    unsigned head = *CqHead;
+
+    // Only enter the kernel if there is nothing to reap
+    if (head == LoadAcquire(CqTail) || SqLocalTail != *SqTail)
+    {
+        if (submitAndWait(timeoutMsec) < 0) {
+            return -1;
+        }
+    }
+
+    const unsigned payloadOffset = sizeof(io_uring_recvmsg_out) +
+        RecvHeader.msg_namelen + (unsigned)RecvHeader.msg_controllen;
+
+    int count = 0;
+    const unsigned tail = LoadAcquire(CqTail);
+
+    for (; head != tail; ++head)
+    {
+        const io_uring_cqe* cqe = &Cqes[head & CqMask];
+        const uint32_t socketId = (uint32_t)cqe->user_data;
+        const int result = cqe->res;
+        const uint32_t flags = cqe->flags;
+
+        // Multishot request stopped: Re-arm it after this batch
+        if (0 == (flags & IORING_CQE_F_MORE) && socketId < Sockets.size())
+        {
+            NeedsRearm[socketId] = 1;
+            AnyRearm = true;
+        }
+
+        if (result < 0)
+        {
+            if (result == -ENOBUFS) {
+                ++Starved;
+            }
+            continue;
+        }
+
+        if (0 == (flags & IORING_CQE_F_BUFFER)) {
+            continue;
+        }
+
+        const uint16_t bufferId = (uint16_t)(flags >> IORING_CQE_BUFFER_SHIFT);
+        uint8_t* buffer = Buffers + (size_t)bufferId * kUringBufferBytes;
+        const io_uring_recvmsg_out* out = (const io_uring_recvmsg_out*)buffer;
+
+        if ((out->flags & MSG_TRUNC) || (unsigned)result < payloadOffset)
+        {
+            ++Truncated;
+            ReturnBuffer(bufferId);
+            continue;
+        }
+
+        ++count;
+        handler->OnDatagram(socketId, buffer + payloadOffset, out->payloadlen, bufferId);
+    }
+
+    StoreRelease(CqHead, head);
+
+    // Publish buffers returned by the handler (including by decoder callbacks)
+    StoreRelease(&BufRing->tail, BufLocalTail);
+
+    if (AnyRearm)
+    {
+        AnyRearm = false;
+        for (uint32_t i = 0; i < (uint32_t)Sockets.size(); ++i)
+        {
+            if (NeedsRearm[i])
+            {
+                NeedsRearm[i] = 0;
+                ++Rearms;
+                if (!armSocket(i)) {
+                    return -1;
+                }
+            }
+        }
+    }
+
+    Datagrams += count;
+    return count;
+}
+
+
+} // namespace transport
@@ -0,0 +1,193 @@
+/** \file
+    \brief io_uring Receive Loop Reference
+    \copyright Copyright (c) 2018 Christopher A. Taylor.  All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of CCat nor the names of its contributors may be
+      used to endorse or promote products derived from this software without
+      specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+    ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+    SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+    INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+    CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+    POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+/** \page UringTransport io_uring Receive Loop Reference
+
+    Reference Linux receive loop for terminating many CCat streams on one core:
+
+    + One io_uring serves all sockets.  Each socket has a single multishot
+      recvmsg request armed, so the kernel keeps posting completions without
+      any new submissions.
+    + Datagrams land in a provided buffer ring (IORING_REGISTER_PBUF_RING)
+      shared by all sockets, so no buffer is tied up in an idle socket.
+    + Buffers are handed to the application, which can pass originals to a
+      decoder in zero-copy retention mode (CCatSettings::OnReleaseOriginal)
+      and return each buffer with ReturnBuffer() when it is released.
+
+    The ring is driven with raw system calls so liburing is not required.
+    Requires Linux 6.0 or newer; Initialize() fails on older kernels or when
+    io_uring is blocked, and the application should fall back to epoll.
+*/
+
+#include <stdint.h>
+#include <sys/socket.h>
+#include <vector>
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+struct io_uring_buf_ring;
+
+namespace transport {
+
+
+//------------------------------------------------------------------------------
+// Constants
+
+/// Size of each provided buffer
+static const unsigned kUringBufferBytes = 2048;
+
+/// Provided buffer group id
+static const uint16_t kUringBufferGroup = 1;
+
+/// Buffers one decoder may retain: 2x CCAT_MAX_WINDOW_PACKETS
+static const unsigned kUringRetainedPerStream = 2 * 192;
+
+
+//------------------------------------------------------------------------------
+// UringHandler
+
+/// Receives datagrams from UringReceiver::Poll()
+class UringHandler
+{
+public:
+    virtual ~UringHandler() = default;
+
+    /**
+        OnDatagram()
+
+        Called for each received datagram.  The payload is in provided buffer
+        bufferId, which the handler now owns and must give back with
+        UringReceiver::ReturnBuffer() once it is done with it.  At least 16
+        bytes in front of the payload are writable.
+    */
+    virtual void OnDatagram(
+        uint32_t socketId,
+        uint8_t* payload,
+        unsigned bytes,
+        uint16_t bufferId) = 0;
+};
+
+
+//------------------------------------------------------------------------------
+// UringReceiver
+
+class UringReceiver
+{
+public:
+    ~UringReceiver();
+
+    /// Create the ring with a provided buffer ring of bufferCount buffers.
+    /// bufferCount must be a power of two <= 32768.
+    /// Returns false if io_uring or a required feature is unavailable
+    bool Initialize(unsigned bufferCount);
+
+    /// Arm a multishot receive on the socket.
+    /// Returns the socketId reported to OnDatagram(), or -1 on failure
+    int AddSocket(int socket);
+
+    /**
+        Poll()
+
+        Waits up to timeoutMsec for completions, then calls the handler for
+        each datagram.  Returned buffers are published to the kernel and any
+        multishot receives that stopped are re-armed before returning.
+
+        Returns the number of datagrams, 0 on timeout, or -1 on error.
+    */
+    int Poll(UringHandler* handler, unsigned timeoutMsec);
+
+    /// Give a buffer back to the kernel.  Published at the end of Poll()
+    void ReturnBuffer(uint16_t bufferId);
+
+    /// Look up the buffer that holds a payload pointer
+    uint16_t BufferIdFromPointer(const uint8_t* payload) const
+    {
+        return (uint16_t)((payload - Buffers) / kUringBufferBytes);
+    }
+
+    /// Statistics
+    uint64_t Datagrams = 0;
+    uint64_t EnterCalls = 0;
+    uint64_t Rearms = 0;
+    uint64_t Starved = 0;
+    uint64_t Truncated = 0;
+
+private:
+    int RingFd = -1;
+
+    /// Submission queue
+    void* SqRing = nullptr;
+    size_t SqRingBytes = 0;
+    unsigned* SqHead = nullptr;
+    unsigned* SqTail = nullptr;
+    unsigned* SqArray = nullptr;
+    unsigned SqMask = 0;
+    unsigned SqEntries = 0;
+    unsigned SqLocalTail = 0;
+    io_uring_sqe* Sqes = nullptr;
+    size_t SqesBytes = 0;
+
+    /// Completion queue
+    void* CqRing = nullptr;
+    size_t CqRingBytes = 0;
+    unsigned* CqHead = nullptr;
+    unsigned* CqTail = nullptr;
+    unsigned CqMask = 0;
+    io_uring_cqe* Cqes = nullptr;
+
+    /// Provided buffer ring
+    io_uring_buf_ring* BufRing = nullptr;
+    size_t BufRingBytes = 0;
+    unsigned BufCount = 0;
+    uint16_t BufLocalTail = 0;
+    bool BufRegistered = false;
+    uint8_t* Buffers = nullptr;
+
+    /// Sockets by socketId, and whether each needs to be re-armed
+    std::vector<int> Sockets;
+    std::vector<uint8_t> NeedsRearm;
+    bool AnyRearm = false;
+
+    /// Header shared by all multishot recvmsg requests
+    msghdr RecvHeader;
+
+    /// Get the next free submission entry, submitting if the queue is full
+    io_uring_sqe* getSqe();
+
+    /// Arm multishot recvmsg on the given socketId
+    bool armSocket(uint32_t socketId);
+
+    /// Submit pending entries and wait for up to timeoutMsec for one completion
+    int submitAndWait(unsigned timeoutMsec);
+};
+
+
+} // namespace transport